@@ -369,22 +369,13 @@ const uint8_t* avcodec_get_icc_profile(int color_primaries, size_t& profile_size
     }
 }
 
-int avcodec_decoder_get_icc(const avcodec_decoder d, void* dest, size_t dest_len)
+const void* avcodec_decoder_get_icc(const avcodec_decoder d, size_t* len)
 {
-    size_t profile_size;
-
+    *len = 0;
     if (!d || !d->codec) {
-        return -1;
-    }
-    
-    const uint8_t* profile_data = avcodec_get_icc_profile(d->codec->color_primaries, profile_size);
-
-    if (profile_size > dest_len) {
-        return -1; // Destination buffer is too small
+        return nullptr;
     }
-
-    std::memcpy(dest, profile_data, profile_size);
-    return static_cast<int>(profile_size);
+    return avcodec_get_icc_profile(d->codec->color_primaries, *len);
 }
 
 int avcodec_decoder_get_width(const avcodec_decoder d)
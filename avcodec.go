@@ -30,6 +30,10 @@ type avCodecDecoder struct {
 	maybeMP4     bool
 	isStreamable bool
 	hasSubtitles bool
+	// decodeWidth and decodeHeight are set by setDecodeSize; 0 decodes
+	// the frame at full size
+	decodeWidth  int
+	decodeHeight int
 }
 
 // newAVCodecDecoder creates a new decoder instance from the provided buffer.
@@ -107,12 +111,9 @@ func (d *avCodecDecoder) LoopCount() int {
 
 // ICC returns the ICC color profile data if present, or an empty slice if not.
 func (d *avCodecDecoder) ICC() []byte {
-	iccDst := make([]byte, ICCProfileBufferSize)
-	iccLength := C.avcodec_decoder_get_icc(d.decoder, unsafe.Pointer(&iccDst[0]), C.size_t(cap(iccDst)))
-	if iccLength <= 0 {
-		return []byte{}
-	}
-	return iccDst[:iccLength]
+	var n C.size_t
+	p := C.avcodec_decoder_get_icc(d.decoder, &n)
+	return cICC(p, n)
 }
 
 // VideoCodec returns the video codec name (H264, HEVC, AV1, VP8, VP9, MPEG4, or Unknown).
@@ -153,7 +154,17 @@ func (d *avCodecDecoder) DecodeTo(f *Framebuffer) error {
 	if err != nil {
 		return err
 	}
-	err = f.resizeMat(h.Width(), h.Height(), h.PixelType())
+	width, height := h.Width(), h.Height()
+	if d.decodeWidth > 0 {
+		width, height = d.decodeWidth, d.decodeHeight
+	}
+	// as in DecodeRawKeyframe, the C layer writes padded rows
+	requiredSize := bgraStrideBufSize(width, height)
+	if f.maxBytes < requiredSize {
+		f.maxBytes = requiredSize
+	}
+	f.reserve(requiredSize)
+	err = f.resizeMat(width, height, h.PixelType())
 	if err != nil {
 		return err
 	}
@@ -170,6 +181,13 @@ func (d *avCodecDecoder) DecodeTo(f *Framebuffer) error {
 	return nil
 }
 
+// setDecodeSize makes DecodeTo produce a width x height frame. The frame is
+// converted from YUV by sws_scale, which scales to the framebuffer's size in
+// the same pass, so a smaller frame costs no extra work.
+func (d *avCodecDecoder) setDecodeSize(width, height int) {
+	d.decodeWidth, d.decodeHeight = width, height
+}
+
 // SkipFrame attempts to skip the next frame, but is not supported by this decoder.
 func (d *avCodecDecoder) SkipFrame() error {
 	return ErrSkipNotSupported
@@ -269,9 +287,13 @@ func bgraStrideBufSize(width, height int) int {
 // codecID, extradata, sourceWidth, and sourceHeight come from the moov parse phase.
 // thumbWidth and thumbHeight specify the desired output dimensions.
 func DecodeRawKeyframe(codecID int, extradata []byte, sourceWidth, sourceHeight int, chunk []byte, thumbWidth, thumbHeight int, dst *Framebuffer) error {
-	if requiredSize := bgraStrideBufSize(thumbWidth, thumbHeight); len(dst.buf) < requiredSize {
-		dst.buf = make([]byte, requiredSize)
+	// the C layer writes padded rows, so the buffer may need to exceed the
+	// framebuffer's nominal size
+	requiredSize := bgraStrideBufSize(thumbWidth, thumbHeight)
+	if dst.maxBytes < requiredSize {
+		dst.maxBytes = requiredSize
 	}
+	dst.reserve(requiredSize)
 
 	err := dst.resizeMat(thumbWidth, thumbHeight, PixelType(C.CV_8UC4))
 	if err != nil {
@@ -23,7 +23,9 @@ bool avcodec_decoder_has_subtitles(const avcodec_decoder d);
 const char* avcodec_decoder_get_description(const avcodec_decoder d);
 const char* avcodec_decoder_get_video_codec(const avcodec_decoder d);
 const char* avcodec_decoder_get_audio_codec(const avcodec_decoder d);
-int avcodec_decoder_get_icc(const avcodec_decoder d, void* dest, size_t dest_len);
+// the canned ICC profile matching the video's colour primaries, which is
+// static data, and its length in *len; null if d has no video
+const void* avcodec_decoder_get_icc(const avcodec_decoder d, size_t* len);
 
 typedef struct {
     int64_t timestamp_us;
@@ -334,3 +334,27 @@ func BenchmarkIsStreamableWebMp4(b *testing.B) {
 		_ = webAvCodecDecoder.IsStreamable()
 	}
 }
+
+// TestAVCodecDecodeUnalignedWidth decodes to a width that is not a multiple
+// of 32 pixels into a framebuffer sized for its unpadded rows.
+func TestAVCodecDecodeUnalignedWidth(t *testing.T) {
+	buf, err := os.ReadFile("testdata/big_buck_bunny_480p_10s_std.mp4")
+	if err != nil {
+		t.Fatalf("failed to open test file: %v", err)
+	}
+	dec, err := newAVCodecDecoder(buf)
+	if err != nil {
+		t.Fatalf("failed to create decoder: %v", err)
+	}
+	defer dec.Close()
+
+	dec.setDecodeSize(1010, 1030)
+	framebuffer := NewFramebuffer(1010, 1030)
+	defer framebuffer.Close()
+	if err := dec.DecodeTo(framebuffer); err != nil {
+		t.Fatalf("failed to decode: %v", err)
+	}
+	if framebuffer.Width() != 1010 || framebuffer.Height() != 1030 {
+		t.Errorf("decoded %dx%d, want 1010x1030", framebuffer.Width(), framebuffer.Height())
+	}
+}
@@ -4,6 +4,7 @@
 #include <avif/avif.h>
 #include <lcms2.h>
 #include <cstring>
+#include <libyuv/scale.h>
 #include "color_info.hpp"
 #include "icc_profiles/rec709_profile.h"
 #define DEFAULT_BACKGROUND_COLOR 0xFFFFFFFF
@@ -14,6 +15,9 @@
 struct avif_decoder_struct {
     avifDecoder* decoder;
     avifRGBImage rgb;
+    // the high-bit-depth RGB that HDR frames are tone-mapped from, kept
+    // across frames of the same size
+    avifRGBImage hdr_rgb;
     const uint8_t* buffer;
     size_t buffer_size;
     int frame_count;
@@ -23,6 +27,9 @@ struct avif_decoder_struct {
     int timescale;
     int total_duration;
     bool tone_mapping_enabled;
+    // when nonzero, frames are scaled to this size in YUV before conversion
+    int decode_width;
+    int decode_height;
 };
 
 struct avif_encoder_struct {
@@ -33,6 +40,12 @@ struct avif_encoder_struct {
     size_t icc_len;
     int frame_count;
     bool has_alpha;
+
+    // each frame is held back until the next one arrives (or the encoder is
+    // flushed) so that its duration can still be extended
+    avifImage* pending_image;
+    int pending_delay_ms;
+    avifAddImageFlags pending_flags;
 };
 
 //----------------------
@@ -87,9 +100,8 @@ static bool avif_is_hdr_source(const avifImage* image)
 }
 
 // PQ/HLG transfer decoding, the Reinhard tone-map and the colour-primaries
-// conversion now live in color_info.cpp so the still-image decoder can apply
-// the identical transform to container-signalled HDR (PNG cICP). This is a
-// pure move: the arithmetic is unchanged.
+// conversion live in color_info.cpp so the still-image decoder can apply the
+// identical transform to container-signalled HDR (PNG cICP).
 static void avif_tonemap_rgb(uint16_t* src,
                              uint8_t* dst,
                              int width,
@@ -104,13 +116,15 @@ static void avif_tonemap_rgb(uint16_t* src,
                        height,
                        src_depth,
                        static_cast<uint8_t>(transfer),
-                       static_cast<uint8_t>(primaries));
+                       static_cast<uint8_t>(primaries),
+                       1);
 }
 
-// Convert YUV to RGB with optional HDR tone-mapping
+// Convert YUV to RGB with optional HDR tone-mapping, by way of temp
 static avifResult avif_convert_yuv_to_rgb_with_tone_mapping(avifImage* image,
                                                             avifRGBImage* rgb,
-                                                            bool enable_tone_mapping)
+                                                            bool enable_tone_mapping,
+                                                            avifRGBImage* temp)
 {
     if (!enable_tone_mapping || !avif_is_hdr_source(image)) {
         // Not HDR or tone-mapping disabled, proceed with normal YUV to RGB conversion
@@ -122,22 +136,24 @@ static avifResult avif_convert_yuv_to_rgb_with_tone_mapping(avifImage* image,
     // 2. Apply tone-mapping
     // 3. Convert to 8-bit RGB
 
-    // First convert YUV to high bit depth RGB
-    avifRGBImage temp;
-    avifRGBImageSetDefaults(&temp, image);
-    temp.depth = image->depth;
-    temp.format = rgb->format;
-
-    avifResult result = avifRGBImageAllocatePixels(&temp);
-    if (result != AVIF_RESULT_OK) {
-        fprintf(stderr, "Failed to allocate pixels for temp image\n");
-        return result;
+    // First convert YUV to high bit depth RGB, reusing the last frame's
+    // buffer when it has the same size
+    if (!temp->pixels || temp->width != image->width || temp->height != image->height ||
+        temp->depth != image->depth || temp->format != rgb->format) {
+        avifRGBImageFreePixels(temp);
+        avifRGBImageSetDefaults(temp, image);
+        temp->depth = image->depth;
+        temp->format = rgb->format;
+        avifResult result = avifRGBImageAllocatePixels(temp);
+        if (result != AVIF_RESULT_OK) {
+            fprintf(stderr, "Failed to allocate pixels for temp image\n");
+            return result;
+        }
     }
 
-    result = avifImageYUVToRGB(image, &temp);
+    avifResult result = avifImageYUVToRGB(image, temp);
     if (result != AVIF_RESULT_OK) {
         fprintf(stderr, "Failed to convert YUV to RGB\n");
-        avifRGBImageFreePixels(&temp);
         return result;
     }
 
@@ -146,18 +162,80 @@ static avifResult avif_convert_yuv_to_rgb_with_tone_mapping(avifImage* image,
     avif_get_color_info(image, &colorPrimaries, &transferCharacteristics);
 
     // Apply tone-mapping with colorspace information
-    avif_tonemap_rgb((uint16_t*)temp.pixels,
+    avif_tonemap_rgb((uint16_t*)temp->pixels,
                      rgb->pixels,
                      image->width,
                      image->height,
-                     temp.depth,
+                     temp->depth,
                      transferCharacteristics,
                      colorPrimaries);
-
-    avifRGBImageFreePixels(&temp);
     return AVIF_RESULT_OK;
 }
 
+// Returns a copy of image scaled to width x height, plane by plane with
+// libyuv's box filter, or nullptr on failure. Colour signalling, ICC and
+// transforms are carried over, so it converts like the original would.
+static avifImage* avif_scale_yuv(const avifImage* image, int width, int height)
+{
+    avifImage* scaled = avifImageCreateEmpty();
+    if (!scaled) {
+        return nullptr;
+    }
+    if (avifImageCopy(scaled, image, (avifPlanesFlags)0) != AVIF_RESULT_OK) {
+        avifImageDestroy(scaled);
+        return nullptr;
+    }
+    scaled->width = width;
+    scaled->height = height;
+    avifPlanesFlags planes = image->alphaPlane ? AVIF_PLANES_ALL : AVIF_PLANES_YUV;
+    if (avifImageAllocatePlanes(scaled, planes) != AVIF_RESULT_OK) {
+        avifImageDestroy(scaled);
+        return nullptr;
+    }
+
+    for (int c = AVIF_CHAN_Y; c <= AVIF_CHAN_A; c++) {
+        const uint8_t* src = avifImagePlane(image, c);
+        uint8_t* dst = avifImagePlane(scaled, c);
+        if (!src || !dst) {
+            continue;
+        }
+        const int src_width = avifImagePlaneWidth(image, c);
+        const int src_height = avifImagePlaneHeight(image, c);
+        const int dst_width = avifImagePlaneWidth(scaled, c);
+        const int dst_height = avifImagePlaneHeight(scaled, c);
+        int ret;
+        if (image->depth > 8) {
+            // AVIF samples are at most 12 bits, which the _12 variant's
+            // 16-bit lanes can sum without overflowing
+            ret = libyuv::ScalePlane_12((const uint16_t*)src,
+                                        avifImagePlaneRowBytes(image, c) / 2,
+                                        src_width,
+                                        src_height,
+                                        (uint16_t*)dst,
+                                        avifImagePlaneRowBytes(scaled, c) / 2,
+                                        dst_width,
+                                        dst_height,
+                                        libyuv::kFilterBox);
+        }
+        else {
+            ret = libyuv::ScalePlane(src,
+                                     avifImagePlaneRowBytes(image, c),
+                                     src_width,
+                                     src_height,
+                                     dst,
+                                     avifImagePlaneRowBytes(scaled, c),
+                                     dst_width,
+                                     dst_height,
+                                     libyuv::kFilterBox);
+        }
+        if (ret != 0) {
+            avifImageDestroy(scaled);
+            return nullptr;
+        }
+    }
+    return scaled;
+}
+
 //----------------------
 // Decoder Management
 //----------------------
@@ -212,22 +290,9 @@ avif_decoder avif_decoder_create(const opencv_mat buf, const bool tone_mapping_e
         return nullptr;
     }
 
-    // Initialize RGB image
-    avifRGBImageSetDefaults(&d->rgb, d->decoder->image);
-    d->rgb.format = AVIF_RGB_FORMAT_BGR;
-    d->rgb.depth = 8;
-
+    // RGB pixels are allocated per frame by avif_decoder_decode, at the size
+    // the frame is converted at
     d->has_alpha = d->decoder->image->alphaPlane != nullptr;
-    if (d->has_alpha) {
-        d->rgb.format = AVIF_RGB_FORMAT_BGRA;
-    }
-
-    result = avifRGBImageAllocatePixels(&d->rgb);
-    if (result != AVIF_RESULT_OK) {
-        avifDecoderDestroy(d->decoder);
-        delete d;
-        return nullptr;
-    }
 
     d->current_frame = 0;
     d->bgcolor = DEFAULT_BACKGROUND_COLOR;
@@ -236,11 +301,27 @@ avif_decoder avif_decoder_create(const opencv_mat buf, const bool tone_mapping_e
     return d;
 }
 
+void avif_decoder_set_decode_size(avif_decoder d, int width, int height)
+{
+    if (!d || !d->decoder) {
+        return;
+    }
+    const int full_width = d->decoder->image->width;
+    const int full_height = d->decoder->image->height;
+    if (width <= 0 || height <= 0 || width > full_width || height > full_height ||
+        (width == full_width && height == full_height)) {
+        width = height = 0;
+    }
+    d->decode_width = width;
+    d->decode_height = height;
+}
+
 void avif_decoder_release(avif_decoder d)
 {
     if (d) {
         if (d->decoder) {
             avifRGBImageFreePixels(&d->rgb);
+            avifRGBImageFreePixels(&d->hdr_rgb);
             avifDecoderDestroy(d->decoder);
         }
         delete d;
@@ -271,26 +352,20 @@ int avif_decoder_get_pixel_type(const avif_decoder d)
     if (!d || !d->decoder) {
         return 0;
     }
+    // deeper sources report 16-bit pixels, which frames that cannot hold them
+    // narrow to 8 bits; a tone-mapped source is 8-bit SDR once decoded
+    const avifImage* image = d->decoder->image;
+    const bool tone_mapped = d->tone_mapping_enabled && avif_is_hdr_source(image);
+    if (image->depth > 8 && !tone_mapped) {
+        return d->has_alpha ? CV_16UC4 : CV_16UC3;
+    }
     return d->has_alpha ? CV_8UC4 : CV_8UC3;
 }
 
-int avif_decoder_get_orientation(const avif_decoder d)
+int avif_orientation_from_transform(int angle, bool mirrored, int axis)
 {
-    if (!d || !d->decoder || !d->decoder->image) {
-        return CV_IMAGE_ORIENTATION_TL;
-    }
-
-    const avifImage* image = d->decoder->image;
-
-    // 'irot' (ISO/IEC 23008-12:2017 6.5.10) stores an anti-clockwise angle in
-    // 90-degree units; 'imir' (ISO/IEC 23008-12:2022 6.5.12) stores a mirror
-    // axis, 0 = top/bottom exchanged, 1 = left/right exchanged. libavif only
-    // populates each box when the matching transformFlags bit is set, and
-    // avifDecoderParse() folds any Exif orientation tag into the same fields,
-    // so this covers both signalling paths.
-    const uint8_t angle = (image->transformFlags & AVIF_TRANSFORM_IROT) ? (image->irot.angle & 3) : 0;
-    const bool mirrored = (image->transformFlags & AVIF_TRANSFORM_IMIR) != 0;
-    const uint8_t axis = mirrored ? (image->imir.axis & 1) : 0;
+    angle &= 3;
+    axis = mirrored ? (axis & 1) : 0;
 
     if (!mirrored) {
         switch (angle) {
@@ -320,6 +395,22 @@ int avif_decoder_get_orientation(const avif_decoder d)
     }
 }
 
+int avif_decoder_get_orientation(const avif_decoder d)
+{
+    if (!d || !d->decoder || !d->decoder->image) {
+        return CV_IMAGE_ORIENTATION_TL;
+    }
+
+    const avifImage* image = d->decoder->image;
+
+    // libavif only populates irot and imir when the matching transformFlags
+    // bit is set, and avifDecoderParse() folds any Exif orientation tag into
+    // the same fields, so this covers both signalling paths.
+    const uint8_t angle = (image->transformFlags & AVIF_TRANSFORM_IROT) ? image->irot.angle : 0;
+    const bool mirrored = (image->transformFlags & AVIF_TRANSFORM_IMIR) != 0;
+    return avif_orientation_from_transform(angle, mirrored, mirrored ? image->imir.axis : 0);
+}
+
 bool avif_decoder_is_animated(const avif_decoder d)
 {
     if (!d || !d->decoder) {
@@ -367,27 +458,28 @@ uint32_t avif_decoder_get_loop_count(const avif_decoder d)
     }
 }
 
-size_t avif_decoder_get_icc(const avif_decoder d, void* buf, size_t buf_len)
+const void* avif_decoder_get_icc(const avif_decoder d, size_t* len, bool* canned)
 {
+    *len = 0;
+    *canned = false;
     if (!d || !d->decoder) {
-        return 0;
+        return nullptr;
     }
 
     // Report rec709 profile for tone-mapped HDR content
     if (d->tone_mapping_enabled && avif_is_hdr_source(d->decoder->image)) {
-        size_t profile_size = sizeof(rec709_profile);
-        const uint8_t* profile_data = rec709_profile;
-        std::memcpy(buf, profile_data, profile_size);
-        return static_cast<int>(profile_size);
+        *len = sizeof(rec709_profile);
+        *canned = true;
+        return rec709_profile;
     }
 
     // Always preserve ICC profile for HDR content, even when tone mapping
     // This ensures proper colorspace information is maintained
-    if (d->decoder->image->icc.size > 0 && d->decoder->image->icc.size <= buf_len) {
-        memcpy(buf, d->decoder->image->icc.data, d->decoder->image->icc.size);
-        return d->decoder->image->icc.size;
+    if (d->decoder->image->icc.size > 0) {
+        *len = d->decoder->image->icc.size;
+        return d->decoder->image->icc.data;
     }
-    return 0;
+    return nullptr;
 }
 
 uint32_t avif_decoder_get_bg_color(const avif_decoder d)
@@ -409,7 +501,7 @@ int avif_decoder_get_total_duration(const avif_decoder d)
 //----------------------
 // Frame Properties
 //----------------------
-int avif_decoder_get_frame_duration(const avif_decoder d)
+static int avif_decoder_get_frame_duration(const avif_decoder d)
 {
     if (!d || !d->decoder) {
         return 0;
@@ -418,7 +510,7 @@ int avif_decoder_get_frame_duration(const avif_decoder d)
     return (int)(d->decoder->imageTiming.duration * 1000.0f);
 }
 
-int avif_decoder_get_frame_dispose(const avif_decoder d)
+static int avif_decoder_get_frame_dispose(const avif_decoder d)
 {
     if (!d || !d->decoder || !d->decoder->image) {
         return 0;
@@ -435,7 +527,7 @@ int avif_decoder_get_frame_dispose(const avif_decoder d)
     return d->decoder->image->imageOwnsYUVPlanes ? AVIF_DISPOSE_BACKGROUND : AVIF_DISPOSE_NONE;
 }
 
-int avif_decoder_get_frame_blend(const avif_decoder d)
+static int avif_decoder_get_frame_blend(const avif_decoder d)
 {
     if (!d || !d->decoder || !d->decoder->image) {
         return AVIF_BLEND_NONE;
@@ -452,26 +544,34 @@ int avif_decoder_get_frame_blend(const avif_decoder d)
     return d->has_alpha ? AVIF_BLEND_ALPHA : AVIF_BLEND_NONE;
 }
 
-int avif_decoder_get_frame_x_offset(const avif_decoder d)
+static int avif_decoder_get_frame_x_offset(const avif_decoder d)
 {
     if (!d || !d->decoder || !d->decoder->image) {
         return 0;
     }
     // Get horizontal offset from Clean Aperture Box
     if (d->decoder->image->transformFlags & AVIF_TRANSFORM_CLAP) {
-        return (int)(d->decoder->image->clap.horizOffN / d->decoder->image->clap.horizOffD);
+        int offset = (int)(d->decoder->image->clap.horizOffN / d->decoder->image->clap.horizOffD);
+        if (d->decode_width > 0) {
+            offset = (int)((int64_t)offset * d->decode_width / (int)d->decoder->image->width);
+        }
+        return offset;
     }
     return 0;
 }
 
-int avif_decoder_get_frame_y_offset(const avif_decoder d)
+static int avif_decoder_get_frame_y_offset(const avif_decoder d)
 {
     if (!d || !d->decoder || !d->decoder->image) {
         return 0;
     }
     // Get vertical offset from Clean Aperture Box
     if (d->decoder->image->transformFlags & AVIF_TRANSFORM_CLAP) {
-        return (int)(d->decoder->image->clap.vertOffN / d->decoder->image->clap.vertOffD);
+        int offset = (int)(d->decoder->image->clap.vertOffN / d->decoder->image->clap.vertOffD);
+        if (d->decode_height > 0) {
+            offset = (int)((int64_t)offset * d->decode_height / (int)d->decoder->image->height);
+        }
+        return offset;
     }
     return 0;
 }
@@ -479,7 +579,29 @@ int avif_decoder_get_frame_y_offset(const avif_decoder d)
 //----------------------
 // Frame Operations
 //----------------------
-bool avif_decoder_decode(avif_decoder d, opencv_mat mat)
+
+// Advances past a frame that has been converted and reports its properties.
+static bool avif_decoder_finish_frame(avif_decoder d, lilliput_frame_info* info)
+{
+    // Advance to next frame if there are more frames
+    if (d->current_frame < d->frame_count - 1) {
+        avifResult result = avifDecoderNextImage(d->decoder);
+        if (result != AVIF_RESULT_OK) {
+            fprintf(stderr, "Failed to advance to next frame: %s\n", avifResultToString(result));
+            return false;
+        }
+    }
+    d->current_frame++;
+
+    info->duration_ms = avif_decoder_get_frame_duration(d);
+    info->x_offset = avif_decoder_get_frame_x_offset(d);
+    info->y_offset = avif_decoder_get_frame_y_offset(d);
+    info->dispose = avif_decoder_get_frame_dispose(d);
+    info->blend = avif_decoder_get_frame_blend(d);
+    return true;
+}
+
+bool avif_decoder_decode(avif_decoder d, opencv_mat mat, lilliput_frame_info* info)
 {
     if (!d || !d->decoder) {
         fprintf(stderr, "Decoder null check failed\n");
@@ -492,19 +614,74 @@ bool avif_decoder_decode(avif_decoder d, opencv_mat mat)
         return false;
     }
 
+    // Shrink in YUV first if asked to, so that only the small image is
+    // converted (and tone-mapped)
+    avifImage* image = d->decoder->image;
+    avifImage* scaled = nullptr;
+    if (d->decode_width > 0 && d->decode_height > 0) {
+        scaled = avif_scale_yuv(image, d->decode_width, d->decode_height);
+        if (!scaled) {
+            fprintf(stderr, "YUV scaling failed for frame %d\n", d->current_frame);
+            return false;
+        }
+        image = scaled;
+    }
+
+    auto cvMat = static_cast<cv::Mat*>(mat);
+    if (cvMat->depth() == CV_16U) {
+        // a 16-bit frame is converted straight into the caller's buffer,
+        // with no intermediate to allocate and copy out of
+        bool converted = false;
+        if (cvMat->cols == int(image->width) && cvMat->rows == int(image->height) &&
+            (cvMat->channels() == 3 || cvMat->channels() == 4)) {
+            avifRGBImage rgb;
+            avifRGBImageSetDefaults(&rgb, image);
+            rgb.format = cvMat->channels() == 4 ? AVIF_RGB_FORMAT_BGRA : AVIF_RGB_FORMAT_BGR;
+            rgb.depth = 16;
+            rgb.pixels = cvMat->data;
+            rgb.rowBytes = uint32_t(cvMat->step);
+            converted = avifImageYUVToRGB(image, &rgb) == AVIF_RESULT_OK;
+        }
+        if (scaled) {
+            avifImageDestroy(scaled);
+        }
+        if (!converted) {
+            fprintf(stderr, "YUV to 16-bit RGB conversion failed for frame %d\n", d->current_frame);
+            return false;
+        }
+        return avif_decoder_finish_frame(d, info);
+    }
+
+    avifRGBImageSetDefaults(&d->rgb, image);
+    d->rgb.format = d->has_alpha ? AVIF_RGB_FORMAT_BGRA : AVIF_RGB_FORMAT_BGR;
+    d->rgb.depth = 8;
+    avifResult result = avifRGBImageAllocatePixels(&d->rgb);
+    if (result != AVIF_RESULT_OK) {
+        fprintf(stderr,
+                "Failed to allocate RGB pixels for frame %d: %s\n",
+                d->current_frame,
+                avifResultToString(result));
+        if (scaled) {
+            avifImageDestroy(scaled);
+        }
+        return false;
+    }
+
     // Convert YUV to RGB with optional HDR handling
-    avifResult result = avif_convert_yuv_to_rgb_with_tone_mapping(
-      d->decoder->image, &d->rgb, d->tone_mapping_enabled);
+    result = avif_convert_yuv_to_rgb_with_tone_mapping(image, &d->rgb, d->tone_mapping_enabled, &d->hdr_rgb);
+    if (scaled) {
+        avifImageDestroy(scaled);
+    }
     if (result != AVIF_RESULT_OK) {
         fprintf(stderr,
                 "YUV to RGB conversion failed for frame %d: %s\n",
                 d->current_frame,
                 avifResultToString(result));
+        avifRGBImageFreePixels(&d->rgb);
         return false;
     }
 
     // Create OpenCV matrix from AVIF buffer
-    auto cvMat = static_cast<cv::Mat*>(mat);
     cv::Mat srcMat(d->rgb.height,
                    d->rgb.width,
                    d->has_alpha ? CV_8UC4 : CV_8UC3,
@@ -524,35 +701,9 @@ bool avif_decoder_decode(avif_decoder d, opencv_mat mat)
         channels.push_back(alpha);
         cv::merge(channels, *cvMat);
     }
+    avifRGBImageFreePixels(&d->rgb);
 
-    // Advance to next frame if there are more frames
-    if (d->current_frame < d->frame_count - 1) {
-        // Free current RGB pixels before moving to next frame
-        avifRGBImageFreePixels(&d->rgb);
-
-        result = avifDecoderNextImage(d->decoder);
-        if (result != AVIF_RESULT_OK) {
-            fprintf(stderr, "Failed to advance to next frame: %s\n", avifResultToString(result));
-            return false;
-        }
-
-        // Reinitialize RGB image for the new frame
-        avifRGBImageSetDefaults(&d->rgb, d->decoder->image);
-        d->rgb.format = d->has_alpha ? AVIF_RGB_FORMAT_BGRA : AVIF_RGB_FORMAT_BGR;
-        d->rgb.depth = 8;
-
-        // Reallocate pixels for the new frame
-        result = avifRGBImageAllocatePixels(&d->rgb);
-        if (result != AVIF_RESULT_OK) {
-            fprintf(stderr,
-                    "Failed to allocate RGB pixels for frame %d: %s\n",
-                    d->current_frame,
-                    avifResultToString(result));
-            return false;
-        }
-    }
-    d->current_frame++;
-    return true;
+    return avif_decoder_finish_frame(d, info);
 }
 
 int avif_decoder_has_more_frames(avif_decoder d)
@@ -602,9 +753,32 @@ avif_encoder avif_encoder_create(void* buf,
     return e;
 }
 
+// hand the held-back frame, if any, to libavif
+static avifResult avif_encoder_add_pending(avif_encoder e)
+{
+    if (!e->pending_image) {
+        return AVIF_RESULT_OK;
+    }
+
+    // Set up frame timing, in timescale units (ms)
+    uint64_t durationInTimescales = (uint64_t)(e->pending_delay_ms);
+    if (durationInTimescales < 1) {
+        durationInTimescales = 1; // Ensure minimum duration
+    }
+
+    avifResult result =
+      avifEncoderAddImage(e->encoder, e->pending_image, durationInTimescales, e->pending_flags);
+    avifImageDestroy(e->pending_image);
+    e->pending_image = nullptr;
+    return result;
+}
+
 void avif_encoder_release(avif_encoder e)
 {
     if (e) {
+        if (e->pending_image) {
+            avifImageDestroy(e->pending_image);
+        }
         if (e->encoder) {
             avifEncoderDestroy(e->encoder);
         }
@@ -617,6 +791,7 @@ void avif_encoder_release(avif_encoder e)
 //----------------------
 size_t avif_encoder_write(avif_encoder e,
                           const opencv_mat src,
+                          bool premultiplied,
                           const int* opt,
                           size_t opt_len,
                           int delay_ms,
@@ -630,8 +805,14 @@ size_t avif_encoder_write(avif_encoder e,
 
     // Handle flush case
     if (!src) {
+        avifResult result = avif_encoder_add_pending(e);
+        if (result != AVIF_RESULT_OK) {
+            fprintf(stderr, "AVIF Encoder: failed to add frame: %s\n", avifResultToString(result));
+            return 0;
+        }
+
         avifRWData output = AVIF_DATA_EMPTY;
-        avifResult result = avifEncoderFinish(e->encoder, &output);
+        result = avifEncoderFinish(e->encoder, &output);
 
         if (result != AVIF_RESULT_OK || output.size == 0) {
             fprintf(
@@ -657,8 +838,10 @@ size_t avif_encoder_write(avif_encoder e,
         return 0;
     }
 
-    // Create AVIF image
-    avifImage* avifImage = avifImageCreate(cvMat->cols, cvMat->rows, 8, AVIF_PIXEL_FORMAT_YUV444);
+    // Create AVIF image. 16-bit frames are encoded at 10 bits rather than
+    // being narrowed to 8 first.
+    const bool wide = cvMat->depth() == CV_16U;
+    avifImage* avifImage = avifImageCreate(cvMat->cols, cvMat->rows, wide ? 10 : 8, AVIF_PIXEL_FORMAT_YUV444);
     if (!avifImage) {
         fprintf(stderr, "AVIF Encoder: failed to create image\n");
         return 0;
@@ -690,11 +873,12 @@ size_t avif_encoder_write(avif_encoder e,
 
     // Set the correct pixel format based on input channels
     rgb.format = cvMat->channels() == 4 ? AVIF_RGB_FORMAT_BGRA : AVIF_RGB_FORMAT_BGR;
-    rgb.depth = 8;
+    rgb.depth = wide ? 16 : 8;
     rgb.pixels = cvMat->data;
     rgb.rowBytes = cvMat->step;
     rgb.width = cvMat->cols;
     rgb.height = cvMat->rows;
+    rgb.alphaPremultiplied = premultiplied && cvMat->channels() == 4;
 
     avifResult result = avifImageRGBToYUV(avifImage, &rgb);
     if (result != AVIF_RESULT_OK) {
@@ -704,33 +888,38 @@ size_t avif_encoder_write(avif_encoder e,
         return 0;
     }
 
-    // Set up frame timing and flags
-    float durationInTimescale = (float)delay_ms * e->encoder->timescale;
-    if (durationInTimescale < e->encoder->timescale) {
-        durationInTimescale = e->encoder->timescale; // Ensure minimum duration
-    }
-    float durationInSeconds = durationInTimescale / e->encoder->timescale;
-
     // Handle blending mode
     avifAddImageFlags flags = AVIF_ADD_IMAGE_FLAG_NONE;
     if (blend == 1) { // BLEND_OVER
         flags |= AVIF_ADD_IMAGE_FLAG_FORCE_KEYFRAME;
     }
 
-    // Add frame to encoder
-    result = avifEncoderAddImage(e->encoder, avifImage, durationInSeconds, flags);
-    avifImageDestroy(avifImage);
-
+    // The previous frame's duration is final now, so it can go to the encoder
+    result = avif_encoder_add_pending(e);
     if (result != AVIF_RESULT_OK) {
+        avifImageDestroy(avifImage);
         fprintf(stderr, "AVIF Encoder: failed to add frame: %s\n", avifResultToString(result));
         return 0;
     }
 
+    e->pending_image = avifImage;
+    e->pending_delay_ms = delay_ms;
+    e->pending_flags = flags;
+
     e->frame_count++;
     return 1; // Return success without actual data (data comes in flush)
 }
 
+bool avif_encoder_extend_prev_frame_delay(avif_encoder e, int delay_ms)
+{
+    if (!e || !e->pending_image || delay_ms < 0) {
+        return false;
+    }
+    e->pending_delay_ms += delay_ms;
+    return true;
+}
+
 size_t avif_encoder_flush(avif_encoder e)
 {
-    return avif_encoder_write(e, nullptr, nullptr, 0, 0, 0, 0);
+    return avif_encoder_write(e, nullptr, false, nullptr, 0, 0, 0, 0);
 }
@@ -16,6 +16,11 @@ type avifDecoder struct {
 	decoder C.avif_decoder
 	mat     C.opencv_mat
 	buf     []byte
+	// decodeWidth and decodeHeight are set by setDecodeSize; 0 decodes
+	// frames at full size
+	decodeWidth  int
+	decodeHeight int
+	header       *ImageHeader // read once, since DecodeTo needs it for every frame
 }
 
 type avifEncoder struct {
@@ -49,14 +54,18 @@ func newAvifDecoder(buf []byte, toneMappingEnabled bool) (*avifDecoder, error) {
 }
 
 func (d *avifDecoder) Header() (*ImageHeader, error) {
-	return &ImageHeader{
-		width:         int(C.avif_decoder_get_width(d.decoder)),
-		height:        int(C.avif_decoder_get_height(d.decoder)),
-		pixelType:     PixelType(C.avif_decoder_get_pixel_type(d.decoder)),
-		orientation:   ImageOrientation(C.avif_decoder_get_orientation(d.decoder)),
-		numFrames:     int(C.avif_decoder_get_num_frames(d.decoder)),
-		contentLength: len(d.buf),
-	}, nil
+	if d.header == nil {
+		d.header = &ImageHeader{
+			width:         int(C.avif_decoder_get_width(d.decoder)),
+			height:        int(C.avif_decoder_get_height(d.decoder)),
+			pixelType:     PixelType(C.avif_decoder_get_pixel_type(d.decoder)),
+			orientation:   ImageOrientation(C.avif_decoder_get_orientation(d.decoder)),
+			numFrames:     int(C.avif_decoder_get_num_frames(d.decoder)),
+			contentLength: len(d.buf),
+		}
+	}
+	header := *d.header
+	return &header, nil
 }
 
 func (d *avifDecoder) DecodeTo(f *Framebuffer) error {
@@ -73,26 +82,38 @@ func (d *avifDecoder) DecodeTo(f *Framebuffer) error {
 		return err
 	}
 
-	err = f.resizeMat(h.Width(), h.Height(), h.PixelType())
+	width, height := h.Width(), h.Height()
+	if d.decodeWidth > 0 {
+		width, height = d.decodeWidth, d.decodeHeight
+	}
+	err = f.resizeMat(width, height, h.PixelType())
 	if err != nil {
 		return err
 	}
 
-	ret := C.avif_decoder_decode(d.decoder, f.mat)
+	var info C.lilliput_frame_info
+	ret := C.avif_decoder_decode(d.decoder, f.mat, &info)
 	if !ret {
 		return ErrDecodingFailed
 	}
 
-	// Set frame properties
-	f.duration = time.Duration(C.avif_decoder_get_frame_duration(d.decoder)) * time.Millisecond
-	f.dispose = DisposeMethod(C.avif_decoder_get_frame_dispose(d.decoder))
-	f.blend = BlendMethod(C.avif_decoder_get_frame_blend(d.decoder))
-	f.xOffset = int(C.avif_decoder_get_frame_x_offset(d.decoder))
-	f.yOffset = int(C.avif_decoder_get_frame_y_offset(d.decoder))
-
+	f.setFrameInfo(&info)
 	return nil
 }
 
+// setDecodeSize makes DecodeTo scale frames to width x height while they are
+// still YUV, so that colour conversion and tone-mapping only touch the
+// smaller image.
+func (d *avifDecoder) setDecodeSize(width, height int) {
+	fullWidth := int(C.avif_decoder_get_width(d.decoder))
+	fullHeight := int(C.avif_decoder_get_height(d.decoder))
+	if width <= 0 || height <= 0 || width > fullWidth || height > fullHeight {
+		width, height = 0, 0
+	}
+	C.avif_decoder_set_decode_size(d.decoder, C.int(width), C.int(height))
+	d.decodeWidth, d.decodeHeight = width, height
+}
+
 // Decoder Helper Methods
 // ----------------------------------------
 
@@ -101,9 +122,13 @@ func (d *avifDecoder) hasReachedEndOfFrames() bool {
 }
 
 func (d *avifDecoder) ICC() []byte {
-	iccDst := make([]byte, ICCProfileBufferSize)
-	iccLength := C.avif_decoder_get_icc(d.decoder, unsafe.Pointer(&iccDst[0]), C.size_t(cap(iccDst)))
-	return iccDst[:iccLength]
+	var n C.size_t
+	var canned C.bool
+	p := C.avif_decoder_get_icc(d.decoder, &n, &canned)
+	if canned {
+		return cICC(p, n)
+	}
+	return internCICC(p, n)
 }
 
 func (d *avifDecoder) Description() string {
@@ -160,7 +185,9 @@ func newAvifEncoder(decodedBy Decoder, dstBuf []byte, config *EncodeConfig) (*av
 
 	// Use ICC override from config if provided, otherwise use decoder's ICC
 	var icc []byte
-	if config != nil && len(config.ICCOverride) > 0 {
+	if config != nil && config.DropICC {
+		icc = nil
+	} else if config != nil && len(config.ICCOverride) > 0 {
 		icc = config.ICCOverride
 	} else {
 		icc = decodedBy.ICC()
@@ -224,7 +251,7 @@ func (e *avifEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
 	}
 
 	frameDelayMs := int(f.duration.Milliseconds())
-	length := C.avif_encoder_write(e.encoder, f.mat, firstOpt, C.size_t(len(optList)),
+	length := C.avif_encoder_write(e.encoder, f.mat, C._Bool(f.premultiplied), firstOpt, C.size_t(len(optList)),
 		C.int(frameDelayMs), C.int(f.blend), C.int(f.dispose))
 	if length == 0 {
 		return nil, ErrInvalidImage
@@ -234,6 +261,26 @@ func (e *avifEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
 	return nil, nil
 }
 
+// acceptsPremultiplied reports that Encode takes premultiplied frames, which
+// libavif unpremultiplies while converting them to YUV.
+func (e *avifEncoder) acceptsPremultiplied() bool {
+	return true
+}
+
+// acceptsHighDepth reports that Encode takes 16-bit frames, which it encodes
+// at 10 bits.
+func (e *avifEncoder) acceptsHighDepth() bool {
+	return true
+}
+
+// extendLastFrame lengthens the most recently encoded frame by d.
+func (e *avifEncoder) extendLastFrame(d time.Duration) bool {
+	if e.hasFlushed {
+		return false
+	}
+	return bool(C.avif_encoder_extend_prev_frame_delay(e.encoder, C.int(d.Milliseconds())))
+}
+
 func (e *avifEncoder) Close() {
 	C.avif_encoder_release(e.encoder)
 }
@@ -26,6 +26,10 @@ typedef struct avif_encoder_struct* avif_encoder;
 // Decoder Management
 //----------------------
 avif_decoder avif_decoder_create(const opencv_mat buf, const bool tone_mapping_enabled);
+// decode frames scaled down to width x height, shrinking the YUV planes before
+// colour conversion. a size that is not smaller than the image restores full
+// size decoding
+void avif_decoder_set_decode_size(avif_decoder d, int width, int height);
 void avif_decoder_release(avif_decoder d);
 
 //----------------------
@@ -35,26 +39,26 @@ int avif_decoder_get_width(const avif_decoder d);
 int avif_decoder_get_height(const avif_decoder d);
 int avif_decoder_get_pixel_type(const avif_decoder d);
 int avif_decoder_get_orientation(const avif_decoder d);
+// the orientation of an image with an 'irot' (ISO/IEC 23008-12:2017 6.5.10)
+// anti-clockwise angle in 90-degree units and, if mirrored, an 'imir'
+// (ISO/IEC 23008-12:2022 6.5.12) axis, 0 = top/bottom exchanged, 1 =
+// left/right exchanged
+int avif_orientation_from_transform(int angle, bool mirrored, int axis);
 int avif_decoder_get_num_frames(const avif_decoder d);
 uint32_t avif_decoder_get_duration(const avif_decoder d);
 uint32_t avif_decoder_get_loop_count(const avif_decoder d);
-size_t avif_decoder_get_icc(const avif_decoder d, void* buf, size_t buf_len);
+// the image's ICC profile and its length in *len, null if it has none. *canned
+// is set when the profile is static data rather than owned by d
+const void* avif_decoder_get_icc(const avif_decoder d, size_t* len, bool* canned);
 uint32_t avif_decoder_get_bg_color(const avif_decoder d);
 int avif_decoder_get_total_duration(const avif_decoder d);
 
-//----------------------
-// Frame Properties
-//----------------------
-int avif_decoder_get_frame_duration(const avif_decoder d);
-int avif_decoder_get_frame_dispose(const avif_decoder d);
-int avif_decoder_get_frame_blend(const avif_decoder d);
-int avif_decoder_get_frame_x_offset(const avif_decoder d);
-int avif_decoder_get_frame_y_offset(const avif_decoder d);
-
 //----------------------
 // Frame Operations
 //----------------------
-bool avif_decoder_decode(avif_decoder d, opencv_mat mat);
+// decode the current frame into mat and its properties into info, then advance
+// to the next frame
+bool avif_decoder_decode(avif_decoder d, opencv_mat mat, lilliput_frame_info* info);
 int avif_decoder_has_more_frames(avif_decoder d);
 
 //----------------------
@@ -70,13 +74,19 @@ void avif_encoder_release(avif_encoder e);
 //----------------------
 // Encoder Operations
 //----------------------
+// src is 8-bit BGR or BGRA; premultiplied is set if the colour of a BGRA src
+// has been multiplied by its alpha
 size_t avif_encoder_write(avif_encoder e,
                           const opencv_mat src,
+                          bool premultiplied,
                           const int* opt,
                           size_t opt_len,
                           int delay_ms,
                           int blend,
                           int dispose);
+// lengthen the most recently written frame by delay_ms. returns false if no
+// frame has been written yet
+bool avif_encoder_extend_prev_frame_delay(avif_encoder e, int delay_ms);
 size_t avif_encoder_flush(avif_encoder e);
 
 #ifdef __cplusplus
@@ -1,6 +1,7 @@
 package lilliput
 
 import (
+	"bytes"
 	"math"
 	"os"
 	"reflect"
@@ -697,3 +698,146 @@ func TestAvifIrotOrientation(t *testing.T) {
 		})
 	}
 }
+
+// TestAvifOrientedResize checks that shrinking a rotated image, which applies
+// the orientation after the resize rather than before it, gives the same
+// pixels as rotating at full size and then resizing. A 2x INTER_AREA
+// downscale commutes exactly with the flips and rotations.
+func TestAvifOrientedResize(t *testing.T) {
+	for _, filename := range []string{
+		"testdata/rotation-irot90.avif",
+		"testdata/rotation-irot180.avif",
+		"testdata/rotation-irot270.avif",
+		"testdata/rotation-irot90-imir1.avif",
+	} {
+		t.Run(filename, func(t *testing.T) {
+			buf, err := os.ReadFile(filename)
+			if err != nil {
+				t.Fatalf("Failed to read %s: %v", filename, err)
+			}
+
+			transform := func(method ImageOpsSizeMethod, width, height int) *Framebuffer {
+				decoder, err := newAvifDecoder(buf, true)
+				if err != nil {
+					t.Fatalf("Failed to create decoder: %v", err)
+				}
+				defer decoder.Close()
+
+				ops := NewImageOps(8192)
+				defer ops.Close()
+				out, err := ops.Transform(decoder, &ImageOptions{
+					FileType:             ".png",
+					Width:                width,
+					Height:               height,
+					NormalizeOrientation: true,
+					ResizeMethod:         method,
+					EncodeTimeout:        time.Second * 30,
+				}, make([]byte, destinationBufferSize))
+				if err != nil {
+					t.Fatalf("Transform failed: %v", err)
+				}
+
+				outDecoder, err := NewDecoder(out)
+				if err != nil {
+					t.Fatalf("Failed to decode transform output: %v", err)
+				}
+				defer outDecoder.Close()
+				fb := NewFramebuffer(64, 64)
+				if err := outDecoder.DecodeTo(fb); err != nil {
+					t.Fatalf("DecodeTo failed: %v", err)
+				}
+				return fb
+			}
+
+			full := transform(ImageOpsNoResize, 0, 0)
+			defer full.Close()
+			want := NewFramebuffer(64, 64)
+			defer want.Close()
+			if err := full.ResizeTo(full.Width()/2, full.Height()/2, want); err != nil {
+				t.Fatalf("ResizeTo failed: %v", err)
+			}
+
+			got := transform(ImageOpsResize, full.Width()/2, full.Height()/2)
+			defer got.Close()
+
+			if got.Width() != want.Width() || got.Height() != want.Height() {
+				t.Fatalf("Output dimensions = %dx%d, want %dx%d", got.Width(), got.Height(), want.Width(), want.Height())
+			}
+			n := want.Width() * want.Height() * want.PixelType().Channels()
+			if !bytes.Equal(got.buf[:n], want.buf[:n]) {
+				t.Error("resizing before rotating changed the output pixels")
+			}
+		})
+	}
+}
+
+// TestAvifDecodeDownscale checks that a large downscale, which shrinks the
+// YUV planes before converting them, keeps the requested size and stays close
+// to converting at full size and then resizing.
+func TestAvifDecodeDownscale(t *testing.T) {
+	buf, err := os.ReadFile("testdata/paris_icc_exif_xmp.avif")
+	if err != nil {
+		t.Fatalf("Failed to read test file: %v", err)
+	}
+
+	transform := func(method ImageOpsSizeMethod, width, height int) *Framebuffer {
+		decoder, err := newAvifDecoder(buf, true)
+		if err != nil {
+			t.Fatalf("Failed to create decoder: %v", err)
+		}
+		defer decoder.Close()
+
+		ops := NewImageOps(8192)
+		defer ops.Close()
+		out, err := ops.Transform(decoder, &ImageOptions{
+			FileType:             ".png",
+			Width:                width,
+			Height:               height,
+			NormalizeOrientation: true,
+			ResizeMethod:         method,
+			EncodeTimeout:        time.Second * 30,
+		}, make([]byte, destinationBufferSize))
+		if err != nil {
+			t.Fatalf("Transform failed: %v", err)
+		}
+
+		outDecoder, err := NewDecoder(out)
+		if err != nil {
+			t.Fatalf("Failed to decode transform output: %v", err)
+		}
+		defer outDecoder.Close()
+		fb := NewFramebuffer(8192, 8192)
+		if err := outDecoder.DecodeTo(fb); err != nil {
+			t.Fatalf("DecodeTo failed: %v", err)
+		}
+		return fb
+	}
+
+	full := transform(ImageOpsNoResize, 0, 0)
+	defer full.Close()
+	width, height := full.Width()/8, full.Height()/8
+	want := NewFramebuffer(width, height)
+	defer want.Close()
+	if err := full.ResizeTo(width, height, want); err != nil {
+		t.Fatalf("ResizeTo failed: %v", err)
+	}
+
+	got := transform(ImageOpsResize, width, height)
+	defer got.Close()
+
+	if got.Width() != width || got.Height() != height {
+		t.Fatalf("Output dimensions = %dx%d, want %dx%d", got.Width(), got.Height(), width, height)
+	}
+	n := width * height * want.PixelType().Channels()
+	total := 0
+	for i := 0; i < n; i++ {
+		diff := int(got.buf[i]) - int(want.buf[i])
+		if diff < 0 {
+			diff = -diff
+		}
+		total += diff
+	}
+	if mean := float64(total) / float64(n); mean > 3 {
+		t.Errorf("mean difference from a full size decode = %.2f, want at most 3", mean)
+	}
+}
@@ -1,4 +1,5 @@
 #include "color_info.hpp"
+#include "parallel.hpp"
 #include <lcms2.h>
 #include "icc_profiles/displayp3_profile.h"
 #include "icc_profiles/rec2020_profile.h"
@@ -6,9 +7,12 @@
 #include "icc_profiles/rec601_pal_profile.h"
 #include "icc_profiles/srgb_profile.h"
 #include <opencv2/core.hpp>
-#include <opencv2/photo.hpp>
+#include <cfloat>
 #include <cmath>
 #include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 // Maximum ICC profile size we're willing to parse (1MB)
@@ -109,96 +113,378 @@ static float hlg_to_linear(float x)
     }
 }
 
-void tonemap_rgb_to_sdr(const uint16_t* src,
-                        uint8_t* dst,
-                        int width,
-                        int height,
-                        int src_depth,
-                        uint8_t transfer,
-                        uint8_t primaries)
-{
-    float scale = 1.0f / ((1 << src_depth) - 1);
+// Reinhard parameters: intensity, light adaptation and colour adaptation, as
+// in Reinhard and Devlin's "Dynamic Range Reduction Inspired by
+// Photoreceptor Physiology"
+static const float TONEMAP_INTENSITY = 0.6f;
+static const float TONEMAP_LIGHT_ADAPT = 0.2f;
+static const float TONEMAP_COLOR_ADAPT = 0.3f;
+
+// Entries in the table of the Reinhard adaptation curve
+static const int TONEMAP_CURVE_SIZE = 4096;
+
+// Entries in the table of the 1/2.2 gamma applied to linear sources
+static const int TONEMAP_GAMMA_SIZE = 4096;
 
-    cv::Mat hdrMat(height, width, CV_32FC3);
-    cv::Mat sdrMat(height, width, CV_8UC3);
+// Image statistics are gathered from a grid of at most this many pixels
+static const int TONEMAP_MAX_SAMPLES = 1 << 16;
 
-    // Convert to linear RGB
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = (y * width + x) * 3;
-            float r = src[idx] * scale;
-            float g = src[idx + 1] * scale;
-            float b = src[idx + 2] * scale;
+// Linear light for every sample value of a depth-bit source
+static std::vector<float> tonemap_build_transfer_lut(uint8_t transfer, int depth)
+{
+    const int size = 1 << depth;
+    const float scale = 1.0f / (size - 1);
+    std::vector<float> lut(size);
+    for (int i = 0; i < size; i++) {
+        float x = i * scale;
+        if (transfer == CICP_TRANSFER_PQ) {
+            x = pq_to_linear(x);
+        }
+        else if (transfer == CICP_TRANSFER_HLG) {
+            x = hlg_to_linear(x);
+        }
+        lut[i] = x;
+    }
+    return lut;
+}
 
-            if (transfer == CICP_TRANSFER_PQ) {
-                r = pq_to_linear(r);
-                g = pq_to_linear(g);
-                b = pq_to_linear(b);
+// Returns the transfer table for a source, building it into scratch unless it
+// is one of the 8, 10 and 12-bit tables that are built once and kept.
+static const float* tonemap_transfer_lut(uint8_t transfer, int depth, std::vector<float>& scratch)
+{
+    struct transfer_luts {
+        std::vector<float> luts[3][3];
+        transfer_luts()
+        {
+            const uint8_t transfers[3] = {CICP_TRANSFER_PQ, CICP_TRANSFER_HLG, CICP_TRANSFER_UNSPECIFIED};
+            for (int t = 0; t < 3; t++) {
+                for (int d = 0; d < 3; d++) {
+                    luts[t][d] = tonemap_build_transfer_lut(transfers[t], 8 + 2 * d);
+                }
             }
-            else if (transfer == CICP_TRANSFER_HLG) {
-                r = hlg_to_linear(r);
-                g = hlg_to_linear(g);
-                b = hlg_to_linear(b);
+        }
+    };
+    static const transfer_luts kept;
+
+    if (depth == 8 || depth == 10 || depth == 12) {
+        const int t = transfer == CICP_TRANSFER_PQ ? 0 : (transfer == CICP_TRANSFER_HLG ? 1 : 2);
+        return kept.luts[t][(depth - 8) / 2].data();
+    }
+    scratch = tonemap_build_transfer_lut(transfer, depth);
+    return scratch.data();
+}
+
+// 8-bit output of the 1/2.2 gamma for linear values 0..1
+static const uint8_t* tonemap_gamma_lut()
+{
+    struct gamma_lut {
+        uint8_t lut[TONEMAP_GAMMA_SIZE];
+        gamma_lut()
+        {
+            for (int i = 0; i < TONEMAP_GAMMA_SIZE; i++) {
+                lut[i] = cv::saturate_cast<uint8_t>(
+                  std::pow(float(i) / (TONEMAP_GAMMA_SIZE - 1), 1.0f / 2.2f) * 255.0f);
             }
+        }
+    };
+    static const gamma_lut kept;
+    return kept.lut;
+}
+
+// Conversion to BT.709 primaries, or nullptr for BT.709 and unknown primaries,
+// which are taken to be BT.709. dst[i] = sum of m[i][j] * src[j].
+static const float (*tonemap_primaries_matrix(uint8_t primaries))[3]
+{
+    static const float bt2020_to_bt709[3][3] = {
+      {1.6605f, -0.5876f, -0.0728f}, {-0.1246f, 1.1329f, -0.0083f}, {-0.0182f, -0.1006f, 1.1187f}};
+    static const float p3_to_bt709[3][3] = {
+      {1.2249f, -0.2247f, -0.0002f}, {-0.0420f, 1.0419f, 0.0001f}, {-0.0197f, 0.0754f, 0.9443f}};
+    static const float bt601_to_bt709[3][3] = {
+      {1.0440f, -0.0440f, 0.0000f}, {-0.0000f, 1.0000f, 0.0000f}, {0.0000f, 0.0000f, 1.0000f}};
+    // CIE 1931 XYZ (SMPTE ST 428-1) to BT.709, D65 white point. The buffer is
+    // channel-ordered B,G,R (Z,Y,X here), so rows and columns are reversed
+    // relative to the textbook row-major XYZ->RGB matrix.
+    static const float xyz_to_bt709[3][3] = {{1.0569715f, -0.2039770f, 0.0556301f},
+                                             {0.0415551f, 1.8759675f, -0.9692436f},
+                                             {-0.4986108f, -1.5373832f, 3.2409699f}};
+
+    switch (primaries) {
+    case CICP_PRIMARIES_BT2020:
+        return bt2020_to_bt709;
+    case CICP_PRIMARIES_SMPTE431:
+    case CICP_PRIMARIES_SMPTE432:
+        return p3_to_bt709;
+    case CICP_PRIMARIES_BT601:
+        return bt601_to_bt709;
+    case CICP_PRIMARIES_XYZ:
+        return xyz_to_bt709;
+    default:
+        return nullptr;
+    }
+}
+
+// Everything the per-pixel pass needs, worked out once per image. The steps
+// are those of cv::TonemapReinhard followed by a primaries conversion and
+// 8-bit quantization, but with each image-wide statistic taken up front so
+// that every pixel can then go from source to destination in one step.
+struct tonemapper {
+    const float* transfer; // linear light by sample value >> sample_shift
+    int sample_shift;
+    int max_sample;
+
+    // normalizes linear light to 0..1 over the image's range
+    float in_min;
+    float in_scale;
 
-            hdrMat.at<cv::Vec3f>(y, x) = cv::Vec3f(r, g, b);
+    // the adaptation of a channel c of value v in a pixel of gray level g is
+    // self * v + gray * g + global[c], raised to the key by curve
+    float adapt_self;
+    float adapt_gray;
+    float adapt_global[3];
+    float curve[TONEMAP_CURVE_SIZE + 1];
+    float curve_scale;
+
+    // normalizes the tone-mapped values over their range, converts
+    // primaries and scales to the output, all as one affine transform
+    float out[3][4];
+    const uint8_t* gamma; // applied to the output if not null
+};
+
+// Normalized linear light of a pixel's first three channels
+template <typename T> static inline void tonemap_load(const tonemapper& t, const T* px, float v[3])
+{
+    for (int c = 0; c < 3; c++) {
+        const int sample = std::min<int>(px[c] >> t.sample_shift, t.max_sample);
+        v[c] = std::min(std::max((t.transfer[sample] - t.in_min) * t.in_scale, 0.0f), 1.0f);
+    }
+}
+
+// cv::cvtColor's RGB2GRAY weights, applied positionally as before
+static inline float tonemap_gray(const float v[3])
+{
+    return 0.299f * v[0] + 0.587f * v[1] + 0.114f * v[2];
+}
+
+// The Reinhard curve of normalized values v
+static inline void tonemap_curve(const tonemapper& t, const float v[3], float o[3])
+{
+    const float gray = tonemap_gray(v);
+    for (int c = 0; c < 3; c++) {
+        const float adapt = t.adapt_self * v[c] + t.adapt_gray * gray + t.adapt_global[c];
+        const float pos = std::min(std::max(adapt * t.curve_scale, 0.0f), float(TONEMAP_CURVE_SIZE));
+        const int i = std::min(int(pos), TONEMAP_CURVE_SIZE - 1);
+        const float frac = pos - i;
+        const float curved = t.curve[i] + (t.curve[i + 1] - t.curve[i]) * frac;
+        const float den = curved + v[c];
+        o[c] = den > 0.0f ? v[c] / den : 0.0f;
+    }
+}
+
+// Calls fn on a grid of at most TONEMAP_MAX_SAMPLES pixels spread over the image
+template <typename T, typename Fn>
+static void tonemap_each_sample(const T* src, int width, int height, int channels, Fn fn)
+{
+    const int64_t pixels = int64_t(width) * height;
+    const int step = std::max(1, int(std::ceil(std::sqrt(double(pixels) / TONEMAP_MAX_SAMPLES))));
+    for (int y = step / 2; y < height; y += step) {
+        const T* row = src + size_t(y) * width * channels;
+        for (int x = step / 2; x < width; x += step) {
+            fn(row + size_t(x) * channels);
         }
     }
+}
 
-    // Create a Reinhard tonemap with typical parameters for HDR content
-    cv::Ptr<cv::TonemapReinhard> tonemap = cv::createTonemapReinhard(1.0f, 0.6f, 0.2f, 0.3f);
-    cv::Mat tonemapped;
-    tonemap->process(hdrMat, tonemapped);
-
-    // Convert colorspace if needed
-    cv::Mat converted;
-    if (primaries == CICP_PRIMARIES_BT2020) {
-        cv::Matx33f bt2020_to_bt709(
-          1.6605f, -0.5876f, -0.0728f, -0.1246f, 1.1329f, -0.0083f, -0.0182f, -0.1006f, 1.1187f);
-        cv::transform(tonemapped, converted, bt2020_to_bt709);
-    }
-    else if (primaries == CICP_PRIMARIES_SMPTE432 || primaries == CICP_PRIMARIES_SMPTE431) {
-        cv::Matx33f p3_to_bt709(
-          1.2249f, -0.2247f, -0.0002f, -0.0420f, 1.0419f, 0.0001f, -0.0197f, 0.0754f, 0.9443f);
-        cv::transform(tonemapped, converted, p3_to_bt709);
-    }
-    else if (primaries == CICP_PRIMARIES_BT601) {
-        cv::Matx33f bt601_to_bt709(
-          1.0440f, -0.0440f, 0.0000f, -0.0000f, 1.0000f, 0.0000f, 0.0000f, 0.0000f, 1.0000f);
-        cv::transform(tonemapped, converted, bt601_to_bt709);
-    }
-    else if (primaries == CICP_PRIMARIES_XYZ) {
-        // CIE 1931 XYZ (SMPTE ST 428-1) to BT.709, D65 white point. The buffer is
-        // channel-ordered B,G,R (Z,Y,X here), so rows and columns are reversed
-        // relative to the textbook row-major XYZ->RGB matrix.
-        cv::Matx33f xyz_to_bt709(1.0569715f,
-                                 -0.2039770f,
-                                 0.0556301f,
-                                 0.0415551f,
-                                 1.8759675f,
-                                 -0.9692436f,
-                                 -0.4986108f,
-                                 -1.5373832f,
-                                 3.2409699f);
-        cv::transform(tonemapped, converted, xyz_to_bt709);
+template <typename T>
+static void tonemap_prepare(tonemapper& t,
+                            const T* src,
+                            int width,
+                            int height,
+                            int channels,
+                            int src_depth,
+                            uint8_t transfer,
+                            uint8_t primaries,
+                            std::vector<float>& scratch)
+{
+    // deeper sources are looked up by their top 12 bits, which is ample
+    // precision for an 8-bit result
+    t.sample_shift = std::max(src_depth - 12, 0);
+    t.transfer = tonemap_transfer_lut(transfer, src_depth - t.sample_shift, scratch);
+    t.max_sample = (1 << (src_depth - t.sample_shift)) - 1;
+
+    // the range of linear light over all channels, and channel means
+    float lo = FLT_MAX, hi = -FLT_MAX;
+    double sums[3] = {0, 0, 0};
+    int64_t count = 0;
+    tonemap_each_sample(src, width, height, channels, [&](const T* px) {
+        for (int c = 0; c < 3; c++) {
+            const float l = t.transfer[std::min<int>(px[c] >> t.sample_shift, t.max_sample)];
+            lo = std::min(lo, l);
+            hi = std::max(hi, l);
+            sums[c] += l;
+        }
+        count++;
+    });
+    if (hi - lo > DBL_EPSILON) {
+        t.in_min = lo;
+        t.in_scale = 1.0f / (hi - lo);
     }
     else {
-        // For unknown colorspaces, default to assuming BT709
-        converted = tonemapped;
+        t.in_min = 0.0f;
+        t.in_scale = 1.0f;
+    }
+    float chan_mean[3];
+    for (int c = 0; c < 3; c++) {
+        chan_mean[c] = float((sums[c] / count - t.in_min) * t.in_scale);
     }
+    const float gray_mean = tonemap_gray(chan_mean);
 
-    // Convert to 8-bit with proper gamma correction
-    cv::Mat gamma_corrected;
-    if (transfer == CICP_TRANSFER_LINEAR) {
-        cv::pow(converted, 1.0f / 2.2f, gamma_corrected);
+    // the log-average luminance against its range sets the key
+    double log_sum = 0;
+    float log_min = FLT_MAX, log_max = -FLT_MAX;
+    tonemap_each_sample(src, width, height, channels, [&](const T* px) {
+        float v[3];
+        tonemap_load(t, px, v);
+        const float log_gray = std::log(std::max(tonemap_gray(v), 1e-4f));
+        log_sum += log_gray;
+        log_min = std::min(log_min, log_gray);
+        log_max = std::max(log_max, log_gray);
+    });
+    const float log_mean = float(log_sum / count);
+    const float key = log_max > log_min ? (log_max - log_mean) / (log_max - log_min) : 0.0f;
+    const float map_key = 0.3f + 0.7f * std::pow(key, 1.4f);
+
+    const float intensity = std::exp(-TONEMAP_INTENSITY);
+    t.adapt_self = intensity * TONEMAP_LIGHT_ADAPT * TONEMAP_COLOR_ADAPT;
+    t.adapt_gray = intensity * TONEMAP_LIGHT_ADAPT * (1.0f - TONEMAP_COLOR_ADAPT);
+    for (int c = 0; c < 3; c++) {
+        const float global = TONEMAP_COLOR_ADAPT * chan_mean[c] + (1.0f - TONEMAP_COLOR_ADAPT) * gray_mean;
+        t.adapt_global[c] = intensity * (1.0f - TONEMAP_LIGHT_ADAPT) * global;
     }
-    else {
-        // PQ and HLG already include transfer function
-        gamma_corrected = converted;
+    // the adaptation of values in 0..1 is at most intensity
+    for (int i = 0; i <= TONEMAP_CURVE_SIZE; i++) {
+        t.curve[i] = std::pow(intensity * i / TONEMAP_CURVE_SIZE, map_key);
     }
-    gamma_corrected.convertTo(sdrMat, CV_8UC3, 255.0f);
+    t.curve_scale = TONEMAP_CURVE_SIZE / intensity;
 
-    memcpy(dst, sdrMat.data, (size_t)width * height * 3);
+    // the range of the curve's output
+    float out_lo = FLT_MAX, out_hi = -FLT_MAX;
+    tonemap_each_sample(src, width, height, channels, [&](const T* px) {
+        float v[3], o[3];
+        tonemap_load(t, px, v);
+        tonemap_curve(t, v, o);
+        for (int c = 0; c < 3; c++) {
+            out_lo = std::min(out_lo, o[c]);
+            out_hi = std::max(out_hi, o[c]);
+        }
+    });
+    float out_min = 0.0f, out_scale = 1.0f;
+    if (out_hi - out_lo > DBL_EPSILON) {
+        out_min = out_lo;
+        out_scale = 1.0f / (out_hi - out_lo);
+    }
+
+    // linear sources are gamma-corrected from a table, the rest quantized
+    t.gamma = transfer == CICP_TRANSFER_LINEAR ? tonemap_gamma_lut() : nullptr;
+    out_scale *= t.gamma ? float(TONEMAP_GAMMA_SIZE - 1) : 255.0f;
+
+    static const float identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    const float(*m)[3] = tonemap_primaries_matrix(primaries);
+    if (!m) {
+        m = identity;
+    }
+    for (int i = 0; i < 3; i++) {
+        t.out[i][3] = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            t.out[i][j] = m[i][j] * out_scale;
+            t.out[i][3] -= m[i][j] * out_scale * out_min;
+        }
+    }
+}
+
+// alpha carried from a source sample to the 8-bit output
+static inline uint8_t tonemap_alpha(uint8_t a)
+{
+    return a;
+}
+
+static inline uint8_t tonemap_alpha(uint16_t a)
+{
+    return uint8_t((uint32_t(a) * 255 + 32767) / 65535);
+}
+
+// Tone-maps rows y0..y1 of src into dst, either of which may carry a fourth
+// channel, which is copied across when both do. src and dst may be the same
+// buffer if they have the same layout.
+template <typename T>
+static void tonemap_rows(const tonemapper& t,
+                         const T* src,
+                         int src_channels,
+                         uint8_t* dst,
+                         int dst_channels,
+                         int width,
+                         int y0,
+                         int y1)
+{
+    for (int y = y0; y < y1; y++) {
+        const T* in = src + size_t(y) * width * src_channels;
+        uint8_t* out = dst + size_t(y) * width * dst_channels;
+        for (int x = 0; x < width; x++, in += src_channels, out += dst_channels) {
+            float v[3], o[3];
+            tonemap_load(t, in, v);
+            tonemap_curve(t, v, o);
+            for (int c = 0; c < 3; c++) {
+                const float value = t.out[c][0] * o[0] + t.out[c][1] * o[1] + t.out[c][2] * o[2] + t.out[c][3];
+                if (t.gamma) {
+                    out[c] = t.gamma[std::min(std::max(cvRound(value), 0), TONEMAP_GAMMA_SIZE - 1)];
+                }
+                else {
+                    out[c] = cv::saturate_cast<uint8_t>(value);
+                }
+            }
+            if (src_channels == 4 && dst_channels == 4) {
+                out[3] = tonemap_alpha(in[3]);
+            }
+        }
+    }
+}
+
+template <typename T>
+static void tonemap_to_sdr(const T* src,
+                           int src_channels,
+                           uint8_t* dst,
+                           int dst_channels,
+                           int width,
+                           int height,
+                           int src_depth,
+                           uint8_t transfer,
+                           uint8_t primaries,
+                           int threads)
+{
+    std::vector<float> scratch;
+    std::unique_ptr<tonemapper> t(new tonemapper);
+    tonemap_prepare(*t, src, width, height, src_channels, src_depth, transfer, primaries, scratch);
+
+    const int stripes = parallel_stripes(threads, height, (size_t)width * height * 3);
+    parallel_for(stripes, [&](int s) {
+        const int y0 = (int)((int64_t)height * s / stripes);
+        const int y1 = (int)((int64_t)height * (s + 1) / stripes);
+        tonemap_rows(*t, src, src_channels, dst, dst_channels, width, y0, y1);
+    });
+}
+
+void tonemap_rgb_to_sdr(const uint16_t* src,
+                        uint8_t* dst,
+                        int width,
+                        int height,
+                        int src_depth,
+                        uint8_t transfer,
+                        uint8_t primaries,
+                        int threads)
+{
+    if (!src || !dst || width <= 0 || height <= 0 || src_depth < 1 || src_depth > 16) {
+        return;
+    }
+    tonemap_to_sdr(src, 3, dst, 3, width, height, src_depth, transfer, primaries, threads);
 }
 
 void tonemap_rgb_8u_inplace(uint8_t* pixels,
@@ -206,31 +492,184 @@ void tonemap_rgb_8u_inplace(uint8_t* pixels,
                             int height,
                             int channels,
                             uint8_t transfer,
-                            uint8_t primaries)
+                            uint8_t primaries,
+                            int threads)
 {
     if (!pixels || width <= 0 || height <= 0 || (channels != 3 && channels != 4)) {
         return;
     }
+    // Each pixel is read in full before it is written, so this works in
+    // place, and alpha, when present, is untouched.
+    tonemap_to_sdr(pixels, channels, pixels, channels, width, height, 8, transfer, primaries, threads);
+}
 
-    const size_t count = (size_t)width * height;
+void tonemap_rgb_16u(const uint16_t* src,
+                     uint8_t* dst,
+                     int width,
+                     int height,
+                     int channels,
+                     uint8_t transfer,
+                     uint8_t primaries,
+                     int threads)
+{
+    if (!src || !dst || width <= 0 || height <= 0 || (channels != 3 && channels != 4)) {
+        return;
+    }
+    tonemap_to_sdr(src, channels, dst, channels, width, height, 16, transfer, primaries, threads);
+}
+
+// Transforms to sRGB are kept for the ICC_CACHE_SIZE profiles used most
+// recently. Each entry parses its profile once and builds the transform for
+// each pixel format the first time a buffer of that format needs it.
+static const size_t ICC_CACHE_SIZE = 16;
 
-    // Widen the colour channels to the 16-bit layout the shared tone-mapper
-    // consumes. Samples are copied rather than rescaled: src_depth is 8, so
-    // it normalizes against the same 0..255 range.
-    std::vector<uint16_t> wide(count * 3);
-    for (size_t i = 0; i < count; i++) {
-        wide[i * 3 + 0] = pixels[i * channels + 0];
-        wide[i * 3 + 1] = pixels[i * channels + 1];
-        wide[i * 3 + 2] = pixels[i * channels + 2];
+struct icc_srgb_entry {
+    std::vector<uint8_t> icc;
+    uint64_t hash = 0;
+    cmsHPROFILE profile = nullptr; // null if it cannot be converted
+    cmsHTRANSFORM transforms[2][2] = {}; // by 16-bitness, then alpha
+
+    ~icc_srgb_entry()
+    {
+        for (auto& by_depth : transforms) {
+            for (cmsHTRANSFORM t : by_depth) {
+                if (t) {
+                    cmsDeleteTransform(t);
+                }
+            }
+        }
+        if (profile) {
+            cmsCloseProfile(profile);
+        }
     }
+};
 
-    std::vector<uint8_t> sdr(count * 3);
-    tonemap_rgb_to_sdr(wide.data(), sdr.data(), width, height, 8, transfer, primaries);
+static std::mutex icc_cache_mutex;
+static std::list<std::shared_ptr<icc_srgb_entry>> icc_cache;
 
-    for (size_t i = 0; i < count; i++) {
-        pixels[i * channels + 0] = sdr[i * 3 + 0];
-        pixels[i * channels + 1] = sdr[i * 3 + 1];
-        pixels[i * channels + 2] = sdr[i * 3 + 2];
-        // Alpha, when present, is untouched.
+// FNV-1a, which only has to tell the few profiles in the cache apart
+static uint64_t icc_hash(const uint8_t* icc, size_t icc_len)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < icc_len; i++) {
+        h = (h ^ icc[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static cmsHPROFILE icc_open_convertible(const uint8_t* icc, size_t icc_len)
+{
+    cmsHPROFILE profile = cmsOpenProfileFromMem(icc, icc_len);
+    if (!profile) {
+        return nullptr;
+    }
+    if (cmsGetColorSpace(profile) != cmsSigRgbData || cmsGetDeviceClass(profile) == cmsSigLinkClass) {
+        cmsCloseProfile(profile);
+        return nullptr;
+    }
+    cmsVideoSignalType* cicp = (cmsVideoSignalType*)cmsReadTag(profile, cmsSigcicpTag);
+    if (cicp && cicp_is_hdr_transfer(static_cast<uint8_t>(cicp->TransferCharacteristics))) {
+        cmsCloseProfile(profile);
+        return nullptr;
+    }
+    return profile;
+}
+
+// the cache entry for icc, moved to the front, or a new one in its place.
+// Must be called with icc_cache_mutex held.
+static std::shared_ptr<icc_srgb_entry> icc_cache_lookup(const uint8_t* icc, size_t icc_len)
+{
+    const uint64_t hash = icc_hash(icc, icc_len);
+    for (auto it = icc_cache.begin(); it != icc_cache.end(); ++it) {
+        const auto& e = *it;
+        if (e->hash == hash && e->icc.size() == icc_len && memcmp(e->icc.data(), icc, icc_len) == 0) {
+            icc_cache.splice(icc_cache.begin(), icc_cache, it);
+            return e;
+        }
+    }
+
+    auto e = std::make_shared<icc_srgb_entry>();
+    e->icc.assign(icc, icc + icc_len);
+    e->hash = hash;
+    e->profile = icc_open_convertible(icc, icc_len);
+    icc_cache.push_front(e);
+    if (icc_cache.size() > ICC_CACHE_SIZE) {
+        icc_cache.pop_back();
+    }
+    return e;
+}
+
+bool icc_converts_to_srgb(const uint8_t* icc, size_t icc_len)
+{
+    if (!icc || icc_len == 0 || icc_len > MAX_ICC_PROFILE_SIZE) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(icc_cache_mutex);
+    return icc_cache_lookup(icc, icc_len)->profile != nullptr;
+}
+
+bool icc_transform_to_srgb(const uint8_t* icc,
+                           size_t icc_len,
+                           void* pixels,
+                           int width,
+                           int height,
+                           size_t stride,
+                           int channels,
+                           int depth,
+                           int threads)
+{
+    if (!icc || icc_len == 0 || icc_len > MAX_ICC_PROFILE_SIZE || !pixels || width <= 0 ||
+        height <= 0 || (channels != 3 && channels != 4) || (depth != 8 && depth != 16)) {
+        return false;
     }
+
+    // The entry is held for the length of the transform, so that it outlives
+    // being evicted by another thread meanwhile
+    std::shared_ptr<icc_srgb_entry> e;
+    cmsHTRANSFORM transform;
+    {
+        std::lock_guard<std::mutex> lock(icc_cache_mutex);
+        e = icc_cache_lookup(icc, icc_len);
+        if (!e->profile) {
+            return false;
+        }
+        cmsHTRANSFORM& slot = e->transforms[depth == 16][channels == 4];
+        if (!slot) {
+            static const cmsUInt32Number formats[2][2] = {
+                {TYPE_BGR_8, TYPE_BGRA_8},
+                {TYPE_BGR_16, TYPE_BGRA_16},
+            };
+            const cmsUInt32Number format = formats[depth == 16][channels == 4];
+            cmsHPROFILE srgb = cmsCreate_sRGBProfile();
+            if (!srgb) {
+                return false;
+            }
+            // NOCACHE makes the transform safe to run from several threads
+            // at once; HIGHRESPRECALC buys a finer lookup table with the
+            // time saved by building it once per profile
+            slot = cmsCreateTransform(e->profile,
+                                      format,
+                                      srgb,
+                                      format,
+                                      INTENT_PERCEPTUAL,
+                                      cmsFLAGS_HIGHRESPRECALC | cmsFLAGS_NOCACHE);
+            cmsCloseProfile(srgb);
+            if (!slot) {
+                return false;
+            }
+        }
+        transform = slot;
+    }
+
+    uint8_t* base = static_cast<uint8_t*>(pixels);
+    const int stripes = parallel_stripes(threads, height, (size_t)width * height * channels * depth / 8);
+    parallel_for(stripes, [&](int s) {
+        const int y0 = (int)((int64_t)height * s / stripes);
+        const int y1 = (int)((int64_t)height * (s + 1) / stripes);
+        for (int y = y0; y < y1; y++) {
+            uint8_t* row = base + (size_t)y * stride;
+            cmsDoTransform(transform, row, row, (cmsUInt32Number)width);
+        }
+    });
+    return true;
 }
@@ -77,7 +77,10 @@ bool icc_header_is_sane(const uint8_t* icc, size_t icc_len);
  *
  * Shared by the AVIF decoder and the still-image (OpenCV) decoder so both
  * apply an identical transform; see also `tonemap_rgb_8u_inplace` for callers
- * that already hold an 8-bit buffer.
+ * that already hold an 8-bit buffer. The Reinhard curve's image statistics are
+ * taken from a subsample of pixels, after which each pixel is decoded,
+ * tone-mapped, converted and quantized in a single pass over up to `threads`
+ * stripes, with table lookups in place of the transfer functions.
  */
 void tonemap_rgb_to_sdr(
     const uint16_t* src,
@@ -86,15 +89,16 @@ void tonemap_rgb_to_sdr(
     int height,
     int src_depth,
     uint8_t transfer,
-    uint8_t primaries
+    uint8_t primaries,
+    int threads
 );
 
 /**
  * In-place tone-map of an interleaved 8-bit buffer with `channels` channels
  * (3 = BGR, 4 = BGRA). Alpha, when present, is passed through untouched.
  *
- * Convenience wrapper over `tonemap_rgb_to_sdr` for the still-image path,
- * whose decoded frames are already 8-bit.
+ * The same transform as `tonemap_rgb_to_sdr` for the still-image path, whose
+ * decoded frames are already 8-bit, applied without an intermediate copy.
  */
 void tonemap_rgb_8u_inplace(
     uint8_t* pixels,
@@ -102,7 +106,61 @@ void tonemap_rgb_8u_inplace(
     int height,
     int channels,
     uint8_t transfer,
-    uint8_t primaries
+    uint8_t primaries,
+    int threads
+);
+
+/**
+ * Tone-map an interleaved 16-bit buffer with `channels` channels (3 = BGR,
+ * 4 = BGRA), whose samples span the full 16-bit range, into an 8-bit buffer
+ * of the same layout. Alpha, when present, is narrowed to 8 bits.
+ *
+ * The same transform as `tonemap_rgb_8u_inplace`, for frames kept at 16 bits
+ * so that they are resized at full precision before being tone-mapped.
+ */
+void tonemap_rgb_16u(
+    const uint16_t* src,
+    uint8_t* dst,
+    int width,
+    int height,
+    int channels,
+    uint8_t transfer,
+    uint8_t primaries,
+    int threads
+);
+
+/**
+ * Report whether `icc` is an RGB profile whose pixels
+ * `icc_transform_to_srgb` can convert to sRGB. HDR profiles, whose cICP tag
+ * signals PQ or HLG, are left to the tone-mapper and report false, as do
+ * profiles lcms2 cannot parse.
+ */
+bool icc_converts_to_srgb(
+    const uint8_t* icc,
+    size_t icc_len
+);
+
+/**
+ * Convert an interleaved buffer with `channels` channels (3 = BGR,
+ * 4 = BGRA) of `depth`-bit samples (8 or 16), rows `stride` bytes apart,
+ * from the colour space of `icc` to sRGB in place, in up to `threads`
+ * stripes. Alpha is untouched. Returns false, leaving the pixels as they
+ * were, when `icc_converts_to_srgb` would.
+ *
+ * Transforms are cached process-wide by profile, least recently used first
+ * out, so a profile seen before costs neither parsing nor building its
+ * lookup tables again.
+ */
+bool icc_transform_to_srgb(
+    const uint8_t* icc,
+    size_t icc_len,
+    void* pixels,
+    int width,
+    int height,
+    size_t stride,
+    int channels,
+    int depth,
+    int threads
 );
 
 #ifdef __cplusplus
@@ -0,0 +1,92 @@
+package lilliput
+
+import (
+	"math/bits"
+	"sync"
+	"sync/atomic"
+)
+
+// Framebuffer pixel memory comes from a process-wide pool bucketed into
+// power-of-two size classes. A Framebuffer takes a buffer when resizeMat first
+// needs one (or needs a larger one) and hands it back on Clear or Close, so an
+// idle ImageOps holds no pixel memory and concurrent workers share whatever
+// the largest recent images needed rather than each committing its maximum.
+// Idle buffers are held in sync.Pools and are released by the garbage
+// collector if they go unused.
+
+const (
+	minFramebufferClassBits = 12 // 4KB
+	numFramebufferClasses   = 48
+)
+
+var (
+	framebufferClasses [numFramebufferClasses]sync.Pool
+
+	framebufferPoolGets       uint64
+	framebufferPoolAllocs     uint64
+	framebufferPoolPuts       uint64
+	framebufferPoolInUseBytes int64
+)
+
+// FramebufferPoolStats is a snapshot of the shared framebuffer pool counters.
+type FramebufferPoolStats struct {
+	// Gets is the number of buffers handed out to framebuffers.
+	Gets uint64
+	// Allocs is the number of Gets that could not reuse a pooled buffer.
+	Allocs uint64
+	// Puts is the number of buffers framebuffers have returned.
+	Puts uint64
+	// InUseBytes is the capacity of all buffers currently held by framebuffers.
+	InUseBytes int64
+}
+
+// GetFramebufferPoolStats returns the current framebuffer pool counters.
+func GetFramebufferPoolStats() FramebufferPoolStats {
+	return FramebufferPoolStats{
+		Gets:       atomic.LoadUint64(&framebufferPoolGets),
+		Allocs:     atomic.LoadUint64(&framebufferPoolAllocs),
+		Puts:       atomic.LoadUint64(&framebufferPoolPuts),
+		InUseBytes: atomic.LoadInt64(&framebufferPoolInUseBytes),
+	}
+}
+
+// framebufferClass returns the size class that holds buffers of at least n bytes.
+func framebufferClass(n int) int {
+	class := bits.Len(uint(n - 1))
+	if class < minFramebufferClassBits {
+		class = minFramebufferClassBits
+	}
+	return class
+}
+
+// getFramebufferBuf returns a buffer of at least n bytes. Its contents are
+// undefined.
+func getFramebufferBuf(n int) []byte {
+	class := framebufferClass(n)
+	atomic.AddUint64(&framebufferPoolGets, 1)
+	var buf []byte
+	if class < numFramebufferClasses {
+		if p, ok := framebufferClasses[class].Get().(*[]byte); ok {
+			buf = *p
+		}
+	}
+	if buf == nil {
+		atomic.AddUint64(&framebufferPoolAllocs, 1)
+		buf = make([]byte, 1<<class)
+	}
+	atomic.AddInt64(&framebufferPoolInUseBytes, int64(len(buf)))
+	return buf
+}
+
+// putFramebufferBuf returns a buffer obtained from getFramebufferBuf. Nothing
+// may reference buf afterwards.
+func putFramebufferBuf(buf []byte) {
+	if buf == nil {
+		return
+	}
+	atomic.AddUint64(&framebufferPoolPuts, 1)
+	atomic.AddInt64(&framebufferPoolInUseBytes, -int64(len(buf)))
+	if class := framebufferClass(len(buf)); class < numFramebufferClasses && len(buf) == 1<<class {
+		framebufferClasses[class].Put(&buf)
+	}
+}
@@ -2,6 +2,12 @@
 #include "gif_lib.h"
 #include <stdbool.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 // Constants
 constexpr int BYTES_PER_PIXEL = 4; // BGRA format: 4 bytes per pixel
 
@@ -53,23 +59,54 @@ struct giflib_encoder_struct {
 
     int prev_frame_disposal;
 
+    // where the delay field of the last frame's graphics control extension
+    // landed in dst, or -1 if that frame had none. lets us lengthen a frame
+    // after it has been written
+    ptrdiff_t prev_frame_delay_offset;
+
     uint8_t* prev_frame_bgra;
 
     bool have_written_first_frame;
 
-    // keep track of all of the things we've allocated
-    // we could technically just stuff all of these into a vector
-    // of void*s but it might be interesting to build a pool
-    // for these later, so it makes sense to keep them separated
-    // n.b. that even if we do that, giflib still uses hella mallocs
-    // when building the decoder, so it would only save us on the encoder
-    std::vector<ExtensionBlock*> extension_blocks;
-    std::vector<GifByteType*> gif_bytes;
-    std::vector<ColorMapObject*> color_maps;
-    std::vector<GifColorType*> colors;
-    std::vector<SavedImage*> saved_images;
+    // dithering state. dither_row holds one row of dithered BGRA for the
+    // ordered kernel; dither_error holds two rows of BGR error terms (scaled
+    // by 16) for floyd-steinberg. both only grow, like pixels
+    int dither_mode;
+    uint8_t* dither_row;
+    size_t dither_row_len;
+    int32_t* dither_error;
+    size_t dither_error_len;
+
+    // lzw dictionary, see giflib_encoder_compress_frame. lzw_table is an
+    // open-addressed hash of (prefix, suffix) -> code and lzw_slot_of records
+    // which slot each code landed in, so a reset only touches the slots we used
+    uint32_t* lzw_table;
+    uint16_t* lzw_slot_of;
+
+    // extension blocks, color maps and the like are bump-allocated out of an
+    // arena and released all at once. the arena is either private to this
+    // encoder or borrowed from the caller so it can be reused across encoders,
+    // in which case it is reset rather than freed on release
+    giflib_arena arena;
+    bool owns_arena;
+};
+
+// a bump allocator handing out memory from large chunks. chunks are kept when
+// the arena is reset, so an arena lent to successive encoders stops touching
+// malloc once it has grown to fit the largest gif it has seen
+struct giflib_arena_struct {
+    std::vector<uint8_t*> chunks;
+    std::vector<size_t> chunk_sizes;
+    size_t chunk_index;
+    size_t chunk_offset;
 };
 
+constexpr size_t GIFLIB_ARENA_CHUNK_SIZE = 64 * 1024;
+constexpr size_t GIFLIB_ARENA_ALIGN = 16;
+// how much an arena holds on to across resets. chunks past this are returned
+// so that one enormous gif doesn't pin memory on a worker indefinitely
+constexpr size_t GIFLIB_ARENA_RETAIN_SIZE = 1024 * 1024;
+
 int decode_func(GifFileType* gif, GifByteType* buf, int len)
 {
     auto d = static_cast<giflib_decoder>(gif->UserData);
@@ -723,39 +760,100 @@ bool giflib_decoder_decode_frame(giflib_decoder d, opencv_mat mat)
     return true;
 }
 
+giflib_arena giflib_arena_create()
+{
+    giflib_arena a = new struct giflib_arena_struct();
+    a->chunk_index = 0;
+    a->chunk_offset = 0;
+    return a;
+}
+
+static void* giflib_arena_alloc(giflib_arena a, size_t size)
+{
+    size = (size + GIFLIB_ARENA_ALIGN - 1) & ~(GIFLIB_ARENA_ALIGN - 1);
+
+    while (a->chunk_index < a->chunks.size()) {
+        if (a->chunk_offset + size <= a->chunk_sizes[a->chunk_index]) {
+            void* p = a->chunks[a->chunk_index] + a->chunk_offset;
+            a->chunk_offset += size;
+            return p;
+        }
+        a->chunk_index++;
+        a->chunk_offset = 0;
+    }
+
+    size_t chunk_size = (size > GIFLIB_ARENA_CHUNK_SIZE) ? size : GIFLIB_ARENA_CHUNK_SIZE;
+    uint8_t* chunk = (uint8_t*)(malloc(chunk_size));
+    if (!chunk) {
+        return NULL;
+    }
+    a->chunks.push_back(chunk);
+    a->chunk_sizes.push_back(chunk_size);
+    a->chunk_index = a->chunks.size() - 1;
+    a->chunk_offset = size;
+    return chunk;
+}
+
+static bool giflib_arena_owns(const giflib_arena a, const void* p)
+{
+    const uint8_t* b = (const uint8_t*)(p);
+    for (size_t i = 0; i < a->chunks.size(); i++) {
+        if (b >= a->chunks[i] && b < a->chunks[i] + a->chunk_sizes[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// forget every allocation made so far, keeping (most of) the memory around
+static void giflib_arena_reset(giflib_arena a)
+{
+    size_t retained = 0;
+    size_t keep = 0;
+    while (keep < a->chunks.size() && retained + a->chunk_sizes[keep] <= GIFLIB_ARENA_RETAIN_SIZE) {
+        retained += a->chunk_sizes[keep];
+        keep++;
+    }
+    for (size_t i = keep; i < a->chunks.size(); i++) {
+        free(a->chunks[i]);
+    }
+    a->chunks.resize(keep);
+    a->chunk_sizes.resize(keep);
+    a->chunk_index = 0;
+    a->chunk_offset = 0;
+}
+
+void giflib_arena_release(giflib_arena a)
+{
+    for (size_t i = 0; i < a->chunks.size(); i++) {
+        free(a->chunks[i]);
+    }
+    delete a;
+}
+
 ExtensionBlock* giflib_encoder_allocate_extension_blocks(giflib_encoder e, size_t count)
 {
-    ExtensionBlock* blocks = (ExtensionBlock*)(malloc(count * sizeof(ExtensionBlock)));
-    e->extension_blocks.push_back(blocks);
-    return blocks;
+    return (ExtensionBlock*)(giflib_arena_alloc(e->arena, count * sizeof(ExtensionBlock)));
 }
 
 GifByteType* giflib_encoder_allocate_gif_bytes(giflib_encoder e, size_t count)
 {
-    GifByteType* bytes = (GifByteType*)(malloc(count * sizeof(GifByteType)));
-    e->gif_bytes.push_back(bytes);
-    return bytes;
+    return (GifByteType*)(giflib_arena_alloc(e->arena, count * sizeof(GifByteType)));
 }
 
 ColorMapObject* giflib_encoder_allocate_color_maps(giflib_encoder e, size_t count)
 {
-    ColorMapObject* color_maps = (ColorMapObject*)(malloc(count * sizeof(ColorMapObject)));
-    e->color_maps.push_back(color_maps);
-    return color_maps;
+    return (ColorMapObject*)(giflib_arena_alloc(e->arena, count * sizeof(ColorMapObject)));
 }
 
 GifColorType* giflib_encoder_allocate_colors(giflib_encoder e, size_t count)
 {
-    GifColorType* colors = (GifColorType*)(malloc(count * sizeof(GifColorType)));
-    e->colors.push_back(colors);
-    return colors;
+    return (GifColorType*)(giflib_arena_alloc(e->arena, count * sizeof(GifColorType)));
 }
 
 SavedImage* giflib_encoder_allocate_saved_images(giflib_encoder e, size_t count)
 {
-    SavedImage* saved_images = (SavedImage*)(malloc(count * sizeof(SavedImage)));
-    e->saved_images.push_back(saved_images);
-    return saved_images;
+    return (SavedImage*)(giflib_arena_alloc(e->arena, count * sizeof(SavedImage)));
 }
 
 int encode_func(GifFileType* gif, const GifByteType* buf, int len)
@@ -769,7 +867,7 @@ int encode_func(GifFileType* gif, const GifByteType* buf, int len)
     return len;
 }
 
-giflib_encoder giflib_encoder_create(void* buf, size_t buf_len)
+giflib_encoder giflib_encoder_create(void* buf, size_t buf_len, giflib_arena arena)
 {
     giflib_encoder e = new struct giflib_encoder_struct();
     memset(e, 0, sizeof(struct giflib_encoder_struct));
@@ -785,6 +883,9 @@ giflib_encoder giflib_encoder_create(void* buf, size_t buf_len)
     }
     e->gif = gif_out;
 
+    e->owns_arena = (arena == NULL);
+    e->arena = e->owns_arena ? giflib_arena_create() : arena;
+
     // set up palette lookup table. we need 2^15 entries because we will be
     // using bit-crushed RGB values, 5 bits each. this is a reasonable compromise
     // between fidelity and computation/storage
@@ -929,6 +1030,277 @@ static inline int rgb_distance(int r0, int g0, int b0, int r1, int g1, int b1)
     return dist;
 }
 
+// 8x8 bayer threshold matrix, values 0..63
+static const uint8_t bayer_8x8[8][8] = {
+  {0, 32, 8, 40, 2, 34, 10, 42},
+  {48, 16, 56, 24, 50, 18, 58, 26},
+  {12, 44, 4, 36, 14, 46, 6, 38},
+  {60, 28, 52, 20, 62, 30, 54, 22},
+  {3, 35, 11, 43, 1, 33, 9, 41},
+  {51, 19, 59, 27, 49, 17, 57, 25},
+  {15, 47, 7, 39, 13, 45, 5, 37},
+  {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+// ordered dither offsets are centered on zero and span [-16, 15], roughly one
+// step of a 256-entry palette spread over the RGB cube
+static inline int bayer_offset(int x, int y)
+{
+    return (bayer_8x8[y & 7][x & 7] >> 1) - 16;
+}
+
+// the bayer offsets for one pattern row, laid out as 8 BGRA pixels (32 bytes)
+// and split into unsigned add/subtract halves so they can be applied with
+// saturating byte arithmetic. alpha lanes are always 0
+typedef struct {
+    uint8_t add[8][32];
+    uint8_t sub[8][32];
+} bayer_row_masks;
+
+static const bayer_row_masks& giflib_bayer_row_masks()
+{
+    static const bayer_row_masks masks = [] {
+        bayer_row_masks m;
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                int offset = bayer_offset(x, y);
+                for (int c = 0; c < 3; c++) {
+                    m.add[y][x * 4 + c] = offset > 0 ? offset : 0;
+                    m.sub[y][x * 4 + c] = offset < 0 ? -offset : 0;
+                }
+                m.add[y][x * 4 + 3] = 0;
+                m.sub[y][x * 4 + 3] = 0;
+            }
+        }
+        return m;
+    }();
+    return masks;
+}
+
+static inline uint8_t clamp_u8(int v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+// apply the ordered dither to one row of BGRA pixels whose first pixel sits
+// at canvas column x0. the pattern is anchored to the canvas rather than the
+// frame, so an unchanged region dithers identically on every frame and the
+// previous-frame transparency trick below keeps working
+static void giflib_dither_ordered_row(const uint8_t* src, uint8_t* dst, int x0, int width, int y)
+{
+    const bayer_row_masks& masks = giflib_bayer_row_masks();
+    const uint8_t* add = masks.add[y & 7];
+    const uint8_t* sub = masks.sub[y & 7];
+
+    int i = 0;
+    // scalar until we are aligned to the start of the 8-pixel pattern
+    for (; i < width && ((x0 + i) & 7) != 0; i++) {
+        int p = ((x0 + i) & 7) * 4;
+        for (int c = 0; c < 3; c++) {
+            dst[i * 4 + c] = clamp_u8(src[i * 4 + c] + add[p + c] - sub[p + c]);
+        }
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+
+#if defined(__SSE2__)
+    const __m128i add_lo = _mm_loadu_si128((const __m128i*)(add));
+    const __m128i add_hi = _mm_loadu_si128((const __m128i*)(add + 16));
+    const __m128i sub_lo = _mm_loadu_si128((const __m128i*)(sub));
+    const __m128i sub_hi = _mm_loadu_si128((const __m128i*)(sub + 16));
+    for (; i + 8 <= width; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(src + i * 4 + 16));
+        lo = _mm_subs_epu8(_mm_adds_epu8(lo, add_lo), sub_lo);
+        hi = _mm_subs_epu8(_mm_adds_epu8(hi, add_hi), sub_hi);
+        _mm_storeu_si128((__m128i*)(dst + i * 4), lo);
+        _mm_storeu_si128((__m128i*)(dst + i * 4 + 16), hi);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t add_lo = vld1q_u8(add);
+    const uint8x16_t add_hi = vld1q_u8(add + 16);
+    const uint8x16_t sub_lo = vld1q_u8(sub);
+    const uint8x16_t sub_hi = vld1q_u8(sub + 16);
+    for (; i + 8 <= width; i += 8) {
+        uint8x16_t lo = vld1q_u8(src + i * 4);
+        uint8x16_t hi = vld1q_u8(src + i * 4 + 16);
+        lo = vqsubq_u8(vqaddq_u8(lo, add_lo), sub_lo);
+        hi = vqsubq_u8(vqaddq_u8(hi, add_hi), sub_hi);
+        vst1q_u8(dst + i * 4, lo);
+        vst1q_u8(dst + i * 4 + 16, hi);
+    }
+#endif
+
+    for (; i < width; i++) {
+        int p = ((x0 + i) & 7) * 4;
+        for (int c = 0; c < 3; c++) {
+            dst[i * 4 + c] = clamp_u8(src[i * 4 + c] + add[p + c] - sub[p + c]);
+        }
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+}
+
+// map one pixel to a palette index. (R, G, B) is the color to look up, which
+// is the dithered color when dithering is on; (src_R, src_G, src_B) is the
+// undithered source color, which is what we compare against the previous frame
+static inline int giflib_encoder_map_pixel(giflib_encoder e,
+                                           const ColorMapObject* color_map,
+                                           int transparency_index,
+                                           bool prev_frame_valid,
+                                           ptrdiff_t prev_frame_index,
+                                           uint32_t R,
+                                           uint32_t G,
+                                           uint32_t B,
+                                           uint32_t A,
+                                           uint32_t src_R,
+                                           uint32_t src_G,
+                                           uint32_t src_B)
+{
+    bool have_transparency = (transparency_index != NO_TRANSPARENT_COLOR);
+
+    // TODO come up with what this threshold value should be
+    // probably ought to be a lot smaller, but greater than 0
+    // for now we just pick halfway
+    if (A < 128 && have_transparency) {
+        // this composite frame pixel is actually transparent
+        // what this means is that the background color must be transparent
+        // AND this frame pixel must be transparent
+        // for now we'll just assume bg is transparent since otherwise decoder
+        // could not have generated this frame pixel with a low opacity
+        return transparency_index;
+    }
+
+    uint32_t crushed = ((R >> 3) << 10) | ((G >> 3) << 5) | ((B >> 3));
+    int least_dist = INT_MAX;
+    int best_color = 0;
+    if (!(e->palette_lookup[crushed].present)) {
+        bool is_extreme_color = (R > 240 && G > 240 && B > 240) || (R < 15 && G < 15 && B < 15);
+
+        // calculate the best palette entry based on the midpoint of the crushed colors.
+        // what this means is that we drop the crushed bits (& 0xf8)
+        // and then OR the highest-order crushed bit back in, which is approx midpoint.
+        // for extreme colors, use actual values
+        uint32_t R_compare = is_extreme_color ? R : (R & 0xf8) | 4;
+        uint32_t G_compare = is_extreme_color ? G : (G & 0xf8) | 4;
+        uint32_t B_compare = is_extreme_color ? B : (B & 0xf8) | 4;
+
+        // we're calculating the best, so keep track of which
+        // palette entry has least distance
+        int count = color_map->ColorCount;
+        for (int i = 0; i < count; i++) {
+            if (i == transparency_index) {
+                // this index doesn't point to an actual color
+                continue;
+            }
+            int dist = rgb_distance(R_compare,
+                                    G_compare,
+                                    B_compare,
+                                    color_map->Colors[i].Red,
+                                    color_map->Colors[i].Green,
+                                    color_map->Colors[i].Blue);
+            if (dist < least_dist) {
+                least_dist = dist;
+                best_color = i;
+            }
+        }
+        e->palette_lookup[crushed].present = 1;
+        e->palette_lookup[crushed].index = best_color;
+    }
+    else {
+        best_color = e->palette_lookup[crushed].index;
+        least_dist = rgb_distance(R,
+                                  G,
+                                  B,
+                                  color_map->Colors[best_color].Red,
+                                  color_map->Colors[best_color].Green,
+                                  color_map->Colors[best_color].Blue);
+    }
+
+    // now that we for sure know which palette entry to pick, we have one more test
+    // to perform. it's possible that the best color for this pixel is actually
+    // the color of this pixel in the previous frame. if that's true, we'll just
+    // choose the transparency color, which will compress better on average
+    // (plus it improves color range of image)
+    if (prev_frame_valid && have_transparency) {
+        uint32_t last_B = e->prev_frame_bgra[prev_frame_index];
+        uint32_t last_G = e->prev_frame_bgra[prev_frame_index + 1];
+        uint32_t last_R = e->prev_frame_bgra[prev_frame_index + 2];
+        int dist = rgb_distance(src_R, src_G, src_B, last_R, last_G, last_B);
+        if (dist < least_dist) {
+            least_dist = dist;
+            best_color = transparency_index;
+        }
+    }
+
+    return best_color;
+}
+
+// serpentine floyd-steinberg over one row. errors are carried as BGR triples
+// scaled by 16 in two rows of (width + 2) entries so the kernel never needs
+// bounds checks at the edges. pixels that map to the transparency index, either
+// because they are transparent or because they are unchanged from the previous
+// frame, diffuse no error; this keeps static regions from picking up shimmer
+// from the moving parts of an animation
+static void giflib_encoder_dither_fs_row(giflib_encoder e,
+                                         const ColorMapObject* color_map,
+                                         int transparency_index,
+                                         bool prev_frame_valid,
+                                         const uint8_t* src,
+                                         GifByteType* row_out,
+                                         int32_t* err_cur,
+                                         int32_t* err_next,
+                                         int x0,
+                                         int y,
+                                         int width)
+{
+    bool have_transparency = (transparency_index != NO_TRANSPARENT_COLOR);
+    // direction alternates with the canvas row so the result is deterministic
+    int dir = (y & 1) ? -1 : 1;
+    int start = (dir > 0) ? 0 : width - 1;
+
+    for (int n = 0, i = start; n < width; n++, i += dir) {
+        const uint8_t* px = src + i * 4;
+        int32_t* err = err_cur + (i + 1) * 3;
+
+        int adjusted[3];
+        for (int c = 0; c < 3; c++) {
+            adjusted[c] = clamp_u8(px[c] + ((err[c] + 8) >> 4));
+        }
+
+        ptrdiff_t prev_frame_index = 4 * ((y * e->gif->SWidth) + x0 + i);
+        int best_color = giflib_encoder_map_pixel(e,
+                                                  color_map,
+                                                  transparency_index,
+                                                  prev_frame_valid,
+                                                  prev_frame_index,
+                                                  adjusted[2],
+                                                  adjusted[1],
+                                                  adjusted[0],
+                                                  px[3],
+                                                  px[2],
+                                                  px[1],
+                                                  px[0]);
+        row_out[i] = best_color;
+
+        if (have_transparency && best_color == transparency_index) {
+            continue;
+        }
+
+        const GifColorType* chosen = &color_map->Colors[best_color];
+        int quant_err[3] = {
+          adjusted[0] - chosen->Blue, adjusted[1] - chosen->Green, adjusted[2] - chosen->Red};
+        int32_t* ahead = err_cur + (i + 1 + dir) * 3;
+        int32_t* below_behind = err_next + (i + 1 - dir) * 3;
+        int32_t* below = err_next + (i + 1) * 3;
+        int32_t* below_ahead = err_next + (i + 1 + dir) * 3;
+        for (int c = 0; c < 3; c++) {
+            ahead[c] += quant_err[c] * 7;
+            below_behind[c] += quant_err[c] * 3;
+            below[c] += quant_err[c] * 5;
+            below_ahead[c] += quant_err[c];
+        }
+    }
+}
+
 static bool giflib_encoder_render_frame(giflib_encoder e,
                                         const giflib_decoder d,
                                         const opencv_mat opaque_frame)
@@ -993,7 +1365,6 @@ static bool giflib_encoder_render_frame(giflib_encoder e,
     GraphicsControlBlock gcb;
     giflib_get_frame_gcb(e->gif, &gcb);
     int transparency_index = gcb.TransparentColor;
-    bool have_transparency = (transparency_index != NO_TRANSPARENT_COLOR);
 
     // decide whether we can use transparency against the previous frame
     bool prev_frame_valid = e->have_written_first_frame &&
@@ -1005,95 +1376,67 @@ static bool giflib_encoder_render_frame(giflib_encoder e,
     int frame_width = im_out->Width;
     int frame_height = im_out->Height;
 
-    GifByteType* raster_out = e->pixels;
+    if (e->dither_mode == GIF_DITHER_ORDERED && frame_width * 4 > e->dither_row_len) {
+        e->dither_row_len = frame_width * 4;
+        e->dither_row = (uint8_t*)(realloc(e->dither_row, e->dither_row_len));
+    }
 
-    int raster_index = 0;
-    for (int y = frame_top; y < frame_top + frame_height; y++) {
-        uint8_t* src = frame->data + y * frame->step + (frame_left * 4);
-        for (int x = frame_left; x < frame_left + frame_width; x++) {
-            uint32_t B = *src++;
-            uint32_t G = *src++;
-            uint32_t R = *src++;
-            uint32_t A = *src++;
-
-            // TODO come up with what this threshold value should be
-            // probably ought to be a lot smaller, but greater than 0
-            // for now we just pick halfway
-            if (A < 128 && have_transparency) {
-                // this composite frame pixel is actually transparent
-                // what this means is that the background color must be transparent
-                // AND this frame pixel must be transparent
-                // for now we'll just assume bg is transparent since otherwise decoder
-                // could not have generated this frame pixel with a low opacity
-                *raster_out++ = transparency_index;
-                continue;
-            }
+    int32_t* err_cur = NULL;
+    int32_t* err_next = NULL;
+    if (e->dither_mode == GIF_DITHER_FLOYD_STEINBERG) {
+        size_t err_row_len = (frame_width + 2) * 3;
+        if (2 * err_row_len > e->dither_error_len) {
+            e->dither_error_len = 2 * err_row_len;
+            e->dither_error =
+              (int32_t*)(realloc(e->dither_error, e->dither_error_len * sizeof(int32_t)));
+        }
+        err_cur = e->dither_error;
+        err_next = e->dither_error + err_row_len;
+        memset(err_next, 0, err_row_len * sizeof(int32_t));
+    }
 
-            uint32_t crushed = ((R >> 3) << 10) | ((G >> 3) << 5) | ((B >> 3));
-            int least_dist = INT_MAX;
-            int best_color = 0;
-            if (!(e->palette_lookup[crushed].present)) {
-                bool is_extreme_color =
-                  (R > 240 && G > 240 && B > 240) || (R < 15 && G < 15 && B < 15);
-
-                // calculate the best palette entry based on the midpoint of the crushed colors.
-                // what this means is that we drop the crushed bits (& 0xf8)
-                // and then OR the highest-order crushed bit back in, which is approx midpoint.
-                // for extreme colors, use actual values
-                uint32_t R_compare = is_extreme_color ? R : (R & 0xf8) | 4;
-                uint32_t G_compare = is_extreme_color ? G : (G & 0xf8) | 4;
-                uint32_t B_compare = is_extreme_color ? B : (B & 0xf8) | 4;
-
-                // we're calculating the best, so keep track of which
-                // palette entry has least distance
-                int count = color_map->ColorCount;
-                for (int i = 0; i < count; i++) {
-                    if (i == transparency_index) {
-                        // this index doesn't point to an actual color
-                        continue;
-                    }
-                    int dist = rgb_distance(R_compare,
-                                            G_compare,
-                                            B_compare,
-                                            color_map->Colors[i].Red,
-                                            color_map->Colors[i].Green,
-                                            color_map->Colors[i].Blue);
-                    if (dist < least_dist) {
-                        least_dist = dist;
-                        best_color = i;
-                    }
-                }
-                e->palette_lookup[crushed].present = 1;
-                e->palette_lookup[crushed].index = best_color;
-            }
-            else {
-                best_color = e->palette_lookup[crushed].index;
-                least_dist = rgb_distance(R,
-                                          G,
-                                          B,
-                                          color_map->Colors[best_color].Red,
-                                          color_map->Colors[best_color].Green,
-                                          color_map->Colors[best_color].Blue);
-            }
+    for (int y = frame_top; y < frame_top + frame_height; y++) {
+        const uint8_t* src = frame->data + y * frame->step + (frame_left * 4);
+        GifByteType* row_out = e->pixels + (y - frame_top) * frame_width;
+
+        if (e->dither_mode == GIF_DITHER_FLOYD_STEINBERG) {
+            // last row's "next" becomes this row's "current"
+            std::swap(err_cur, err_next);
+            memset(err_next, 0, (frame_width + 2) * 3 * sizeof(int32_t));
+            giflib_encoder_dither_fs_row(e,
+                                         color_map,
+                                         transparency_index,
+                                         prev_frame_valid,
+                                         src,
+                                         row_out,
+                                         err_cur,
+                                         err_next,
+                                         frame_left,
+                                         y,
+                                         frame_width);
+            continue;
+        }
 
-            // now that we for sure know which palette entry to pick, we have one more test
-            // to perform. it's possible that the best color for this pixel is actually
-            // the color of this pixel in the previous frame. if that's true, we'll just
-            // choose the transparency color, which will compress better on average
-            // (plus it improves color range of image)
-            if (prev_frame_valid && have_transparency) {
-                ptrdiff_t frame_index = 4 * ((y * e->gif->SWidth) + x);
-                uint32_t last_B = e->prev_frame_bgra[frame_index];
-                uint32_t last_G = e->prev_frame_bgra[frame_index + 1];
-                uint32_t last_R = e->prev_frame_bgra[frame_index + 2];
-                int dist = rgb_distance(R, G, B, last_R, last_G, last_B);
-                if (dist < least_dist) {
-                    least_dist = dist;
-                    best_color = transparency_index;
-                }
-            }
+        const uint8_t* lookup = src;
+        if (e->dither_mode == GIF_DITHER_ORDERED) {
+            giflib_dither_ordered_row(src, e->dither_row, frame_left, frame_width, y);
+            lookup = e->dither_row;
+        }
 
-            *raster_out++ = best_color;
+        for (int i = 0; i < frame_width; i++) {
+            ptrdiff_t prev_frame_index = 4 * ((y * e->gif->SWidth) + frame_left + i);
+            row_out[i] = giflib_encoder_map_pixel(e,
+                                                  color_map,
+                                                  transparency_index,
+                                                  prev_frame_valid,
+                                                  prev_frame_index,
+                                                  lookup[i * 4 + 2],
+                                                  lookup[i * 4 + 1],
+                                                  lookup[i * 4],
+                                                  src[i * 4 + 3],
+                                                  src[i * 4 + 2],
+                                                  src[i * 4 + 1],
+                                                  src[i * 4]);
         }
     }
 
@@ -1118,6 +1461,11 @@ static int giflib_encoder_write_extensions(giflib_encoder e)
                     return false;
                 }
             }
+            if (ep->Function == GRAPHICS_EXT_FUNC_CODE && ep->ByteCount >= 4) {
+                // the block is written as its length byte, then the packed
+                // flags, then the little-endian delay
+                e->prev_frame_delay_offset = e->dst_offset + 2;
+            }
             if (EGifPutExtensionBlock(e->gif, ep->ByteCount, ep->Bytes) == GIF_ERROR) {
                 return false;
             }
@@ -1133,59 +1481,333 @@ static int giflib_encoder_write_extensions(giflib_encoder e)
     return true;
 }
 
-bool giflib_encoder_encode_frame(giflib_encoder e,
-                                 const giflib_decoder d,
-                                 const opencv_mat opaque_frame)
+// write len bytes straight into dst, failing if they would not fit. this is
+// what encode_func does for giflib, minus the trip through its buffering
+static bool giflib_encoder_write(giflib_encoder e, const void* buf, size_t len)
 {
-    giflib_encoder_setup_frame(e, d);
-    giflib_encoder_render_frame(e, d, opaque_frame);
+    if (e->dst_offset + len > e->dst_len) {
+        return false;
+    }
+    memcpy(e->dst + e->dst_offset, buf, len);
+    e->dst_offset += len;
+    return true;
+}
 
-    GifImageDesc* im_out = &e->gif->Image;
-    int frame_height = im_out->Height;
+// write the image descriptor and local color map for the current frame. this
+// matches EGifPutImageDesc byte for byte; we write it ourselves because that
+// call also primes giflib's compressor, which we no longer use
+static bool giflib_encoder_write_image_desc(giflib_encoder e)
+{
+    const GifImageDesc* im_out = &e->gif->Image;
+    const ColorMapObject* color_map = e->frame_color_map;
+
+    if (!color_map && !e->gif->SColorMap) {
+        fprintf(stderr, "encountered error, gif frame has no color map\n");
+        return false;
+    }
+
+    uint8_t desc[10];
+    desc[0] = ',';
+    desc[1] = im_out->Left & 0xff;
+    desc[2] = (im_out->Left >> 8) & 0xff;
+    desc[3] = im_out->Top & 0xff;
+    desc[4] = (im_out->Top >> 8) & 0xff;
+    desc[5] = im_out->Width & 0xff;
+    desc[6] = (im_out->Width >> 8) & 0xff;
+    desc[7] = im_out->Height & 0xff;
+    desc[8] = (im_out->Height >> 8) & 0xff;
+    desc[9] = (color_map ? 0x80 : 0x00) | (im_out->Interlace ? 0x40 : 0x00) |
+      (color_map ? color_map->BitsPerPixel - 1 : 0);
+    if (!giflib_encoder_write(e, desc, sizeof(desc))) {
+        return false;
+    }
+
+    if (color_map) {
+        for (int i = 0; i < color_map->ColorCount; i++) {
+            uint8_t rgb[3] = {
+              color_map->Colors[i].Red, color_map->Colors[i].Green, color_map->Colors[i].Blue};
+            if (!giflib_encoder_write(e, rgb, sizeof(rgb))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// lzw dictionary parameters. codes are at most 12 bits, and giflib emits a
+// clear code rather than assigning code 4095, so we do the same to stay
+// byte-compatible with its output
+constexpr int LZW_MAX_CODE = 4095;
+constexpr int LZW_HASH_BITS = 14;
+constexpr uint32_t LZW_HASH_SIZE = 1 << LZW_HASH_BITS;
+constexpr uint32_t LZW_EMPTY = 0xffffffff;
+
+static inline uint32_t lzw_hash(uint32_t key)
+{
+    return (key * 0x9e3779b1u) >> (32 - LZW_HASH_BITS);
+}
+
+// bit packer that writes straight into dst, framing the output into the
+// 255-byte sub-blocks gif requires as it goes. codes are accumulated into a
+// 64-bit word and flushed 32 bits at a time
+typedef struct {
+    uint8_t* out;
+    uint8_t* end;
+    uint8_t* block_len;
+    int block_fill;
+    uint64_t acc;
+    int acc_bits;
+    bool overflow;
+} lzw_writer;
+
+static inline void lzw_put_byte(lzw_writer* w, uint8_t b)
+{
+    if (w->block_fill == 255) {
+        if (w->out >= w->end) {
+            w->overflow = true;
+            return;
+        }
+        *w->block_len = 255;
+        w->block_len = w->out++;
+        w->block_fill = 0;
+    }
+    if (w->out >= w->end) {
+        w->overflow = true;
+        return;
+    }
+    *w->out++ = b;
+    w->block_fill++;
+}
+
+static inline void lzw_put_code(lzw_writer* w, uint32_t code, int bits)
+{
+    w->acc |= (uint64_t)(code) << w->acc_bits;
+    w->acc_bits += bits;
+    if (w->acc_bits < 32) {
+        return;
+    }
+
+    uint32_t word = (uint32_t)(w->acc);
+    w->acc >>= 32;
+    w->acc_bits -= 32;
+    if (w->block_fill + 4 <= 255 && w->end - w->out >= 4) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap32(word);
+#endif
+        memcpy(w->out, &word, 4);
+        w->out += 4;
+        w->block_fill += 4;
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        lzw_put_byte(w, (word >> (8 * i)) & 0xff);
+    }
+}
+
+// lzw-compress the current frame's palette indices into dst. the code
+// sequence, code widths and clear points mirror giflib's EGifCompressLine,
+// so the result is identical to what EGifPutLine would have produced, but
+// we probe a larger table and skip the per-byte output callback
+static bool giflib_encoder_compress_frame(giflib_encoder e)
+{
+    const GifImageDesc* im_out = &e->gif->Image;
     int frame_width = im_out->Width;
+    int frame_height = im_out->Height;
 
-    int res = giflib_encoder_write_extensions(e);
-    if (res == GIF_ERROR) {
+    if (!e->lzw_table) {
+        e->lzw_table = (uint32_t*)(malloc(LZW_HASH_SIZE * sizeof(uint32_t)));
+        e->lzw_slot_of = (uint16_t*)(malloc((LZW_MAX_CODE + 1) * sizeof(uint16_t)));
+        if (!e->lzw_table || !e->lzw_slot_of) {
+            return false;
+        }
+        memset(e->lzw_table, 0xff, LZW_HASH_SIZE * sizeof(uint32_t));
+    }
+    uint32_t* table = e->lzw_table;
+    uint16_t* slot_of = e->lzw_slot_of;
+
+    // same minimum code size giflib derives in EGifSetupCompress
+    int bits_per_pixel = e->frame_color_map ? GifBitSize(e->frame_color_map->ColorCount)
+                                            : e->gif->SColorMap->BitsPerPixel;
+    if (bits_per_pixel < 2) {
+        bits_per_pixel = 2;
+    }
+
+    uint8_t code_size = bits_per_pixel;
+    if (!giflib_encoder_write(e, &code_size, 1)) {
         return false;
     }
 
-    res = EGifPutImageDesc(e->gif,
-                           im_out->Left,
-                           im_out->Top,
-                           im_out->Width,
-                           im_out->Height,
-                           im_out->Interlace,
-                           e->frame_color_map);
-    if (res == GIF_ERROR) {
+    lzw_writer w;
+    w.out = e->dst + e->dst_offset;
+    w.end = e->dst + e->dst_len;
+    w.acc = 0;
+    w.acc_bits = 0;
+    w.overflow = false;
+    if (w.out >= w.end) {
         return false;
     }
+    w.block_len = w.out++;
+    w.block_fill = 0;
+
+    const int clear_code = 1 << bits_per_pixel;
+    const int eof_code = clear_code + 1;
+    int running_code = eof_code + 1;
+    int running_bits = bits_per_pixel + 1;
+    int max_code1 = 1 << running_bits;
+
+    auto emit = [&](int code) {
+        lzw_put_code(&w, code, running_bits);
+        if (running_code >= max_code1 && code <= LZW_MAX_CODE) {
+            max_code1 = 1 << ++running_bits;
+        }
+    };
+
+    auto reset_table = [&]() {
+        for (int code = eof_code + 1; code < running_code; code++) {
+            table[slot_of[code]] = LZW_EMPTY;
+        }
+    };
+
+    emit(clear_code);
+
+    int crnt_code = -1;
+    auto compress_line = [&](const GifByteType* line) {
+        int i = 0;
+        if (crnt_code < 0) {
+            crnt_code = line[i++];
+        }
+        for (; i < frame_width; i++) {
+            uint32_t pixel = line[i];
+            uint32_t key = ((uint32_t)(crnt_code) << 8) | pixel;
+            uint32_t slot = lzw_hash(key);
+            uint32_t entry;
+            while ((entry = table[slot]) != LZW_EMPTY && (entry >> 12) != key) {
+                slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+            }
+            if (entry != LZW_EMPTY) {
+                crnt_code = entry & 0xfff;
+                continue;
+            }
+
+            emit(crnt_code);
+            crnt_code = pixel;
+
+            if (running_code >= LZW_MAX_CODE) {
+                emit(clear_code);
+                reset_table();
+                running_code = eof_code + 1;
+                running_bits = bits_per_pixel + 1;
+                max_code1 = 1 << running_bits;
+            }
+            else {
+                table[slot] = (key << 12) | running_code;
+                slot_of[running_code] = slot;
+                running_code++;
+            }
+        }
+    };
 
     if (im_out->Interlace) {
-        /* Need to perform 4 passes on the images: */
         for (int i = 0; i < 4; i++) {
             for (int j = interlace_offset[i]; j < frame_height; j += interlace_jumps[i]) {
-                res = EGifPutLine(e->gif, e->pixels + j * frame_width, frame_width);
-                if (res == GIF_ERROR) {
-                    fprintf(stderr, "encountered error, could not serialize gif line\n");
-                    return false;
-                }
+                compress_line(e->pixels + j * frame_width);
             }
         }
     }
     else {
-        for (int i = 0; i < frame_height; i++) {
-            res = EGifPutLine(e->gif, e->pixels + i * frame_width, frame_width);
-            if (res == GIF_ERROR) {
-                return false;
+        for (int j = 0; j < frame_height; j++) {
+            compress_line(e->pixels + j * frame_width);
+        }
+    }
+
+    emit(crnt_code);
+    emit(eof_code);
+    reset_table();
+
+    // drain whatever is left in the accumulator and close the last sub-block,
+    // followed by the zero-length block that terminates the image data
+    while (w.acc_bits > 0) {
+        lzw_put_byte(&w, w.acc & 0xff);
+        w.acc >>= 8;
+        w.acc_bits -= 8;
+    }
+    *w.block_len = w.block_fill;
+    if (w.out >= w.end) {
+        w.overflow = true;
+    }
+    else {
+        *w.out++ = 0;
+    }
+
+    if (w.overflow) {
+        return false;
+    }
+
+    e->dst_offset = w.out - e->dst;
+    return true;
+}
+
+bool giflib_encoder_encode_frame(giflib_encoder e,
+                                 const giflib_decoder d,
+                                 const opencv_mat opaque_frame,
+                                 const int* opt,
+                                 size_t opt_len)
+{
+    for (size_t i = 0; i + 1 < opt_len; i += 2) {
+        if (opt[i] == GIF_DITHER) {
+            switch (opt[i + 1]) {
+            case GIF_DITHER_ORDERED:
+            case GIF_DITHER_FLOYD_STEINBERG:
+                e->dither_mode = opt[i + 1];
+                break;
+            default:
+                e->dither_mode = GIF_DITHER_NONE;
+                break;
             }
         }
     }
 
+    giflib_encoder_setup_frame(e, d);
+    giflib_encoder_render_frame(e, d, opaque_frame);
+
+    e->prev_frame_delay_offset = -1;
+    int res = giflib_encoder_write_extensions(e);
+    if (res == GIF_ERROR) {
+        return false;
+    }
+
+    if (!giflib_encoder_write_image_desc(e)) {
+        return false;
+    }
+
+    if (!giflib_encoder_compress_frame(e)) {
+        fprintf(stderr, "encountered error, could not serialize gif frame\n");
+        return false;
+    }
+
     e->have_written_first_frame = true;
 
     return true;
 }
 
+bool giflib_encoder_extend_prev_frame_delay(giflib_encoder e, int delay_cs)
+{
+    if (!e->have_written_first_frame || e->prev_frame_delay_offset < 0 || delay_cs < 0) {
+        return false;
+    }
+
+    uint8_t* delay = e->dst + e->prev_frame_delay_offset;
+    int extended = (delay[0] | (delay[1] << 8)) + delay_cs;
+    if (extended > 0xffff) {
+        return false;
+    }
+
+    delay[0] = extended & 0xff;
+    delay[1] = (extended >> 8) & 0xff;
+    return true;
+}
+
 bool giflib_encoder_flush(giflib_encoder e, const giflib_decoder d)
 {
     // XXX we need to pull these trailing blocks on d
@@ -1237,55 +1859,33 @@ void giflib_encoder_release(giflib_encoder e)
         free(e->pixels);
     }
 
-    for (std::vector<ExtensionBlock*>::iterator it = e->extension_blocks.begin();
-         it != e->extension_blocks.end();
-         ++it) {
-        free(*it);
+    if (e->dither_row) {
+        free(e->dither_row);
+    }
+
+    if (e->dither_error) {
+        free(e->dither_error);
     }
-    e->extension_blocks.clear();
 
-    for (std::vector<GifByteType*>::iterator it = e->gif_bytes.begin(); it != e->gif_bytes.end();
-         ++it) {
-        free(*it);
+    if (e->lzw_table) {
+        free(e->lzw_table);
+    }
+
+    if (e->lzw_slot_of) {
+        free(e->lzw_slot_of);
     }
-    e->gif_bytes.clear();
 
-    ColorMapObject* gif_scolor = NULL;
-    ColorMapObject* gif_last_color = NULL;
     if (e->gif) {
-        gif_scolor = e->gif->SColorMap;
-        gif_last_color = e->gif->Image.ColorMap;
-    }
-    for (std::vector<ColorMapObject*>::iterator it = e->color_maps.begin();
-         it != e->color_maps.end();
-         ++it) {
-        if (gif_scolor && gif_scolor == *it) {
-            // this is extremely unlikely to happen, but giflib transitions from
-            // borrowing this ptr to owning it, and it's possible that it will try
-            // to free ours in certain circumstances
-            // so swap its ptr if it matches one we own
+        // giflib transitions from borrowing the color maps we hand it to owning
+        // them, and it's possible that it will try to free ours in certain
+        // circumstances. so drop its ptrs if they point into our arena
+        if (e->gif->SColorMap && giflib_arena_owns(e->arena, e->gif->SColorMap)) {
             e->gif->SColorMap = NULL;
         }
-        if (gif_last_color && gif_last_color == *it) {
-            // this seemingly will never happen, but given how strange last case is,
-            // check for it anyway
+        if (e->gif->Image.ColorMap && giflib_arena_owns(e->arena, e->gif->Image.ColorMap)) {
             e->gif->Image.ColorMap = NULL;
         }
-        free(*it);
-    }
-    e->color_maps.clear();
-
-    for (std::vector<GifColorType*>::iterator it = e->colors.begin(); it != e->colors.end(); ++it) {
-        free(*it);
-    }
-    e->colors.clear();
-
-    for (std::vector<SavedImage*>::iterator it = e->saved_images.begin();
-         it != e->saved_images.end();
-         ++it) {
-        free(*it);
     }
-    e->saved_images.clear();
 
     if (e->gif) {
         // we most likely won't actually call this since Spew() does it
@@ -1297,6 +1897,13 @@ void giflib_encoder_release(giflib_encoder e)
         }
     }
 
+    if (e->owns_arena) {
+        giflib_arena_release(e->arena);
+    }
+    else {
+        giflib_arena_reset(e->arena);
+    }
+
     delete e;
 }
 
@@ -36,6 +36,13 @@ type gifEncoder struct {
 	hasFlushed bool
 }
 
+// gifEncoderArena is scratch memory for the per-frame metadata a GIF encoder
+// allocates. Lending one to successive encoders, as ImageOps does, lets long
+// animations be re-encoded without a malloc/free per frame.
+type gifEncoderArena struct {
+	arena C.giflib_arena
+}
+
 const defaultMaxFrameDimension = 10000
 
 var (
@@ -233,9 +240,18 @@ func (d *gifDecoder) SkipFrame() error {
 	return nil
 }
 
+func newGifEncoderArena() *gifEncoderArena {
+	return &gifEncoderArena{arena: C.giflib_arena_create()}
+}
+
+// Close releases the arena. No encoder may still be using it.
+func (a *gifEncoderArena) Close() {
+	C.giflib_arena_release(a.arena)
+}
+
 // newGifEncoder creates a new GIF encoder that will write to the provided buffer.
 // Requires the original decoder that was used to decode the source GIF.
-// config is accepted for API uniformity but not used by GIF encoder.
+// config may carry an arena to allocate from; otherwise the encoder uses its own.
 func newGifEncoder(decodedBy Decoder, buf []byte, config *EncodeConfig) (*gifEncoder, error) {
 	// we must have a decoder since we can't build our own palettes
 	// so if we don't get a gif decoder, bail out
@@ -248,8 +264,13 @@ func newGifEncoder(decodedBy Decoder, buf []byte, config *EncodeConfig) (*gifEnc
 		return nil, ErrGifEncoderNeedsDecoder
 	}
 
+	var arena C.giflib_arena
+	if config != nil && config.gifArena != nil {
+		arena = config.gifArena.arena
+	}
+
 	buf = buf[:1]
-	enc := C.giflib_encoder_create(unsafe.Pointer(&buf[0]), C.size_t(cap(buf)))
+	enc := C.giflib_encoder_create(unsafe.Pointer(&buf[0]), C.size_t(cap(buf)), arena)
 	if enc == nil {
 		return nil, ErrBufTooSmall
 	}
@@ -287,7 +308,17 @@ func (e *gifEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
 		C.giflib_encoder_init(e.encoder, e.decoder, C.int(f.Width()), C.int(f.Height()))
 	}
 
-	if !C.giflib_encoder_encode_frame(e.encoder, e.decoder, f.mat) {
+	var optList []C.int
+	var firstOpt *C.int
+	for k, v := range opt {
+		optList = append(optList, C.int(k))
+		optList = append(optList, C.int(v))
+	}
+	if len(optList) > 0 {
+		firstOpt = (*C.int)(unsafe.Pointer(&optList[0]))
+	}
+
+	if !C.giflib_encoder_encode_frame(e.encoder, e.decoder, f.mat, firstOpt, C.size_t(len(optList))) {
 		return nil, ErrInvalidImage
 	}
 
@@ -296,6 +327,16 @@ func (e *gifEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
 	return nil, nil
 }
 
+// extendLastFrame lengthens the most recently encoded frame by d, rounded to
+// the GIF delay resolution of 10ms.
+func (e *gifEncoder) extendLastFrame(d time.Duration) bool {
+	if e.hasFlushed {
+		return false
+	}
+	delayCs := (d.Milliseconds() + 5) / 10
+	return bool(C.giflib_encoder_extend_prev_frame_delay(e.encoder, C.int(delayCs)))
+}
+
 // Close releases resources associated with the encoder.
 func (e *gifEncoder) Close() {
 	C.giflib_encoder_release(e.encoder)
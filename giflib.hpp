@@ -21,8 +21,19 @@ struct GifAnimationInfo {
 #define GIF_DISPOSE_BACKGROUND 1
 #define GIF_DISPOSE_PREVIOUS 2
 
+enum GifEncoderOptions { GIF_DITHER = 3000 };
+
+// Palette mapping strategies for GIF_DITHER. Ordered dithering is anchored to
+// canvas coordinates so static regions dither identically on every frame.
+enum GifDitherMode {
+    GIF_DITHER_NONE = 0,
+    GIF_DITHER_ORDERED = 1,
+    GIF_DITHER_FLOYD_STEINBERG = 2,
+};
+
 typedef struct giflib_decoder_struct* giflib_decoder;
 typedef struct giflib_encoder_struct* giflib_encoder;
+typedef struct giflib_arena_struct* giflib_arena;
 
 typedef enum {
     giflib_decoder_have_next_frame,
@@ -42,9 +53,21 @@ giflib_decoder_frame_state giflib_decoder_decode_frame_header(giflib_decoder d);
 bool giflib_decoder_decode_frame(giflib_decoder d, opencv_mat mat);
 giflib_decoder_frame_state giflib_decoder_skip_frame(giflib_decoder d);
 
-giflib_encoder giflib_encoder_create(void* buf, size_t buf_len);
+giflib_arena giflib_arena_create();
+void giflib_arena_release(giflib_arena a);
+
+// arena may be NULL, in which case the encoder allocates a private one. a
+// non-NULL arena must outlive the encoder and serve one encoder at a time
+giflib_encoder giflib_encoder_create(void* buf, size_t buf_len, giflib_arena arena);
 bool giflib_encoder_init(giflib_encoder e, const giflib_decoder d, int width, int height);
-bool giflib_encoder_encode_frame(giflib_encoder e, const giflib_decoder d, const opencv_mat frame);
+bool giflib_encoder_encode_frame(giflib_encoder e,
+                                 const giflib_decoder d,
+                                 const opencv_mat frame,
+                                 const int* opt,
+                                 size_t opt_len);
+// lengthen the most recently encoded frame by delay_cs hundredths of a second.
+// returns false if there is no such frame or it carries no delay to extend
+bool giflib_encoder_extend_prev_frame_delay(giflib_encoder e, int delay_cs);
 bool giflib_encoder_flush(giflib_encoder e, const giflib_decoder d);
 void giflib_encoder_release(giflib_encoder e);
 int giflib_encoder_get_output_length(giflib_encoder e);
@@ -0,0 +1,72 @@
+package lilliput
+
+import (
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+	"time"
+)
+
+func benchmarkGifDither(b *testing.B, path string, mode int) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		b.Fatalf("read %s: %v", path, err)
+	}
+
+	ops := NewImageOps(8192)
+	defer ops.Close()
+	dst := make([]byte, destinationBufferSize)
+
+	b.SetBytes(int64(len(data)))
+	b.ResetTimer()
+	var lastSize int64
+	for i := 0; i < b.N; i++ {
+		dec, err := NewDecoder(data)
+		if err != nil {
+			b.Fatalf("decoder: %v", err)
+		}
+		hdr, err := dec.Header()
+		if err != nil {
+			b.Fatalf("header: %v", err)
+		}
+		out, err := ops.Transform(dec, &ImageOptions{
+			FileType:      ".gif",
+			Width:         hdr.Width() / 2,
+			Height:        hdr.Height() / 2,
+			ResizeMethod:  ImageOpsResize,
+			EncodeOptions: map[int]int{GifDither: mode},
+			EncodeTimeout: time.Minute,
+		}, dst)
+		if err != nil {
+			b.Fatalf("transform: %v", err)
+		}
+		lastSize = int64(len(out))
+		dec.Close()
+	}
+	b.ReportMetric(float64(lastSize), "out_bytes/op")
+}
+
+func BenchmarkGIFDither(b *testing.B) {
+	files, err := filepath.Glob("testdata/*.gif")
+	if err != nil {
+		b.Fatalf("glob: %v", err)
+	}
+	modes := []struct {
+		name string
+		mode int
+	}{
+		{"none", GifDitherNone},
+		{"ordered", GifDitherOrdered},
+		{"floyd_steinberg", GifDitherFloydSteinberg},
+	}
+	for _, file := range files {
+		name := strings.TrimSuffix(filepath.Base(file), ".gif")
+		for _, m := range modes {
+			file, m := file, m
+			b.Run(name+"_"+m.name, func(b *testing.B) {
+				benchmarkGifDither(b, file, m.mode)
+			})
+		}
+	}
+}
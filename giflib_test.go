@@ -13,6 +13,170 @@ func TestGIFOperations(t *testing.T) {
 	t.Run("GIFDuration", testGIFDuration)
 	t.Run("GIFDisposalMethods", testGIFDisposalMethods)
 	t.Run("GIFNoGCEFirstFrame", testGIFNoGCEFirstFrame)
+	t.Run("GIFDitherModes", testGIFDitherModes)
+	t.Run("GIFEncoderArenaReuse", testGIFEncoderArenaReuse)
+	t.Run("GIFFoldUnchangedFrames", testGIFFoldUnchangedFrames)
+	t.Run("GIFMaxFrameRate", testGIFMaxFrameRate)
+}
+
+// Successive GIF transforms on one ImageOps share its encoder arena; reusing
+// that memory must not change the output.
+func testGIFEncoderArenaReuse(t *testing.T) {
+	ops := NewImageOps(8192)
+	defer ops.Close()
+
+	var first []byte
+	for i, file := range []string{
+		"testdata/party-discord.gif",
+		"testdata/restore_previous.gif",
+		"testdata/party-discord.gif",
+	} {
+		buf, err := os.ReadFile(file)
+		if err != nil {
+			t.Fatalf("read fixture: %v", err)
+		}
+		dec, err := NewDecoder(buf)
+		if err != nil {
+			t.Fatalf("new decoder: %v", err)
+		}
+		hdr, err := dec.Header()
+		if err != nil {
+			t.Fatalf("header: %v", err)
+		}
+		out, err := ops.Transform(dec, &ImageOptions{
+			FileType:      ".gif",
+			Width:         hdr.Width(),
+			Height:        hdr.Height(),
+			ResizeMethod:  ImageOpsNoResize,
+			EncodeTimeout: 30 * time.Second,
+		}, make([]byte, 10*1024*1024))
+		dec.Close()
+		if err != nil {
+			t.Fatalf("transform %s: %v", file, err)
+		}
+		if _, err := gif.DecodeAll(bytes.NewReader(out)); err != nil {
+			t.Fatalf("decode output gif: %v", err)
+		}
+		switch i {
+		case 0:
+			first = out
+		case 2:
+			if !bytes.Equal(out, first) {
+				t.Error("re-encoding with a reused arena changed the output")
+			}
+		}
+	}
+}
+
+// no-loop.gif repeats one frame verbatim; the transform should drop the repeat
+// and carry its delay on the frame before it.
+func testGIFFoldUnchangedFrames(t *testing.T) {
+	buf, err := os.ReadFile("testdata/no-loop.gif")
+	if err != nil {
+		t.Fatalf("read fixture: %v", err)
+	}
+	in, err := gif.DecodeAll(bytes.NewReader(buf))
+	if err != nil {
+		t.Fatalf("decode input gif: %v", err)
+	}
+
+	dec, err := NewDecoder(buf)
+	if err != nil {
+		t.Fatalf("new decoder: %v", err)
+	}
+	defer dec.Close()
+	hdr, err := dec.Header()
+	if err != nil {
+		t.Fatalf("header: %v", err)
+	}
+
+	ops := NewImageOps(8192)
+	defer ops.Close()
+	out, err := ops.Transform(dec, &ImageOptions{
+		FileType:      ".gif",
+		Width:         hdr.Width(),
+		Height:        hdr.Height(),
+		ResizeMethod:  ImageOpsNoResize,
+		EncodeTimeout: 30 * time.Second,
+	}, make([]byte, 10*1024*1024))
+	if err != nil {
+		t.Fatalf("transform: %v", err)
+	}
+	got, err := gif.DecodeAll(bytes.NewReader(out))
+	if err != nil {
+		t.Fatalf("decode output gif: %v", err)
+	}
+
+	if len(got.Image) >= len(in.Image) {
+		t.Errorf("frame count = %d, want fewer than %d", len(got.Image), len(in.Image))
+	}
+	sum := func(delays []int) (total int) {
+		for _, d := range delays {
+			total += d
+		}
+		return total
+	}
+	if sum(got.Delay) != sum(in.Delay) {
+		t.Errorf("total delay = %d, want %d", sum(got.Delay), sum(in.Delay))
+	}
+}
+
+// party-discord.gif runs at 3cs per frame; capped at 10fps, every output frame
+// but the last should last at least 10cs and the total should be unchanged.
+func testGIFMaxFrameRate(t *testing.T) {
+	buf, err := os.ReadFile("testdata/party-discord.gif")
+	if err != nil {
+		t.Fatalf("read fixture: %v", err)
+	}
+	in, err := gif.DecodeAll(bytes.NewReader(buf))
+	if err != nil {
+		t.Fatalf("decode input gif: %v", err)
+	}
+
+	dec, err := NewDecoder(buf)
+	if err != nil {
+		t.Fatalf("new decoder: %v", err)
+	}
+	defer dec.Close()
+	hdr, err := dec.Header()
+	if err != nil {
+		t.Fatalf("header: %v", err)
+	}
+
+	ops := NewImageOps(8192)
+	defer ops.Close()
+	out, err := ops.Transform(dec, &ImageOptions{
+		FileType:      ".gif",
+		Width:         hdr.Width() / 2,
+		Height:        hdr.Height() / 2,
+		ResizeMethod:  ImageOpsResize,
+		MaxFrameRate:  10,
+		EncodeTimeout: 30 * time.Second,
+	}, make([]byte, 10*1024*1024))
+	if err != nil {
+		t.Fatalf("transform: %v", err)
+	}
+	got, err := gif.DecodeAll(bytes.NewReader(out))
+	if err != nil {
+		t.Fatalf("decode output gif: %v", err)
+	}
+
+	if len(got.Image) >= len(in.Image) {
+		t.Errorf("frame count = %d, want fewer than %d", len(got.Image), len(in.Image))
+	}
+	total, wantTotal := 0, 0
+	for i, d := range got.Delay {
+		if i < len(got.Delay)-1 && d < 10 {
+			t.Errorf("frame %d delay = %dcs, want at least 10cs", i, d)
+		}
+		total += d
+	}
+	for _, d := range in.Delay {
+		wantTotal += d
+	}
+	if total != wantTotal {
+		t.Errorf("total delay = %d, want %d", total, wantTotal)
+	}
 }
 
 // A first frame with no Graphic Control Extension declares no transparent
@@ -66,6 +230,72 @@ func testGIFNoGCEFirstFrame(t *testing.T) {
 	}
 }
 
+// Every dither mode must produce a valid GIF with the same frame count and
+// dimensions when resizing, where quantization error is actually introduced.
+func testGIFDitherModes(t *testing.T) {
+	modes := []struct {
+		name string
+		mode int
+	}{
+		{"None", GifDitherNone},
+		{"Ordered", GifDitherOrdered},
+		{"FloydSteinberg", GifDitherFloydSteinberg},
+	}
+
+	for _, file := range []string{"testdata/ferry_sunset.gif", "testdata/party-discord.gif"} {
+		buf, err := os.ReadFile(file)
+		if err != nil {
+			t.Fatalf("read fixture: %v", err)
+		}
+		want, err := gif.DecodeAll(bytes.NewReader(buf))
+		if err != nil {
+			t.Fatalf("decode fixture: %v", err)
+		}
+
+		for _, m := range modes {
+			t.Run(file+"/"+m.name, func(t *testing.T) {
+				dec, err := NewDecoder(buf)
+				if err != nil {
+					t.Fatalf("new decoder: %v", err)
+				}
+				defer dec.Close()
+
+				hdr, err := dec.Header()
+				if err != nil {
+					t.Fatalf("header: %v", err)
+				}
+
+				ops := NewImageOps(8192)
+				defer ops.Close()
+
+				out, err := ops.Transform(dec, &ImageOptions{
+					FileType:      ".gif",
+					Width:         hdr.Width() / 2,
+					Height:        hdr.Height() / 2,
+					ResizeMethod:  ImageOpsResize,
+					EncodeOptions: map[int]int{GifDither: m.mode},
+					EncodeTimeout: 30 * time.Second,
+				}, make([]byte, 10*1024*1024))
+				if err != nil {
+					t.Fatalf("transform: %v", err)
+				}
+
+				g, err := gif.DecodeAll(bytes.NewReader(out))
+				if err != nil {
+					t.Fatalf("decode output gif: %v", err)
+				}
+				if len(g.Image) != len(want.Image) {
+					t.Errorf("frame count = %d, want %d", len(g.Image), len(want.Image))
+				}
+				if g.Config.Width != hdr.Width()/2 || g.Config.Height != hdr.Height()/2 {
+					t.Errorf("dimensions = %dx%d, want %dx%d",
+						g.Config.Width, g.Config.Height, hdr.Width()/2, hdr.Height()/2)
+				}
+			})
+		}
+	}
+}
+
 func testGIFDisposalMethods(t *testing.T) {
 	// This test verifies that the disposal method of each frame is correctly identified
 	// Without checking the actual rendering of frames
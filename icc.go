@@ -0,0 +1,102 @@
+package lilliput
+
+import "C"
+
+import (
+	"bytes"
+	"sync"
+	"unsafe"
+)
+
+// ICC profiles handed out by Decoder.ICC are interned: every decoder that
+// finds a given profile returns the same immutable slice, so the handful of
+// profiles that most images carry (sRGB, Display-P3 and so on) are held once
+// rather than copied for every request. Canned profiles, which live in static
+// C data, are returned in place without being copied at all. The store holds
+// up to maxInternedICC profiles, forgetting the oldest beyond that; slices it
+// has handed out stay valid regardless.
+
+const maxInternedICC = 64
+
+var (
+	internedICCMutex sync.Mutex
+	internedICC      = make(map[uint64][]byte, maxInternedICC)
+	internedICCOrder []uint64
+
+	// iccScratch holds ICCProfileBufferSize buffers that JPEG and PNG
+	// profiles, which have to be reassembled or inflated, are read into
+	// before being interned
+	iccScratch = sync.Pool{
+		New: func() interface{} {
+			buf := make([]byte, ICCProfileBufferSize)
+			return &buf
+		},
+	}
+)
+
+// iccHash is FNV-1a, which only has to tell the interned profiles apart.
+func iccHash(icc []byte) uint64 {
+	h := uint64(0xcbf29ce484222325)
+	for _, b := range icc {
+		h = (h ^ uint64(b)) * 0x100000001b3
+	}
+	return h
+}
+
+// internICC returns the interned copy of icc, interning it first if need be.
+// icc itself is not retained, so it may be a view of C or scratch memory.
+// Profiles over ICCProfileBufferSize are dropped, as the decoders always have.
+func internICC(icc []byte) []byte {
+	if len(icc) == 0 || len(icc) > ICCProfileBufferSize {
+		return nil
+	}
+	h := iccHash(icc)
+
+	internedICCMutex.Lock()
+	defer internedICCMutex.Unlock()
+	if interned, ok := internedICC[h]; ok {
+		if bytes.Equal(interned, icc) {
+			return interned
+		}
+		// a collision, which is left to the profile already interned
+		return append([]byte(nil), icc...)
+	}
+
+	// capped at its length, so that a caller appending to it reallocates
+	// rather than writing past it into the copy everyone shares
+	interned := append([]byte(nil), icc...)
+	interned = interned[:len(interned):len(interned)]
+	if len(internedICCOrder) >= maxInternedICC {
+		delete(internedICC, internedICCOrder[0])
+		internedICCOrder = internedICCOrder[1:]
+	}
+	internedICC[h] = interned
+	internedICCOrder = append(internedICCOrder, h)
+	return interned
+}
+
+// cICC returns a view of the n bytes of C memory at p, without copying them.
+// The view is only valid for as long as that memory is.
+func cICC(p unsafe.Pointer, n C.size_t) []byte {
+	if p == nil || n == 0 {
+		return nil
+	}
+	return (*[1 << 30]byte)(p)[:n:n]
+}
+
+// internCICC interns the profile in the n bytes of C memory at p.
+func internCICC(p unsafe.Pointer, n C.size_t) []byte {
+	return internICC(cICC(p, n))
+}
+
+// readICC interns the profile that read writes into a scratch buffer of
+// ICCProfileBufferSize bytes, returning how many bytes it wrote.
+func readICC(read func(dst []byte) int) []byte {
+	scratch := iccScratch.Get().(*[]byte)
+	defer iccScratch.Put(scratch)
+	n := read(*scratch)
+	if n <= 0 {
+		return nil
+	}
+	return internICC((*scratch)[:n])
+}
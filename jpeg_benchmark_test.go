@@ -0,0 +1,126 @@
+package lilliput
+
+import (
+	"image"
+	"os"
+	"testing"
+)
+
+// BenchmarkJpegEncode compares the libjpeg-turbo JPEG encoder with the
+// OpenCV one it replaced, on 3 and 4-channel frames, and the encoder's own
+// options against its defaults.
+func BenchmarkJpegEncode(b *testing.B) {
+	data, err := os.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		b.Fatalf("read fixture: %v", err)
+	}
+	dec, err := NewDecoder(data)
+	if err != nil {
+		b.Fatalf("decoder: %v", err)
+	}
+	defer dec.Close()
+	bgr := NewFramebuffer(8192, 8192)
+	defer bgr.Close()
+	if err := dec.DecodeTo(bgr); err != nil {
+		b.Fatalf("decode: %v", err)
+	}
+	bgra := NewFramebuffer(8192, 8192)
+	defer bgra.Close()
+	if err := bgra.Create4Channel(bgr.Width(), bgr.Height()); err != nil {
+		b.Fatalf("create: %v", err)
+	}
+	if err := bgra.CopyToOffsetNoBlend(bgr, image.Rect(0, 0, bgr.Width(), bgr.Height())); err != nil {
+		b.Fatalf("copy: %v", err)
+	}
+
+	dst := make([]byte, 32*1024*1024)
+	quality := map[int]int{JpegQuality: 85}
+	for _, frame := range []struct {
+		name string
+		fb   *Framebuffer
+	}{{"bgr", bgr}, {"bgra", bgra}} {
+		frame := frame
+		b.Run(frame.name+"/opencv", func(b *testing.B) {
+			enc, err := newOpenCVEncoder(".jpeg", dec, dst, nil)
+			if err != nil {
+				b.Fatalf("encoder: %v", err)
+			}
+			defer enc.Close()
+			b.SetBytes(int64(frame.fb.Width() * frame.fb.Height() * 3))
+			for i := 0; i < b.N; i++ {
+				if _, err := enc.Encode(frame.fb, quality); err != nil {
+					b.Fatalf("encode: %v", err)
+				}
+			}
+		})
+		for _, variant := range []struct {
+			name string
+			opt  map[int]int
+		}{
+			{"turbo", quality},
+			{"turbo_ifast", map[int]int{JpegQuality: 85, JpegDCTMethod: JpegDCTIfast}},
+			{"turbo_444", map[int]int{JpegQuality: 85, JpegSubsampling: JpegSubsampling444}},
+			{"turbo_optimize", map[int]int{JpegQuality: 85, JpegOptimize: 1}},
+			{"turbo_progressive", map[int]int{JpegQuality: 85, JpegProgressive: 1}},
+		} {
+			variant := variant
+			b.Run(frame.name+"/"+variant.name, func(b *testing.B) {
+				enc, err := newJpegEncoder(dec, dst, nil)
+				if err != nil {
+					b.Fatalf("encoder: %v", err)
+				}
+				defer enc.Close()
+				b.SetBytes(int64(frame.fb.Width() * frame.fb.Height() * 3))
+				var n int
+				for i := 0; i < b.N; i++ {
+					out, err := enc.Encode(frame.fb, variant.opt)
+					if err != nil {
+						b.Fatalf("encode: %v", err)
+					}
+					n = len(out)
+				}
+				b.ReportMetric(float64(n), "bytes/op")
+			})
+		}
+	}
+}
+
+// BenchmarkJpegOrient normalizes the orientation of a JPEG with a transpose,
+// which its dimensions let be done losslessly, against a 90 degree rotation,
+// which they do not and so is decoded and re-encoded.
+func BenchmarkJpegOrient(b *testing.B) {
+	data, err := os.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		b.Fatalf("read fixture: %v", err)
+	}
+	ops := NewImageOps(8192)
+	defer ops.Close()
+	dst := make([]byte, 32*1024*1024)
+	opt := &ImageOptions{
+		FileType:             ".jpeg",
+		NormalizeOrientation: true,
+		EncodeOptions:        map[int]int{JpegQuality: 85},
+	}
+	for _, tc := range []struct {
+		name        string
+		orientation ImageOrientation
+	}{
+		{"transpose_lossless", OrientationLeftTop},
+		{"rotate_reencode", OrientationRightTop},
+	} {
+		src := withJpegOrientation(data, tc.orientation)
+		b.Run(tc.name, func(b *testing.B) {
+			b.SetBytes(int64(len(src)))
+			for i := 0; i < b.N; i++ {
+				dec, err := NewDecoder(src)
+				if err != nil {
+					b.Fatalf("decoder: %v", err)
+				}
+				if _, err := ops.Transform(dec, opt, dst); err != nil {
+					b.Fatalf("transform: %v", err)
+				}
+				dec.Close()
+			}
+		})
+	}
+}
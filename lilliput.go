@@ -74,7 +74,9 @@ type Decoder interface {
 	// BackgroundColor as BGRA
 	BackgroundColor() uint32
 
-	// ICC returns the ICC color profile, if any
+	// ICC returns the ICC color profile, if any. The slice is shared with
+	// every other decoder that found the same profile and must not be
+	// modified.
 	ICC() []byte
 
 	// LoopCount() returns the number of loops in the image
@@ -170,6 +172,14 @@ type EncodeConfig struct {
 	// ICCOverride overrides the decoder's ICC profile when set.
 	// Used for HDR→SDR conversion to force sRGB output.
 	ICCOverride []byte
+
+	// DropICC writes no ICC profile at all, for frames whose pixels have
+	// been converted to sRGB. It takes precedence over ICCOverride.
+	DropICC bool
+
+	// gifArena, when set, is lent to a GIF encoder for its per-frame
+	// allocations so it can be reused by the next encoder.
+	gifArena *gifEncoderArena
 }
 
 // NewEncoder returns an Encoder which can be used to encode Framebuffer
@@ -194,6 +204,14 @@ func NewEncoder(ext string, decodedBy Decoder, dst []byte, config *EncodeConfig)
 		return nil, errors.New("Encoder cannot encode into video types")
 	}
 
+	if strings.ToLower(ext) == ".jpeg" || strings.ToLower(ext) == ".jpg" {
+		return newJpegEncoder(decodedBy, dst, config)
+	}
+
+	if strings.ToLower(ext) == ".png" {
+		return newPngEncoder(decodedBy, dst, config)
+	}
+
 	if strings.ToLower(ext) == ".thumbhash" {
 		return newThumbhashEncoder(decodedBy, dst, config)
 	}
@@ -5,6 +5,7 @@ package lilliput
 import (
 	"io/ioutil"
 	"testing"
+	"time"
 )
 
 func TestNewDecoder(t *testing.T) {
@@ -118,6 +119,66 @@ func TestNewDecoder(t *testing.T) {
 	}
 }
 
+func TestProbe(t *testing.T) {
+	tests := []struct {
+		sourceFilePath string
+		want           ProbeResult
+	}{
+		{"testdata/ferry_sunset.jpg", ProbeResult{Format: "JPEG", Width: 800, Height: 297, Orientation: OrientationTopLeft, NumFrames: 1, HasICC: true}},
+		{"testdata/ferry_sunset_no_icc.png", ProbeResult{Format: "PNG", Width: 800, Height: 297, Orientation: OrientationTopLeft, NumFrames: 1}},
+		{"testdata/party-discord.gif", ProbeResult{Format: "GIF", Width: 28, Height: 18, Orientation: OrientationTopLeft, NumFrames: 16, Duration: 480 * time.Millisecond, HasAlpha: true}},
+		{"testdata/duplicate_number_of_loops.gif", ProbeResult{Format: "GIF", Width: 1, Height: 1, Orientation: OrientationTopLeft, NumFrames: 2}},
+		{"testdata/tears_of_steel_icc.webp", ProbeResult{Format: "WEBP", Width: 1920, Height: 800, Orientation: OrientationTopLeft, NumFrames: 1, HasICC: true}},
+		{"testdata/animated-webp-supported.webp", ProbeResult{Format: "WEBP", Width: 400, Height: 400, Orientation: OrientationTopLeft, NumFrames: 12, Duration: 840 * time.Millisecond, HasAlpha: true}},
+		{"testdata/paris_icc_exif_xmp.avif", ProbeResult{Format: "AVIF", Width: 403, Height: 302, Orientation: OrientationTopLeft, NumFrames: 1, HasICC: true}},
+		{"testdata/rotation-irot90.avif", ProbeResult{Format: "AVIF", Width: 64, Height: 32, Orientation: OrientationLeftBottom, NumFrames: 1}},
+		{"testdata/colors-animated-8bpc-alpha-exif-xmp.avif", ProbeResult{Format: "AVIF", Width: 150, Height: 150, Orientation: OrientationTopLeft, NumFrames: 5, Duration: 833 * time.Millisecond, HasAlpha: true}},
+	}
+	for _, tt := range tests {
+		t.Run(tt.sourceFilePath, func(t *testing.T) {
+			buf, err := ioutil.ReadFile(tt.sourceFilePath)
+			if err != nil {
+				t.Fatalf("Failed to read source file: %v", err)
+			}
+			want := tt.want
+			want.ContentLength = len(buf)
+			got, err := Probe(buf)
+			if err != nil {
+				t.Fatalf("Probe() error = %v", err)
+			}
+			if got != want {
+				t.Errorf("Probe() = %+v, want %+v", got, want)
+			}
+
+			// a probe of a truncated image must fail or stay within what it was given
+			for _, n := range []int{0, 1, 16, len(buf) / 2} {
+				if got, err := Probe(buf[:n]); err == nil && got.ContentLength > n {
+					t.Errorf("Probe(buf[:%d]) content length = %d", n, got.ContentLength)
+				}
+			}
+		})
+	}
+
+	if _, err := Probe([]byte("not an image")); err != ErrInvalidImage {
+		t.Errorf("Probe() error = %v, want %v", err, ErrInvalidImage)
+	}
+}
+
+func TestProbeAllocs(t *testing.T) {
+	buf, err := ioutil.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		t.Fatalf("Failed to read source file: %v", err)
+	}
+	allocs := testing.AllocsPerRun(100, func() {
+		if _, err := Probe(buf); err != nil {
+			t.Fatalf("Probe() error = %v", err)
+		}
+	})
+	if allocs != 0 {
+		t.Errorf("Probe() allocs = %v, want 0", allocs)
+	}
+}
+
 func BenchmarkNewDecoder(b *testing.B) {
 	sourceFilePath := "testdata/big_buck_bunny_480p_10s_web.mp4"
 	sourceFileData, err := ioutil.ReadFile(sourceFilePath)
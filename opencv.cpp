@@ -1,9 +1,12 @@
 #include "opencv.hpp"
+#include "parallel.hpp"
+#include "quantize.hpp"
 
 #include <stdbool.h>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <jpeglib.h>
+#include <turbojpeg.h>
 // Include the vendored libpng explicitly by its versioned path. A bare
 // <png.h> resolves to the system libpng, which on many build hosts predates
 // PNG 3rd edition and so lacks png_get_cICP, while the library we actually
@@ -13,6 +16,20 @@
 #include <zlib.h>
 #include <setjmp.h>
 #include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 // Interpolation constants
 const int CV_INTER_AREA = cv::INTER_AREA;
@@ -207,6 +224,669 @@ void opencv_mat_resize(const opencv_mat src,
                interpolation);
 }
 
+// Separable resampler. Each axis is resampled with a table of fixed-point
+// filter taps: a horizontal pass turns source rows into 16-bit intermediate
+// rows, then a vertical pass combines intermediate rows into the output.
+// Building the tables is the costly part for large downscales, so a resampler
+// keeps the last few and every frame of an animation reuses them.
+#define RESAMPLE_COEFF_BITS 14
+#define RESAMPLE_ROW_BITS 7
+#define RESAMPLE_CACHE_SIZE 4
+// halve the source with exact 2x2 box reductions while it is at least this
+// many times the output size on both axes, leaving the filter a 2-4x step
+#define RESAMPLE_PYRAMID_RATIO 4
+#define RESAMPLE_PYRAMID_MAX_LEVELS 16
+
+struct resample_table {
+    int src_size = 0;
+    int dst_size = 0;
+    double scale = 0;
+    int kernel = 0;
+    int taps = 0;
+    // for each output sample, the first of `taps` consecutive source samples
+    // and their weights, which sum to 1 << RESAMPLE_COEFF_BITS
+    std::vector<int> start;
+    std::vector<int16_t> coeffs;
+};
+
+// A source reduced by 2^levels, generated a row at a time: a row of level l
+// is made from two rows of level l - 1, so each level only ever holds the two
+// rows its parent is combining and the reduced image never exists in full.
+struct resample_pyramid {
+    const cv::Mat* src;
+    int levels;
+    int width[RESAMPLE_PYRAMID_MAX_LEVELS + 1];
+    int height[RESAMPLE_PYRAMID_MAX_LEVELS + 1];
+    uint8_t* rows[RESAMPLE_PYRAMID_MAX_LEVELS + 1][2];
+};
+
+// Scratch memory for one horizontal stripe of the output: a ring of as many
+// intermediate rows as the vertical pass combines for an output row, the
+// pointers to those rows in the order it reads them, and the row buffers of
+// its own pyramid. 8-bit sources use rows and 16-bit ones wide_rows.
+struct resample_stripe {
+    std::vector<int16_t> rows;
+    std::vector<const int16_t*> row_ptrs;
+    std::vector<int32_t> wide_rows;
+    std::vector<const int32_t*> wide_row_ptrs;
+    std::vector<uint8_t> pyramid_rows;
+};
+
+struct opencv_resampler_struct {
+    resample_table tables[RESAMPLE_CACHE_SIZE];
+    int next_table = 0;
+    std::vector<resample_stripe> stripes;
+};
+
+static double resample_kernel_support(int kernel)
+{
+    switch (kernel) {
+    case OPENCV_RESAMPLE_BOX:
+        return 0.5;
+    case OPENCV_RESAMPLE_MITCHELL:
+        return 2.0;
+    case OPENCV_RESAMPLE_LANCZOS3:
+        return 3.0;
+    default:
+        // area enlarges with a triangle filter, like cv::INTER_AREA
+        return 1.0;
+    }
+}
+
+static double resample_kernel_weight(int kernel, double x)
+{
+    switch (kernel) {
+    case OPENCV_RESAMPLE_BOX:
+        return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+    case OPENCV_RESAMPLE_MITCHELL: {
+        // Mitchell-Netravali with B = C = 1/3
+        const double B = 1.0 / 3.0;
+        const double C = 1.0 / 3.0;
+        x = fabs(x);
+        if (x < 1.0) {
+            return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+        }
+        if (x < 2.0) {
+            return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x +
+                    (8 * B + 24 * C)) /
+                   6;
+        }
+        return 0.0;
+    }
+    case OPENCV_RESAMPLE_LANCZOS3:
+        if (x == 0.0) {
+            return 1.0;
+        }
+        if (x > -3.0 && x < 3.0) {
+            return 3.0 * sin(CV_PI * x) * sin(CV_PI * x / 3.0) / (CV_PI * CV_PI * x * x);
+        }
+        return 0.0;
+    default:
+        x = fabs(x);
+        return x < 1.0 ? 1.0 - x : 0.0;
+    }
+}
+
+// scale is source samples per output sample. It is src_size / dst_size unless
+// the source is a pyramid level, whose last sample may hang past the image.
+static void resample_table_build(resample_table* t, int src_size, int dst_size, double scale, int kernel)
+{
+    const bool area = kernel == OPENCV_RESAMPLE_AREA && scale >= 1.0;
+    const double filter_scale = scale > 1.0 ? scale : 1.0;
+    const double support = area ? scale / 2 : resample_kernel_support(kernel) * filter_scale;
+
+    int taps = int(ceil(support)) * 2 + 1;
+    if (taps > src_size) {
+        taps = src_size;
+    }
+
+    t->src_size = src_size;
+    t->dst_size = dst_size;
+    t->scale = scale;
+    t->kernel = kernel;
+    t->taps = taps;
+    t->start.resize(dst_size);
+    t->coeffs.assign(size_t(dst_size) * taps, 0);
+
+    std::vector<double> weights(taps);
+    for (int x = 0; x < dst_size; x++) {
+        const double center = (x + 0.5) * scale;
+        int lo = area ? int(floor(x * scale)) : int(center - support + 0.5);
+        if (lo < 0) {
+            lo = 0;
+        }
+        int hi = area ? int(ceil((x + 1) * scale)) : int(center + support + 0.5);
+        if (hi > src_size) {
+            hi = src_size;
+        }
+        // keep the whole window inside the source so the passes need no
+        // bounds checks; the slots it gains carry zero weight
+        int start = lo < src_size - taps ? lo : src_size - taps;
+        if (hi - start > taps) {
+            hi = start + taps;
+        }
+
+        double sum = 0;
+        std::fill(weights.begin(), weights.end(), 0.0);
+        for (int i = lo; i < hi; i++) {
+            double w;
+            if (area) {
+                // exact coverage of source pixel i by this output pixel
+                double a = i > x * scale ? i : x * scale;
+                double b = i + 1 < (x + 1) * scale ? i + 1 : (x + 1) * scale;
+                w = b > a ? b - a : 0;
+            }
+            else {
+                w = resample_kernel_weight(kernel, (i - center + 0.5) / filter_scale);
+            }
+            weights[i - start] = w;
+            sum += w;
+        }
+
+        int16_t* k = &t->coeffs[size_t(x) * taps];
+        int total = 0;
+        int largest = 0;
+        for (int i = 0; i < taps; i++) {
+            double w = sum != 0 ? weights[i] / sum : 0;
+            k[i] = int16_t(lround(w * (1 << RESAMPLE_COEFF_BITS)));
+            total += k[i];
+            if (abs(k[i]) > abs(k[largest])) {
+                largest = i;
+            }
+        }
+        if (sum == 0) {
+            int nearest = int(center) - start;
+            largest = nearest < 0 ? 0 : (nearest >= taps ? taps - 1 : nearest);
+        }
+        // put the rounding error on the biggest tap so flat areas stay flat
+        k[largest] += (1 << RESAMPLE_COEFF_BITS) - total;
+        t->start[x] = start;
+    }
+}
+
+// the cached table for these parameters, built into the oldest slot if there
+// is none. keep, a table already returned for the same resample, is never
+// the slot rebuilt.
+static const resample_table* resample_table_get(opencv_resampler r,
+                                                int src_size,
+                                                int dst_size,
+                                                double scale,
+                                                int kernel,
+                                                const resample_table* keep)
+{
+    for (int i = 0; i < RESAMPLE_CACHE_SIZE; i++) {
+        const resample_table& t = r->tables[i];
+        if (t.src_size == src_size && t.dst_size == dst_size && t.scale == scale && t.kernel == kernel) {
+            return &t;
+        }
+    }
+    if (&r->tables[r->next_table] == keep) {
+        r->next_table = (r->next_table + 1) % RESAMPLE_CACHE_SIZE;
+    }
+    resample_table* t = &r->tables[r->next_table];
+    r->next_table = (r->next_table + 1) % RESAMPLE_CACHE_SIZE;
+    resample_table_build(t, src_size, dst_size, scale, kernel);
+    return t;
+}
+
+// two 16-bit taps packed for _mm_madd_epi16
+static inline int32_t resample_tap_pair(int16_t k0, int16_t k1)
+{
+    return int32_t(uint32_t(uint16_t(k0)) | (uint32_t(uint16_t(k1)) << 16));
+}
+
+static inline int16_t resample_clamp_s16(int32_t v)
+{
+    return v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : int16_t(v));
+}
+
+static inline uint8_t resample_clamp_u8(int32_t v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : uint8_t(v));
+}
+
+// horizontal pass over one row: src has t.src_size pixels of C channels and
+// dst receives t.dst_size pixels with RESAMPLE_ROW_BITS fractional bits
+template <int C>
+static void resample_row_h(const resample_table& t, const uint8_t* src, int16_t* dst)
+{
+    const int shift = RESAMPLE_COEFF_BITS - RESAMPLE_ROW_BITS;
+    const int taps = t.taps;
+    int x = 0;
+
+#if defined(__SSE2__)
+    if (C == 4) {
+        const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+        for (; x < t.dst_size; x++) {
+            const uint8_t* p = src + t.start[x] * 4;
+            const int16_t* k = &t.coeffs[size_t(x) * taps];
+            __m128i acc = _mm_setzero_si128();
+            int i = 0;
+            for (; i + 2 <= taps; i += 2) {
+                // two pixels, interleaved by channel so madd pairs them up
+                __m128i px = _mm_loadl_epi64((const __m128i*)(p + i * 4));
+                px = _mm_unpacklo_epi8(px, _mm_srli_si128(px, 4));
+                px = _mm_unpacklo_epi8(px, _mm_setzero_si128());
+                __m128i kk = _mm_set1_epi32(resample_tap_pair(k[i], k[i + 1]));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, kk));
+            }
+            if (i < taps) {
+                int32_t last;
+                memcpy(&last, p + i * 4, 4);
+                __m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128(last), _mm_setzero_si128());
+                px = _mm_unpacklo_epi16(px, _mm_setzero_si128());
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(resample_tap_pair(k[i], 0))));
+            }
+            acc = _mm_srai_epi32(_mm_add_epi32(acc, round), shift);
+            _mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packs_epi32(acc, acc));
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (C == 4) {
+        for (; x < t.dst_size; x++) {
+            const uint8_t* p = src + t.start[x] * 4;
+            const int16_t* k = &t.coeffs[size_t(x) * taps];
+            int32x4_t acc = vdupq_n_s32(0);
+            for (int i = 0; i < taps; i++) {
+                uint32_t px;
+                memcpy(&px, p + i * 4, 4);
+                int16x4_t px16 =
+                  vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(px)))));
+                acc = vmlal_n_s16(acc, px16, k[i]);
+            }
+            vst1_s16(dst + x * 4, vqmovn_s32(vrshrq_n_s32(acc, shift)));
+        }
+    }
+#endif
+
+    for (; x < t.dst_size; x++) {
+        const uint8_t* p = src + t.start[x] * C;
+        const int16_t* k = &t.coeffs[size_t(x) * taps];
+        int32_t acc[C] = {};
+        for (int i = 0; i < taps; i++) {
+            for (int c = 0; c < C; c++) {
+                acc[c] += k[i] * p[i * C + c];
+            }
+        }
+        for (int c = 0; c < C; c++) {
+            dst[x * C + c] = resample_clamp_s16((acc[c] + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+// vertical pass for one output row: combines the `taps` intermediate rows
+// at rows into n output bytes
+static void resample_row_v(const int16_t* const* rows, const int16_t* k, int taps, uint8_t* dst, int n)
+{
+    const int shift = RESAMPLE_COEFF_BITS + RESAMPLE_ROW_BITS;
+    int x = 0;
+
+#if defined(__SSE2__)
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    for (; x + 8 <= n; x += 8) {
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 2 <= taps; i += 2) {
+            __m128i r0 = _mm_loadu_si128((const __m128i*)(rows[i] + x));
+            __m128i r1 = _mm_loadu_si128((const __m128i*)(rows[i + 1] + x));
+            __m128i kk = _mm_set1_epi32(resample_tap_pair(k[i], k[i + 1]));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(r0, r1), kk));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(r0, r1), kk));
+        }
+        if (i < taps) {
+            __m128i r0 = _mm_loadu_si128((const __m128i*)(rows[i] + x));
+            __m128i kk = _mm_set1_epi32(resample_tap_pair(k[i], 0));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(r0, _mm_setzero_si128()), kk));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(r0, _mm_setzero_si128()), kk));
+        }
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), shift);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), shift);
+        __m128i px = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(px, px));
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 8 <= n; x += 8) {
+        int32x4_t lo = vdupq_n_s32(0);
+        int32x4_t hi = vdupq_n_s32(0);
+        for (int i = 0; i < taps; i++) {
+            int16x8_t r = vld1q_s16(rows[i] + x);
+            lo = vmlal_n_s16(lo, vget_low_s16(r), k[i]);
+            hi = vmlal_n_s16(hi, vget_high_s16(r), k[i]);
+        }
+        int16x8_t px = vcombine_s16(vqmovn_s32(vrshrq_n_s32(lo, shift)), vqmovn_s32(vrshrq_n_s32(hi, shift)));
+        vst1_u8(dst + x, vqmovun_s16(px));
+    }
+#endif
+
+    for (; x < n; x++) {
+        int32_t acc = 0;
+        for (int i = 0; i < taps; i++) {
+            acc += k[i] * rows[i][x];
+        }
+        dst[x] = resample_clamp_u8((acc + (1 << (shift - 1))) >> shift);
+    }
+}
+
+// The passes for 16-bit samples. Their intermediate rows are 32-bit and carry
+// no fractional bits, and the vertical pass accumulates in 64 bits.
+template <int C>
+static void resample_row_h(const resample_table& t, const uint16_t* src, int32_t* dst)
+{
+    const int shift = RESAMPLE_COEFF_BITS;
+    for (int x = 0; x < t.dst_size; x++) {
+        const uint16_t* p = src + t.start[x] * C;
+        const int16_t* k = &t.coeffs[size_t(x) * t.taps];
+        int32_t acc[C] = {};
+        for (int i = 0; i < t.taps; i++) {
+            for (int c = 0; c < C; c++) {
+                acc[c] += k[i] * p[i * C + c];
+            }
+        }
+        for (int c = 0; c < C; c++) {
+            dst[x * C + c] = (acc[c] + (1 << (shift - 1))) >> shift;
+        }
+    }
+}
+
+static void resample_row_v(const int32_t* const* rows, const int16_t* k, int taps, uint16_t* dst, int n)
+{
+    const int shift = RESAMPLE_COEFF_BITS;
+    for (int x = 0; x < n; x++) {
+        int64_t acc = 0;
+        for (int i = 0; i < taps; i++) {
+            acc += int64_t(k[i]) * rows[i][x];
+        }
+        acc = (acc + (1 << (shift - 1))) >> shift;
+        dst[x] = uint16_t(acc < 0 ? 0 : (acc > UINT16_MAX ? UINT16_MAX : acc));
+    }
+}
+
+// 2x2 box reduction of rows a and b, src_width pixels wide, into
+// (src_width + 1) / 2 pixels. An odd last column is averaged with itself.
+template <int C, typename T>
+static void resample_halve_row(const T* a, const T* b, T* dst, int src_width)
+{
+    const int width = src_width / 2;
+    int x = 0;
+
+#if defined(__SSE2__)
+    if constexpr (C == 4 && sizeof(T) == 1) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+        for (; x + 2 <= width; x += 2) {
+            // four source pixels from each row make two output pixels
+            __m128i ra = _mm_loadu_si128((const __m128i*)(a + x * 8));
+            __m128i rb = _mm_loadu_si128((const __m128i*)(b + x * 8));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero), _mm_unpacklo_epi8(rb, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero), _mm_unpackhi_epi8(rb, zero));
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+            _mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packus_epi16(sum, sum));
+        }
+    }
+#elif defined(__ARM_NEON)
+    if constexpr (C == 4 && sizeof(T) == 1) {
+        for (; x + 4 <= width; x += 4) {
+            // split eight source pixels per row into even and odd ones
+            uint32x4x2_t ra = vuzpq_u32(vreinterpretq_u32_u8(vld1q_u8(a + x * 8)),
+                                        vreinterpretq_u32_u8(vld1q_u8(a + x * 8 + 16)));
+            uint32x4x2_t rb = vuzpq_u32(vreinterpretq_u32_u8(vld1q_u8(b + x * 8)),
+                                        vreinterpretq_u32_u8(vld1q_u8(b + x * 8 + 16)));
+            uint8x16_t ae = vreinterpretq_u8_u32(ra.val[0]);
+            uint8x16_t ao = vreinterpretq_u8_u32(ra.val[1]);
+            uint8x16_t be = vreinterpretq_u8_u32(rb.val[0]);
+            uint8x16_t bo = vreinterpretq_u8_u32(rb.val[1]);
+            uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(ae), vget_low_u8(ao)),
+                                      vaddl_u8(vget_low_u8(be), vget_low_u8(bo)));
+            uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(ae), vget_high_u8(ao)),
+                                      vaddl_u8(vget_high_u8(be), vget_high_u8(bo)));
+            vst1q_u8(dst + x * 4, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (int c = 0; c < C; c++) {
+            int sum = a[2 * x * C + c] + a[(2 * x + 1) * C + c] + b[2 * x * C + c] + b[(2 * x + 1) * C + c];
+            dst[x * C + c] = T((sum + 2) >> 2);
+        }
+    }
+    if (src_width & 1) {
+        for (int c = 0; c < C; c++) {
+            int sum = 2 * (a[2 * x * C + c] + b[2 * x * C + c]);
+            dst[x * C + c] = T((sum + 2) >> 2);
+        }
+    }
+}
+
+static int resample_pyramid_init(resample_pyramid* p, const cv::Mat& src, const cv::Mat& dst)
+{
+    p->src = &src;
+    p->levels = 0;
+    p->width[0] = src.cols;
+    p->height[0] = src.rows;
+    while (p->levels < RESAMPLE_PYRAMID_MAX_LEVELS &&
+           p->width[p->levels] >= RESAMPLE_PYRAMID_RATIO * dst.cols &&
+           p->height[p->levels] >= RESAMPLE_PYRAMID_RATIO * dst.rows) {
+        p->levels++;
+        p->width[p->levels] = (p->width[p->levels - 1] + 1) / 2;
+        p->height[p->levels] = (p->height[p->levels - 1] + 1) / 2;
+    }
+    return p->levels;
+}
+
+// bytes of pyramid rows for a source with samples of pixel_bytes
+static size_t resample_pyramid_row_bytes(const resample_pyramid* p, size_t pixel_bytes)
+{
+    size_t row_bytes = 0;
+    for (int l = 1; l <= p->levels; l++) {
+        row_bytes += 2 * size_t(p->width[l]) * pixel_bytes;
+    }
+    return row_bytes;
+}
+
+// points the pyramid's row buffers into buf, which must hold
+// resample_pyramid_row_bytes
+static void resample_pyramid_bind(resample_pyramid* p, uint8_t* buf, size_t pixel_bytes)
+{
+    for (int l = 1; l <= p->levels; l++) {
+        for (int slot = 0; slot < 2; slot++) {
+            p->rows[l][slot] = buf;
+            buf += size_t(p->width[l]) * pixel_bytes;
+        }
+    }
+}
+
+// row y of pyramid level l, built into that level's buffer for slot
+template <int C, typename T>
+static const T* resample_pyramid_row(resample_pyramid* p, int l, int y, int slot)
+{
+    if (l == 0) {
+        return p->src->ptr<T>(y);
+    }
+    const T* a = resample_pyramid_row<C, T>(p, l - 1, 2 * y, 0);
+    const T* b = a;
+    if (2 * y + 1 < p->height[l - 1]) {
+        b = resample_pyramid_row<C, T>(p, l - 1, 2 * y + 1, 1);
+    }
+    T* row = reinterpret_cast<T*>(p->rows[l][slot]);
+    resample_halve_row<C>(a, b, row, p->width[l - 1]);
+    return row;
+}
+
+// intermediate rows between the passes: 16-bit fixed point for 8-bit
+// samples and 32-bit integers for 16-bit ones
+template <typename T>
+using resample_row_t = typename std::conditional<sizeof(T) == 1, int16_t, int32_t>::type;
+
+template <typename T>
+static std::vector<resample_row_t<T>>& resample_stripe_rows(resample_stripe& scratch)
+{
+    if constexpr (sizeof(T) == 1) {
+        return scratch.rows;
+    }
+    else {
+        return scratch.wide_rows;
+    }
+}
+
+template <typename T>
+static std::vector<const resample_row_t<T>*>& resample_stripe_row_ptrs(resample_stripe& scratch)
+{
+    if constexpr (sizeof(T) == 1) {
+        return scratch.row_ptrs;
+    }
+    else {
+        return scratch.wide_row_ptrs;
+    }
+}
+
+// output rows [y0, y1) of dst. Each output row reads v.taps consecutive
+// source rows, starting no earlier than the previous one's, so source row y
+// is filtered horizontally into slot y % v.taps of the ring once, when an
+// output row first needs it, and stays there for as long as any can.
+template <int C, typename T>
+static void resample_mat_rows(resample_pyramid pyramid,
+                              resample_stripe& scratch,
+                              const resample_table& h,
+                              const resample_table& v,
+                              cv::Mat& dst,
+                              int y0,
+                              int y1)
+{
+    resample_pyramid_bind(&pyramid, scratch.pyramid_rows.data(), C * sizeof(T));
+    auto& rows = resample_stripe_rows<T>(scratch);
+    auto& row_ptrs = resample_stripe_row_ptrs<T>(scratch);
+    const size_t stride = size_t(dst.cols) * C;
+    int next = v.start[y0];
+    for (int y = y0; y < y1; y++) {
+        const int first = v.start[y];
+        next = std::max(next, first);
+        for (; next < first + v.taps; next++) {
+            const T* row = resample_pyramid_row<C, T>(&pyramid, pyramid.levels, next, 0);
+            resample_row_h<C>(h, row, &rows[size_t(next % v.taps) * stride]);
+        }
+        for (int i = 0; i < v.taps; i++) {
+            row_ptrs[i] = &rows[size_t((first + i) % v.taps) * stride];
+        }
+        resample_row_v(row_ptrs.data(), &v.coeffs[size_t(y) * v.taps], v.taps, dst.ptr<T>(y), int(stride));
+    }
+}
+
+template <int C, typename T>
+static void resample_mat(opencv_resampler r, const cv::Mat& src, cv::Mat& dst, int kernel, int threads)
+{
+    resample_pyramid pyramid;
+    const int levels = resample_pyramid_init(&pyramid, src, dst);
+    // pyramid levels round odd sizes up, so scale from the true source size
+    const double scale_x = ldexp(src.cols, -levels) / dst.cols;
+    const double scale_y = ldexp(src.rows, -levels) / dst.rows;
+    const resample_table* h = resample_table_get(r, pyramid.width[levels], dst.cols, scale_x, kernel, nullptr);
+    const resample_table* v = resample_table_get(r, pyramid.height[levels], dst.rows, scale_y, kernel, h);
+
+    // Each stripe of output rows runs the horizontal pass over just the source
+    // rows it reads, so stripes share nothing but the tables. Scratch is
+    // sized here, on the calling thread, where a failed allocation can throw.
+    const int stripes = parallel_stripes(threads, dst.rows, src.total() * src.elemSize());
+    const size_t stride = size_t(dst.cols) * C;
+    const size_t pyramid_bytes = resample_pyramid_row_bytes(&pyramid, C * sizeof(T));
+    r->stripes.resize(std::max(r->stripes.size(), size_t(stripes)));
+    for (int s = 0; s < stripes; s++) {
+        resample_stripe_rows<T>(r->stripes[s]).resize(stride * v->taps);
+        resample_stripe_row_ptrs<T>(r->stripes[s]).resize(v->taps);
+        r->stripes[s].pyramid_rows.resize(pyramid_bytes);
+    }
+
+    parallel_for(stripes, [&](int s) {
+        const int y0 = int(int64_t(dst.rows) * s / stripes);
+        const int y1 = int(int64_t(dst.rows) * (s + 1) / stripes);
+        resample_mat_rows<C, T>(pyramid, r->stripes[s], *h, *v, dst, y0, y1);
+    });
+}
+
+opencv_resampler opencv_resampler_create()
+{
+    return new struct opencv_resampler_struct();
+}
+
+void opencv_resampler_clear(opencv_resampler r)
+{
+    for (int i = 0; i < RESAMPLE_CACHE_SIZE; i++) {
+        r->tables[i] = resample_table();
+    }
+    r->next_table = 0;
+    std::vector<resample_stripe>().swap(r->stripes);
+}
+
+void opencv_resampler_release(opencv_resampler r)
+{
+    delete r;
+}
+
+int opencv_mat_resample(opencv_resampler r, const opencv_mat src, opencv_mat dst, int kernel, int threads)
+{
+    auto cvSrc = static_cast<const cv::Mat*>(src);
+    auto cvDst = static_cast<cv::Mat*>(dst);
+    if (!cvSrc || !cvDst) {
+        return OPENCV_ERROR_NULL_MATRIX;
+    }
+    if ((cvSrc->depth() != CV_8U && cvSrc->depth() != CV_16U) || cvSrc->type() != cvDst->type()) {
+        return OPENCV_ERROR_CONVERSION_FAILED;
+    }
+    if (cvSrc->cols <= 0 || cvSrc->rows <= 0 || cvDst->cols <= 0 || cvDst->rows <= 0) {
+        return OPENCV_ERROR_INVALID_DIMENSIONS;
+    }
+
+    // without a resampler to cache in, the tables live for this call only
+    struct opencv_resampler_struct scratch;
+    if (!r) {
+        r = &scratch;
+    }
+
+    try {
+        const bool wide = cvSrc->depth() == CV_16U;
+        switch (cvSrc->channels()) {
+        case 1:
+            wide ? resample_mat<1, uint16_t>(r, *cvSrc, *cvDst, kernel, threads)
+                 : resample_mat<1, uint8_t>(r, *cvSrc, *cvDst, kernel, threads);
+            break;
+        case 2:
+            wide ? resample_mat<2, uint16_t>(r, *cvSrc, *cvDst, kernel, threads)
+                 : resample_mat<2, uint8_t>(r, *cvSrc, *cvDst, kernel, threads);
+            break;
+        case 3:
+            wide ? resample_mat<3, uint16_t>(r, *cvSrc, *cvDst, kernel, threads)
+                 : resample_mat<3, uint8_t>(r, *cvSrc, *cvDst, kernel, threads);
+            break;
+        case 4:
+            wide ? resample_mat<4, uint16_t>(r, *cvSrc, *cvDst, kernel, threads)
+                 : resample_mat<4, uint8_t>(r, *cvSrc, *cvDst, kernel, threads);
+            break;
+        default:
+            return OPENCV_ERROR_INVALID_CHANNEL_COUNT;
+        }
+    }
+    catch (const std::bad_alloc&) {
+        return OPENCV_ERROR_RESIZE_FAILED;
+    }
+    return OPENCV_SUCCESS;
+}
+
+bool opencv_mat_narrow_to_8u(const opencv_mat src, opencv_mat dst)
+{
+    auto cvSrc = static_cast<const cv::Mat*>(src);
+    auto cvDst = static_cast<cv::Mat*>(dst);
+    if (!cvSrc || !cvDst || cvSrc->depth() != CV_16U || cvDst->depth() != CV_8U ||
+        cvSrc->channels() != cvDst->channels() || cvSrc->size() != cvDst->size()) {
+        return false;
+    }
+    // dst already has the right size and type, so this writes into its buffer
+    cvSrc->convertTo(*cvDst, CV_8U, 1.0 / 257.0);
+    return true;
+}
+
 opencv_mat opencv_mat_crop(const opencv_mat src, int x, int y, int width, int height)
 {
     auto ret = new cv::Mat;
@@ -214,10 +894,193 @@ opencv_mat opencv_mat_crop(const opencv_mat src, int x, int y, int width, int he
     return ret;
 }
 
-void opencv_mat_orientation_transform(CVImageOrientation orientation, opencv_mat mat)
+// Orientation transforms move whole pixels, so they are written over a pixel
+// of N bytes and work for any depth and channel count with that element size.
+template <int N>
+struct orientation_pixel {
+    uint8_t bytes[N];
+};
+
+// Mirrors rows [y0, y1) of m in place: each row left to right if flip_x, and
+// if flip_y, rows y0..y1 of the top half are exchanged with their mirror
+// images in the bottom half.
+template <int N>
+static void orientation_flip_rows(cv::Mat& m, bool flip_x, bool flip_y, int y0, int y1)
+{
+    typedef orientation_pixel<N> pixel;
+    for (int y = y0; y < y1; y++) {
+        pixel* a = m.ptr<pixel>(y);
+        if (!flip_y) {
+            std::reverse(a, a + m.cols);
+            continue;
+        }
+        pixel* b = m.ptr<pixel>(m.rows - 1 - y);
+        if (!flip_x) {
+            if (a != b) {
+                std::swap_ranges(a, a + m.cols, b);
+            }
+        }
+        else if (a == b) {
+            std::reverse(a, a + m.cols);
+        }
+        else {
+            std::swap_ranges(a, a + m.cols, std::reverse_iterator<pixel*>(b + m.cols));
+        }
+    }
+}
+
+// Writes rows [y0, y1) of the transpose of src into dst. Row y of the
+// transpose is source column y, or column cols - 1 - y if mirror_cols, read top
+// to bottom, or bottom to top if mirror_rows. Works in square tiles so that
+// the column reads stay in cache.
+template <int N>
+static void orientation_transpose_rows(const cv::Mat& src,
+                                       uint8_t* dst,
+                                       size_t dst_step,
+                                       bool mirror_cols,
+                                       bool mirror_rows,
+                                       int y0,
+                                       int y1)
+{
+    typedef orientation_pixel<N> pixel;
+    const int tile = 32;
+    const size_t src_step = src.step[0];
+    for (int ty = y0; ty < y1; ty += tile) {
+        const int ty1 = std::min(ty + tile, y1);
+        for (int tx = 0; tx < src.rows; tx += tile) {
+            const int tx1 = std::min(tx + tile, src.rows);
+            for (int y = ty; y < ty1; y++) {
+                const int col = mirror_cols ? src.cols - 1 - y : y;
+                pixel* out = reinterpret_cast<pixel*>(dst + size_t(y) * dst_step);
+                for (int x = tx; x < tx1; x++) {
+                    const int row = mirror_rows ? src.rows - 1 - x : x;
+                    out[x] = *reinterpret_cast<const pixel*>(src.data + size_t(row) * src_step +
+                                                             size_t(col) * N);
+                }
+            }
+        }
+    }
+}
+
+// Applies orientation as cv::OrientationTransform would, in up to `threads`
+// stripes. Returns false if it could not and the caller should fall back.
+template <int N>
+static bool orientation_transform(CVImageOrientation orientation, cv::Mat& m, int threads)
+{
+    bool transpose = false;
+    bool flip_x = false;
+    bool flip_y = false;
+    switch (orientation) {
+    case CV_IMAGE_ORIENTATION_TR:
+        flip_x = true;
+        break;
+    case CV_IMAGE_ORIENTATION_BR:
+        flip_x = flip_y = true;
+        break;
+    case CV_IMAGE_ORIENTATION_BL:
+        flip_y = true;
+        break;
+    case CV_IMAGE_ORIENTATION_LT:
+        transpose = true;
+        break;
+    case CV_IMAGE_ORIENTATION_RT:
+        transpose = flip_x = true;
+        break;
+    case CV_IMAGE_ORIENTATION_RB:
+        transpose = flip_x = flip_y = true;
+        break;
+    case CV_IMAGE_ORIENTATION_LB:
+        transpose = flip_y = true;
+        break;
+    default:
+        return true;
+    }
+    if (m.empty()) {
+        return true;
+    }
+    const size_t bytes = m.total() * N;
+
+    if (!transpose) {
+        const int rows = flip_y ? (m.rows + 1) / 2 : m.rows;
+        const int stripes = parallel_stripes(threads, rows, bytes);
+        parallel_for(stripes, [&](int s) {
+            orientation_flip_rows<N>(m,
+                                     flip_x,
+                                     flip_y,
+                                     int(int64_t(rows) * s / stripes),
+                                     int(int64_t(rows) * (s + 1) / stripes));
+        });
+        return true;
+    }
+
+    // The transpose is built in scratch and copied back, so the mat keeps
+    // its (caller-owned) buffer. Flipping the transpose horizontally reads the
+    // source bottom to top, and flipping it vertically reads its columns
+    // right to left.
+    if (!m.isContinuous()) {
+        return false;
+    }
+    // left uninitialised: zeroing it would cost a third as much as the
+    // transpose. Without the memory, the caller falls back rather than let
+    // bad_alloc leave this extern "C" call.
+    std::unique_ptr<uint8_t[]> transposed(new (std::nothrow) uint8_t[bytes]);
+    if (!transposed) {
+        return false;
+    }
+    const size_t dst_step = size_t(m.rows) * N;
+    const int stripes = parallel_stripes(threads, m.cols, bytes);
+    parallel_for(stripes, [&](int s) {
+        orientation_transpose_rows<N>(m,
+                                      transposed.get(),
+                                      dst_step,
+                                      flip_y,
+                                      flip_x,
+                                      int(int64_t(m.cols) * s / stripes),
+                                      int(int64_t(m.cols) * (s + 1) / stripes));
+    });
+    parallel_for(stripes, [&](int s) {
+        const size_t begin = bytes * s / stripes;
+        const size_t end = bytes * (s + 1) / stripes;
+        memcpy(m.data + begin, transposed.get() + begin, end - begin);
+    });
+    const uchar* datalimit = m.datalimit;
+    m = cv::Mat(m.cols, m.rows, m.type(), m.data);
+    m.datalimit = datalimit;
+    return true;
+}
+
+void opencv_mat_orientation_transform(CVImageOrientation orientation, opencv_mat mat, int threads)
 {
     auto cvMat = static_cast<cv::Mat*>(mat);
-    cv::OrientationTransform(int(orientation), *cvMat);
+    bool done = false;
+    switch (cvMat->elemSize()) {
+    case 1:
+        done = orientation_transform<1>(orientation, *cvMat, threads);
+        break;
+    case 2:
+        done = orientation_transform<2>(orientation, *cvMat, threads);
+        break;
+    case 3:
+        done = orientation_transform<3>(orientation, *cvMat, threads);
+        break;
+    case 4:
+        done = orientation_transform<4>(orientation, *cvMat, threads);
+        break;
+    case 6:
+        done = orientation_transform<6>(orientation, *cvMat, threads);
+        break;
+    case 8:
+        done = orientation_transform<8>(orientation, *cvMat, threads);
+        break;
+    }
+    if (!done) {
+        try {
+            cv::OrientationTransform(int(orientation), *cvMat);
+        }
+        catch (const std::exception&) {
+            // the frame is left as it was
+        }
+    }
 }
 
 int opencv_mat_get_width(const opencv_mat mat)
@@ -250,159 +1113,1207 @@ void opencv_jpeg_error_exit(j_common_ptr cinfo)
     longjmp(myerr->setjmp_buffer, 1);
 }
 
-int opencv_decoder_get_jpeg_icc(void* src, size_t src_len, void* dest, size_t dest_len)
+// A destination that compresses into a fixed buffer, and gives up as soon as
+// that is full rather than growing it
+struct opencv_jpeg_dest_mgr {
+    struct jpeg_destination_mgr pub;
+    JOCTET* buf;
+    size_t cap;
+    // set by empty_output_buffer before it longjmps out
+    volatile bool overflowed;
+};
+
+static void opencv_jpeg_init_destination(j_compress_ptr cinfo)
 {
-    struct jpeg_decompress_struct cinfo;
+    auto dest = reinterpret_cast<opencv_jpeg_dest_mgr*>(cinfo->dest);
+    dest->pub.next_output_byte = dest->buf;
+    dest->pub.free_in_buffer = dest->cap;
+}
+
+static boolean opencv_jpeg_empty_output_buffer(j_compress_ptr cinfo)
+{
+    auto dest = reinterpret_cast<opencv_jpeg_dest_mgr*>(cinfo->dest);
+    dest->overflowed = true;
+    longjmp(reinterpret_cast<opencv_jpeg_error_mgr*>(cinfo->err)->setjmp_buffer, 1);
+}
+
+static void opencv_jpeg_term_destination(j_compress_ptr) {}
+
+int opencv_jpeg_encode(const opencv_mat src,
+                       const int* opt,
+                       size_t opt_len,
+                       const void* icc,
+                       size_t icc_len,
+                       void* dst,
+                       size_t dst_cap,
+                       size_t* dst_len)
+{
+    auto mat = static_cast<const cv::Mat*>(src);
+    if (!mat || mat->empty() || mat->depth() != CV_8U || !dst || dst_cap == 0) {
+        return OPENCV_JPEG_ENCODE_FAILED;
+    }
+    J_COLOR_SPACE color_space;
+    switch (mat->channels()) {
+    case 1:
+        color_space = JCS_GRAYSCALE;
+        break;
+    case 3:
+        color_space = JCS_EXT_BGR;
+        break;
+    case 4:
+        color_space = JCS_EXT_BGRX;
+        break;
+    default:
+        return OPENCV_JPEG_ENCODE_FAILED;
+    }
+
+    // the same defaults as OpenCV's JPEG encoder
+    int quality = 95;
+    bool progressive = false;
+    bool optimize = false;
+    int restart_interval = 0;
+    int subsampling = JPEG_SUBSAMPLING_420;
+    int dct_method = JPEG_DCT_ISLOW;
+    for (size_t i = 0; i + 1 < opt_len; i += 2) {
+        const int value = opt[i + 1];
+        switch (opt[i]) {
+        case CV_IMWRITE_JPEG_QUALITY:
+            quality = std::min(100, std::max(0, value));
+            break;
+        case CV_IMWRITE_JPEG_PROGRESSIVE:
+            progressive = value != 0;
+            break;
+        case CV_IMWRITE_JPEG_OPTIMIZE:
+            optimize = value != 0;
+            break;
+        case CV_IMWRITE_JPEG_RST_INTERVAL:
+            restart_interval = std::min(65535, std::max(0, value));
+            break;
+        case JPEG_SUBSAMPLING:
+            subsampling = value;
+            break;
+        case JPEG_DCT_METHOD:
+            dct_method = value;
+            break;
+        }
+    }
+
+    struct jpeg_compress_struct cinfo;
     struct opencv_jpeg_error_mgr jerr;
+    opencv_jpeg_dest_mgr dest;
+    dest.pub.init_destination = opencv_jpeg_init_destination;
+    dest.pub.empty_output_buffer = opencv_jpeg_empty_output_buffer;
+    dest.pub.term_destination = opencv_jpeg_term_destination;
+    dest.buf = static_cast<JOCTET*>(dst);
+    dest.cap = dst_cap;
+    dest.overflowed = false;
 
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = opencv_jpeg_error_exit;
-
     if (setjmp(jerr.setjmp_buffer)) {
-        // JPEG processing error
-        jpeg_destroy_decompress(&cinfo);
-        return 0;
+        jpeg_destroy_compress(&cinfo);
+        return dest.overflowed ? OPENCV_JPEG_ENCODE_BUF_TOO_SMALL : OPENCV_JPEG_ENCODE_FAILED;
     }
 
-    jpeg_create_decompress(&cinfo);
-    jpeg_mem_src(&cinfo, static_cast<unsigned char*>(src), src_len);
+    jpeg_create_compress(&cinfo);
+    cinfo.dest = &dest.pub;
+    cinfo.image_width = mat->cols;
+    cinfo.image_height = mat->rows;
+    cinfo.input_components = mat->channels();
+    cinfo.in_color_space = color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    if (color_space != JCS_GRAYSCALE) {
+        // jpeg_set_defaults subsamples chroma 2x2
+        if (subsampling == JPEG_SUBSAMPLING_422) {
+            cinfo.comp_info[0].v_samp_factor = 1;
+        }
+        else if (subsampling == JPEG_SUBSAMPLING_444) {
+            cinfo.comp_info[0].h_samp_factor = 1;
+            cinfo.comp_info[0].v_samp_factor = 1;
+        }
+    }
+    switch (dct_method) {
+    case JPEG_DCT_IFAST:
+        cinfo.dct_method = JDCT_IFAST;
+        break;
+    case JPEG_DCT_FLOAT:
+        cinfo.dct_method = JDCT_FLOAT;
+        break;
+    default:
+        cinfo.dct_method = JDCT_ISLOW;
+        break;
+    }
+    cinfo.optimize_coding = optimize;
+    cinfo.restart_interval = restart_interval;
+    if (progressive) {
+        jpeg_simple_progression(&cinfo);
+    }
 
-    // Ask libjpeg to save markers that might be ICC profiles
-    jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xFFFF);
+    jpeg_start_compress(&cinfo, TRUE);
+    if (icc && icc_len > 0) {
+        jpeg_write_icc_profile(&cinfo, static_cast<const JOCTET*>(icc), (unsigned int)icc_len);
+    }
+    // rows are handed to the compressor where they are, in batches
+    JSAMPROW rows[16];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const int first = cinfo.next_scanline;
+        const int n = std::min<int>(16, cinfo.image_height - first);
+        for (int i = 0; i < n; i++) {
+            rows[i] = const_cast<JSAMPROW>(mat->ptr<uint8_t>(first + i));
+        }
+        jpeg_write_scanlines(&cinfo, rows, n);
+    }
+    jpeg_finish_compress(&cinfo);
+    *dst_len = dst_cap - dest.pub.free_in_buffer;
+    jpeg_destroy_compress(&cinfo);
+    return OPENCV_JPEG_ENCODE_OK;
+}
+
+static int opencv_jpeg_orientation_xop(int orientation)
+{
+    switch (orientation) {
+    case CV_IMAGE_ORIENTATION_TR:
+        return TJXOP_HFLIP;
+    case CV_IMAGE_ORIENTATION_BR:
+        return TJXOP_ROT180;
+    case CV_IMAGE_ORIENTATION_BL:
+        return TJXOP_VFLIP;
+    case CV_IMAGE_ORIENTATION_LT:
+        return TJXOP_TRANSPOSE;
+    case CV_IMAGE_ORIENTATION_RT:
+        return TJXOP_ROT90;
+    case CV_IMAGE_ORIENTATION_RB:
+        return TJXOP_TRANSVERSE;
+    case CV_IMAGE_ORIENTATION_LB:
+        return TJXOP_ROT270;
+    default:
+        return TJXOP_NONE;
+    }
+}
+
+int opencv_jpeg_transform(const void* src,
+                          size_t src_len,
+                          int orientation,
+                          int crop_x,
+                          int crop_y,
+                          int crop_width,
+                          int crop_height,
+                          const int* opt,
+                          size_t opt_len,
+                          const void* icc,
+                          size_t icc_len,
+                          void* dst,
+                          size_t dst_cap,
+                          size_t* dst_len)
+{
+    if (!src || src_len == 0 || !dst || dst_cap == 0 || crop_x < 0 || crop_y < 0 || crop_width <= 0 ||
+        crop_height <= 0) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+    std::unique_ptr<void, void (*)(tjhandle)> handle(tj3Init(TJINIT_TRANSFORM), tj3Destroy);
+    if (!handle) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+    tjhandle h = handle.get();
+    if (tj3DecompressHeader(h, static_cast<const unsigned char*>(src), src_len) != 0) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+
+    // CMYK and deeper images decode to something other than their samples,
+    // and lossless JPEGs have no DCT coefficients to move
+    const int colorspace = tj3Get(h, TJPARAM_COLORSPACE);
+    const int subsamp = tj3Get(h, TJPARAM_SUBSAMP);
+    if ((colorspace != TJCS_YCbCr && colorspace != TJCS_GRAY) || tj3Get(h, TJPARAM_PRECISION) != 8 ||
+        tj3Get(h, TJPARAM_LOSSLESS) == 1 || subsamp < 0 || subsamp >= TJ_NUMSAMP) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+
+    tjtransform xform;
+    memset(&xform, 0, sizeof(xform));
+    xform.op = opencv_jpeg_orientation_xop(orientation);
+    // without PERFECT the partial MCUs on the right and bottom edges would be
+    // left where they are rather than moved
+    xform.options = TJXOPT_PERFECT;
+
+    const bool transposes = xform.op == TJXOP_TRANSPOSE || xform.op == TJXOP_TRANSVERSE ||
+                            xform.op == TJXOP_ROT90 || xform.op == TJXOP_ROT270;
+    const int width = tj3Get(h, transposes ? TJPARAM_JPEGHEIGHT : TJPARAM_JPEGWIDTH);
+    const int height = tj3Get(h, transposes ? TJPARAM_JPEGWIDTH : TJPARAM_JPEGHEIGHT);
+    if (crop_x + int64_t(crop_width) > width || crop_y + int64_t(crop_height) > height) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+    if (crop_x != 0 || crop_y != 0 || crop_width != width || crop_height != height) {
+        // libjpeg-turbo moves a crop that does not start on an MCU boundary
+        // up and left to one, which would keep pixels outside of it
+        const int mcu_width = transposes ? tjMCUHeight[subsamp] : tjMCUWidth[subsamp];
+        const int mcu_height = transposes ? tjMCUWidth[subsamp] : tjMCUHeight[subsamp];
+        if (crop_x % mcu_width != 0 || crop_y % mcu_height != 0) {
+            return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+        }
+        xform.r.x = crop_x;
+        xform.r.y = crop_y;
+        xform.r.w = crop_width;
+        xform.r.h = crop_height;
+        xform.options |= TJXOPT_CROP;
+    }
+
+    for (size_t i = 0; i + 1 < opt_len; i += 2) {
+        if (opt[i] == CV_IMWRITE_JPEG_PROGRESSIVE && opt[i + 1] != 0) {
+            xform.options |= TJXOPT_PROGRESSIVE;
+        }
+        else if (opt[i] == CV_IMWRITE_JPEG_OPTIMIZE && opt[i + 1] != 0) {
+            xform.options |= TJXOPT_OPTIMIZE;
+        }
+    }
+
+    // like opencv_jpeg_encode's, the output carries the given profile and no
+    // other markers, so neither an EXIF orientation nor the rest of the
+    // source's metadata goes through
+    tj3Set(h, TJPARAM_SAVEMARKERS, 0);
+    if (icc && icc_len > 0 &&
+        tj3SetICCProfile(h, static_cast<unsigned char*>(const_cast<void*>(icc)), icc_len) != 0) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+
+    // libjpeg-turbo writes into dst until it runs out, then carries on in a
+    // buffer of its own, leaving dst to us
+    unsigned char* out = static_cast<unsigned char*>(dst);
+    size_t out_len = dst_cap;
+    const int result = tj3Transform(h, static_cast<const unsigned char*>(src), src_len, 1, &out, &out_len, &xform);
+    if (out != dst) {
+        tj3Free(out);
+        return result == 0 ? OPENCV_JPEG_TRANSFORM_BUF_TOO_SMALL : OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+    // warnings are failures too, as the output may then differ from what
+    // decoding the source would give
+    if (result != 0) {
+        return OPENCV_JPEG_TRANSFORM_UNSUPPORTED;
+    }
+    *dst_len = out_len;
+    return OPENCV_JPEG_TRANSFORM_OK;
+}
+
+int opencv_decoder_get_jpeg_icc(void* src, size_t src_len, void* dest, size_t dest_len)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct opencv_jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = opencv_jpeg_error_exit;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        // JPEG processing error
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, static_cast<unsigned char*>(src), src_len);
+
+    // Ask libjpeg to save markers that might be ICC profiles
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xFFFF);
+
+    // Read JPEG header
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
+    }
+
+    // Check if ICC profile is available
+    JOCTET* icc_profile = nullptr;
+    unsigned int icc_length = 0;
+    if (jpeg_read_icc_profile(&cinfo, &icc_profile, &icc_length)) {
+        if (icc_length > 0 && icc_length <= dest_len) {
+            memcpy(dest, icc_profile, icc_length);
+            free(icc_profile);
+            jpeg_destroy_decompress(&cinfo);
+            return icc_length;
+        }
+    }
+
+    if (icc_profile) {
+        // Free the ICC profile if it was allocated but not copied
+        free(icc_profile);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+}
+
+void opencv_decoder_png_read(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    auto buffer_info = reinterpret_cast<std::pair<const char**, size_t*>*>(png_get_io_ptr(png_ptr));
+    const char*& buffer = *buffer_info->first;
+    size_t& buffer_size = *buffer_info->second;
+
+    if (buffer_size < length) {
+        png_error(png_ptr, "Read error: attempting to read beyond buffer size");
+        return;
+    }
+
+    memcpy(data, buffer, length);
+    buffer += length;
+    buffer_size -= length;
+}
+
+int opencv_decoder_get_png_icc(void* src, size_t src_len, void* dest, size_t dest_len)
+{
+    // Set up libpng to read from memory
+    const char* buffer = reinterpret_cast<const char*>(src);
+    size_t buffer_size = src_len;
+    std::pair<const char**, size_t*> buffer_info(&buffer, &buffer_size);
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return 0;
+    }
+    png_set_read_fn(png_ptr, &buffer_info, opencv_decoder_png_read);
+    png_read_info(png_ptr, info_ptr);
+
+    // Check for ICC profile
+    png_charp icc_name;
+    int compression_type;
+    png_bytep icc_profile;
+    png_uint_32 icc_length;
+    if (png_get_iCCP(png_ptr, info_ptr, &icc_name, &compression_type, &icc_profile, &icc_length)) {
+        if (icc_length > 0 && icc_length <= dest_len) {
+            memcpy(dest, icc_profile, icc_length);
+            png_destroy_read_struct(&png_ptr, &info_ptr, nullptr); // handles freeing icc_profile
+            return icc_length;
+        }
+    }
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return 0;
+}
+
+/**
+ * Read the top-level cICP chunk (PNG 3rd edition, W3C CR-png-3-20250313) from a
+ * PNG buffer.
+ *
+ * cICP is the highest-priority colour descriptor in PNG: when present it takes
+ * precedence over iCCP, sRGB and cHRM+gAMA. Unlike an ICC profile it is not a
+ * blob to pass through but four H.273 code points, so it is reported via
+ * out-params rather than copied into a buffer.
+ *
+ * Returns 1 when a cICP chunk was found, 0 otherwise.
+ */
+int opencv_decoder_get_png_cicp(void* src,
+                                size_t src_len,
+                                uint8_t* primaries,
+                                uint8_t* transfer,
+                                uint8_t* matrix,
+                                uint8_t* full_range)
+{
+    const char* buffer = reinterpret_cast<const char*>(src);
+    size_t buffer_size = src_len;
+    std::pair<const char**, size_t*> buffer_info(&buffer, &buffer_size);
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return 0;
+    }
+    png_set_read_fn(png_ptr, &buffer_info, opencv_decoder_png_read);
+    png_read_info(png_ptr, info_ptr);
+
+    png_byte cicp_primaries = 0;
+    png_byte cicp_transfer = 0;
+    png_byte cicp_matrix = 0;
+    png_byte cicp_range = 0;
+    int found = 0;
+    if (png_get_cICP(
+          png_ptr, info_ptr, &cicp_primaries, &cicp_transfer, &cicp_matrix, &cicp_range)) {
+        *primaries = static_cast<uint8_t>(cicp_primaries);
+        *transfer = static_cast<uint8_t>(cicp_transfer);
+        *matrix = static_cast<uint8_t>(cicp_matrix);
+        *full_range = static_cast<uint8_t>(cicp_range);
+        found = 1;
+    }
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return found;
+}
+
+// Region decoding. Fit keeps only a centred crop of the image, so for a still
+// JPEG or PNG the decoder can skip everything outside it. cv::ImageDecoder
+// only decodes whole images, so these read the encoded buffer themselves, and
+// only for the layouts where that gives exactly the pixels OpenCV would.
+
+// Decodes the dst-sized region at x, y of a JPEG. Rows above the region are
+// skipped and rows below it never decoded; libjpeg-turbo widens the columns
+// to whole iMCUs, which are trimmed while copying out.
+static bool opencv_jpeg_read_region(void* src, size_t src_len, int type, cv::Mat& dst, int x, int y)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct opencv_jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = opencv_jpeg_error_exit;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, static_cast<unsigned char*>(src), src_len);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    // CMYK and YCCK need OpenCV's own conversion
+    const int channels = CV_MAT_CN(type);
+    const bool supported = (cinfo.num_components == 3 && channels == 3) ||
+                           (cinfo.num_components == 1 && (channels == 1 || channels == 3));
+    if (!supported || (JDIMENSION)(x + dst.cols) > cinfo.image_width ||
+        (JDIMENSION)(y + dst.rows) > cinfo.image_height) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cinfo.out_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_EXT_BGR;
+    jpeg_start_decompress(&cinfo);
+
+    // chroma upsampling treats the edges of the crop as image edges, so keep
+    // a column either side of the region to give its edge pixels neighbours
+    JDIMENSION xoffset = std::max(x - 1, 0);
+    JDIMENSION width = std::min<JDIMENSION>(x + dst.cols + 1, cinfo.output_width) - xoffset;
+    jpeg_crop_scanline(&cinfo, &xoffset, &width);
+    if (y > 0 && jpeg_skip_scanlines(&cinfo, y) != (JDIMENSION)y) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    JSAMPARRAY row =
+      (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, width * channels, 1);
+    const size_t skip = (size_t)(x - xoffset) * channels;
+    const size_t row_bytes = (size_t)dst.cols * channels;
+    for (int r = 0; r < dst.rows; r++) {
+        if (jpeg_read_scanlines(&cinfo, row, 1) != 1) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        memcpy(dst.ptr(r), row[0] + skip, row_bytes);
+    }
+
+    // abandons the rows below the region
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+// Decodes the dst-sized region at x, y of a non-interlaced 8-bit PNG. Rows
+// above the region still have to be inflated, but nothing below it is.
+static bool opencv_png_read_region(void* src, size_t src_len, int type, cv::Mat& dst, int x, int y)
+{
+    const char* buffer = reinterpret_cast<const char*>(src);
+    size_t buffer_size = src_len;
+    std::pair<const char**, size_t*> buffer_info(&buffer, &buffer_size);
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    png_bytep volatile row = nullptr;
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_free(png_ptr, row);
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return false;
+    }
+    png_set_read_fn(png_ptr, &buffer_info, opencv_decoder_png_read);
+    png_read_info(png_ptr, info_ptr);
+
+    png_uint_32 width, height;
+    int bit_depth, color_type, interlace;
+    png_get_IHDR(
+      png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace, nullptr, nullptr);
+
+    // palettes, transparency chunks and 16-bit samples need OpenCV's own
+    // expansion; these layouts only differ from its output in channel order
+    const int channels = CV_MAT_CN(type);
+    const bool supported = bit_depth == 8 && interlace == PNG_INTERLACE_NONE &&
+                           !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS) &&
+                           ((color_type == PNG_COLOR_TYPE_RGB && channels == 3) ||
+                            (color_type == PNG_COLOR_TYPE_RGB_ALPHA && channels == 4) ||
+                            (color_type == PNG_COLOR_TYPE_GRAY && channels == 1));
+    if (!supported || (png_uint_32)(x + dst.cols) > width || (png_uint_32)(y + dst.rows) > height) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return false;
+    }
+
+    png_set_bgr(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+    row = (png_bytep)png_malloc(png_ptr, png_get_rowbytes(png_ptr, info_ptr));
+    for (int r = 0; r < y; r++) {
+        png_read_row(png_ptr, row, nullptr);
+    }
+    const size_t skip = (size_t)x * channels;
+    const size_t row_bytes = (size_t)dst.cols * channels;
+    for (int r = 0; r < dst.rows; r++) {
+        png_read_row(png_ptr, row, nullptr);
+        memcpy(dst.ptr(r), row + skip, row_bytes);
+    }
+
+    png_free(png_ptr, row);
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return true;
+}
+
+bool opencv_decoder_read_region(opencv_decoder d, void* src, size_t src_len, opencv_mat dst, int x, int y)
+{
+    auto d_ptr = static_cast<cv::ImageDecoder*>(d);
+    auto mat = static_cast<cv::Mat*>(dst);
+    if (!d_ptr || !mat || mat->empty() || x < 0 || y < 0 ||
+        x + mat->cols > d_ptr->width() || y + mat->rows > d_ptr->height()) {
+        return false;
+    }
+
+    const int type = d_ptr->type();
+    if (mat->type() == type && CV_MAT_DEPTH(type) == CV_8U) {
+        static const uint8_t png_signature[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+        if (src_len >= 3 && bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF) {
+            if (opencv_jpeg_read_region(src, src_len, type, *mat, x, y)) {
+                return true;
+            }
+        }
+        else if (src_len >= sizeof(png_signature) &&
+                 memcmp(bytes, png_signature, sizeof(png_signature)) == 0) {
+            if (opencv_png_read_region(src, src_len, type, *mat, x, y)) {
+                return true;
+            }
+        }
+    }
+
+    // everything else decodes at full size, which is no worse than before
+    try {
+        cv::Mat full(d_ptr->height(), d_ptr->width(), mat->type());
+        if (!d_ptr->readData(full)) {
+            return false;
+        }
+        full(cv::Rect(x, y, mat->cols, mat->rows)).copyTo(*mat);
+        return true;
+    }
+    catch (const cv::Exception& e) {
+        std::cerr << "OpenCV exception in opencv_decoder_read_region: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// PNG encoding. Rows are converted to PNG's sample order, filtered and
+// deflated in horizontal stripes, pigz-style: each stripe is compressed on a
+// thread of its own as raw deflate, primed with the 32K of filtered data
+// that precedes it as a preset dictionary and ended with a sync flush, so
+// the stripes concatenate into a single zlib stream. Stripes only need the
+// source rows around them, so none waits on another.
+#define PNG_DEFLATE_WINDOW (32 * 1024)
+#define PNG_ROW_BATCH 16
+// rows sampled to tell synthetic images from photos
+#define PNG_CLASSIFY_ROWS 64
+
+static_assert(PNG_STRATEGY_FILTERED == Z_FILTERED && PNG_STRATEGY_HUFFMAN_ONLY == Z_HUFFMAN_ONLY &&
+                PNG_STRATEGY_RLE == Z_RLE && PNG_STRATEGY_FIXED == Z_FIXED,
+              "PngStrategy values must be zlib's");
+
+static void png_put_be32(uint8_t* out, uint32_t v)
+{
+    out[0] = (uint8_t)(v >> 24);
+    out[1] = (uint8_t)(v >> 16);
+    out[2] = (uint8_t)(v >> 8);
+    out[3] = (uint8_t)v;
+}
+
+// write a chunk of type with len bytes of data to out, returning its size
+static size_t png_put_chunk(uint8_t* out, const char* type, const uint8_t* data, uint32_t len)
+{
+    png_put_be32(out, len);
+    memcpy(out + 4, type, 4);
+    if (len > 0) {
+        memcpy(out + 8, data, len);
+    }
+    // the CRC covers the type and data, not the length
+    png_put_be32(out + 8 + len, (uint32_t)crc32(0, out + 4, 4 + len));
+    return 12 + len;
+}
+
+// copy a row of mat samples into out in PNG's order: RGB rather than BGR,
+// and 16-bit samples big-endian
+static void png_pack_row(const uint8_t* row, uint8_t* out, int width, int channels, int depth)
+{
+    if (depth == 8) {
+        if (channels < 3) {
+            memcpy(out, row, (size_t)width * channels);
+            return;
+        }
+        for (int x = 0; x < width; x++, row += channels, out += channels) {
+            out[0] = row[2];
+            out[1] = row[1];
+            out[2] = row[0];
+            if (channels == 4) {
+                out[3] = row[3];
+            }
+        }
+        return;
+    }
+    auto samples = reinterpret_cast<const uint16_t*>(row);
+    for (int x = 0; x < width; x++, samples += channels) {
+        for (int c = 0; c < channels; c++, out += 2) {
+            const uint16_t v = samples[channels >= 3 && c < 3 ? 2 - c : c];
+            out[0] = (uint8_t)(v >> 8);
+            out[1] = (uint8_t)v;
+        }
+    }
+}
+
+static inline uint8_t png_paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// apply filter to the packed row raw, whose predecessor is prev, writing the
+// filter byte and residuals to out. returns the sum of the residuals' magnitudes,
+// giving up with a partial sum once it passes limit
+static size_t png_filter_row(const uint8_t* raw,
+                             const uint8_t* prev,
+                             uint8_t* out,
+                             size_t rowbytes,
+                             int bpp,
+                             int filter,
+                             size_t limit)
+{
+    out[0] = (uint8_t)filter;
+    uint8_t* res = out + 1;
+    size_t sum = 0;
+    size_t i = 0;
+    // residuals are summed as signed bytes, as libpng's heuristic does
+#define PNG_RESIDUAL(expr)                                                                                   \
+    do {                                                                                                     \
+        const uint8_t v = (uint8_t)(expr);                                                                   \
+        res[i] = v;                                                                                          \
+        sum += v < 128 ? v : 256 - v;                                                                        \
+    } while (0)
+    switch (filter) {
+    case PNG_FILTER_VALUE_NONE:
+        for (; i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i]);
+        }
+        break;
+    case PNG_FILTER_VALUE_SUB:
+        for (; i < (size_t)bpp && i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i]);
+        }
+        for (; i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i] - raw[i - bpp]);
+            if ((i & 255) == 0 && sum > limit) {
+                return sum;
+            }
+        }
+        break;
+    case PNG_FILTER_VALUE_UP:
+        for (; i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i] - prev[i]);
+            if ((i & 255) == 0 && sum > limit) {
+                return sum;
+            }
+        }
+        break;
+    case PNG_FILTER_VALUE_AVG:
+        for (; i < (size_t)bpp && i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i] - (prev[i] >> 1));
+        }
+        for (; i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i] - ((raw[i - bpp] + prev[i]) >> 1));
+            if ((i & 255) == 0 && sum > limit) {
+                return sum;
+            }
+        }
+        break;
+    default:
+        for (; i < (size_t)bpp && i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i] - prev[i]);
+        }
+        for (; i < rowbytes; i++) {
+            PNG_RESIDUAL(raw[i] - png_paeth(raw[i - bpp], prev[i], prev[i - bpp]));
+            if ((i & 255) == 0 && sum > limit) {
+                return sum;
+            }
+        }
+        break;
+    }
+#undef PNG_RESIDUAL
+    return sum;
+}
+
+// Rows of a frame being encoded as a PNG, packed and filtered one at a time.
+// scratch holds a candidate row for the adaptive filter to compare against
+// the best so far.
+struct png_row_filter {
+    const uint8_t* data;
+    size_t stride;
+    int width;
+    int channels;
+    int depth;
+    int bpp;
+    size_t rowbytes;
+    int filter;
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> prev;
+    std::vector<uint8_t> scratch;
+
+    png_row_filter(const uint8_t* data, size_t stride, int width, int channels, int depth, int filter)
+        : data(data), stride(stride), width(width), channels(channels), depth(depth),
+          bpp(channels * depth / 8), rowbytes((size_t)width * channels * depth / 8), filter(filter),
+          raw(rowbytes), prev(rowbytes), scratch(rowbytes + 1)
+    {
+    }
 
-    // Read JPEG header
-    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
-        jpeg_destroy_decompress(&cinfo);
-        return 0;
+    // position at row y, so that the next call to filter is for y
+    void seek(int y)
+    {
+        if (y == 0) {
+            std::fill(prev.begin(), prev.end(), 0);
+        }
+        else {
+            png_pack_row(data + (y - 1) * stride, prev.data(), width, channels, depth);
+        }
     }
 
-    // Check if ICC profile is available
-    JOCTET* icc_profile = nullptr;
-    unsigned int icc_length = 0;
-    if (jpeg_read_icc_profile(&cinfo, &icc_profile, &icc_length)) {
-        if (icc_length > 0 && icc_length <= dest_len) {
-            memcpy(dest, icc_profile, icc_length);
-            free(icc_profile);
-            jpeg_destroy_decompress(&cinfo);
-            return icc_length;
+    // filter row y, the row after the last one filtered or sought to, into
+    // the rowbytes + 1 bytes at out
+    void filter_row(int y, uint8_t* out)
+    {
+        png_pack_row(data + y * stride, raw.data(), width, channels, depth);
+        if (filter != PNG_ROW_FILTER_ADAPTIVE) {
+            png_filter_row(raw.data(), prev.data(), out, rowbytes, bpp, filter, SIZE_MAX);
         }
+        else {
+            size_t best = png_filter_row(raw.data(), prev.data(), out, rowbytes, bpp, PNG_FILTER_VALUE_NONE, SIZE_MAX);
+            for (int f = PNG_FILTER_VALUE_SUB; f <= PNG_FILTER_VALUE_PAETH; f++) {
+                const size_t sum = png_filter_row(raw.data(), prev.data(), scratch.data(), rowbytes, bpp, f, best);
+                if (sum < best) {
+                    best = sum;
+                    memcpy(out, scratch.data(), rowbytes + 1);
+                }
+            }
+        }
+        raw.swap(prev);
     }
+};
 
-    if (icc_profile) {
-        // Free the ICC profile if it was allocated but not copied
-        free(icc_profile);
+// One stripe's share of the zlib stream: the raw deflate of its filtered
+// rows, written to dst when that is given and to buf otherwise, with the
+// Adler-32 of its input and the CRC-32 of its output for the caller to
+// combine.
+struct png_stripe {
+    int y0;
+    int y1;
+    uint8_t* dst;
+    size_t cap;
+    std::vector<uint8_t> buf;
+    size_t len;
+    size_t in_len;
+    uLong adler;
+    uLong crc;
+    int result;
+};
+
+// ends a deflate stream however the function that began it returns, so a
+// failed allocation part way through leaks nothing
+struct png_deflate_end {
+    z_stream* strm;
+    ~png_deflate_end()
+    {
+        deflateEnd(strm);
     }
-    jpeg_destroy_decompress(&cinfo);
-    return 0;
-}
+};
 
-void opencv_decoder_png_read(png_structp png_ptr, png_bytep data, png_size_t length)
+static void png_deflate_stripe(const uint8_t* data,
+                               size_t stride,
+                               int width,
+                               int height,
+                               int channels,
+                               int depth,
+                               int level,
+                               int strategy,
+                               int filter,
+                               png_stripe* stripe)
 {
-    auto buffer_info = reinterpret_cast<std::pair<const char**, size_t*>*>(png_get_io_ptr(png_ptr));
-    const char*& buffer = *buffer_info->first;
-    size_t& buffer_size = *buffer_info->second;
-
-    if (buffer_size < length) {
-        png_error(png_ptr, "Read error: attempting to read beyond buffer size");
+    png_row_filter rows(data, stride, width, channels, depth, filter);
+    const size_t filtered_row = rows.rowbytes + 1;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+        stripe->result = OPENCV_PNG_ENCODE_FAILED;
         return;
     }
+    png_deflate_end end{&strm};
+
+    std::vector<uint8_t> batch(filtered_row * PNG_ROW_BATCH);
+    if (stripe->y0 > 0) {
+        // refilter enough of the rows before the stripe to prime the window
+        // with what the stripe before it ended on
+        const int n = std::min<int>(stripe->y0, (PNG_DEFLATE_WINDOW + filtered_row - 1) / filtered_row);
+        std::vector<uint8_t> dict(filtered_row * n);
+        rows.seek(stripe->y0 - n);
+        for (int i = 0; i < n; i++) {
+            rows.filter_row(stripe->y0 - n + i, dict.data() + i * filtered_row);
+        }
+        const size_t dict_len = std::min<size_t>(dict.size(), PNG_DEFLATE_WINDOW);
+        deflateSetDictionary(&strm, dict.data() + dict.size() - dict_len, (uInt)dict_len);
+    }
+    else {
+        rows.seek(0);
+    }
 
-    memcpy(data, buffer, length);
-    buffer += length;
-    buffer_size -= length;
+    stripe->in_len = filtered_row * (stripe->y1 - stripe->y0);
+    if (!stripe->dst) {
+        stripe->buf.resize(deflateBound(&strm, stripe->in_len) + 16);
+        stripe->dst = stripe->buf.data();
+        stripe->cap = stripe->buf.size();
+    }
+    strm.next_out = stripe->dst;
+    strm.avail_out = (uInt)std::min<size_t>(stripe->cap, UINT_MAX);
+    stripe->adler = adler32(0, Z_NULL, 0);
+    stripe->result = OPENCV_PNG_ENCODE_OK;
+
+    for (int y = stripe->y0; y < stripe->y1; y += PNG_ROW_BATCH) {
+        const int n = std::min(PNG_ROW_BATCH, stripe->y1 - y);
+        for (int i = 0; i < n; i++) {
+            rows.filter_row(y + i, batch.data() + i * filtered_row);
+        }
+        const size_t batch_len = filtered_row * n;
+        stripe->adler = adler32(stripe->adler, batch.data(), (uInt)batch_len);
+        strm.next_in = batch.data();
+        strm.avail_in = (uInt)batch_len;
+        int flush = Z_NO_FLUSH;
+        if (y + n == stripe->y1) {
+            flush = stripe->y1 == height ? Z_FINISH : Z_SYNC_FLUSH;
+        }
+        do {
+            if (strm.avail_out == 0) {
+                if (stripe->buf.empty()) {
+                    stripe->result = OPENCV_PNG_ENCODE_BUF_TOO_SMALL;
+                    return;
+                }
+                const size_t used = strm.next_out - stripe->buf.data();
+                stripe->buf.resize(stripe->buf.size() * 3 / 2);
+                stripe->dst = stripe->buf.data();
+                stripe->cap = stripe->buf.size();
+                strm.next_out = stripe->dst + used;
+                strm.avail_out = (uInt)std::min<size_t>(stripe->cap - used, UINT_MAX);
+            }
+            if (deflate(&strm, flush) == Z_STREAM_ERROR) {
+                stripe->result = OPENCV_PNG_ENCODE_FAILED;
+                return;
+            }
+        } while (strm.avail_out == 0);
+    }
+    stripe->len = strm.next_out - stripe->dst;
+    stripe->crc = crc32(0, stripe->dst, (uInt)stripe->len);
 }
 
-int opencv_decoder_get_png_icc(void* src, size_t src_len, void* dest, size_t dest_len)
+// encode the width x height pixels at data, rows stride bytes apart, as a PNG
+// in up to `threads` stripes. With a palette, of which the first translucent
+// entries are not opaque, data holds one 8-bit index per pixel
+static int opencv_png_encode_pixels(const uint8_t* data,
+                                    size_t stride,
+                                    int width,
+                                    int height,
+                                    int channels,
+                                    int depth,
+                                    const uint8_t (*palette)[4],
+                                    int palette_size,
+                                    int translucent,
+                                    int level,
+                                    int strategy,
+                                    int filter,
+                                    int threads,
+                                    void* dst,
+                                    size_t dst_cap,
+                                    size_t* dst_len)
 {
-    // Set up libpng to read from memory
-    const char* buffer = reinterpret_cast<const char*>(src);
-    size_t buffer_size = src_len;
-    std::pair<const char**, size_t*> buffer_info(&buffer, &buffer_size);
-
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        return 0;
+    static const uint8_t kSignature[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+    // what follows the compressed data: the Adler-32, the IDAT CRC and IEND
+    const size_t kTrailer = 4 + 4 + 12;
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    size_t idat_pos = sizeof(kSignature) + 12 + 13;
+    if (palette) {
+        idat_pos += 12 + 3 * palette_size + (translucent > 0 ? 12 + translucent : 0);
+    }
+    if (dst_cap < idat_pos + 8 + 2 + kTrailer) {
+        return OPENCV_PNG_ENCODE_BUF_TOO_SMALL;
     }
-    png_set_read_fn(png_ptr, &buffer_info, opencv_decoder_png_read);
-    png_read_info(png_ptr, info_ptr);
 
-    // Check for ICC profile
-    png_charp icc_name;
-    int compression_type;
-    png_bytep icc_profile;
-    png_uint_32 icc_length;
-    if (png_get_iCCP(png_ptr, info_ptr, &icc_name, &compression_type, &icc_profile, &icc_length)) {
-        if (icc_length > 0 && icc_length <= dest_len) {
-            memcpy(dest, icc_profile, icc_length);
-            png_destroy_read_struct(&png_ptr, &info_ptr, nullptr); // handles freeing icc_profile
-            return icc_length;
+    memcpy(out, kSignature, sizeof(kSignature));
+    uint8_t ihdr[13];
+    png_put_be32(ihdr, (uint32_t)width);
+    png_put_be32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = (uint8_t)depth;
+    if (palette) {
+        ihdr[9] = PNG_COLOR_TYPE_PALETTE;
+    }
+    else {
+        ihdr[9] = channels == 1 ? PNG_COLOR_TYPE_GRAY : channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA;
+    }
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+    size_t chunk_pos = sizeof(kSignature);
+    chunk_pos += png_put_chunk(out + chunk_pos, "IHDR", ihdr, sizeof(ihdr));
+    if (palette) {
+        uint8_t plte[3 * 256];
+        uint8_t trns[256];
+        for (int i = 0; i < palette_size; i++) {
+            memcpy(plte + 3 * i, palette[i], 3);
+            trns[i] = palette[i][3];
+        }
+        chunk_pos += png_put_chunk(out + chunk_pos, "PLTE", plte, 3 * palette_size);
+        if (translucent > 0) {
+            png_put_chunk(out + chunk_pos, "tRNS", trns, translucent);
         }
     }
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-    return 0;
+    // a single IDAT chunk, its length filled in once the stripes are done,
+    // holding the zlib header that deflate would have written
+    uint8_t* idat = out + idat_pos;
+    memcpy(idat + 4, "IDAT", 4);
+    int level_flags = 3;
+    if (strategy >= Z_HUFFMAN_ONLY || level < 2) {
+        level_flags = 0;
+    }
+    else if (level < 6) {
+        level_flags = 1;
+    }
+    else if (level == 6) {
+        level_flags = 2;
+    }
+    uint16_t header = ((Z_DEFLATED + ((15 - 8) << 4)) << 8) | (level_flags << 6);
+    header += 31 - header % 31;
+    idat[8] = (uint8_t)(header >> 8);
+    idat[9] = (uint8_t)header;
+
+    const size_t rowbytes = (size_t)width * channels * depth / 8;
+    const int n = parallel_stripes(threads, height, (rowbytes + 1) * height);
+    std::vector<png_stripe> stripes(n);
+    for (int s = 0; s < n; s++) {
+        stripes[s].y0 = (int)((int64_t)height * s / n);
+        stripes[s].y1 = (int)((int64_t)height * (s + 1) / n);
+        stripes[s].dst = nullptr;
+        stripes[s].cap = 0;
+        stripes[s].len = 0;
+    }
+    // the first stripe compresses straight into place
+    uint8_t* zdata = idat + 10;
+    stripes[0].dst = zdata;
+    stripes[0].cap = dst_cap - (zdata - out) - kTrailer;
+    // parallel_for's stripes must not throw, so a stripe that runs out of
+    // memory fails on its own
+    parallel_for(n, [&](int s) {
+        try {
+            png_deflate_stripe(data, stride, width, height, channels, depth, level, strategy, filter, &stripes[s]);
+        }
+        catch (const std::bad_alloc&) {
+            stripes[s].result = OPENCV_PNG_ENCODE_FAILED;
+        }
+    });
+
+    uLong adler = adler32(0, Z_NULL, 0);
+    uLong crc = crc32(0, idat + 4, 6);
+    uint8_t* pos = zdata;
+    for (auto& stripe : stripes) {
+        if (stripe.result != OPENCV_PNG_ENCODE_OK) {
+            return stripe.result;
+        }
+        if (stripe.dst != pos) {
+            if ((size_t)(out + dst_cap - pos) < stripe.len + kTrailer) {
+                return OPENCV_PNG_ENCODE_BUF_TOO_SMALL;
+            }
+            memcpy(pos, stripe.dst, stripe.len);
+        }
+        pos += stripe.len;
+        adler = adler32_combine(adler, stripe.adler, (z_off_t)stripe.in_len);
+        crc = crc32_combine(crc, stripe.crc, (z_off_t)stripe.len);
+    }
+    png_put_be32(pos, (uint32_t)adler);
+    crc = crc32(crc, pos, 4);
+    pos += 4;
+    const size_t idat_len = pos - (idat + 8);
+    if (idat_len > 0x7FFFFFFF) {
+        return OPENCV_PNG_ENCODE_FAILED;
+    }
+    png_put_be32(idat, (uint32_t)idat_len);
+    png_put_be32(pos, (uint32_t)crc);
+    pos += 4;
+    pos += png_put_chunk(pos, "IEND", nullptr, 0);
+    *dst_len = pos - out;
+    return OPENCV_PNG_ENCODE_OK;
 }
 
-/**
- * Read the top-level cICP chunk (PNG 3rd edition, W3C CR-png-3-20250313) from a
- * PNG buffer.
- *
- * cICP is the highest-priority colour descriptor in PNG: when present it takes
- * precedence over iCCP, sRGB and cHRM+gAMA. Unlike an ICC profile it is not a
- * blob to pass through but four H.273 code points, so it is reported via
- * out-params rather than copied into a buffer.
- *
- * Returns 1 when a cICP chunk was found, 0 otherwise.
- */
-int opencv_decoder_get_png_cicp(void* src,
-                                size_t src_len,
-                                uint8_t* primaries,
-                                uint8_t* transfer,
-                                uint8_t* matrix,
-                                uint8_t* full_range)
+// Whether an image looks synthetic, like a screenshot or artwork, rather than
+// like a photo, judged on a sample of rows by how many pixels repeat the one
+// to their left: flat fills do, and camera noise all but never does.
+static bool png_is_synthetic(const uint8_t* data, size_t stride, int width, int height, int bpp)
 {
-    const char* buffer = reinterpret_cast<const char*>(src);
-    size_t buffer_size = src_len;
-    std::pair<const char**, size_t*> buffer_info(&buffer, &buffer_size);
+    const int rows = std::min(height, PNG_CLASSIFY_ROWS);
+    size_t repeats = 0;
+    for (int i = 0; i < rows; i++) {
+        const uint8_t* row = data + (size_t)((int64_t)height * i / rows) * stride;
+        for (int x = 1; x < width; x++) {
+            repeats += memcmp(row + x * bpp, row + (x - 1) * bpp, bpp) == 0;
+        }
+    }
+    return repeats * 2 > (size_t)rows * std::max(width - 1, 1);
+}
 
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        return 0;
+static int png_encode_mat(const cv::Mat* mat,
+                          const int* opt,
+                          size_t opt_len,
+                          int threads,
+                          void* dst,
+                          size_t dst_cap,
+                          size_t* dst_len)
+{
+    if (!mat || mat->empty() || !dst) {
+        return OPENCV_PNG_ENCODE_FAILED;
+    }
+    const int channels = mat->channels();
+    const int depth = mat->depth() == CV_16U ? 16 : 8;
+    if ((mat->depth() != CV_8U && mat->depth() != CV_16U) || channels == 2 || channels > 4) {
+        return OPENCV_PNG_ENCODE_FAILED;
     }
-    png_set_read_fn(png_ptr, &buffer_info, opencv_decoder_png_read);
-    png_read_info(png_ptr, info_ptr);
 
-    png_byte cicp_primaries = 0;
-    png_byte cicp_transfer = 0;
-    png_byte cicp_matrix = 0;
-    png_byte cicp_range = 0;
-    int found = 0;
-    if (png_get_cICP(
-          png_ptr, info_ptr, &cicp_primaries, &cicp_transfer, &cicp_matrix, &cicp_range)) {
-        *primaries = static_cast<uint8_t>(cicp_primaries);
-        *transfer = static_cast<uint8_t>(cicp_transfer);
-        *matrix = static_cast<uint8_t>(cicp_matrix);
-        *full_range = static_cast<uint8_t>(cicp_range);
-        found = 1;
+    int level = -1;
+    int strategy = -1;
+    int filter = -1;
+    int palette_quality = 0;
+    for (size_t i = 0; i + 1 < opt_len; i += 2) {
+        const int value = opt[i + 1];
+        switch (opt[i]) {
+        case CV_IMWRITE_PNG_COMPRESSION:
+            level = std::min(9, std::max(0, value));
+            break;
+        case CV_IMWRITE_PNG_STRATEGY:
+            if (value >= PNG_STRATEGY_DEFAULT && value <= PNG_STRATEGY_AUTO) {
+                strategy = value;
+            }
+            break;
+        case PNG_ROW_FILTER:
+            if (value >= PNG_ROW_FILTER_NONE && value <= PNG_ROW_FILTER_ADAPTIVE) {
+                filter = value;
+            }
+            break;
+        case PNG_PALETTE_QUALITY:
+            palette_quality = std::min(100, std::max(0, value));
+            break;
+        }
     }
+    // indices are left unfiltered unless a filter is asked for, as libpng
+    // does, since neighbouring indices are no guide to one another
+    const int palette_filter = filter < 0 ? PNG_ROW_FILTER_NONE : filter;
+    // the same defaults as OpenCV's PNG encoder: fast settings unless a
+    // compression level is asked for, and libpng's adaptive filtering and
+    // zlib's default strategy when it is
+    if (level < 0) {
+        level = Z_BEST_SPEED;
+        strategy = strategy < 0 ? PNG_STRATEGY_RLE : strategy;
+        filter = filter < 0 ? PNG_ROW_FILTER_SUB : filter;
+    }
+    strategy = strategy < 0 ? PNG_STRATEGY_DEFAULT : strategy;
+    filter = filter < 0 ? PNG_ROW_FILTER_ADAPTIVE : filter;
+    if (strategy == PNG_STRATEGY_AUTO) {
+        // artwork repeats itself, in glyphs and UI, in ways only full string
+        // matching finds, while the noisy residuals of a photo leave little
+        // but runs to match, which RLE finds faster and codes as tightly
+        strategy = png_is_synthetic(mat->data, mat->step, mat->cols, mat->rows, (int)mat->elemSize())
+                     ? PNG_STRATEGY_DEFAULT
+                     : PNG_STRATEGY_RLE;
+    }
+    if (palette_quality > 0 && depth == 8 && channels >= 3) {
+        std::vector<uint8_t> indices((size_t)mat->cols * mat->rows);
+        uint8_t palette[256][4];
+        int palette_size = 0;
+        int translucent = 0;
+        if (quantize_bgra(mat->data,
+                          mat->step,
+                          mat->cols,
+                          mat->rows,
+                          channels,
+                          palette_quality,
+                          threads,
+                          palette,
+                          &palette_size,
+                          &translucent,
+                          indices.data())) {
+            return opencv_png_encode_pixels(indices.data(),
+                                            mat->cols,
+                                            mat->cols,
+                                            mat->rows,
+                                            1,
+                                            8,
+                                            palette,
+                                            palette_size,
+                                            translucent,
+                                            level,
+                                            strategy,
+                                            palette_filter,
+                                            threads,
+                                            dst,
+                                            dst_cap,
+                                            dst_len);
+        }
+    }
+    return opencv_png_encode_pixels(mat->data,
+                                    mat->step,
+                                    mat->cols,
+                                    mat->rows,
+                                    channels,
+                                    depth,
+                                    nullptr,
+                                    0,
+                                    0,
+                                    level,
+                                    strategy,
+                                    filter,
+                                    threads,
+                                    dst,
+                                    dst_cap,
+                                    dst_len);
+}
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-    return found;
+int opencv_png_encode(const opencv_mat src,
+                      const int* opt,
+                      size_t opt_len,
+                      int threads,
+                      void* dst,
+                      size_t dst_cap,
+                      size_t* dst_len)
+{
+    // the stripes, the palette indices and the quantizer's tables are all
+    // allocated, and bad_alloc must not reach cgo
+    try {
+        return png_encode_mat(static_cast<const cv::Mat*>(src), opt, opt_len, threads, dst, dst_cap, dst_len);
+    }
+    catch (const std::exception&) {
+        return OPENCV_PNG_ENCODE_FAILED;
+    }
 }
 
 /**
  * Insert a cICP chunk into an already-encoded PNG buffer, in place.
  *
- * cv::imencode cannot emit ancillary chunks, and swapping the PNG encode for a
- * hand-rolled libpng write path would mean re-implementing (and diverging from)
- * OpenCV's encoder for the sake of four bytes of metadata. Injecting the chunk
- * into the finished stream keeps the pixel encoder exactly as it is today; the
- * tradeoff is that this function has to know PNG's container framing, which is
- * a fixed 8-byte signature followed by length/type/data/CRC records.
+ * The encoder knows nothing of the source's colour signalling, so the chunk
+ * is injected into the finished stream instead, for PNGs from any encoder.
+ * This function only has to know PNG's container framing, which is a fixed
+ * 8-byte signature followed by length/type/data/CRC records.
  *
  * The chunk is placed immediately after IHDR, as the spec requires for colour
  * chunks. `png_cap` is the capacity of the caller's buffer; the insert is
@@ -441,22 +2352,9 @@ size_t opencv_png_insert_cicp(void* png,
         return png_len;
     }
 
-    uint8_t chunk[16];
-    chunk[0] = 0;
-    chunk[1] = 0;
-    chunk[2] = 0;
-    chunk[3] = 4; // data length
-    memcpy(chunk + 4, "cICP", 4);
-    chunk[8] = primaries;
-    chunk[9] = transfer;
-    chunk[10] = matrix;
-    chunk[11] = full_range;
-    // CRC covers the type and data, not the length field.
-    uint32_t crc = (uint32_t)crc32(0, chunk + 4, 8);
-    chunk[12] = (uint8_t)((crc >> 24) & 0xFF);
-    chunk[13] = (uint8_t)((crc >> 16) & 0xFF);
-    chunk[14] = (uint8_t)((crc >> 8) & 0xFF);
-    chunk[15] = (uint8_t)(crc & 0xFF);
+    uint8_t chunk[kChunkLen];
+    const uint8_t body[4] = {primaries, transfer, matrix, full_range};
+    png_put_chunk(chunk, "cICP", body, sizeof(body));
 
     memmove(buf + insert_at + kChunkLen, buf + insert_at, png_len - insert_at);
     memcpy(buf + insert_at, chunk, kChunkLen);
@@ -666,6 +2564,250 @@ int opencv_copy_to_region_with_alpha(opencv_mat src,
     }
 }
 
+// Premultiplied alpha. Colour channels are scaled by alpha / 255 once after
+// decode, so that resizing weights colour by coverage and compositing needs
+// no per-pixel division, and scaled back once before encoding.
+
+// x / 255 rounded, for x up to 255 * 255
+static inline uint32_t premultiply_div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+#if defined(__SSE2__)
+// rounded x / 255 in each 16-bit lane, for x up to 255 * 255
+static inline __m128i premultiply_div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// each pixel's alpha in all four 16-bit lanes of its BGRA pixel
+static inline __m128i premultiply_alpha_epi16(__m128i px)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+                               _MM_SHUFFLE(3, 3, 3, 3));
+}
+#elif defined(__ARM_NEON)
+// rounded a * b / 255 in each lane
+static inline uint8x16_t premultiply_mul_div255(uint8x16_t a, uint8x16_t b)
+{
+    uint16x8_t lo = vmull_u8(vget_low_u8(a), vget_low_u8(b));
+    uint16x8_t hi = vmull_u8(vget_high_u8(a), vget_high_u8(b));
+    return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+#endif
+
+static void premultiply_row(uint8_t* p, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    // the alpha lanes are multiplied by 255, which the division undoes exactly
+    const __m128i colour = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i alpha = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(p + x * 4));
+        __m128i lo = _mm_unpacklo_epi8(px, zero);
+        __m128i hi = _mm_unpackhi_epi8(px, zero);
+        __m128i lo_k = _mm_or_si128(_mm_and_si128(premultiply_alpha_epi16(lo), colour), alpha);
+        __m128i hi_k = _mm_or_si128(_mm_and_si128(premultiply_alpha_epi16(hi), colour), alpha);
+        lo = premultiply_div255_epi16(_mm_mullo_epi16(lo, lo_k));
+        hi = premultiply_div255_epi16(_mm_mullo_epi16(hi, hi_k));
+        _mm_storeu_si128((__m128i*)(p + x * 4), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t px = vld4q_u8(p + x * 4);
+        px.val[0] = premultiply_mul_div255(px.val[0], px.val[3]);
+        px.val[1] = premultiply_mul_div255(px.val[1], px.val[3]);
+        px.val[2] = premultiply_mul_div255(px.val[2], px.val[3]);
+        vst4q_u8(p + x * 4, px);
+    }
+#endif
+    for (; x < width; x++) {
+        uint8_t* px = p + x * 4;
+        const uint32_t a = px[3];
+        px[0] = premultiply_div255(px[0] * a);
+        px[1] = premultiply_div255(px[1] * a);
+        px[2] = premultiply_div255(px[2] * a);
+    }
+}
+
+// Runs once per output frame on the (usually small) resized image, so it is
+// a plain loop over a reciprocal table. Resampling filters with negative
+// lobes can leave colour above alpha, which saturates here.
+static void unpremultiply_row(uint8_t* p, int width)
+{
+    // round(255 * 65536 / a); 255 * this still fits in 32 bits
+    static const std::vector<uint32_t> scale = [] {
+        std::vector<uint32_t> s(256, 0);
+        for (uint32_t a = 1; a < 256; a++) {
+            s[a] = (255u * 65536u + a / 2) / a;
+        }
+        return s;
+    }();
+    for (int x = 0; x < width; x++) {
+        uint8_t* px = p + x * 4;
+        const uint32_t k = scale[px[3]];
+        px[0] = (uint8_t)std::min<uint32_t>(255, (px[0] * k + 32768) >> 16);
+        px[1] = (uint8_t)std::min<uint32_t>(255, (px[1] * k + 32768) >> 16);
+        px[2] = (uint8_t)std::min<uint32_t>(255, (px[2] * k + 32768) >> 16);
+    }
+}
+
+// The same for 16-bit BGRA, which is rare enough to be left scalar
+static void premultiply_row_16(uint16_t* p, int width)
+{
+    for (int x = 0; x < width; x++) {
+        uint16_t* px = p + x * 4;
+        const uint32_t a = px[3];
+        px[0] = (uint16_t)((px[0] * a + 32767) / 65535);
+        px[1] = (uint16_t)((px[1] * a + 32767) / 65535);
+        px[2] = (uint16_t)((px[2] * a + 32767) / 65535);
+    }
+}
+
+static void unpremultiply_row_16(uint16_t* p, int width)
+{
+    for (int x = 0; x < width; x++) {
+        uint16_t* px = p + x * 4;
+        const uint32_t a = px[3];
+        if (a == 0) {
+            continue;
+        }
+        px[0] = (uint16_t)std::min<uint32_t>(65535, (px[0] * 65535u + a / 2) / a);
+        px[1] = (uint16_t)std::min<uint32_t>(65535, (px[1] * 65535u + a / 2) / a);
+        px[2] = (uint16_t)std::min<uint32_t>(65535, (px[2] * 65535u + a / 2) / a);
+    }
+}
+
+static bool premultiply_mat(opencv_mat mat,
+                            int threads,
+                            void (*row)(uint8_t*, int),
+                            void (*row_16)(uint16_t*, int))
+{
+    auto m = static_cast<cv::Mat*>(mat);
+    if (!m || m->empty() || (m->type() != CV_8UC4 && m->type() != CV_16UC4)) {
+        return false;
+    }
+    const bool wide = m->type() == CV_16UC4;
+    const int width = m->cols;
+    const int height = m->rows;
+    const int stripes = parallel_stripes(threads, height, (size_t)width * height * 4);
+    parallel_for(stripes, [&](int s) {
+        const int y0 = (int)((int64_t)height * s / stripes);
+        const int y1 = (int)((int64_t)height * (s + 1) / stripes);
+        for (int y = y0; y < y1; y++) {
+            if (wide) {
+                row_16(m->ptr<uint16_t>(y), width);
+            }
+            else {
+                row(m->ptr<uint8_t>(y), width);
+            }
+        }
+    });
+    return true;
+}
+
+bool opencv_mat_premultiply_alpha(opencv_mat mat, int threads)
+{
+    return premultiply_mat(mat, threads, premultiply_row, premultiply_row_16);
+}
+
+bool opencv_mat_unpremultiply_alpha(opencv_mat mat, int threads)
+{
+    return premultiply_mat(mat, threads, unpremultiply_row, unpremultiply_row_16);
+}
+
+// dst = src + dst * (255 - src alpha) / 255 for premultiplied BGRA, alpha
+// included
+static void premultiplied_over_row(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    for (; x + 4 <= width; x += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + x * 4));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + x * 4));
+        __m128i lo_k = _mm_sub_epi16(full, premultiply_alpha_epi16(_mm_unpacklo_epi8(s, zero)));
+        __m128i hi_k = _mm_sub_epi16(full, premultiply_alpha_epi16(_mm_unpackhi_epi8(s, zero)));
+        __m128i lo = premultiply_div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), lo_k));
+        __m128i hi = premultiply_div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), hi_k));
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t s = vld4q_u8(src + x * 4);
+        uint8x16x4_t d = vld4q_u8(dst + x * 4);
+        const uint8x16_t k = vmvnq_u8(s.val[3]);
+        for (int c = 0; c < 4; c++) {
+            d.val[c] = vqaddq_u8(s.val[c], premultiply_mul_div255(d.val[c], k));
+        }
+        vst4q_u8(dst + x * 4, d);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* s = src + x * 4;
+        uint8_t* d = dst + x * 4;
+        const uint32_t k = 255 - s[3];
+        for (int c = 0; c < 4; c++) {
+            d[c] = (uint8_t)std::min<uint32_t>(255, s[c] + premultiply_div255(d[c] * k));
+        }
+    }
+}
+
+/**
+ * @brief Composite a premultiplied source over a region of a premultiplied
+ * destination.
+ *
+ * Unlike opencv_copy_to_region_with_alpha, both matrices must already be
+ * 8-bit BGRA and the source must be the size of the region.
+ *
+ * @param src Pointer to the source OpenCV matrix.
+ * @param dst Pointer to the destination OpenCV matrix.
+ * @param xOffset X-coordinate offset in the destination image.
+ * @param yOffset Y-coordinate offset in the destination image.
+ * @param width Width of the region to composite.
+ * @param height Height of the region to composite.
+ * @return int Error code.
+ */
+int opencv_copy_to_region_premultiplied(opencv_mat src,
+                                        opencv_mat dst,
+                                        int xOffset,
+                                        int yOffset,
+                                        int width,
+                                        int height)
+{
+    auto srcMat = static_cast<const cv::Mat*>(src);
+    auto dstMat = static_cast<cv::Mat*>(dst);
+
+    if (!srcMat || !dstMat || srcMat->empty() || dstMat->empty()) {
+        return OPENCV_ERROR_NULL_MATRIX;
+    }
+
+    if (xOffset < 0 || yOffset < 0 || xOffset + width > dstMat->cols ||
+        yOffset + height > dstMat->rows) {
+        return OPENCV_ERROR_OUT_OF_BOUNDS;
+    }
+
+    if (width <= 0 || height <= 0 || srcMat->cols != width || srcMat->rows != height) {
+        return OPENCV_ERROR_INVALID_DIMENSIONS;
+    }
+
+    if (srcMat->type() != CV_8UC4 || dstMat->type() != CV_8UC4) {
+        return OPENCV_ERROR_INVALID_CHANNEL_COUNT;
+    }
+
+    for (int y = 0; y < height; y++) {
+        premultiplied_over_row(
+          srcMat->ptr<uint8_t>(y), dstMat->ptr<uint8_t>(yOffset + y) + xOffset * 4, width);
+    }
+    return OPENCV_SUCCESS;
+}
+
 /**
  * @brief Copy source image to a rectangular region of the destination image.
  *
@@ -750,3 +2892,64 @@ int opencv_copy_to_region(opencv_mat src,
         return OPENCV_ERROR_UNKNOWN;
     }
 }
+
+/**
+ * @brief Make a rectangular region of dst match the same region of src.
+ *
+ * Rows are compared first and only copied from the first mismatch onward, so
+ * an unchanged region costs a single read pass over both matrices.
+ *
+ * @param src Pointer to the source OpenCV matrix.
+ * @param dst Pointer to the destination OpenCV matrix; same size and type as src.
+ * @param xOffset X-coordinate of the top-left corner of the region.
+ * @param yOffset Y-coordinate of the top-left corner of the region.
+ * @param width Width of the region.
+ * @param height Height of the region.
+ * @param changed Set to whether the region differed before the call.
+ * @return int Error code.
+ */
+int opencv_mat_sync_region(opencv_mat src,
+                           opencv_mat dst,
+                           int xOffset,
+                           int yOffset,
+                           int width,
+                           int height,
+                           bool* changed)
+{
+    auto srcMat = static_cast<const cv::Mat*>(src);
+    auto dstMat = static_cast<cv::Mat*>(dst);
+    *changed = false;
+
+    if (!srcMat || !dstMat || srcMat->empty() || dstMat->empty()) {
+        return OPENCV_ERROR_NULL_MATRIX;
+    }
+
+    if (srcMat->size() != dstMat->size() || srcMat->type() != dstMat->type()) {
+        return OPENCV_ERROR_INVALID_DIMENSIONS;
+    }
+
+    if (xOffset < 0 || yOffset < 0 || xOffset + width > dstMat->cols ||
+        yOffset + height > dstMat->rows) {
+        return OPENCV_ERROR_OUT_OF_BOUNDS;
+    }
+
+    if (width <= 0 || height <= 0) {
+        return OPENCV_SUCCESS;
+    }
+
+    size_t pixel_size = srcMat->elemSize();
+    size_t row_len = width * pixel_size;
+    for (int y = yOffset; y < yOffset + height; y++) {
+        const uint8_t* src_row = srcMat->ptr<uint8_t>(y) + xOffset * pixel_size;
+        uint8_t* dst_row = dstMat->ptr<uint8_t>(y) + xOffset * pixel_size;
+        if (*changed) {
+            memcpy(dst_row, src_row, row_len);
+        }
+        else if (memcmp(dst_row, src_row, row_len) != 0) {
+            *changed = true;
+            memcpy(dst_row, src_row, row_len);
+        }
+    }
+
+    return OPENCV_SUCCESS;
+}
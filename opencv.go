@@ -3,6 +3,7 @@ package lilliput
 // #include "opencv.hpp"
 // #include "avif.hpp"
 // #include "webp.hpp"
+// #include "giflib.hpp"
 // #include "color_info.hpp"
 import "C"
 
@@ -39,6 +40,31 @@ const (
 // ImageOrientation describes how the decoded image is oriented according to its metadata.
 type ImageOrientation int
 
+// ResizeFilter selects the filter kernel used when an image is resized.
+type ResizeFilter int
+
+const (
+	// ResizeFilterArea averages the source pixels each output pixel covers when
+	// shrinking and interpolates linearly when enlarging. This is the default.
+	ResizeFilterArea = ResizeFilter(C.OPENCV_RESAMPLE_AREA)
+	// ResizeFilterBox averages the source pixels whose centres each output pixel
+	// covers, or picks the nearest one when enlarging.
+	ResizeFilterBox = ResizeFilter(C.OPENCV_RESAMPLE_BOX)
+	// ResizeFilterMitchell is the Mitchell-Netravali cubic (B = C = 1/3).
+	ResizeFilterMitchell = ResizeFilter(C.OPENCV_RESAMPLE_MITCHELL)
+	// ResizeFilterLanczos3 is the sharpest filter, at the cost of some ringing
+	// around hard edges and about four times the work of ResizeFilterArea.
+	ResizeFilterLanczos3 = ResizeFilter(C.OPENCV_RESAMPLE_LANCZOS3)
+)
+
+// resampler caches the filter tables of recent resizes so that resizes with
+// the same geometry, like the frames of an animation, don't rebuild them.
+type resampler struct {
+	resampler C.opencv_resampler
+	filter    ResizeFilter
+	threads   int
+}
+
 const (
 	// Standard image encoding constants
 	JpegQuality     = int(C.CV_IMWRITE_JPEG_QUALITY)     // Quality parameter for JPEG encoding (0-100)
@@ -59,6 +85,57 @@ const (
 	WebpThreadLevel    = int(C.WEBP_THREAD_LEVEL)    // Thread level (0=off, 1=on)
 	WebpPalette        = int(C.WEBP_PALETTE)         // Use palette (0=off, 1=on)
 
+	// JPEG specific encoding options
+	JpegOptimize        = int(C.CV_IMWRITE_JPEG_OPTIMIZE)     // Compute optimal Huffman tables (0=off, 1=on)
+	JpegRestartInterval = int(C.CV_IMWRITE_JPEG_RST_INTERVAL) // MCUs between restart markers (0=none)
+	JpegSubsampling     = int(C.JPEG_SUBSAMPLING)             // Chroma subsampling (one of the JpegSubsampling* values below)
+	JpegDCTMethod       = int(C.JPEG_DCT_METHOD)              // DCT implementation (one of the JpegDCT* values below)
+
+	// JpegSubsampling values
+	JpegSubsampling420 = int(C.JPEG_SUBSAMPLING_420) // Chroma halved both ways (the default)
+	JpegSubsampling422 = int(C.JPEG_SUBSAMPLING_422) // Chroma halved horizontally
+	JpegSubsampling444 = int(C.JPEG_SUBSAMPLING_444) // Full resolution chroma
+
+	// JpegDCTMethod values
+	JpegDCTIslow = int(C.JPEG_DCT_ISLOW) // Accurate integer DCT (the default)
+	JpegDCTIfast = int(C.JPEG_DCT_IFAST) // Faster, less accurate integer DCT
+	JpegDCTFloat = int(C.JPEG_DCT_FLOAT) // Floating point DCT
+
+	// PNG specific encoding options
+	PngStrategy  = int(C.CV_IMWRITE_PNG_STRATEGY) // Deflate strategy (one of the PngStrategy* values below)
+	PngRowFilter = int(C.PNG_ROW_FILTER)          // Row filter (one of the PngRowFilter* values below)
+	// PngPaletteQuality writes 8-bit frames as palette PNGs of up to 256
+	// colours, with alpha, when quantizing them to that many rates at least
+	// this quality (1-100, 100 meaning exact). Frames that fall short are
+	// written in full colour. 0, the default, never quantizes.
+	PngPaletteQuality = int(C.PNG_PALETTE_QUALITY)
+
+	// PngStrategy values. Without PngCompression the default is RLE, and
+	// with it Default
+	PngStrategyDefault     = int(C.PNG_STRATEGY_DEFAULT)      // zlib's default matching
+	PngStrategyFiltered    = int(C.PNG_STRATEGY_FILTERED)     // Favour Huffman coding over matches
+	PngStrategyHuffmanOnly = int(C.PNG_STRATEGY_HUFFMAN_ONLY) // Huffman coding alone
+	PngStrategyRLE         = int(C.PNG_STRATEGY_RLE)          // Matches of distance one only, fast and suited to photos
+	PngStrategyFixed       = int(C.PNG_STRATEGY_FIXED)        // Fixed Huffman codes
+	PngStrategyAuto        = int(C.PNG_STRATEGY_AUTO)         // Default for screenshots and artwork, RLE for photos
+
+	// PngRowFilter values. Without PngCompression the default is Sub, and
+	// with it Adaptive
+	PngRowFilterNone     = int(C.PNG_ROW_FILTER_NONE)     // Rows stored as they are
+	PngRowFilterSub      = int(C.PNG_ROW_FILTER_SUB)      // Difference from the pixel to the left
+	PngRowFilterUp       = int(C.PNG_ROW_FILTER_UP)       // Difference from the pixel above
+	PngRowFilterAvg      = int(C.PNG_ROW_FILTER_AVG)      // Difference from the mean of left and above
+	PngRowFilterPaeth    = int(C.PNG_ROW_FILTER_PAETH)    // Difference from the Paeth predictor
+	PngRowFilterAdaptive = int(C.PNG_ROW_FILTER_ADAPTIVE) // Each row's filter chosen by least sum of absolute differences
+
+	// GIF specific encoding options
+	GifDither = int(C.GIF_DITHER) // Palette dithering mode (one of the GifDither* values below)
+
+	// GifDither values
+	GifDitherNone           = int(C.GIF_DITHER_NONE)            // Nearest palette entry, no dithering
+	GifDitherOrdered        = int(C.GIF_DITHER_ORDERED)         // 8x8 Bayer ordered dither
+	GifDitherFloydSteinberg = int(C.GIF_DITHER_FLOYD_STEINBERG) // Serpentine Floyd-Steinberg error diffusion
+
 	// Image orientation constants
 	OrientationTopLeft     = ImageOrientation(C.CV_IMAGE_ORIENTATION_TL)
 	OrientationTopRight    = ImageOrientation(C.CV_IMAGE_ORIENTATION_TR)
@@ -116,7 +193,8 @@ type ImageHeader struct {
 
 // Framebuffer contains an array of raw, decoded pixel data.
 type Framebuffer struct {
-	buf       []byte        // Raw pixel data
+	buf       []byte        // Raw pixel data, taken from the framebuffer pool on demand
+	maxBytes  int           // Largest buffer resizeMat may take for buf
 	mat       C.opencv_mat  // OpenCV matrix containing the pixel data
 	width     int           // Width of the frame in pixels
 	height    int           // Height of the frame in pixels
@@ -126,6 +204,12 @@ type Framebuffer struct {
 	yOffset   int           // Y offset for drawing this frame
 	dispose   DisposeMethod // How to dispose previous frame
 	blend     BlendMethod   // How to blend with previous frame
+	// premultiplied is set while the colour channels hold colour * alpha / 255
+	// rather than straight colour; see ImageOps.decode and ImageOps.encode
+	premultiplied bool
+	// highDepth lets resizeMat keep 16-bit samples rather than narrowing
+	// every frame to 8 bits; see ImageOptions.PreserveHighBitDepth
+	highDepth bool
 }
 
 // openCVDecoder implements the Decoder interface for images supported by OpenCV.
@@ -135,6 +219,23 @@ type openCVDecoder struct {
 	buf           []byte           // Original encoded image data
 	hasReadHeader bool             // Whether header has been read
 	hasDecoded    bool             // Whether image has been decoded
+	crop          image.Rectangle  // Region to decode, set by setCrop; empty for all of it
+	icc           []byte           // Interned ICC profile, once hasReadICC is set
+	hasReadICC    bool             // Whether the ICC profile has been read
+}
+
+// jpegEncoder implements the Encoder interface for JPEG, compressing frames
+// with libjpeg-turbo straight into dstBuf.
+type jpegEncoder struct {
+	dstBuf []byte // Destination buffer for encoded data
+	icc    []byte // ICC color profile to embed, if any
+}
+
+// pngEncoder implements the Encoder interface for PNG, deflating frames in
+// parallel stripes straight into dstBuf.
+type pngEncoder struct {
+	dstBuf  []byte // Destination buffer for encoded data
+	threads int    // Number of threads deflate may use
 }
 
 // openCVEncoder implements the Encoder interface for images supported by OpenCV.
@@ -204,27 +305,46 @@ func (h *ImageHeader) ContentLength() int {
 }
 
 // NewFramebuffer creates a backing store for a pixel frame buffer with the specified dimensions.
+// No pixel memory is allocated until a frame is decoded or resized into it.
 func NewFramebuffer(width, height int) *Framebuffer {
 	return &Framebuffer{
-		buf: make([]byte, width*height*4),
-		mat: nil,
+		maxBytes: width * height * 4,
+		mat:      nil,
 	}
 }
 
 // Close releases the resources associated with Framebuffer.
 func (f *Framebuffer) Close() {
+	f.releaseBuf()
+}
+
+// Clear discards the pixel data in Framebuffer and returns its memory to the
+// shared framebuffer pool. The Framebuffer holds no pixels until it is next
+// decoded or resized into.
+func (f *Framebuffer) Clear() {
+	f.releaseBuf()
+	f.width = 0
+	f.height = 0
+}
+
+// releaseBuf drops the mat and hands buf back to the framebuffer pool.
+func (f *Framebuffer) releaseBuf() {
 	if f.mat != nil {
 		C.opencv_mat_release(f.mat)
 		f.mat = nil
 	}
+	putFramebufferBuf(f.buf)
+	f.buf = nil
 }
 
-// Clear resets all pixel data in Framebuffer for the active frame and resets the mat if it exists.
-func (f *Framebuffer) Clear() {
-	C.memset(unsafe.Pointer(&f.buf[0]), 0, C.size_t(len(f.buf)))
-	if f.mat != nil {
-		C.opencv_mat_reset(f.mat)
+// reserve makes buf at least n bytes long, replacing it with a larger pooled
+// buffer if necessary. Pixel data is not preserved across a replacement.
+func (f *Framebuffer) reserve(n int) {
+	if f.buf != nil && len(f.buf) >= n {
+		return
 	}
+	f.releaseBuf()
+	f.buf = getFramebufferBuf(n)
 }
 
 // Create3Channel initializes the framebuffer for 3-channel (RGB) image data.
@@ -232,7 +352,7 @@ func (f *Framebuffer) Create3Channel(width, height int) error {
 	if err := f.resizeMat(width, height, C.CV_8UC3); err != nil {
 		return err
 	}
-	f.Clear()
+	C.opencv_mat_reset(f.mat)
 	return nil
 }
 
@@ -241,11 +361,13 @@ func (f *Framebuffer) Create4Channel(width, height int) error {
 	if err := f.resizeMat(width, height, C.CV_8UC4); err != nil {
 		return err
 	}
-	f.Clear()
+	C.opencv_mat_reset(f.mat)
 	return nil
 }
 
 // resizeMat resizes the OpenCV matrix to the specified dimensions and pixel type.
+// Deeper pixel types are narrowed to 8 bits, unless highDepth is set and a
+// 16-bit frame of that size fits in maxBytes.
 // Returns ErrBufTooSmall if the matrix cannot be created at the specified size.
 func (f *Framebuffer) resizeMat(width, height int, pixelType PixelType) error {
 	if f.mat != nil {
@@ -253,8 +375,17 @@ func (f *Framebuffer) resizeMat(width, height int, pixelType PixelType) error {
 		f.mat = nil
 	}
 	if pixelType.Depth() > 8 {
-		pixelType = PixelType(C.opencv_type_convert_depth(C.int(pixelType), C.CV_8U))
+		if f.highDepth && width*height*pixelType.Channels()*2 <= f.maxBytes {
+			pixelType = PixelType(C.opencv_type_convert_depth(C.int(pixelType), C.CV_16U))
+		} else {
+			pixelType = PixelType(C.opencv_type_convert_depth(C.int(pixelType), C.CV_8U))
+		}
 	}
+	size := width * height * pixelType.Channels() * pixelType.Depth() / 8
+	if width < 0 || height < 0 || size > f.maxBytes {
+		return ErrBufTooSmall
+	}
+	f.reserve(size)
 	newMat := C.opencv_mat_create_from_data(C.int(width), C.int(height), C.int(pixelType), unsafe.Pointer(&f.buf[0]), C.size_t(len(f.buf)))
 	if newMat == nil {
 		return ErrBufTooSmall
@@ -263,17 +394,33 @@ func (f *Framebuffer) resizeMat(width, height int, pixelType PixelType) error {
 	f.width = width
 	f.height = height
 	f.pixelType = pixelType
+	f.premultiplied = false
 	return nil
 }
 
+// setFrameInfo sets the animation properties of a frame from those its
+// decoder reported while decoding it.
+func (f *Framebuffer) setFrameInfo(info *C.lilliput_frame_info) {
+	f.duration = time.Duration(info.duration_ms) * time.Millisecond
+	f.xOffset = int(info.x_offset)
+	f.yOffset = int(info.y_offset)
+	f.dispose = DisposeMethod(info.dispose)
+	f.blend = BlendMethod(info.blend)
+}
+
 // OrientationTransform rotates and/or mirrors the Framebuffer according to the given orientation.
 // Passing the orientation from ImageHeader will normalize the orientation.
 func (f *Framebuffer) OrientationTransform(orientation ImageOrientation) {
+	f.orientationTransform(orientation, 1)
+}
+
+// orientationTransform is OrientationTransform split across up to threads threads.
+func (f *Framebuffer) orientationTransform(orientation ImageOrientation, threads int) {
 	if f.mat == nil {
 		return
 	}
 
-	C.opencv_mat_orientation_transform(C.CVImageOrientation(orientation), f.mat)
+	C.opencv_mat_orientation_transform(C.CVImageOrientation(orientation), f.mat, C.int(threads))
 	f.width = int(C.opencv_mat_get_width(f.mat))
 	f.height = int(C.opencv_mat_get_height(f.mat))
 }
@@ -287,11 +434,53 @@ func IsHDRICCProfile(icc []byte) bool {
 	return bool(C.is_hdr_transfer_function((*C.uint8_t)(unsafe.Pointer(&icc[0])), C.size_t(len(icc))))
 }
 
+// iccConvertsToSRGB reports whether ConvertToSRGB can convert pixels tagged
+// with icc, which must be a non-HDR RGB profile.
+func iccConvertsToSRGB(icc []byte) bool {
+	if len(icc) == 0 {
+		return false
+	}
+	return bool(C.icc_converts_to_srgb((*C.uint8_t)(unsafe.Pointer(&icc[0])), C.size_t(len(icc))))
+}
+
+func newResampler() *resampler {
+	return &resampler{resampler: C.opencv_resampler_create(), threads: 1}
+}
+
+// clear drops the cached tables and scratch memory.
+func (r *resampler) clear() {
+	C.opencv_resampler_clear(r.resampler)
+}
+
+// Close releases the resampler.
+func (r *resampler) Close() {
+	C.opencv_resampler_release(r.resampler)
+}
+
+// resample resizes src into dst with r's filter and threads, or with
+// ResizeFilterArea on one thread and no caching if r is nil.
+func resample(src, dst C.opencv_mat, r *resampler) error {
+	var handle C.opencv_resampler
+	filter := ResizeFilterArea
+	threads := 1
+	if r != nil {
+		handle = r.resampler
+		filter = r.filter
+		threads = r.threads
+	}
+	return handleOpenCVError(C.opencv_mat_resample(handle, src, dst, C.int(filter), C.int(threads)))
+}
+
 // ResizeTo performs a resizing transform on the Framebuffer and puts the result
 // in the provided destination Framebuffer. This function does not preserve aspect
 // ratio if the given dimensions differ in ratio from the source. Returns an error
 // if the destination is not large enough to hold the given dimensions.
 func (f *Framebuffer) ResizeTo(width, height int, dst *Framebuffer) error {
+	return f.resizeTo(width, height, dst, nil)
+}
+
+// resizeTo is ResizeTo with the filter and table cache of r.
+func (f *Framebuffer) resizeTo(width, height int, dst *Framebuffer, r *resampler) error {
 	if width < 1 {
 		width = 1
 	}
@@ -304,8 +493,8 @@ func (f *Framebuffer) ResizeTo(width, height int, dst *Framebuffer) error {
 	if err != nil {
 		return err
 	}
-	C.opencv_mat_resize(f.mat, dst.mat, C.int(width), C.int(height), C.CV_INTER_AREA)
-	return nil
+	dst.premultiplied = f.premultiplied
+	return resample(f.mat, dst.mat, r)
 }
 
 // ClearToTransparent clears a rectangular region of the framebuffer to transparent.
@@ -324,23 +513,43 @@ func (f *Framebuffer) ClearToTransparent(rect image.Rectangle) error {
 // keep from stretching the image content. Returns an error if the destination is
 // not large enough to hold the given dimensions.
 func (f *Framebuffer) Fit(width, height int, dst *Framebuffer) error {
+	return f.fit(width, height, dst, nil)
+}
+
+// fit is Fit with the filter and table cache of r.
+func (f *Framebuffer) fit(width, height int, dst *Framebuffer, r *resampler) error {
 	if f.mat == nil {
 		return ErrFrameBufNoPixels
 	}
 
-	aspectIn := float64(f.width) / float64(f.height)
-	aspectOut := float64(width) / float64(height)
+	crop := fitCrop(f.width, f.height, width, height)
+	newMat := C.opencv_mat_crop(f.mat, C.int(crop.Min.X), C.int(crop.Min.Y), C.int(crop.Dx()), C.int(crop.Dy()))
+	defer C.opencv_mat_release(newMat)
+
+	err := dst.resizeMat(width, height, f.pixelType)
+	if err != nil {
+		return err
+	}
+	dst.premultiplied = f.premultiplied
+	return resample(newMat, dst.mat, r)
+}
+
+// fitCrop returns the centred region of a width x height image that Fit keeps
+// when filling width x height of output without stretching.
+func fitCrop(width, height, outputWidth, outputHeight int) image.Rectangle {
+	aspectIn := float64(width) / float64(height)
+	aspectOut := float64(outputWidth) / float64(outputHeight)
 
 	var widthPostCrop, heightPostCrop int
 	if aspectIn > aspectOut {
 		// input is wider than output, so we'll need to narrow
 		// we preserve input height and reduce width
-		widthPostCrop = int((aspectOut * float64(f.height)) + 0.5)
-		heightPostCrop = f.height
+		widthPostCrop = int((aspectOut * float64(height)) + 0.5)
+		heightPostCrop = height
 	} else {
 		// input is taller than output, so we'll need to shrink
-		heightPostCrop = int((float64(f.width) / aspectOut) + 0.5)
-		widthPostCrop = f.width
+		heightPostCrop = int((float64(width) / aspectOut) + 0.5)
+		widthPostCrop = width
 	}
 
 	if widthPostCrop < 1 {
@@ -352,25 +561,17 @@ func (f *Framebuffer) Fit(width, height int, dst *Framebuffer) error {
 	}
 
 	var left, top int
-	left = int(float64(f.width-widthPostCrop) * 0.5)
+	left = int(float64(width-widthPostCrop) * 0.5)
 	if left < 0 {
 		left = 0
 	}
 
-	top = int(float64(f.height-heightPostCrop) * 0.5)
+	top = int(float64(height-heightPostCrop) * 0.5)
 	if top < 0 {
 		top = 0
 	}
 
-	newMat := C.opencv_mat_crop(f.mat, C.int(left), C.int(top), C.int(widthPostCrop), C.int(heightPostCrop))
-	defer C.opencv_mat_release(newMat)
-
-	err := dst.resizeMat(width, height, f.pixelType)
-	if err != nil {
-		return err
-	}
-	C.opencv_mat_resize(newMat, dst.mat, C.int(width), C.int(height), C.CV_INTER_AREA)
-	return nil
+	return image.Rect(left, top, left+widthPostCrop, top+heightPostCrop)
 }
 
 // Width returns the width of the contained pixel data in number of pixels. This may
@@ -428,6 +629,17 @@ func handleOpenCVError(result C.int) error {
 // CopyToOffsetWithAlphaBlending copies the source framebuffer to a specified rectangle within the destination framebuffer.
 // This function performs alpha blending.
 func (f *Framebuffer) CopyToOffsetWithAlphaBlending(src *Framebuffer, rect image.Rectangle) error {
+	if src.premultiplied {
+		// the destination takes on the source's representation, as with
+		// CopyToOffsetNoBlend; a composite starts out cleared to transparent,
+		// which reads the same either way
+		result := C.opencv_copy_to_region_premultiplied(src.mat, f.mat, C.int(rect.Min.X), C.int(rect.Min.Y), C.int(rect.Dx()), C.int(rect.Dy()))
+		if err := handleOpenCVError(result); err != nil {
+			return err
+		}
+		f.premultiplied = true
+		return nil
+	}
 	result := C.opencv_copy_to_region_with_alpha(src.mat, f.mat, C.int(rect.Min.X), C.int(rect.Min.Y), C.int(rect.Dx()), C.int(rect.Dy()))
 	return handleOpenCVError(result)
 }
@@ -436,7 +648,42 @@ func (f *Framebuffer) CopyToOffsetWithAlphaBlending(src *Framebuffer, rect image
 // This function does not perform any blending.
 func (f *Framebuffer) CopyToOffsetNoBlend(src *Framebuffer, rect image.Rectangle) error {
 	result := C.opencv_copy_to_region(src.mat, f.mat, C.int(rect.Min.X), C.int(rect.Min.Y), C.int(rect.Dx()), C.int(rect.Dy()))
-	return handleOpenCVError(result)
+	if err := handleOpenCVError(result); err != nil {
+		return err
+	}
+	f.premultiplied = src.premultiplied
+	return nil
+}
+
+// premultiplyAlpha scales the colour of a 4-channel framebuffer by its alpha,
+// in up to threads stripes, so that resizes weight colour by coverage and
+// alpha compositing needs no division. Other framebuffers are left straight.
+func (f *Framebuffer) premultiplyAlpha(threads int) {
+	if f.premultiplied || f.mat == nil {
+		return
+	}
+	f.premultiplied = bool(C.opencv_mat_premultiply_alpha(f.mat, C.int(threads)))
+}
+
+// unpremultiplyAlpha undoes premultiplyAlpha.
+func (f *Framebuffer) unpremultiplyAlpha(threads int) {
+	if !f.premultiplied || f.mat == nil {
+		return
+	}
+	C.opencv_mat_unpremultiply_alpha(f.mat, C.int(threads))
+	f.premultiplied = false
+}
+
+// syncRegionFrom makes rect of f match the same region of src and reports
+// whether it differed beforehand. Both framebuffers must have the same
+// dimensions and pixel type.
+func (f *Framebuffer) syncRegionFrom(src *Framebuffer, rect image.Rectangle) (bool, error) {
+	var changed C.bool
+	result := C.opencv_mat_sync_region(src.mat, f.mat, C.int(rect.Min.X), C.int(rect.Min.Y), C.int(rect.Dx()), C.int(rect.Dy()), &changed)
+	if err := handleOpenCVError(result); err != nil {
+		return false, err
+	}
+	return bool(changed), nil
 }
 
 func newOpenCVDecoder(buf []byte) (*openCVDecoder, error) {
@@ -695,25 +942,29 @@ func (d *openCVDecoder) HasSubtitles() bool {
 }
 
 func (d *openCVDecoder) ICC() []byte {
+	if d.hasReadICC {
+		return d.icc
+	}
 	switch d.Description() {
 	case "JPEG":
-		return d.iccJPEG()
+		d.icc = d.iccJPEG()
 	case "PNG":
-		return d.iccPNG()
+		d.icc = d.iccPNG()
 	}
-	return []byte{}
+	d.hasReadICC = true
+	return d.icc
 }
 
 func (d *openCVDecoder) iccJPEG() []byte {
-	iccDst := make([]byte, ICCProfileBufferSize)
-	iccLength := C.opencv_decoder_get_jpeg_icc(unsafe.Pointer(&d.buf[0]), C.size_t(len(d.buf)), unsafe.Pointer(&iccDst[0]), C.size_t(cap(iccDst)))
-	return iccDst[:iccLength]
+	return readICC(func(dst []byte) int {
+		return int(C.opencv_decoder_get_jpeg_icc(unsafe.Pointer(&d.buf[0]), C.size_t(len(d.buf)), unsafe.Pointer(&dst[0]), C.size_t(len(dst))))
+	})
 }
 
 func (d *openCVDecoder) iccPNG() []byte {
-	iccDst := make([]byte, ICCProfileBufferSize)
-	iccLength := C.opencv_decoder_get_png_icc(unsafe.Pointer(&d.buf[0]), C.size_t(len(d.buf)), unsafe.Pointer(&iccDst[0]), C.size_t(cap(iccDst)))
-	return iccDst[:iccLength]
+	return readICC(func(dst []byte) int {
+		return int(C.opencv_decoder_get_png_icc(unsafe.Pointer(&d.buf[0]), C.size_t(len(d.buf)), unsafe.Pointer(&dst[0]), C.size_t(len(dst))))
+	})
 }
 
 // CICP describes the colour space of an image using ITU-T H.273 code points,
@@ -768,14 +1019,12 @@ func (d *openCVDecoder) CICP() (CICP, bool) {
 
 // SynthesizeICC returns a canned ICC profile matching this signalling's colour
 // primaries, for carrying the cICP information into an output format that has
-// no cICP channel of its own.
+// no cICP channel of its own. The profile is shared static data and must not
+// be modified.
 func (c CICP) SynthesizeICC() []byte {
 	var size C.size_t
 	data := C.cicp_get_icc_profile(C.uint8_t(c.Primaries), &size)
-	if data == nil || size == 0 {
-		return nil
-	}
-	return C.GoBytes(unsafe.Pointer(data), C.int(size))
+	return cICC(unsafe.Pointer(data), size)
 }
 
 // ICCHeaderIsSane reports whether an ICC blob's declared size field matches its
@@ -788,16 +1037,74 @@ func ICCHeaderIsSane(icc []byte) bool {
 	return bool(C.icc_header_is_sane((*C.uint8_t)(unsafe.Pointer(&icc[0])), C.size_t(len(icc))))
 }
 
+// ConvertToSRGB converts the colour pixels in the framebuffer from the colour
+// space of the ICC profile icc to sRGB in place, after which they are
+// displayed correctly without a profile. It reports false, leaving the
+// pixels untouched, for profiles it cannot convert from and for frames that
+// are not BGR or BGRA. The pixels must not be premultiplied.
+func (f *Framebuffer) ConvertToSRGB(icc []byte) bool {
+	return f.convertToSRGB(icc, 1)
+}
+
+// convertToSRGB is ConvertToSRGB split across up to threads threads.
+func (f *Framebuffer) convertToSRGB(icc []byte, threads int) bool {
+	if f.mat == nil || f.width <= 0 || f.height <= 0 || len(icc) == 0 {
+		return false
+	}
+	channels := f.pixelType.Channels()
+	depth := f.pixelType.Depth()
+	return bool(C.icc_transform_to_srgb(
+		(*C.uint8_t)(unsafe.Pointer(&icc[0])),
+		C.size_t(len(icc)),
+		unsafe.Pointer(&f.buf[0]),
+		C.int(f.width),
+		C.int(f.height),
+		C.size_t(f.width*channels*depth/8),
+		C.int(channels),
+		C.int(depth),
+		C.int(threads),
+	))
+}
+
 // TonemapToSDR converts HDR pixels in the framebuffer to SDR BT.709 in place,
 // using the same Reinhard tone-map and primaries conversion the AVIF decoder
-// applies to HDR AVIF sources.
+// applies to HDR AVIF sources. A 16-bit frame is narrowed to 8 bits, and one
+// that cannot be is left without a mat rather than tone-mapped.
 func (f *Framebuffer) TonemapToSDR(c CICP) {
+	_ = f.tonemapToSDR(c, 1)
+}
+
+// tonemapToSDR is TonemapToSDR split across up to threads threads. A 16-bit
+// frame is always tone-mapped on one thread, which is what lets it be
+// narrowed to 8 bits in place; tonemapTo spreads it across threads instead.
+// The 8-bit mat is set up over buf before the tone-map, so that a frame which
+// cannot be narrowed is not tone-mapped and the error is returned.
+func (f *Framebuffer) tonemapToSDR(c CICP, threads int) error {
 	if f.mat == nil || f.width <= 0 || f.height <= 0 {
-		return
+		return nil
 	}
 	channels := f.pixelType.Channels()
 	if channels != 3 && channels != 4 {
-		return
+		return nil
+	}
+	if f.pixelType.Depth() > 8 {
+		// buf will hold the 8-bit frame at its start, which the smaller mat
+		// takes over as is
+		width, height := f.width, f.height
+		if err := f.resizeMat(width, height, PixelType(C.opencv_type_convert_depth(C.int(f.pixelType), C.CV_8U))); err != nil {
+			return err
+		}
+		C.tonemap_rgb_16u(
+			(*C.uint16_t)(unsafe.Pointer(&f.buf[0])),
+			(*C.uint8_t)(unsafe.Pointer(&f.buf[0])),
+			C.int(width),
+			C.int(height),
+			C.int(channels),
+			C.uint8_t(c.Transfer),
+			C.uint8_t(c.Primaries),
+			1,
+		)
+		return nil
 	}
 	C.tonemap_rgb_8u_inplace(
 		(*C.uint8_t)(unsafe.Pointer(&f.buf[0])),
@@ -806,7 +1113,47 @@ func (f *Framebuffer) TonemapToSDR(c CICP) {
 		C.int(channels),
 		C.uint8_t(c.Transfer),
 		C.uint8_t(c.Primaries),
+		C.int(threads),
 	)
+	return nil
+}
+
+// tonemapTo writes the 8-bit SDR tone-map of the 16-bit frame in f to dst,
+// split across up to threads threads.
+func (f *Framebuffer) tonemapTo(c CICP, dst *Framebuffer, threads int) error {
+	channels := f.pixelType.Channels()
+	if channels != 3 && channels != 4 {
+		return ErrInvalidImage
+	}
+	err := dst.resizeMat(f.width, f.height, PixelType(C.opencv_type_convert_depth(C.int(f.pixelType), C.CV_8U)))
+	if err != nil {
+		return err
+	}
+	C.tonemap_rgb_16u(
+		(*C.uint16_t)(unsafe.Pointer(&f.buf[0])),
+		(*C.uint8_t)(unsafe.Pointer(&dst.buf[0])),
+		C.int(f.width),
+		C.int(f.height),
+		C.int(channels),
+		C.uint8_t(c.Transfer),
+		C.uint8_t(c.Primaries),
+		C.int(threads),
+	)
+	return nil
+}
+
+// narrowTo writes the 16-bit frame in f to dst with 8-bit samples, leaving
+// any premultiplied alpha as it is.
+func (f *Framebuffer) narrowTo(dst *Framebuffer) error {
+	err := dst.resizeMat(f.width, f.height, PixelType(C.opencv_type_convert_depth(C.int(f.pixelType), C.CV_8U)))
+	if err != nil {
+		return err
+	}
+	if !C.opencv_mat_narrow_to_8u(f.mat, dst.mat) {
+		return ErrInvalidImage
+	}
+	dst.premultiplied = f.premultiplied
+	return nil
 }
 
 func (d *openCVDecoder) Duration() time.Duration {
@@ -821,11 +1168,20 @@ func (d *openCVDecoder) DecodeTo(f *Framebuffer) error {
 	if err != nil {
 		return err
 	}
-	err = f.resizeMat(h.Width(), h.Height(), h.PixelType())
+	if d.crop.Empty() {
+		err = f.resizeMat(h.Width(), h.Height(), h.PixelType())
+	} else {
+		err = f.resizeMat(d.crop.Dx(), d.crop.Dy(), h.PixelType())
+	}
 	if err != nil {
 		return err
 	}
-	ret := C.opencv_decoder_read_data(d.decoder, f.mat)
+	var ret C.bool
+	if d.crop.Empty() {
+		ret = C.opencv_decoder_read_data(d.decoder, f.mat)
+	} else {
+		ret = C.opencv_decoder_read_region(d.decoder, unsafe.Pointer(&d.buf[0]), C.size_t(len(d.buf)), f.mat, C.int(d.crop.Min.X), C.int(d.crop.Min.Y))
+	}
 	if !ret {
 		return ErrDecodingFailed
 	}
@@ -838,6 +1194,13 @@ func (d *openCVDecoder) DecodeTo(f *Framebuffer) error {
 	return nil
 }
 
+// setCrop makes DecodeTo decode only rect of the image. JPEGs and PNGs skip
+// the work for the pixels outside it where they can; other images are
+// decoded whole and cropped.
+func (d *openCVDecoder) setCrop(rect image.Rectangle) {
+	d.crop = rect
+}
+
 func (d *openCVDecoder) SkipFrame() error {
 	return ErrSkipNotSupported
 }
@@ -899,6 +1262,107 @@ func (e *openCVEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error)
 	return e.dstBuf[:length], nil
 }
 
+// newJpegEncoder creates a JPEG encoder that embeds the ICC profile of
+// decodedBy, or the one config picks instead.
+func newJpegEncoder(decodedBy Decoder, dstBuf []byte, config *EncodeConfig) (*jpegEncoder, error) {
+	var icc []byte
+	if config != nil && config.DropICC {
+		icc = nil
+	} else if config != nil && len(config.ICCOverride) > 0 {
+		icc = config.ICCOverride
+	} else {
+		icc = decodedBy.ICC()
+	}
+	if len(icc) > 0 && !ICCHeaderIsSane(icc) {
+		icc = nil
+	}
+	return &jpegEncoder{
+		dstBuf: dstBuf[:1],
+		icc:    icc,
+	}, nil
+}
+
+func (e *jpegEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
+	if f == nil {
+		return nil, io.EOF
+	}
+	if f.mat == nil {
+		return nil, ErrFrameBufNoPixels
+	}
+	var optList []C.int
+	var firstOpt *C.int
+	for k, v := range opt {
+		optList = append(optList, C.int(k), C.int(v))
+	}
+	if len(optList) > 0 {
+		firstOpt = &optList[0]
+	}
+	var icc unsafe.Pointer
+	if len(e.icc) > 0 {
+		icc = unsafe.Pointer(&e.icc[0])
+	}
+
+	var length C.size_t
+	switch C.opencv_jpeg_encode(f.mat, firstOpt, C.size_t(len(optList)), icc, C.size_t(len(e.icc)), unsafe.Pointer(&e.dstBuf[0]), C.size_t(cap(e.dstBuf)), &length) {
+	case C.OPENCV_JPEG_ENCODE_OK:
+		return e.dstBuf[:length], nil
+	case C.OPENCV_JPEG_ENCODE_BUF_TOO_SMALL:
+		return nil, ErrBufTooSmall
+	default:
+		return nil, ErrInvalidImage
+	}
+}
+
+func (e *jpegEncoder) Close() {}
+
+// newPngEncoder creates a PNG encoder. config is accepted for API uniformity
+// but not used.
+func newPngEncoder(decodedBy Decoder, dstBuf []byte, config *EncodeConfig) (*pngEncoder, error) {
+	return &pngEncoder{
+		dstBuf:  dstBuf[:1],
+		threads: 1,
+	}, nil
+}
+
+func (e *pngEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
+	if f == nil {
+		return nil, io.EOF
+	}
+	if f.mat == nil {
+		return nil, ErrFrameBufNoPixels
+	}
+	var optList []C.int
+	var firstOpt *C.int
+	for k, v := range opt {
+		optList = append(optList, C.int(k), C.int(v))
+	}
+	if len(optList) > 0 {
+		firstOpt = &optList[0]
+	}
+
+	var length C.size_t
+	switch C.opencv_png_encode(f.mat, firstOpt, C.size_t(len(optList)), C.int(e.threads), unsafe.Pointer(&e.dstBuf[0]), C.size_t(cap(e.dstBuf)), &length) {
+	case C.OPENCV_PNG_ENCODE_OK:
+		return e.dstBuf[:length], nil
+	case C.OPENCV_PNG_ENCODE_BUF_TOO_SMALL:
+		return nil, ErrBufTooSmall
+	default:
+		return nil, ErrInvalidImage
+	}
+}
+
+// acceptsHighDepth reports that Encode stores 16-bit frames as they are.
+func (e *pngEncoder) acceptsHighDepth() bool {
+	return true
+}
+
+// setParallelism lets Encode deflate large frames in up to n stripes at once.
+func (e *pngEncoder) setParallelism(n int) {
+	e.threads = n
+}
+
+func (e *pngEncoder) Close() {}
+
 func (e *openCVEncoder) Close() {
 	C.opencv_encoder_release(e.encoder)
 	C.opencv_mat_release(e.dst)
@@ -34,6 +34,9 @@ extern "C" {
 #define CV_IMWRITE_PNG_COMPRESSION 16
 #define CV_IMWRITE_WEBP_QUALITY 64
 #define CV_IMWRITE_JPEG_PROGRESSIVE 2
+#define CV_IMWRITE_JPEG_OPTIMIZE 3
+#define CV_IMWRITE_JPEG_RST_INTERVAL 4
+#define CV_IMWRITE_PNG_STRATEGY 17
 
 #ifdef __cplusplus
 // Verify values match OpenCV's at compile time
@@ -43,8 +46,77 @@ static_assert(CV_IMWRITE_PNG_COMPRESSION == cv::IMWRITE_PNG_COMPRESSION,
 static_assert(CV_IMWRITE_WEBP_QUALITY == cv::IMWRITE_WEBP_QUALITY, "WEBP_QUALITY mismatch");
 static_assert(CV_IMWRITE_JPEG_PROGRESSIVE == cv::IMWRITE_JPEG_PROGRESSIVE,
               "JPEG_PROGRESSIVE mismatch");
+static_assert(CV_IMWRITE_JPEG_OPTIMIZE == cv::IMWRITE_JPEG_OPTIMIZE, "JPEG_OPTIMIZE mismatch");
+static_assert(CV_IMWRITE_JPEG_RST_INTERVAL == cv::IMWRITE_JPEG_RST_INTERVAL,
+              "JPEG_RST_INTERVAL mismatch");
+static_assert(CV_IMWRITE_PNG_STRATEGY == cv::IMWRITE_PNG_STRATEGY, "PNG_STRATEGY mismatch");
 #endif
 
+// JPEG encoder options of our own, alongside the CV_IMWRITE_JPEG_* ones
+enum JpegEncoderOptions {
+    JPEG_SUBSAMPLING = 1100,
+    JPEG_DCT_METHOD = 1101,
+};
+
+enum JpegSubsampling {
+    JPEG_SUBSAMPLING_420 = 0,
+    JPEG_SUBSAMPLING_422 = 1,
+    JPEG_SUBSAMPLING_444 = 2,
+};
+
+enum JpegDctMethod {
+    JPEG_DCT_ISLOW = 0,
+    JPEG_DCT_IFAST = 1,
+    JPEG_DCT_FLOAT = 2,
+};
+
+enum OpencvJpegEncodeResult {
+    OPENCV_JPEG_ENCODE_OK = 0,
+    OPENCV_JPEG_ENCODE_BUF_TOO_SMALL = 1,
+    OPENCV_JPEG_ENCODE_FAILED = 2,
+};
+
+// Results of opencv_jpeg_transform. UNSUPPORTED means the image cannot be
+// transformed losslessly as asked, and nothing has been written to dst.
+enum OpencvJpegTransformResult {
+    OPENCV_JPEG_TRANSFORM_OK = 0,
+    OPENCV_JPEG_TRANSFORM_BUF_TOO_SMALL = 1,
+    OPENCV_JPEG_TRANSFORM_UNSUPPORTED = 2,
+};
+
+// PNG encoder options of our own, alongside the CV_IMWRITE_PNG_* ones
+enum PngEncoderOptions {
+    PNG_ROW_FILTER = 1200,
+    PNG_PALETTE_QUALITY = 1201,
+};
+
+// zlib's strategies, which OpenCV's IMWRITE_PNG_STRATEGY values match, and
+// AUTO, which picks DEFAULT or RLE by what the image looks like
+enum PngStrategy {
+    PNG_STRATEGY_DEFAULT = 0,
+    PNG_STRATEGY_FILTERED = 1,
+    PNG_STRATEGY_HUFFMAN_ONLY = 2,
+    PNG_STRATEGY_RLE = 3,
+    PNG_STRATEGY_FIXED = 4,
+    PNG_STRATEGY_AUTO = 5,
+};
+
+// PNG's filter types, and ADAPTIVE, which picks one for each row
+enum PngRowFilter {
+    PNG_ROW_FILTER_NONE = 0,
+    PNG_ROW_FILTER_SUB = 1,
+    PNG_ROW_FILTER_UP = 2,
+    PNG_ROW_FILTER_AVG = 3,
+    PNG_ROW_FILTER_PAETH = 4,
+    PNG_ROW_FILTER_ADAPTIVE = 5,
+};
+
+enum OpencvPngEncodeResult {
+    OPENCV_PNG_ENCODE_OK = 0,
+    OPENCV_PNG_ENCODE_BUF_TOO_SMALL = 1,
+    OPENCV_PNG_ENCODE_FAILED = 2,
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -57,6 +129,28 @@ extern const int CV_INTER_CUBIC;  // Cubic interpolation (if you need it)
 typedef void* opencv_mat;
 typedef void* opencv_decoder;
 typedef void* opencv_encoder;
+typedef struct opencv_resampler_struct* opencv_resampler;
+
+// Properties of a decoded frame, which frame decoders fill in as they decode
+// it rather than leaving each to be fetched with a call of its own. dispose
+// and blend hold the values of lilliput's DisposeMethod and BlendMethod.
+typedef struct lilliput_frame_info {
+    int duration_ms;
+    int x_offset;
+    int y_offset;
+    int dispose;
+    int blend;
+} lilliput_frame_info;
+
+// Filter kernels for opencv_mat_resample. AREA averages the source pixels
+// each output pixel covers when shrinking and interpolates linearly when
+// enlarging, like cv::INTER_AREA.
+enum OpenCVResampleKernel {
+    OPENCV_RESAMPLE_AREA = 0,
+    OPENCV_RESAMPLE_BOX = 1,
+    OPENCV_RESAMPLE_MITCHELL = 2,
+    OPENCV_RESAMPLE_LANCZOS3 = 3,
+};
 
 int opencv_type_depth(int type);
 int opencv_type_channels(int type);
@@ -72,18 +166,38 @@ int opencv_decoder_get_height(const opencv_decoder d);
 int opencv_decoder_get_pixel_type(const opencv_decoder d);
 int opencv_decoder_get_orientation(const opencv_decoder d);
 bool opencv_decoder_read_data(opencv_decoder d, opencv_mat dst);
+// decode only the region of the image at x, y with the dimensions of dst,
+// which must have the decoder's pixel type. src is the encoded image d was
+// created from. still JPEGs and PNGs skip the work outside the region where
+// they can; anything else is decoded whole and cropped
+bool opencv_decoder_read_region(opencv_decoder d, void* src, size_t src_len, opencv_mat dst, int x, int y);
 int opencv_copy_to_region_with_alpha(opencv_mat src,
                                      opencv_mat dst,
                                      int xOffset,
                                      int yOffset,
                                      int width,
                                      int height);
+// composite premultiplied 8-bit BGRA src over the same size region of dst,
+// which must also be premultiplied 8-bit BGRA
+int opencv_copy_to_region_premultiplied(opencv_mat src,
+                                        opencv_mat dst,
+                                        int xOffset,
+                                        int yOffset,
+                                        int width,
+                                        int height);
 int opencv_copy_to_region(opencv_mat src,
                           opencv_mat dst,
                           int xOffset,
                           int yOffset,
                           int width,
                           int height);
+int opencv_mat_sync_region(opencv_mat src,
+                           opencv_mat dst,
+                           int xOffset,
+                           int yOffset,
+                           int width,
+                           int height,
+                           bool* changed);
 void opencv_mat_set_color(opencv_mat, int red, int green, int blue, int alpha);
 void opencv_mat_reset(opencv_mat mat);
 int opencv_mat_clear_to_transparent(opencv_mat mat,
@@ -106,8 +220,24 @@ void opencv_mat_resize(const opencv_mat src,
                        int width,
                        int height,
                        int interpolation);
+opencv_resampler opencv_resampler_create();
+void opencv_resampler_clear(opencv_resampler r);
+void opencv_resampler_release(opencv_resampler r);
+// resample an 8 or 16-bit src to the dimensions of dst, which must have the same
+// type, in up to `threads` horizontal stripes. r caches filter tables between
+// calls and may be NULL
+int opencv_mat_resample(opencv_resampler r, const opencv_mat src, opencv_mat dst, int kernel, int threads);
+// narrow a 16-bit src into dst, an 8-bit mat of the same size and channel
+// count, rounding each sample to the nearest of 256 levels. returns false if
+// the mats do not match
+bool opencv_mat_narrow_to_8u(const opencv_mat src, opencv_mat dst);
 opencv_mat opencv_mat_crop(const opencv_mat src, int x, int y, int width, int height);
-void opencv_mat_orientation_transform(CVImageOrientation orientation, opencv_mat mat);
+void opencv_mat_orientation_transform(CVImageOrientation orientation, opencv_mat mat, int threads);
+// scale the colour channels of an 8 or 16-bit BGRA mat by alpha over its
+// maximum, or back, in place and in up to `threads` horizontal stripes.
+// returns false, leaving the mat untouched, for any other pixel type
+bool opencv_mat_premultiply_alpha(opencv_mat mat, int threads);
+bool opencv_mat_unpremultiply_alpha(opencv_mat mat, int threads);
 int opencv_mat_get_width(const opencv_mat mat);
 int opencv_mat_get_height(const opencv_mat mat);
 void* opencv_mat_get_data(const opencv_mat mat);
@@ -115,6 +245,51 @@ void* opencv_mat_get_data(const opencv_mat mat);
 opencv_encoder opencv_encoder_create(const char* ext, opencv_mat dst);
 void opencv_encoder_release(opencv_encoder e);
 bool opencv_encoder_write(opencv_encoder e, const opencv_mat src, const int* opt, size_t opt_len);
+// encode src, an 8-bit gray, BGR or BGRA mat, as a JPEG straight into the
+// dst_cap bytes at dst with the encoder options in opt, embedding icc when it
+// is not null. BGRA is read in place, its alpha ignored. On success *dst_len
+// is the length of the output.
+int opencv_jpeg_encode(const opencv_mat src,
+                       const int* opt,
+                       size_t opt_len,
+                       const void* icc,
+                       size_t icc_len,
+                       void* dst,
+                       size_t dst_cap,
+                       size_t* dst_len);
+// losslessly undo the EXIF orientation of the JPEG at src and crop it to the
+// crop_width x crop_height region at crop_x, crop_y of the oriented image,
+// moving its DCT coefficients rather than decoding and encoding its pixels,
+// straight into the dst_cap bytes at dst. The output embeds icc when it is not
+// null and carries no other metadata. Of the encoder options in opt only
+// progressive and optimized coding apply. The image must be 8-bit YCbCr or
+// gray, the transform must not leave partial MCUs behind, and the crop must
+// start on an MCU boundary. On success *dst_len is the length of the output.
+int opencv_jpeg_transform(const void* src,
+                          size_t src_len,
+                          int orientation,
+                          int crop_x,
+                          int crop_y,
+                          int crop_width,
+                          int crop_height,
+                          const int* opt,
+                          size_t opt_len,
+                          const void* icc,
+                          size_t icc_len,
+                          void* dst,
+                          size_t dst_cap,
+                          size_t* dst_len);
+// encode src, an 8 or 16-bit gray, BGR or BGRA mat, as a PNG straight into
+// the dst_cap bytes at dst with the encoder options in opt, deflating it in
+// up to `threads` stripes at once. On success *dst_len is the length of the
+// output.
+int opencv_png_encode(const opencv_mat src,
+                      const int* opt,
+                      size_t opt_len,
+                      int threads,
+                      void* dst,
+                      size_t dst_cap,
+                      size_t* dst_len);
 int opencv_decoder_get_jpeg_icc(void* src, size_t src_len, void* dest, size_t dest_len);
 int opencv_decoder_get_png_icc(void* src, size_t src_len, void* dest, size_t dest_len);
 int opencv_decoder_get_png_cicp(void* src,
@@ -2,7 +2,10 @@ package lilliput
 
 import (
 	"bytes"
+	"encoding/binary"
+	"image"
 	"io/ioutil"
+	"math"
 	"testing"
 )
 
@@ -292,3 +295,1248 @@ func TestICC(t *testing.T) {
 	}
 }
 
+func TestFramebufferPool(t *testing.T) {
+	before := GetFramebufferPoolStats()
+
+	f := NewFramebuffer(1024, 1024)
+	if got := GetFramebufferPoolStats().InUseBytes; got != before.InUseBytes {
+		t.Errorf("NewFramebuffer took %d bytes of pixel memory, want 0", got-before.InUseBytes)
+	}
+
+	if err := f.Create4Channel(100, 100); err != nil {
+		t.Fatalf("Create4Channel failed: %v", err)
+	}
+	stats := GetFramebufferPoolStats()
+	if stats.Gets != before.Gets+1 {
+		t.Errorf("Gets = %d, want %d", stats.Gets, before.Gets+1)
+	}
+	if held := stats.InUseBytes - before.InUseBytes; held < 100*100*4 || held >= 1024*1024*4 {
+		t.Errorf("framebuffer holds %d bytes for a 100x100 frame", held)
+	}
+
+	if err := f.Create4Channel(2048, 2048); err != ErrBufTooSmall {
+		t.Errorf("Create4Channel past the framebuffer size = %v, want ErrBufTooSmall", err)
+	}
+
+	f.Close()
+	after := GetFramebufferPoolStats()
+	if after.InUseBytes != before.InUseBytes {
+		t.Errorf("InUseBytes after Close = %d, want %d", after.InUseBytes, before.InUseBytes)
+	}
+	if after.Puts != before.Puts+1 {
+		t.Errorf("Puts = %d, want %d", after.Puts, before.Puts+1)
+	}
+}
+
+// resizeReferenceAxis returns, for each of dst output samples along an axis
+// of src input samples, the first input sample it reads and the weights of
+// that and the following ones
+func resizeReferenceAxis(src, dst int) ([]int, [][]float64) {
+	scale := float64(src) / float64(dst)
+	starts := make([]int, dst)
+	weights := make([][]float64, dst)
+	for x := 0; x < dst; x++ {
+		if scale >= 1 {
+			// the exact share of each input sample the output one covers
+			lo, hi := float64(x)*scale, float64(x+1)*scale
+			first := int(math.Floor(lo))
+			for i := first; float64(i) < hi && i < src; i++ {
+				w := math.Min(hi, float64(i+1)) - math.Max(lo, float64(i))
+				weights[x] = append(weights[x], w/scale)
+			}
+			starts[x] = first
+			continue
+		}
+		// linear interpolation between the two nearest input samples
+		pos := (float64(x)+0.5)*scale - 0.5
+		if pos < 0 {
+			pos = 0
+		}
+		first := int(math.Floor(pos))
+		if first >= src-1 {
+			starts[x], weights[x] = src-1, []float64{1}
+			continue
+		}
+		frac := pos - float64(first)
+		starts[x], weights[x] = first, []float64{1 - frac, frac}
+	}
+	return starts, weights
+}
+
+// resizeReference resizes the 8-bit pixels of src, srcWidth x srcHeight with
+// channels samples each, to dstWidth x dstHeight in float64
+func resizeReference(src []byte, srcWidth, srcHeight, channels, dstWidth, dstHeight int) []byte {
+	xs, xw := resizeReferenceAxis(srcWidth, dstWidth)
+	ys, yw := resizeReferenceAxis(srcHeight, dstHeight)
+	rows := make([]float64, srcHeight*dstWidth*channels)
+	for y := 0; y < srcHeight; y++ {
+		for x := 0; x < dstWidth; x++ {
+			for c := 0; c < channels; c++ {
+				sum := 0.0
+				for i, w := range xw[x] {
+					sum += w * float64(src[(y*srcWidth+xs[x]+i)*channels+c])
+				}
+				rows[(y*dstWidth+x)*channels+c] = sum
+			}
+		}
+	}
+	dst := make([]byte, dstWidth*dstHeight*channels)
+	for y := 0; y < dstHeight; y++ {
+		for x := 0; x < dstWidth*channels; x++ {
+			sum := 0.0
+			for i, w := range yw[y] {
+				sum += w * rows[(ys[y]+i)*dstWidth*channels+x]
+			}
+			dst[y*dstWidth*channels+x] = byte(math.Max(0, math.Min(255, math.Round(sum))))
+		}
+	}
+	return dst
+}
+
+// resizeToReference resizes the 8-bit frame f into dst with resizeReference,
+// which is what the area filter does, in floating point
+func (f *Framebuffer) resizeToReference(width, height int, dst *Framebuffer) error {
+	if err := dst.resizeMat(width, height, f.pixelType); err != nil {
+		return err
+	}
+	channels := f.pixelType.Channels()
+	copy(dst.buf, resizeReference(f.buf[:f.Width()*f.Height()*channels], f.Width(), f.Height(), channels, width, height))
+	return nil
+}
+
+// Shrinking by 4x or more goes through 2x box reductions before the area
+// filter, which should still agree with a plain area resize of the whole
+// source. Sources of odd sizes are reduced with their last row or column
+// repeated, so they are held to their mean difference.
+func TestResizePyramid(t *testing.T) {
+	src := NewFramebuffer(4096, 4096)
+	defer src.Close()
+	got := NewFramebuffer(1024, 1024)
+	defer got.Close()
+	want := NewFramebuffer(1024, 1024)
+	defer want.Close()
+
+	for _, tc := range []struct {
+		srcWidth, srcHeight int
+		width, height       int
+		maxDiff             int
+		maxMeanDiff         float64
+	}{
+		{2048, 1536, 256, 192, 2, 0.5},
+		{2000, 1600, 250, 200, 2, 0.5},
+		{4096, 2048, 300, 150, 5, 1.5},
+		{3001, 2001, 300, 200, 8, 2},
+	} {
+		if err := src.Create3Channel(tc.srcWidth, tc.srcHeight); err != nil {
+			t.Fatalf("Create3Channel: %v", err)
+		}
+		for y := 0; y < tc.srcHeight; y++ {
+			for x := 0; x < tc.srcWidth; x++ {
+				for c := 0; c < 3; c++ {
+					v := 128 + 100*math.Sin(float64(x)*0.05*float64(c+1))*math.Cos(float64(y)*0.07) + float64((x*7+y*13)%17-8)
+					src.buf[(y*tc.srcWidth+x)*3+c] = byte(v)
+				}
+			}
+		}
+		if err := src.resizeToReference(tc.width, tc.height, want); err != nil {
+			t.Fatalf("reference resize: %v", err)
+		}
+		if err := src.ResizeTo(tc.width, tc.height, got); err != nil {
+			t.Fatalf("ResizeTo: %v", err)
+		}
+		n := tc.width * tc.height * 3
+		maxDiff, sum := 0, 0
+		for i := 0; i < n; i++ {
+			d := int(got.buf[i]) - int(want.buf[i])
+			if d < 0 {
+				d = -d
+			}
+			if d > maxDiff {
+				maxDiff = d
+			}
+			sum += d
+		}
+		if mean := float64(sum) / float64(n); maxDiff > tc.maxDiff || mean > tc.maxMeanDiff {
+			t.Errorf("%dx%d to %dx%d differs from the reference by up to %d, %.2f on average",
+				tc.srcWidth, tc.srcHeight, tc.width, tc.height, maxDiff, mean)
+		}
+	}
+}
+
+// The area filter should agree with a floating point resize to within
+// fixed-point rounding, and every filter should leave a flat image flat.
+func TestResizeFilters(t *testing.T) {
+	src := decodeResizeSource(t, 1)
+	defer src.Close()
+	got := NewFramebuffer(8192, 8192)
+	defer got.Close()
+	want := NewFramebuffer(8192, 8192)
+	defer want.Close()
+
+	for _, size := range [][2]int{{400, 148}, {333, 111}, {1000, 400}} {
+		if err := src.resizeToReference(size[0], size[1], want); err != nil {
+			t.Fatalf("reference resize: %v", err)
+		}
+		if err := src.ResizeTo(size[0], size[1], got); err != nil {
+			t.Fatalf("ResizeTo: %v", err)
+		}
+		n := size[0] * size[1] * src.PixelType().Channels()
+		maxDiff := 0
+		for i := 0; i < n; i++ {
+			d := int(got.buf[i]) - int(want.buf[i])
+			if d < 0 {
+				d = -d
+			}
+			if d > maxDiff {
+				maxDiff = d
+			}
+		}
+		if maxDiff > 2 {
+			t.Errorf("%dx%d: area filter differs from the reference by up to %d", size[0], size[1], maxDiff)
+		}
+	}
+
+	flat := NewFramebuffer(64, 64)
+	defer flat.Close()
+	if err := flat.Create4Channel(61, 37); err != nil {
+		t.Fatalf("Create4Channel: %v", err)
+	}
+	for i := range flat.buf[:61*37*4] {
+		flat.buf[i] = 200
+	}
+	for _, f := range resizeFilters {
+		r := newResampler()
+		r.filter = f.filter
+		for _, size := range [][2]int{{23, 11}, {61, 37}, {150, 90}} {
+			if err := flat.resizeTo(size[0], size[1], got, r); err != nil {
+				t.Fatalf("%s: resize: %v", f.name, err)
+			}
+			for i, v := range got.buf[:size[0]*size[1]*4] {
+				if v != 200 {
+					t.Errorf("%s %dx%d: byte %d = %d, want 200", f.name, size[0], size[1], i, v)
+					break
+				}
+			}
+		}
+		r.Close()
+	}
+}
+
+// TestResamplerCache resizes through one resampler in an order where the
+// horizontal table is found in the slot the vertical one would be built in,
+// and checks every result against a resize with no cache.
+func TestResamplerCache(t *testing.T) {
+	src := NewFramebuffer(100, 200)
+	defer src.Close()
+	if err := src.Create4Channel(100, 200); err != nil {
+		t.Fatalf("Create4Channel: %v", err)
+	}
+	for i := range src.buf[:100*200*4] {
+		src.buf[i] = byte(i*7 + i/400)
+	}
+	got := NewFramebuffer(256, 256)
+	defer got.Close()
+	want := NewFramebuffer(256, 256)
+	defer want.Close()
+
+	r := newResampler()
+	defer r.Close()
+	for _, size := range [][2]int{{50, 80}, {150, 90}, {50, 30}} {
+		if err := src.resizeTo(size[0], size[1], got, r); err != nil {
+			t.Fatalf("%dx%d: resize: %v", size[0], size[1], err)
+		}
+		if err := src.resizeTo(size[0], size[1], want, nil); err != nil {
+			t.Fatalf("%dx%d: uncached resize: %v", size[0], size[1], err)
+		}
+		n := size[0] * size[1] * 4
+		if !bytes.Equal(got.buf[:n], want.buf[:n]) {
+			t.Errorf("%dx%d: cached resize differs from an uncached one", size[0], size[1])
+		}
+	}
+}
+
+func TestParallelStripes(t *testing.T) {
+	src := decodeResizeSource(t, 2)
+	defer src.Close()
+	single := NewFramebuffer(8192, 8192)
+	defer single.Close()
+	striped := NewFramebuffer(8192, 8192)
+	defer striped.Close()
+
+	for _, f := range resizeFilters {
+		r1 := newResampler()
+		r1.filter = f.filter
+		r8 := newResampler()
+		r8.filter = f.filter
+		r8.threads = 8
+		for _, size := range [][2]int{{400, 148}, {1601, 599}, {4000, 1500}} {
+			if err := src.resizeTo(size[0], size[1], single, r1); err != nil {
+				t.Fatalf("%s: resize: %v", f.name, err)
+			}
+			if err := src.resizeTo(size[0], size[1], striped, r8); err != nil {
+				t.Fatalf("%s: striped resize: %v", f.name, err)
+			}
+			n := size[0] * size[1] * src.PixelType().Channels()
+			if !bytes.Equal(single.buf[:n], striped.buf[:n]) {
+				t.Errorf("%s %dx%d: striped resize differs from single-threaded", f.name, size[0], size[1])
+			}
+		}
+		r1.Close()
+		r8.Close()
+	}
+
+	for orientation := OrientationTopLeft; orientation <= OrientationLeftBottom; orientation++ {
+		if err := src.resizeTo(src.Width(), src.Height(), single, nil); err != nil {
+			t.Fatalf("copy: %v", err)
+		}
+		if err := src.resizeTo(src.Width(), src.Height(), striped, nil); err != nil {
+			t.Fatalf("copy: %v", err)
+		}
+		single.orientationTransform(orientation, 1)
+		striped.orientationTransform(orientation, 8)
+		if single.Width() != striped.Width() || single.Height() != striped.Height() {
+			t.Fatalf("orientation %d: striped result is %dx%d, want %dx%d", orientation, striped.Width(), striped.Height(), single.Width(), single.Height())
+		}
+		n := single.Width() * single.Height() * single.PixelType().Channels()
+		if !bytes.Equal(single.buf[:n], striped.buf[:n]) {
+			t.Errorf("orientation %d: striped transform differs from single-threaded", orientation)
+		}
+	}
+}
+
+// TestPremultipliedAlpha checks that resizing premultiplied pixels keeps the
+// colour of fully transparent pixels out of their neighbours, and that
+// compositing premultiplied frames matches the straight-alpha blend.
+func TestPremultipliedAlpha(t *testing.T) {
+	// opaque red next to transparent green should shrink to a half transparent red
+	src := NewFramebuffer(2, 1)
+	defer src.Close()
+	if err := src.Create4Channel(2, 1); err != nil {
+		t.Fatalf("Create4Channel: %v", err)
+	}
+	copy(src.buf, []byte{0, 0, 255, 255, 0, 255, 0, 0})
+	src.premultiplyAlpha(1)
+	dst := NewFramebuffer(1, 1)
+	defer dst.Close()
+	if err := src.ResizeTo(1, 1, dst); err != nil {
+		t.Fatalf("ResizeTo: %v", err)
+	}
+	dst.unpremultiplyAlpha(1)
+	if got := dst.buf[:4]; got[1] != 0 || got[2] != 255 || got[3] < 127 || got[3] > 128 {
+		t.Errorf("premultiplied resize = %v, want [0 0 255 127]", got)
+	}
+
+	const width, height = 67, 5
+	rand := uint32(1)
+	fill := func(f *Framebuffer) {
+		if err := f.Create4Channel(width, height); err != nil {
+			t.Fatalf("Create4Channel: %v", err)
+		}
+		for i := range f.buf[:width*height*4] {
+			rand = rand*1664525 + 1013904223
+			f.buf[i] = byte(rand >> 24)
+		}
+	}
+	frame := NewFramebuffer(width, height)
+	defer frame.Close()
+	canvas := NewFramebuffer(width, height)
+	defer canvas.Close()
+	straight := NewFramebuffer(width, height)
+	defer straight.Close()
+	fill(frame)
+	fill(canvas)
+	if err := frame.ResizeTo(width, height, straight); err != nil {
+		t.Fatalf("ResizeTo: %v", err)
+	}
+
+	rect := image.Rect(0, 0, width, height)
+	want := NewFramebuffer(width, height)
+	defer want.Close()
+	if err := canvas.ResizeTo(width, height, want); err != nil {
+		t.Fatalf("ResizeTo: %v", err)
+	}
+	if err := want.CopyToOffsetWithAlphaBlending(straight, rect); err != nil {
+		t.Fatalf("straight blend: %v", err)
+	}
+
+	frame.premultiplyAlpha(1)
+	canvas.premultiplyAlpha(1)
+	if err := canvas.CopyToOffsetWithAlphaBlending(frame, rect); err != nil {
+		t.Fatalf("premultiplied blend: %v", err)
+	}
+	canvas.unpremultiplyAlpha(1)
+
+	for i := 0; i < width*height*4; i += 4 {
+		alpha := int(want.buf[i+3])
+		if d := alpha - int(canvas.buf[i+3]); d < -1 || d > 1 {
+			t.Fatalf("pixel %d: alpha %d, want %d", i/4, canvas.buf[i+3], alpha)
+		}
+		if alpha < 128 {
+			// straight colour is only as precise as alpha allows
+			continue
+		}
+		for c := 0; c < 3; c++ {
+			if d := int(want.buf[i+c]) - int(canvas.buf[i+c]); d < -5 || d > 5 {
+				t.Fatalf("pixel %d channel %d: %d, want %d", i/4, c, canvas.buf[i+c], want.buf[i+c])
+			}
+		}
+	}
+}
+
+// TestDecodeCrop checks that decoding only the region Fit keeps gives the same
+// output as decoding the whole image and letting Fit crop it.
+func TestDecodeCrop(t *testing.T) {
+	opt := &ImageOptions{Width: 100, Height: 100, ResizeMethod: ImageOpsFit}
+	for _, filename := range []string{
+		"testdata/ferry_sunset.jpg",
+		"testdata/ferry_sunset.png",
+		"testdata/ferry_sunset.webp",
+	} {
+		t.Run(filename, func(t *testing.T) {
+			buf, err := ioutil.ReadFile(filename)
+			if err != nil {
+				t.Fatalf("Failed to read %s: %v", filename, err)
+			}
+
+			fit := func(crop bool) *Framebuffer {
+				decoder, err := NewDecoder(buf)
+				if err != nil {
+					t.Fatalf("Failed to create decoder: %v", err)
+				}
+				defer decoder.Close()
+				if crop {
+					header, err := decoder.Header()
+					if err != nil {
+						t.Fatalf("Header failed: %v", err)
+					}
+					rect := decodeCrop(opt, header)
+					if rect.Empty() {
+						t.Fatal("expected Fit to crop the image")
+					}
+					decoder.(croppingDecoder).setCrop(rect)
+				}
+				decoded := NewFramebuffer(1024, 1024)
+				defer decoded.Close()
+				if err := decoder.DecodeTo(decoded); err != nil {
+					t.Fatalf("DecodeTo failed: %v", err)
+				}
+				out := NewFramebuffer(opt.Width, opt.Height)
+				if err := decoded.Fit(opt.Width, opt.Height, out); err != nil {
+					t.Fatalf("Fit failed: %v", err)
+				}
+				return out
+			}
+
+			want := fit(false)
+			defer want.Close()
+			got := fit(true)
+			defer got.Close()
+			n := opt.Width * opt.Height * want.PixelType().Channels()
+			if got.PixelType() != want.PixelType() || !bytes.Equal(got.buf[:n], want.buf[:n]) {
+				t.Error("decoding the cropped region changed the output pixels")
+			}
+		})
+	}
+}
+
+// longPathDecoder hides the type of the decoder it wraps, so that Transform
+// takes its general path rather than handing the image to transformStill.
+type longPathDecoder struct {
+	Decoder
+}
+
+func TestTransformStill(t *testing.T) {
+	options := []*ImageOptions{
+		{FileType: ".jpeg", Width: 100, Height: 100, ResizeMethod: ImageOpsFit, NormalizeOrientation: true, EncodeOptions: map[int]int{JpegQuality: 85}},
+		{FileType: ".png", Width: 300, Height: 100, ResizeMethod: ImageOpsFit, NormalizeOrientation: true},
+		{FileType: ".png", Width: 200, Height: 50, ResizeMethod: ImageOpsResize, NormalizeOrientation: true, ResizeFilter: ResizeFilterLanczos3},
+		{FileType: ".jpeg", ResizeMethod: ImageOpsNoResize, NormalizeOrientation: true},
+	}
+	for _, filename := range []string{
+		"testdata/ferry_sunset.jpg",
+		"testdata/ferry_sunset.png",
+		"data/firefox.png",
+		"data/firefox-gray.jpg",
+		"data/opera-gray-alpha.png",
+	} {
+		buf, err := ioutil.ReadFile(filename)
+		if err != nil {
+			t.Fatalf("Failed to read %s: %v", filename, err)
+		}
+		for _, opt := range options {
+			transform := func(longPath bool) []byte {
+				decoder, err := NewDecoder(buf)
+				if err != nil {
+					t.Fatalf("Failed to create decoder: %v", err)
+				}
+				defer decoder.Close()
+				ops := NewImageOps(2048)
+				defer ops.Close()
+
+				d := decoder
+				if longPath {
+					d = longPathDecoder{decoder}
+				}
+				out, err := ops.Transform(d, opt, make([]byte, 10*1024*1024))
+				if err != nil {
+					t.Fatalf("Transform of %s to %s failed: %v", filename, opt.FileType, err)
+				}
+				return out
+			}
+
+			if !bytes.Equal(transform(false), transform(true)) {
+				t.Errorf("%s: transformStill output differs from Transform's for %+v", filename, *opt)
+			}
+		}
+	}
+}
+
+// TestTransformStillFormats checks that transformStill leaves inputs other
+// than JPEG and PNG, here a BMP, to Transform's general path
+func TestTransformStillFormats(t *testing.T) {
+	const width, height = 4, 2
+	rowBytes := (width*3 + 3) &^ 3
+	bmp := make([]byte, 54+rowBytes*height)
+	copy(bmp, "BM")
+	binary.LittleEndian.PutUint32(bmp[2:], uint32(len(bmp)))
+	binary.LittleEndian.PutUint32(bmp[10:], 54)
+	binary.LittleEndian.PutUint32(bmp[14:], 40)
+	binary.LittleEndian.PutUint32(bmp[18:], width)
+	binary.LittleEndian.PutUint32(bmp[22:], height)
+	binary.LittleEndian.PutUint16(bmp[26:], 1)
+	binary.LittleEndian.PutUint16(bmp[28:], 24)
+	for i := 54; i < len(bmp); i++ {
+		bmp[i] = byte(i * 13)
+	}
+
+	decoder, err := NewDecoder(bmp)
+	if err != nil {
+		t.Skipf("BMP is not decodable in this build: %v", err)
+	}
+	defer decoder.Close()
+	ops := NewImageOps(2048)
+	defer ops.Close()
+	opt := &ImageOptions{FileType: ".png", Width: 2, Height: 1, ResizeMethod: ImageOpsFit, NormalizeOrientation: true}
+	if _, done, err := ops.transformStill(decoder, opt, make([]byte, 1024*1024)); done || err != nil {
+		t.Errorf("transformStill of a BMP = done %v, error %v; want it left to Transform", done, err)
+	}
+	if _, err := ops.Transform(decoder, opt, make([]byte, 1024*1024)); err != nil {
+		t.Errorf("Transform of a BMP failed: %v", err)
+	}
+}
+
+// transformStill decodes and resizes into the ImageOps framebuffers, which
+// keep their pooled buffers from one Transform to the next
+func TestTransformStillFramebuffers(t *testing.T) {
+	buf, err := ioutil.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		t.Fatalf("Failed to read fixture: %v", err)
+	}
+	ops := NewImageOps(2048)
+	defer ops.Close()
+	opt := &ImageOptions{FileType: ".jpeg", Width: 200, Height: 100, ResizeMethod: ImageOpsFit}
+	transform := func() {
+		decoder, err := NewDecoder(buf)
+		if err != nil {
+			t.Fatalf("Failed to create decoder: %v", err)
+		}
+		defer decoder.Close()
+		if _, err := ops.Transform(decoder, opt, make([]byte, 1024*1024)); err != nil {
+			t.Fatalf("Transform failed: %v", err)
+		}
+	}
+
+	before := GetFramebufferPoolStats()
+	transform()
+	first := GetFramebufferPoolStats()
+	if first.Gets != before.Gets+2 {
+		t.Errorf("first Transform took %d buffers from the pool, want 2", first.Gets-before.Gets)
+	}
+	// the 594x297 region of the source that Fit keeps, and the output
+	if held := first.InUseBytes - before.InUseBytes; held < 594*297*3+200*100*3 {
+		t.Errorf("framebuffers hold %d bytes after Transform", held)
+	}
+	transform()
+	if second := GetFramebufferPoolStats(); second.Gets != first.Gets {
+		t.Errorf("second Transform took %d buffers from the pool, want 0", second.Gets-first.Gets)
+	}
+}
+
+func TestPreserveHighBitDepth(t *testing.T) {
+	for _, filename := range []string{"data/firefox-16bit.png", "data/firefox-16bit-alpha.png"} {
+		buf, err := ioutil.ReadFile(filename)
+		if err != nil {
+			t.Fatalf("Failed to read %s: %v", filename, err)
+		}
+		transform := func(fileType string, preserve bool) []byte {
+			decoder, err := NewDecoder(buf)
+			if err != nil {
+				t.Fatalf("Failed to create decoder: %v", err)
+			}
+			defer decoder.Close()
+			ops := NewImageOps(2048)
+			defer ops.Close()
+			opt := &ImageOptions{FileType: fileType, Width: 120, Height: 80, ResizeMethod: ImageOpsFit, PreserveHighBitDepth: preserve}
+			out, err := ops.Transform(decoder, opt, make([]byte, 10*1024*1024))
+			if err != nil {
+				t.Fatalf("Transform of %s to %s failed: %v", filename, fileType, err)
+			}
+			return out
+		}
+
+		deep := transform(".png", true)
+		decoder, err := NewDecoder(deep)
+		if err != nil {
+			t.Fatalf("Failed to create decoder: %v", err)
+		}
+		header, err := decoder.Header()
+		decoder.Close()
+		if err != nil {
+			t.Fatalf("Failed to read header: %v", err)
+		}
+		if header.PixelType().Depth() != 16 {
+			t.Errorf("%s: PNG output has %d-bit samples, want 16", filename, header.PixelType().Depth())
+		}
+
+		// the 16-bit resize rounds once rather than twice, so it may differ
+		// from the 8-bit one by a level here and there
+		got := decodeFramebuffer(t, deep)
+		want := decodeFramebuffer(t, transform(".png", false))
+		n := want.Width() * want.Height() * want.PixelType().Channels()
+		if got.Width() != want.Width() || got.Height() != want.Height() || got.PixelType() != want.PixelType() {
+			t.Fatalf("%s: 16-bit output is %dx%d, want %dx%d", filename, got.Width(), got.Height(), want.Width(), want.Height())
+		}
+		for i := 0; i < n; i++ {
+			if diff := int(got.buf[i]) - int(want.buf[i]); diff > 2 || diff < -2 {
+				t.Fatalf("%s: byte %d is %d, want %d", filename, i, got.buf[i], want.buf[i])
+			}
+		}
+		got.Close()
+		want.Close()
+
+		// formats without 16-bit samples are narrowed before encoding
+		transform(".webp", true)
+		transform(".jpeg", true)
+	}
+}
+
+// TestTonemapReference checks the table-driven tone-map, with its sampled
+// image statistics, against the whole-image arithmetic it replaced, for 8-bit
+// and 16-bit frames of data/hdr-ohmama.png as decoded and enlarged past the
+// size at which the statistics are sampled.
+func TestTonemapReference(t *testing.T) {
+	buf, err := ioutil.ReadFile("data/hdr-ohmama.png")
+	if err != nil {
+		t.Fatalf("Failed to read fixture: %v", err)
+	}
+	for _, highDepth := range []bool{false, true} {
+		decoder, err := NewDecoder(buf)
+		if err != nil {
+			t.Fatalf("Failed to create decoder: %v", err)
+		}
+		decoded := NewFramebuffer(1024, 1024)
+		decoded.highDepth = highDepth
+		err = decoder.DecodeTo(decoded)
+		decoder.Close()
+		if err != nil {
+			t.Fatalf("Failed to decode: %v", err)
+		}
+		large := NewFramebuffer(1024, 1024)
+		large.highDepth = highDepth
+		if err := decoded.ResizeTo(decoded.Width()*4, decoded.Height()*4, large); err != nil {
+			t.Fatalf("Failed to enlarge: %v", err)
+		}
+
+		for _, src := range []*Framebuffer{decoded, large} {
+			channels := src.PixelType().Channels()
+			depth := src.PixelType().Depth()
+			if highDepth != (depth == 16) {
+				t.Fatalf("decoded to %d bits with highDepth %v", depth, highDepth)
+			}
+			n := src.Width() * src.Height()
+			samples := make([]float64, n*channels)
+			for i := range samples {
+				if depth == 16 {
+					samples[i] = float64(binary.LittleEndian.Uint16(src.buf[i*2:])) / 65535
+				} else {
+					samples[i] = float64(src.buf[i]) / 255
+				}
+			}
+
+			for _, c := range []CICP{
+				{Primaries: 9, Transfer: 16, FullRange: true},
+				{Primaries: 9, Transfer: 18, FullRange: true},
+				{Primaries: 12, Transfer: 18, FullRange: true},
+			} {
+				want := tonemapReference(samples, channels, c)
+				for _, threads := range []int{1, 4} {
+					got := NewFramebuffer(1024, 1024)
+					if depth == 16 {
+						err = src.tonemapTo(c, got, threads)
+					} else if err = got.resizeMat(src.Width(), src.Height(), src.PixelType()); err == nil {
+						copy(got.buf, src.buf[:n*channels])
+						err = got.tonemapToSDR(c, threads)
+					}
+					if err != nil {
+						t.Fatalf("Failed to tone-map: %v", err)
+					}
+					maxDiff := 0
+					for i := 0; i < n; i++ {
+						for ch := 0; ch < 3; ch++ {
+							d := int(got.buf[i*channels+ch]) - int(want[i*3+ch])
+							if d < 0 {
+								d = -d
+							}
+							if d > maxDiff {
+								maxDiff = d
+							}
+						}
+					}
+					if maxDiff > 1 {
+						t.Errorf("%dx%d %d-bit %+v on %d threads: differs from the reference by up to %d", src.Width(), src.Height(), depth, c, threads, maxDiff)
+					}
+					got.Close()
+				}
+			}
+		}
+		large.Close()
+		decoded.Close()
+	}
+}
+
+// tonemapReference is the tone-map as tonemap_rgb_to_sdr computed it before
+// it was table-driven: cv::TonemapReinhard(1, 0.6, 0.2, 0.3) over the whole
+// image, then the primaries matrix and a rounding to 8 bits. samples holds
+// the colour channels of each pixel, stride apart, scaled to [0, 1].
+func tonemapReference(samples []float64, stride int, c CICP) []byte {
+	n := len(samples) / stride
+	img := make([]float64, n*3)
+	for i := 0; i < n; i++ {
+		for ch := 0; ch < 3; ch++ {
+			v := samples[i*stride+ch]
+			switch c.Transfer {
+			case 16:
+				const m1, m2, c1, c2, c3 = 0.1593017578125, 78.84375, 0.8359375, 18.8515625, 18.6875
+				p := math.Pow(v, 1/m2)
+				v = math.Pow(math.Max(p-c1, 0)/(c2-c3*p), 1/m1)
+			case 18:
+				const a, b, cc = 0.17883277, 0.28466892, 0.55991073
+				if v <= 0.5 {
+					v = v * v / 3
+				} else {
+					v = (math.Exp((v-cc)/a) + b) / 12
+				}
+			}
+			img[i*3+ch] = v
+		}
+	}
+	normalize := func() {
+		lo, hi := math.Inf(1), math.Inf(-1)
+		for _, v := range img {
+			lo, hi = math.Min(lo, v), math.Max(hi, v)
+		}
+		for i := range img {
+			img[i] = (img[i] - lo) / (hi - lo)
+		}
+	}
+	normalize()
+
+	gray := make([]float64, n)
+	var logSum, grayMean float64
+	var chanMean [3]float64
+	logMin, logMax := math.Inf(1), math.Inf(-1)
+	for i := 0; i < n; i++ {
+		gray[i] = 0.299*img[i*3] + 0.587*img[i*3+1] + 0.114*img[i*3+2]
+		l := math.Log(math.Max(gray[i], 1e-4))
+		logSum += l
+		logMin, logMax = math.Min(logMin, l), math.Max(logMax, l)
+		grayMean += gray[i]
+		for ch := 0; ch < 3; ch++ {
+			chanMean[ch] += img[i*3+ch]
+		}
+	}
+	key := (logMax - logSum/float64(n)) / (logMax - logMin)
+	mapKey := 0.3 + 0.7*math.Pow(key, 1.4)
+	intensity := math.Exp(-0.6)
+	for ch := 0; ch < 3; ch++ {
+		global := 0.3*chanMean[ch]/float64(n) + 0.7*grayMean/float64(n)
+		for i := 0; i < n; i++ {
+			v := img[i*3+ch]
+			adapt := 0.2*(0.3*v+0.7*gray[i]) + 0.8*global
+			adapt = math.Pow(intensity*adapt, mapKey)
+			img[i*3+ch] = v / (adapt + v)
+		}
+	}
+	normalize()
+
+	m := [3][3]float64{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}
+	switch c.Primaries {
+	case 9:
+		m = [3][3]float64{{1.6605, -0.5876, -0.0728}, {-0.1246, 1.1329, -0.0083}, {-0.0182, -0.1006, 1.1187}}
+	case 11, 12:
+		m = [3][3]float64{{1.2249, -0.2247, -0.0002}, {-0.0420, 1.0419, 0.0001}, {-0.0197, 0.0754, 0.9443}}
+	}
+	out := make([]byte, n*3)
+	for i := 0; i < n; i++ {
+		for ch := 0; ch < 3; ch++ {
+			v := (m[ch][0]*img[i*3] + m[ch][1]*img[i*3+1] + m[ch][2]*img[i*3+2]) * 255
+			out[i*3+ch] = byte(math.Max(0, math.Min(255, math.Round(v))))
+		}
+	}
+	return out
+}
+
+func TestConvertToSRGB(t *testing.T) {
+	for _, filename := range []string{"testdata/ferry_sunset.jpg", "testdata/ferry_sunset.png", "testdata/tears_of_steel_icc.webp"} {
+		buf, err := ioutil.ReadFile(filename)
+		if err != nil {
+			t.Fatalf("Failed to read %s: %v", filename, err)
+		}
+		transform := func(convert bool) []byte {
+			decoder, err := NewDecoder(buf)
+			if err != nil {
+				t.Fatalf("Failed to create decoder: %v", err)
+			}
+			defer decoder.Close()
+			ops := NewImageOps(2048)
+			defer ops.Close()
+			opt := &ImageOptions{FileType: ".webp", Width: 160, Height: 120, ResizeMethod: ImageOpsFit, ConvertToSRGB: convert}
+			out, err := ops.Transform(decoder, opt, make([]byte, 10*1024*1024))
+			if err != nil {
+				t.Fatalf("Transform of %s failed: %v", filename, err)
+			}
+			return out
+		}
+		outputICC := func(out []byte) []byte {
+			decoder, err := NewDecoder(out)
+			if err != nil {
+				t.Fatalf("Failed to create decoder: %v", err)
+			}
+			defer decoder.Close()
+			return decoder.ICC()
+		}
+
+		if len(outputICC(transform(false))) == 0 {
+			t.Errorf("%s: output lost its ICC profile without ConvertToSRGB", filename)
+		}
+		if icc := outputICC(transform(true)); len(icc) != 0 {
+			t.Errorf("%s: output kept a %d byte ICC profile with ConvertToSRGB", filename, len(icc))
+		}
+	}
+
+	// converting from sRGB itself changes next to nothing
+	buf, err := ioutil.ReadFile("testdata/ferry_sunset_no_icc.png")
+	if err != nil {
+		t.Fatalf("Failed to read testdata/ferry_sunset_no_icc.png: %v", err)
+	}
+	f := decodeFramebuffer(t, buf)
+	defer f.Close()
+	n := f.Width() * f.Height() * f.PixelType().Channels()
+	want := append([]byte(nil), f.buf[:n]...)
+	if !f.ConvertToSRGB(SRGBICCProfile) {
+		t.Fatalf("ConvertToSRGB from sRGB failed")
+	}
+	for i := 0; i < n; i++ {
+		if diff := int(f.buf[i]) - int(want[i]); diff > 1 || diff < -1 {
+			t.Fatalf("byte %d is %d after converting from sRGB, want %d", i, f.buf[i], want[i])
+		}
+	}
+	if f.ConvertToSRGB([]byte("not a profile")) {
+		t.Errorf("ConvertToSRGB accepted an invalid profile")
+	}
+}
+
+func TestICCInterned(t *testing.T) {
+	for _, filename := range []string{"testdata/ferry_sunset.jpg", "testdata/ferry_sunset.png", "testdata/tears_of_steel_icc.webp", "testdata/paris_icc_exif_xmp.avif"} {
+		buf, err := ioutil.ReadFile(filename)
+		if err != nil {
+			t.Fatalf("Failed to read %s: %v", filename, err)
+		}
+		var profiles [][]byte
+		for i := 0; i < 2; i++ {
+			decoder, err := NewDecoder(buf)
+			if err != nil {
+				t.Fatalf("Failed to create decoder: %v", err)
+			}
+			profiles = append(profiles, decoder.ICC(), decoder.ICC())
+			decoder.Close()
+		}
+		if len(profiles[0]) == 0 {
+			t.Fatalf("%s: no ICC profile", filename)
+		}
+		for _, icc := range profiles[1:] {
+			if len(icc) != len(profiles[0]) || &icc[0] != &profiles[0][0] {
+				t.Errorf("%s: ICC profile was not interned", filename)
+			}
+		}
+		if cap(profiles[0]) != len(profiles[0]) {
+			t.Errorf("%s: interned ICC profile has spare capacity", filename)
+		}
+	}
+
+	if icc := internICC(make([]byte, ICCProfileBufferSize+1)); icc != nil {
+		t.Errorf("interned a %d byte ICC profile", ICCProfileBufferSize+1)
+	}
+}
+
+func TestJpegEncode(t *testing.T) {
+	buf, err := ioutil.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		t.Fatalf("Failed to read fixture: %v", err)
+	}
+	decoder, err := NewDecoder(buf)
+	if err != nil {
+		t.Fatalf("Failed to create decoder: %v", err)
+	}
+	defer decoder.Close()
+	framebuffer := NewFramebuffer(4096, 4096)
+	defer framebuffer.Close()
+	if err := decoder.DecodeTo(framebuffer); err != nil {
+		t.Fatalf("Failed to decode: %v", err)
+	}
+
+	for _, tc := range []struct {
+		name         string
+		opt          map[int]int
+		lumaSampling byte
+	}{
+		{"default", map[int]int{JpegQuality: 85}, 0x22},
+		{"422", map[int]int{JpegQuality: 85, JpegSubsampling: JpegSubsampling422}, 0x21},
+		{"444_restart", map[int]int{JpegQuality: 85, JpegSubsampling: JpegSubsampling444, JpegRestartInterval: 4}, 0x11},
+		{"progressive_ifast", map[int]int{JpegQuality: 85, JpegProgressive: 1, JpegDCTMethod: JpegDCTIfast, JpegOptimize: 1}, 0x22},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			encoder, err := NewEncoder(".jpeg", decoder, make([]byte, 8*1024*1024), nil)
+			if err != nil {
+				t.Fatalf("Failed to create encoder: %v", err)
+			}
+			defer encoder.Close()
+			out, err := encoder.Encode(framebuffer, tc.opt)
+			if err != nil {
+				t.Fatalf("Failed to encode: %v", err)
+			}
+
+			// the first component's sampling factors follow the SOF marker's
+			// length, precision, dimensions, component count and id
+			sof := bytes.Index(out, []byte{0xFF, 0xC0})
+			if tc.opt[JpegProgressive] != 0 {
+				sof = bytes.Index(out, []byte{0xFF, 0xC2})
+			}
+			if sof < 0 || sof+12 > len(out) {
+				t.Fatalf("no SOF marker in output")
+			}
+			if got := out[sof+11]; got != tc.lumaSampling {
+				t.Errorf("luma sampling factors %#x, want %#x", got, tc.lumaSampling)
+			}
+			if hasDRI := bytes.Contains(out, []byte{0xFF, 0xDD}); hasDRI != (tc.opt[JpegRestartInterval] != 0) {
+				t.Errorf("restart interval marker present: %v", hasDRI)
+			}
+
+			reencoded, err := NewDecoder(out)
+			if err != nil {
+				t.Fatalf("Failed to decode output: %v", err)
+			}
+			defer reencoded.Close()
+			header, err := reencoded.Header()
+			if err != nil {
+				t.Fatalf("Failed to read output header: %v", err)
+			}
+			if header.Width() != framebuffer.Width() || header.Height() != framebuffer.Height() {
+				t.Errorf("output is %dx%d, want %dx%d", header.Width(), header.Height(), framebuffer.Width(), framebuffer.Height())
+			}
+			if !bytes.Equal(reencoded.ICC(), decoder.ICC()) {
+				t.Errorf("output ICC profile does not match the source's")
+			}
+		})
+	}
+}
+
+func TestPngEncode(t *testing.T) {
+	buf, err := ioutil.ReadFile("testdata/ferry_sunset.png")
+	if err != nil {
+		t.Fatalf("Failed to read fixture: %v", err)
+	}
+	decoder, err := NewDecoder(buf)
+	if err != nil {
+		t.Fatalf("Failed to create decoder: %v", err)
+	}
+	defer decoder.Close()
+	framebuffer := NewFramebuffer(4096, 4096)
+	defer framebuffer.Close()
+	if err := decoder.DecodeTo(framebuffer); err != nil {
+		t.Fatalf("Failed to decode: %v", err)
+	}
+	size := framebuffer.Width() * framebuffer.Height() * framebuffer.pixelType.Channels()
+
+	for _, threads := range []int{1, 4} {
+		for _, opt := range []map[int]int{nil, {PngCompression: 9}, {PngStrategy: PngStrategyAuto, PngRowFilter: PngRowFilterPaeth}} {
+			encoder, err := newPngEncoder(decoder, make([]byte, 8*1024*1024), nil)
+			if err != nil {
+				t.Fatalf("Failed to create encoder: %v", err)
+			}
+			encoder.setParallelism(threads)
+			out, err := encoder.Encode(framebuffer, opt)
+			if err != nil {
+				t.Fatalf("Failed to encode with %d threads: %v", threads, err)
+			}
+
+			reencoded, err := NewDecoder(out)
+			if err != nil {
+				t.Fatalf("Failed to decode output: %v", err)
+			}
+			roundTrip := NewFramebuffer(4096, 4096)
+			if err := reencoded.DecodeTo(roundTrip); err != nil {
+				t.Fatalf("Failed to decode output: %v", err)
+			}
+			if roundTrip.pixelType != framebuffer.pixelType || !bytes.Equal(roundTrip.buf[:size], framebuffer.buf[:size]) {
+				t.Errorf("%d threads, options %v: output does not round-trip", threads, opt)
+			}
+			roundTrip.Close()
+			reencoded.Close()
+		}
+	}
+
+	encoder, err := NewEncoder(".png", decoder, make([]byte, 64), nil)
+	if err != nil {
+		t.Fatalf("Failed to create encoder: %v", err)
+	}
+	defer encoder.Close()
+	if _, err := encoder.Encode(framebuffer, nil); err != ErrBufTooSmall {
+		t.Errorf("Encode into a small buffer returned %v, want ErrBufTooSmall", err)
+	}
+}
+
+func TestPngPalette(t *testing.T) {
+	buf, err := ioutil.ReadFile("data/firefox.png")
+	if err != nil {
+		t.Fatalf("Failed to read fixture: %v", err)
+	}
+	decoder, err := NewDecoder(buf)
+	if err != nil {
+		t.Fatalf("Failed to create decoder: %v", err)
+	}
+	defer decoder.Close()
+	framebuffer := NewFramebuffer(1024, 1024)
+	defer framebuffer.Close()
+	if err := decoder.DecodeTo(framebuffer); err != nil {
+		t.Fatalf("Failed to decode: %v", err)
+	}
+
+	// a frame of 128 colours, half of them translucent, which a palette
+	// holds exactly
+	few := NewFramebuffer(64, 64)
+	defer few.Close()
+	if err := few.Create4Channel(64, 64); err != nil {
+		t.Fatalf("Create4Channel: %v", err)
+	}
+	for y := 0; y < 64; y++ {
+		for x := 0; x < 64; x++ {
+			px := few.buf[(y*64+x)*4:]
+			px[0], px[1], px[2], px[3] = byte(x/8*32), byte(y/8*32), byte((x/8+y/8)%2*128), 255
+			if (x+y)%2 == 1 {
+				px[3] = 160
+			}
+		}
+	}
+
+	// the colour type follows IHDR's dimensions and bit depth. Full colour
+	// and exact palettes must give back the source's pixels, and the firefox
+	// palette of quality 1 measures about 40dB in premultiplied RGBA
+	const colorTypeOffset = 8 + 8 + 9
+	for _, tc := range []struct {
+		name      string
+		src       *Framebuffer
+		quality   int
+		colorType byte
+		minPSNR   float64 // 0 for an exact match
+	}{
+		{"firefox", framebuffer, 0, 6, 0},
+		{"firefox", framebuffer, 1, 3, 35},
+		{"firefox", framebuffer, 100, 6, 0},
+		{"128_colours", few, 100, 3, 0},
+	} {
+		encoder, err := NewEncoder(".png", decoder, make([]byte, 1024*1024), nil)
+		if err != nil {
+			t.Fatalf("Failed to create encoder: %v", err)
+		}
+		out, err := encoder.Encode(tc.src, map[int]int{PngPaletteQuality: tc.quality})
+		encoder.Close()
+		if err != nil {
+			t.Fatalf("Failed to encode: %v", err)
+		}
+		if out[colorTypeOffset] != tc.colorType {
+			t.Errorf("%s quality %d: colour type %d, want %d", tc.name, tc.quality, out[colorTypeOffset], tc.colorType)
+		}
+
+		reencoded, err := NewDecoder(out)
+		if err != nil {
+			t.Fatalf("Failed to decode output: %v", err)
+		}
+		roundTrip := NewFramebuffer(1024, 1024)
+		if err := reencoded.DecodeTo(roundTrip); err != nil {
+			t.Fatalf("%s quality %d: failed to decode output: %v", tc.name, tc.quality, err)
+		}
+		reencoded.Close()
+		if roundTrip.Width() != tc.src.Width() || roundTrip.Height() != tc.src.Height() || roundTrip.pixelType.Channels() != 4 {
+			t.Errorf("%s quality %d: output decoded as %dx%d with %d channels", tc.name, tc.quality, roundTrip.Width(), roundTrip.Height(), roundTrip.pixelType.Channels())
+			roundTrip.Close()
+			continue
+		}
+		n := tc.src.Width() * tc.src.Height() * 4
+		if tc.minPSNR == 0 {
+			if !bytes.Equal(roundTrip.buf[:n], tc.src.buf[:n]) {
+				t.Errorf("%s quality %d: output pixels differ from the source", tc.name, tc.quality)
+			}
+		} else if psnr := premultipliedPSNR(roundTrip.buf[:n], tc.src.buf[:n]); psnr < tc.minPSNR {
+			t.Errorf("%s quality %d: PSNR %.2fdB, want at least %.2fdB", tc.name, tc.quality, psnr, tc.minPSNR)
+		}
+		roundTrip.Close()
+	}
+}
+
+// premultipliedPSNR is the PSNR between two frames of BGRA pixels compared
+// with their colours premultiplied by alpha, as the palette quantizer rates
+// them
+func premultipliedPSNR(a, b []byte) float64 {
+	var sum float64
+	for i := 0; i+3 < len(a); i += 4 {
+		for ch := 0; ch < 4; ch++ {
+			pa, pb := int(a[i+ch]), int(b[i+ch])
+			if ch < 3 {
+				pa = (pa*int(a[i+3]) + 127) / 255
+				pb = (pb*int(b[i+3]) + 127) / 255
+			}
+			sum += float64((pa - pb) * (pa - pb))
+		}
+	}
+	if sum == 0 {
+		return math.Inf(1)
+	}
+	return 10 * math.Log10(255*255*float64(len(a))/sum)
+}
+
+// withJpegOrientation returns the JPEG buf with its EXIF segment, if any,
+// replaced by one holding only the given orientation
+func withJpegOrientation(buf []byte, orientation ImageOrientation) []byte {
+	exif := []byte{
+		0xFF, 0xE1, 0, 34, 'E', 'x', 'i', 'f', 0, 0,
+		'M', 'M', 0, 42, 0, 0, 0, 8, // big-endian TIFF header, IFD0 at 8
+		0, 1, // one entry
+		0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, byte(orientation), 0, 0, // Orientation, SHORT
+		0, 0, 0, 0, // no next IFD
+	}
+	out := append([]byte{0xFF, 0xD8}, exif...)
+	for i := 2; i+4 <= len(buf); {
+		length := int(buf[i+2])<<8 | int(buf[i+3])
+		if buf[i+1] == 0xDA {
+			return append(out, buf[i:]...)
+		}
+		if !(buf[i+1] == 0xE1 && bytes.HasPrefix(buf[i+4:], []byte("Exif\x00\x00"))) {
+			out = append(out, buf[i:i+2+length]...)
+		}
+		i += 2 + length
+	}
+	return out
+}
+
+// jpegQuantTables returns the first DQT segment of buf
+func jpegQuantTables(buf []byte) []byte {
+	i := bytes.Index(buf, []byte{0xFF, 0xDB})
+	if i < 0 || i+4 > len(buf) {
+		return nil
+	}
+	return buf[i : i+2+(int(buf[i+2])<<8|int(buf[i+3]))]
+}
+
+func TestJpegLosslessTransform(t *testing.T) {
+	src, err := ioutil.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		t.Fatalf("Failed to read fixture: %v", err)
+	}
+
+	// the fixture is 800x297 with 16x16 MCUs, so it can be flipped
+	// horizontally and transposed losslessly, but not rotated 180 degrees
+	for _, tc := range []struct {
+		name          string
+		orientation   ImageOrientation
+		method        ImageOpsSizeMethod
+		width, height int
+		wantWidth     int
+		wantHeight    int
+		lossless      bool
+	}{
+		{"hflip", OrientationTopRight, ImageOpsNoResize, 0, 0, 800, 297, true},
+		{"transpose", OrientationLeftTop, ImageOpsNoResize, 0, 0, 297, 800, true},
+		{"imperfect_rotate", OrientationBottomRight, ImageOpsNoResize, 0, 0, 800, 297, false},
+		{"unoriented", OrientationTopLeft, ImageOpsNoResize, 0, 0, 800, 297, false},
+		{"aligned_crop", OrientationTopRight, ImageOpsFit, 256, 297, 256, 297, true},
+		{"unoriented_crop", OrientationTopLeft, ImageOpsFit, 256, 297, 256, 297, false},
+		{"unaligned_crop", OrientationTopRight, ImageOpsFit, 297, 297, 297, 297, false},
+		{"resize", OrientationLeftTop, ImageOpsFit, 100, 100, 100, 100, false},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			buf := withJpegOrientation(src, tc.orientation)
+			decoder, err := NewDecoder(buf)
+			if err != nil {
+				t.Fatalf("Failed to create decoder: %v", err)
+			}
+			defer decoder.Close()
+			icc := decoder.ICC()
+
+			ops := NewImageOps(2048)
+			defer ops.Close()
+			out, err := ops.Transform(decoder, &ImageOptions{
+				FileType:             ".jpeg",
+				Width:                tc.width,
+				Height:               tc.height,
+				ResizeMethod:         tc.method,
+				NormalizeOrientation: true,
+				EncodeOptions:        map[int]int{JpegQuality: 50},
+			}, make([]byte, 4*1024*1024))
+			if err != nil {
+				t.Fatalf("Failed to transform: %v", err)
+			}
+
+			// a lossless transform keeps the source's quantization tables,
+			// where a re-encode uses those of JpegQuality
+			if lossless := bytes.Equal(jpegQuantTables(out), jpegQuantTables(buf)); lossless != tc.lossless {
+				t.Errorf("lossless = %v, want %v", lossless, tc.lossless)
+			}
+			if bytes.Contains(out, []byte("Exif\x00\x00")) {
+				t.Errorf("output carries EXIF data")
+			}
+
+			result, err := NewDecoder(out)
+			if err != nil {
+				t.Fatalf("Failed to decode output: %v", err)
+			}
+			defer result.Close()
+			header, err := result.Header()
+			if err != nil {
+				t.Fatalf("Failed to read output header: %v", err)
+			}
+			if header.Width() != tc.wantWidth || header.Height() != tc.wantHeight {
+				t.Errorf("output is %dx%d, want %dx%d", header.Width(), header.Height(), tc.wantWidth, tc.wantHeight)
+			}
+			if header.Orientation() != OrientationTopLeft {
+				t.Errorf("output orientation %d, want %d", header.Orientation(), OrientationTopLeft)
+			}
+			if !bytes.Equal(result.ICC(), icc) {
+				t.Errorf("output ICC profile does not match the source's")
+			}
+		})
+	}
+
+	// a buffer too small for the output is reported as such
+	decoder, err := NewDecoder(withJpegOrientation(src, OrientationLeftTop))
+	if err != nil {
+		t.Fatalf("Failed to create decoder: %v", err)
+	}
+	defer decoder.Close()
+	ops := NewImageOps(2048)
+	defer ops.Close()
+	_, err = ops.Transform(decoder, &ImageOptions{FileType: ".jpeg", NormalizeOrientation: true}, make([]byte, 1024))
+	if err != ErrBufTooSmall {
+		t.Errorf("Transform into a small buffer returned %v, want %v", err, ErrBufTooSmall)
+	}
+}
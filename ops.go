@@ -5,9 +5,11 @@ import "C"
 
 import (
 	"bytes"
+	"errors"
 	"fmt"
 	"image"
 	"io"
+	"math"
 	"strings"
 	"time"
 	"unsafe"
@@ -58,10 +60,34 @@ type ImageOptions struct {
 	// DisableAnimatedOutput controls the encoder behavior when given a multi-frame input
 	DisableAnimatedOutput bool
 
+	// MaxFrameRate caps the frame rate of animated output, in frames per second.
+	// Frames that start within 1/MaxFrameRate of the last encoded frame are
+	// dropped and their durations added to that frame. 0 means no limit.
+	MaxFrameRate int
+
+	// ResizeFilter selects the filter kernel used to resize the image.
+	// The zero value is ResizeFilterArea.
+	ResizeFilter ResizeFilter
+
 	// ForceSdr enables HDR to SDR tone mapping for images with PQ (Perceptual Quantizer) profiles.
 	// When enabled, images with HDR color profiles will be tone-mapped to SDR for better compatibility.
 	// Only applies to WebP and PNG output formats.
 	ForceSdr bool
+
+	// PreserveHighBitDepth keeps the samples of still images deeper than 8
+	// bits, such as 16-bit PNGs and 10 and 12-bit AVIFs, at 16 bits through
+	// decoding, resizing and tone mapping rather than narrowing them to 8 bits
+	// on decode. PNG output is then written with 16-bit samples and AVIF output
+	// with 10-bit ones; other formats are narrowed to 8 bits just before
+	// encoding. Frames take twice the memory while they are 16-bit, and any
+	// too large to fit in the ImageOps at that size are narrowed as before.
+	PreserveHighBitDepth bool
+
+	// ConvertToSRGB converts the pixels of images with an embedded RGB ICC
+	// profile, such as Display-P3 photos, to sRGB and writes the output
+	// without the profile. Images whose colour is signalled by a PNG cICP
+	// chunk or an HDR profile are left to the handling above.
+	ConvertToSRGB bool
 }
 
 // ImageOps is a reusable object that can resize and encode images.
@@ -75,18 +101,127 @@ type ImageOps struct {
 	// output. At most one is ever set.
 	tonemapCICP *CICP
 	outputCICP  *CICP
+	// gifArena is lent to each GIF encoder this ImageOps creates, so that
+	// back-to-back GIF transforms reuse its memory. Created on first use.
+	gifArena *gifEncoderArena
+	// resampler does every resize, so consecutive frames and transforms of
+	// the same geometry share its filter tables.
+	resampler *resampler
+	// Frame folding for animated transforms. lastEmitted mirrors the
+	// composite canvas as of the last encoded frame and dirty is the part of
+	// the canvas touched since then. When a frame leaves the canvas as it was
+	// and the encoder can lengthen its previous frame, the frame is folded
+	// into that one rather than being resized and encoded again.
+	lastEmitted *Framebuffer
+	dirty       image.Rectangle
+	extender    frameExtender
+	// Frame rate decimation, which also works by folding frames. elapsed is
+	// the source time at which the next frame starts and nextFrameAt the
+	// earliest a frame may start and still be encoded.
+	frameInterval time.Duration
+	elapsed       time.Duration
+	nextFrameAt   time.Duration
+	// deferredOrientation is an orientation Transform skipped applying to the
+	// decoded frame so that the resize can apply it to its (smaller) output
+	// instead. 0 when there is none.
+	deferredOrientation ImageOrientation
+	// parallelism is the number of threads resizing, orientation,
+	// tone-mapping and PNG encoding may use; see SetParallelism.
+	parallelism int
+	// decodedCanvasWidth and decodedCanvasHeight are the canvas size of
+	// frames a downscalingDecoder was asked to shrink while decoding, with
+	// axes swapped as in inputCanvasSize. 0 when frames decode at full size.
+	decodedCanvasWidth  int
+	decodedCanvasHeight int
+	// premultiply is set when decoded frames with alpha are to be
+	// premultiplied, which pays off whenever they are resized or composited.
+	premultiply bool
+	// deferTonemap is set when the tone-map of tonemapCICP is left until the
+	// frame has been shrunk, so that it only runs over the output pixels.
+	deferTonemap bool
+	// srgbICC is the source profile that encode converts frames from to
+	// sRGB, under ImageOptions.ConvertToSRGB; nil when there is none.
+	srgbICC []byte
+}
+
+// downscalingDecoder is implemented by decoders that can shrink frames more
+// cheaply while decoding them than a resize of the decoded frame could, for
+// instance by scaling YUV planes before converting them to BGR. Once
+// setDecodeSize is called, DecodeTo produces frames of that size, in the
+// decoder's stored orientation, with frame offsets scaled to match.
+type downscalingDecoder interface {
+	setDecodeSize(width, height int)
 }
 
+// croppingDecoder is implemented by decoders that can decode a region of a
+// still image more cheaply than the whole of it. Once setCrop is called,
+// DecodeTo produces only the pixels in rect, which is in the decoder's stored
+// orientation.
+type croppingDecoder interface {
+	setCrop(rect image.Rectangle)
+}
+
+// premultipliedEncoder is implemented by encoders that can take frames whose
+// colour is premultiplied by alpha and undo it as part of their own colour
+// conversion, sparing ImageOps a separate pass before encoding.
+type premultipliedEncoder interface {
+	acceptsPremultiplied() bool
+}
+
+// highDepthEncoder is implemented by encoders that can store 16-bit frames
+// without ImageOps narrowing them to 8 bits first.
+type highDepthEncoder interface {
+	acceptsHighDepth() bool
+}
+
+// parallelEncoder is implemented by encoders that can split the encoding of
+// a large frame across threads. setParallelism gives them ImageOps's
+// parallelism before each frame.
+type parallelEncoder interface {
+	setParallelism(n int)
+}
+
+// frameExtender is implemented by encoders of animated formats that can
+// lengthen the frame they encoded last. extendLastFrame reports false if it
+// could not, in which case the frame must be encoded normally.
+type frameExtender interface {
+	extendLastFrame(d time.Duration) bool
+}
+
+// errFrameFolded signals from the transform stage that the current frame was
+// folded into the previous one and there is nothing to encode for it.
+var errFrameFolded = errors.New("frame folded into previous frame")
+
 // NewImageOps creates a new ImageOps object that will operate
 // on images up to maxSize on each axis. It initializes two framebuffers
-// for double-buffering operations.
+// for double-buffering operations; their pixel memory is taken from the
+// framebuffer pool as images need it.
 func NewImageOps(maxSize int) *ImageOps {
 	frames := make([]*Framebuffer, 2)
 	frames[0] = NewFramebuffer(maxSize, maxSize)
 	frames[1] = NewFramebuffer(maxSize, maxSize)
 	return &ImageOps{
-		frames:     frames,
-		frameIndex: 0,
+		frames:      frames,
+		frameIndex:  0,
+		resampler:   newResampler(),
+		parallelism: 1,
+	}
+}
+
+// SetParallelism sets the number of threads that resizing, orientation,
+// tone-mapping and PNG encoding may use for this ImageOps, counting the
+// calling goroutine.
+// Large images are split into horizontal stripes, and stripes beyond the
+// first are taken by a worker pool shared by the whole process, whose size
+// SetMaxParallelism caps. Small images are not split. The default of 1 does
+// all work on the calling goroutine.
+func (o *ImageOps) SetParallelism(n int) {
+	if n < 1 {
+		n = 1
+	}
+	o.parallelism = n
+	if o.resampler != nil {
+		o.resampler.threads = n
 	}
 }
 
@@ -114,6 +249,13 @@ func (o *ImageOps) Clear() {
 	if o.animatedCompositeBuffer != nil {
 		o.animatedCompositeBuffer.Clear()
 	}
+	if o.resampler != nil {
+		o.resampler.clear()
+	}
+	if o.gifArena != nil {
+		o.gifArena.Close()
+		o.gifArena = nil
+	}
 }
 
 // Close releases resources associated with ImageOps
@@ -124,6 +266,14 @@ func (o *ImageOps) Close() {
 		o.animatedCompositeBuffer.Close()
 		o.animatedCompositeBuffer = nil
 	}
+	if o.gifArena != nil {
+		o.gifArena.Close()
+		o.gifArena = nil
+	}
+	if o.resampler != nil {
+		o.resampler.Close()
+		o.resampler = nil
+	}
 }
 
 // setupAnimatedFrameBuffers initializes the composite buffer needed for animated image processing.
@@ -132,6 +282,10 @@ func (o *ImageOps) Close() {
 func (o *ImageOps) setupAnimatedFrameBuffers(d Decoder, inputCanvasWidth, inputCanvasHeight int, hasAlpha bool) error {
 	// Create a buffer to hold the composite of the current frame and the previous frame
 	if o.animatedCompositeBuffer == nil {
+		// frames shrunk while decoding are composited at their own size
+		if o.decodedCanvasWidth > 0 {
+			inputCanvasWidth, inputCanvasHeight = o.decodedCanvasWidth, o.decodedCanvasHeight
+		}
 		o.animatedCompositeBuffer = NewFramebuffer(inputCanvasWidth, inputCanvasHeight)
 		if !hasAlpha {
 			if err := o.animatedCompositeBuffer.Create3Channel(inputCanvasWidth, inputCanvasHeight); err != nil {
@@ -143,12 +297,69 @@ func (o *ImageOps) setupAnimatedFrameBuffers(d Decoder, inputCanvasWidth, inputC
 			}
 		}
 		rect := image.Rect(0, 0, inputCanvasWidth, inputCanvasHeight)
-		return o.animatedCompositeBuffer.ClearToTransparent(rect)
+		if err := o.animatedCompositeBuffer.ClearToTransparent(rect); err != nil {
+			return err
+		}
+
+		// Only needed when frames can be folded; it starts out matching the
+		// freshly cleared composite.
+		if o.extender != nil {
+			o.lastEmitted = NewFramebuffer(inputCanvasWidth, inputCanvasHeight)
+			if err := o.lastEmitted.resizeMat(inputCanvasWidth, inputCanvasHeight, o.animatedCompositeBuffer.PixelType()); err != nil {
+				return err
+			}
+			if err := o.lastEmitted.ClearToTransparent(rect); err != nil {
+				return err
+			}
+		}
+		o.dirty = image.Rectangle{}
+		o.elapsed = 0
+		o.nextFrameAt = 0
 	}
 
 	return nil
 }
 
+// foldFrame runs after the active frame has been blended onto the composite.
+// A frame that starts sooner than MaxFrameRate allows, or that left the
+// composite identical to what was last encoded, is folded into the previous
+// frame if the encoder agrees to lengthen it by the active frame's duration.
+// In that case it reports true and the caller should skip resizing and
+// encoding this frame.
+func (o *ImageOps) foldFrame() (bool, error) {
+	if o.lastEmitted == nil {
+		return false, nil
+	}
+
+	active := o.active()
+	frameRect := image.Rect(active.xOffset, active.yOffset, active.xOffset+active.Width(), active.yOffset+active.Height())
+	start := o.elapsed
+	o.elapsed += active.Duration()
+
+	// A dropped frame's pixels stay on the composite, so remember where they
+	// went for whichever frame is encoded next.
+	if start < o.nextFrameAt && o.extender.extendLastFrame(active.Duration()) {
+		o.dirty = o.dirty.Union(frameRect)
+		return true, nil
+	}
+
+	canvas := image.Rect(0, 0, o.animatedCompositeBuffer.Width(), o.animatedCompositeBuffer.Height())
+	dirty := o.dirty.Union(frameRect).Intersect(canvas)
+
+	// Either way the mirror matches the composite again after this.
+	changed, err := o.lastEmitted.syncRegionFrom(o.animatedCompositeBuffer, dirty)
+	if err != nil {
+		return false, err
+	}
+	o.dirty = image.Rectangle{}
+
+	if !changed && o.extender.extendLastFrame(active.Duration()) {
+		return true, nil
+	}
+	o.nextFrameAt = start + o.frameInterval
+	return false, nil
+}
+
 // decode reads the current frame from the decoder into the active framebuffer.
 // Returns an error if decoding fails.
 func (o *ImageOps) decode(d Decoder) error {
@@ -157,13 +368,60 @@ func (o *ImageOps) decode(d Decoder) error {
 		return err
 	}
 	// Tone-map HDR pixels immediately after decode, before any resize or
-	// composite, so every later stage operates on SDR data.
-	if o.tonemapCICP != nil {
-		active.TonemapToSDR(*o.tonemapCICP)
+	// composite, so every later stage operates on SDR data, unless that is
+	// deferred until after the resize.
+	if o.tonemapCICP != nil && !o.deferTonemap {
+		if err := o.tonemap(); err != nil {
+			return err
+		}
+		active = o.active()
+	}
+	if o.premultiply {
+		active.premultiplyAlpha(o.parallelism)
 	}
 	return nil
 }
 
+// tonemap tone-maps the active frame to SDR. A 16-bit frame becomes 8-bit on
+// the way, so it is tone-mapped into the secondary framebuffer, which is then
+// made active, instead of in place.
+func (o *ImageOps) tonemap() error {
+	active := o.active()
+	if active.pixelType.Depth() > 8 {
+		if err := active.tonemapTo(*o.tonemapCICP, o.secondary(), o.parallelism); err != nil {
+			return err
+		}
+		o.copyFramePropertiesAndSwap()
+		return nil
+	}
+	return active.tonemapToSDR(*o.tonemapCICP, o.parallelism)
+}
+
+// canDeferTonemap reports whether an HDR frame can be tone-mapped after it is
+// resized rather than before. That is only worthwhile for a static image being
+// shrunk, and animated frames must be SDR before they are composited. The
+// resize then filters the source's HDR-encoded values rather than SDR ones,
+// and the tone-map takes its image statistics from the smaller frame, which
+// shifts the output slightly but saves tone-mapping every pixel the resize
+// throws away.
+func canDeferTonemap(opt *ImageOptions, inputHeader *ImageHeader) bool {
+	if inputHeader.IsAnimated() {
+		return false
+	}
+	if opt.ResizeMethod != ImageOpsFit && opt.ResizeMethod != ImageOpsResize {
+		return false
+	}
+	return opt.Width*opt.Height < inputHeader.Width()*inputHeader.Height()
+}
+
+// tonemapResized applies a deferred tone-map to the resized active frame. The
+// tone-map works on straight colour, so a premultiplied frame is first
+// unpremultiplied, which encode would otherwise do.
+func (o *ImageOps) tonemapResized() error {
+	o.active().unpremultiplyAlpha(o.parallelism)
+	return o.tonemap()
+}
+
 // fit resizes the active frame to fit within the specified dimensions while maintaining aspect ratio.
 // For animated images, it handles frame compositing and disposal.
 // Returns (true, nil) if resizing was performed successfully, (false, error) if an error occurred.
@@ -180,8 +438,13 @@ func (o *ImageOps) fit(d Decoder, inputCanvasWidth, inputCanvasHeight, outputCan
 			return false, err
 		}
 
+		// skip the resize entirely if this frame is dropped or didn't change the canvas
+		if folded, err := o.foldFrame(); err != nil || folded {
+			return false, o.finishFoldedFrame(d, err)
+		}
+
 		// resize the composite to the output canvas size
-		if err := o.animatedCompositeBuffer.Fit(newWidth, newHeight, o.secondary()); err != nil {
+		if err := o.animatedCompositeBuffer.fit(newWidth, newHeight, o.secondary(), o.resampler); err != nil {
 			return false, err
 		}
 
@@ -195,7 +458,7 @@ func (o *ImageOps) fit(d Decoder, inputCanvasWidth, inputCanvasHeight, outputCan
 	}
 
 	// If the image is not animated, we can fit it directly.
-	if err := o.active().Fit(newWidth, newHeight, o.secondary()); err != nil {
+	if err := o.resampleOriented((*Framebuffer).fit, newWidth, newHeight); err != nil {
 		return false, err
 	}
 	o.copyFramePropertiesAndSwap()
@@ -217,7 +480,11 @@ func (o *ImageOps) resize(d Decoder, inputCanvasWidth, inputCanvasHeight, output
 			return false, err
 		}
 
-		if err := o.animatedCompositeBuffer.ResizeTo(outputCanvasWidth, outputCanvasHeight, o.secondary()); err != nil {
+		if folded, err := o.foldFrame(); err != nil || folded {
+			return false, o.finishFoldedFrame(d, err)
+		}
+
+		if err := o.animatedCompositeBuffer.resizeTo(outputCanvasWidth, outputCanvasHeight, o.secondary(), o.resampler); err != nil {
 			return false, err
 		}
 
@@ -229,7 +496,7 @@ func (o *ImageOps) resize(d Decoder, inputCanvasWidth, inputCanvasHeight, output
 		return true, nil
 	}
 
-	if err := o.active().ResizeTo(outputCanvasWidth, outputCanvasHeight, o.secondary()); err != nil {
+	if err := o.resampleOriented((*Framebuffer).resizeTo, outputCanvasWidth, outputCanvasHeight); err != nil {
 		return false, err
 	}
 	o.copyFramePropertiesAndSwap()
@@ -266,13 +533,71 @@ func min(a, b int) int {
 // by performing the necessary flips and rotations.
 func (o *ImageOps) normalizeOrientation(orientation ImageOrientation) {
 	active := o.active()
-	active.OrientationTransform(orientation)
+	active.orientationTransform(orientation, o.parallelism)
+}
+
+// canDeferOrientation reports whether the orientation of a decoded frame can be
+// left for resampleOriented to apply after the resize. That is only worthwhile
+// for a static image being shrunk; animated frames are composited in display
+// orientation, and an enlarged image is cheaper to rotate before it grows.
+func canDeferOrientation(opt *ImageOptions, inputHeader *ImageHeader) bool {
+	if inputHeader.IsAnimated() || inputHeader.Orientation() == OrientationTopLeft {
+		return false
+	}
+	if opt.ResizeMethod != ImageOpsFit && opt.ResizeMethod != ImageOpsResize {
+		return false
+	}
+	return opt.Width*opt.Height <= inputHeader.Width()*inputHeader.Height()
+}
+
+// resampleOriented resizes the active frame into the secondary framebuffer to
+// the given display dimensions. If Transform deferred the frame's orientation,
+// the resize runs on the unrotated frame with its axes swapped as needed and
+// the orientation is applied to the output, so no full-size rotated copy of
+// the frame is ever made. Fit crops about the centre, which commutes with the
+// flips and rotations up to the rounding of an odd crop margin.
+func (o *ImageOps) resampleOriented(resize func(f *Framebuffer, width, height int, dst *Framebuffer, r *resampler) error, width, height int) error {
+	orientation := o.deferredOrientation
+	o.deferredOrientation = 0
+	if orientation == 0 {
+		return resize(o.active(), width, height, o.secondary(), o.resampler)
+	}
+
+	if orientation.SwapsAxes() {
+		width, height = height, width
+	}
+	if err := resize(o.active(), width, height, o.secondary(), o.resampler); err != nil {
+		return err
+	}
+	o.secondary().orientationTransform(orientation, o.parallelism)
+	return nil
 }
 
 // encode writes the active frame to an encoded format using the provided encoder
 // and encoding options. Returns the encoded bytes or an error.
 func (o *ImageOps) encode(e Encoder, opt map[int]int) ([]byte, error) {
 	active := o.active()
+	if active.pixelType.Depth() > 8 {
+		if he, ok := e.(highDepthEncoder); !ok || !he.acceptsHighDepth() {
+			if err := active.narrowTo(o.secondary()); err != nil {
+				return nil, err
+			}
+			o.copyFramePropertiesAndSwap()
+			active = o.active()
+		}
+	}
+	// converted here, once the frame is at its output size, rather than on
+	// decode
+	if o.srgbICC != nil {
+		active.unpremultiplyAlpha(o.parallelism)
+		active.convertToSRGB(o.srgbICC, o.parallelism)
+	}
+	if pe, ok := e.(premultipliedEncoder); !ok || !pe.acceptsPremultiplied() {
+		active.unpremultiplyAlpha(o.parallelism)
+	}
+	if pe, ok := e.(parallelEncoder); ok {
+		pe.setParallelism(o.parallelism)
+	}
 	content, err := e.Encode(active, opt)
 	if err != nil {
 		return nil, err
@@ -291,12 +616,11 @@ func (o *ImageOps) encodeEmpty(e Encoder, opt map[int]int) ([]byte, error) {
 }
 
 // outputTagsICC reports whether an output format embeds an ICC profile at all.
-// WebP and AVIF do; JPEG, PNG and GIF outputs carry none through the OpenCV
-// encoder, and PNG has its own cICP channel so it never needs a synthesized
-// profile.
+// WebP, AVIF and JPEG do; PNG and GIF outputs carry none, and PNG has its own
+// cICP channel so it never needs a synthesized profile.
 func outputTagsICC(fileType string) bool {
 	switch strings.ToLower(fileType) {
-	case ".webp", ".avif":
+	case ".webp", ".avif", ".jpeg", ".jpg":
 		return true
 	default:
 		return false
@@ -355,14 +679,68 @@ func (o *ImageOps) Transform(d Decoder, opt *ImageOptions, dst []byte) ([]byte,
 			o.animatedCompositeBuffer.Close()
 			o.animatedCompositeBuffer = nil
 		}
+		if o.lastEmitted != nil {
+			o.lastEmitted.Close()
+			o.lastEmitted = nil
+		}
+		o.extender = nil
+		o.frameInterval = 0
+		o.deferredOrientation = 0
+		o.decodedCanvasWidth = 0
+		o.decodedCanvasHeight = 0
+		o.premultiply = false
+		o.deferTonemap = false
+		for _, f := range o.frames {
+			f.highDepth = false
+		}
+		o.tonemapCICP = nil
+		o.outputCICP = nil
+		o.srgbICC = nil
 	}()
 
+	// still JPEGs and PNGs can be transformed in one call, without the
+	// decoder, framebuffers and encoder each being driven from Go
+	if content, done, err := o.transformStill(d, opt, dst); done {
+		return content, err
+	}
+
 	inputHeader, enc, err := o.initializeTransform(d, opt, dst)
 	if err != nil {
 		return nil, err
 	}
 	defer enc.Close()
 
+	o.resampler.filter = opt.ResizeFilter
+	o.premultiply = inputHeader.HasAlpha() && (opt.ResizeMethod != ImageOpsNoResize || inputHeader.IsAnimated())
+	o.deferTonemap = o.tonemapCICP != nil && canDeferTonemap(opt, inputHeader)
+	// animated frames are composited on 8-bit canvases, so only still images
+	// are kept deep
+	for _, f := range o.frames {
+		f.highDepth = opt.PreserveHighBitDepth && !inputHeader.IsAnimated()
+	}
+
+	if downscaler, ok := d.(downscalingDecoder); ok {
+		if width, height := decodeSize(opt, inputHeader); width > 0 {
+			downscaler.setDecodeSize(width, height)
+			if opt.NormalizeOrientation && inputHeader.Orientation().SwapsAxes() {
+				width, height = height, width
+			}
+			o.decodedCanvasWidth, o.decodedCanvasHeight = width, height
+		}
+	}
+	if cropper, ok := d.(croppingDecoder); ok {
+		if crop := decodeCrop(opt, inputHeader); !crop.Empty() {
+			cropper.setCrop(crop)
+		}
+	}
+
+	if !opt.DisableAnimatedOutput {
+		o.extender, _ = enc.(frameExtender)
+		if opt.MaxFrameRate > 0 {
+			o.frameInterval = time.Second / time.Duration(opt.MaxFrameRate)
+		}
+	}
+
 	frameCount := 0
 	duration := time.Duration(0)
 	encodeTimeoutTime := time.Now().Add(opt.EncodeTimeout)
@@ -389,15 +767,31 @@ func (o *ImageOps) Transform(d Decoder, opt *ImageOptions, dst []byte) ([]byte,
 			return o.encodeEmpty(enc, opt.EncodeOptions)
 		}
 
-		o.normalizeOrientation(inputHeader.Orientation())
+		if !emptyFrame && canDeferOrientation(opt, inputHeader) {
+			o.deferredOrientation = inputHeader.Orientation()
+		} else {
+			o.normalizeOrientation(inputHeader.Orientation())
+		}
 
 		// transform the frame, resizing if necessary
 		var swapped bool
 		if !emptyFrame {
 			swapped, err = o.transformCurrentFrame(d, opt, inputHeader, frameCount)
+			if err == errFrameFolded {
+				// the previous frame was lengthened instead; nothing to encode
+				if time.Now().After(encodeTimeoutTime) {
+					return nil, ErrEncodeTimeout
+				}
+				continue
+			}
 			if err != nil {
 				return nil, err
 			}
+			if o.deferTonemap && swapped {
+				if err = o.tonemapResized(); err != nil {
+					return nil, err
+				}
+			}
 		}
 
 		// encode the frame to the output buffer
@@ -478,6 +872,76 @@ func inputCanvasSize(opt *ImageOptions, inputHeader *ImageHeader) (int, int) {
 	return inputHeader.Width(), inputHeader.Height()
 }
 
+// decodeSize returns the size, in the decoder's stored orientation, that a
+// downscalingDecoder can shrink frames to before the resize without costing
+// the output any detail, or 0, 0 if they should be decoded at full size. The
+// frames are scaled evenly to cover the output, and kept at twice that for
+// filters that need source pixels beyond those each output pixel covers.
+// Shrinking by half or less is not worth the extra pass.
+func decodeSize(opt *ImageOptions, inputHeader *ImageHeader) (int, int) {
+	if opt.ResizeMethod != ImageOpsFit && opt.ResizeMethod != ImageOpsResize {
+		return 0, 0
+	}
+	width, height := inputHeader.Width(), inputHeader.Height()
+	if width <= 0 || height <= 0 {
+		return 0, 0
+	}
+
+	outputWidth, outputHeight := opt.Width, opt.Height
+	if opt.ResizeMethod == ImageOpsFit {
+		canvasWidth, canvasHeight := inputCanvasSize(opt, inputHeader)
+		outputWidth, outputHeight = calculateExpectedSize(canvasWidth, canvasHeight, opt.Width, opt.Height)
+	}
+	// frames are oriented before they are resized, so the output size is in
+	// display orientation
+	if inputHeader.Orientation().SwapsAxes() {
+		outputWidth, outputHeight = outputHeight, outputWidth
+	}
+	if outputWidth <= 0 || outputHeight <= 0 {
+		return 0, 0
+	}
+
+	scale := math.Max(float64(outputWidth)/float64(width), float64(outputHeight)/float64(height))
+	if opt.ResizeFilter != ResizeFilterArea {
+		scale *= 2
+	}
+	if scale >= 0.5 {
+		return 0, 0
+	}
+	return int(math.Ceil(float64(width) * scale)), int(math.Ceil(float64(height) * scale))
+}
+
+// decodeCrop returns the region, in the decoder's stored orientation, of a
+// still image that Fit keeps, or an empty rectangle if it keeps all of it.
+// Decoding just that region gives Fit the same pixels to resize, up to the
+// rounding of an odd crop margin once the frame is flipped.
+func decodeCrop(opt *ImageOptions, inputHeader *ImageHeader) image.Rectangle {
+	if opt.ResizeMethod != ImageOpsFit || inputHeader.IsAnimated() {
+		return image.Rectangle{}
+	}
+	width, height := inputHeader.Width(), inputHeader.Height()
+	canvasWidth, canvasHeight := inputCanvasSize(opt, inputHeader)
+	outputWidth, outputHeight := calculateExpectedSize(canvasWidth, canvasHeight, opt.Width, opt.Height)
+	if width <= 0 || height <= 0 || outputWidth <= 0 || outputHeight <= 0 {
+		return image.Rectangle{}
+	}
+	// the output size is in display orientation
+	if inputHeader.Orientation().SwapsAxes() {
+		outputWidth, outputHeight = outputHeight, outputWidth
+	}
+
+	crop := fitCrop(width, height, outputWidth, outputHeight)
+	if crop.Dx() == width && crop.Dy() == height {
+		return image.Rectangle{}
+	}
+	// Fit crops the decoded region again, and rounding can have it shave off
+	// another row or column, which it would not have done to the whole image
+	if again := fitCrop(crop.Dx(), crop.Dy(), outputWidth, outputHeight); again.Size() != crop.Size() {
+		return image.Rectangle{}
+	}
+	return crop
+}
+
 // initializeTransform prepares for image transformation by reading the input header
 // and creating an appropriate encoder. Returns the header, encoder, and any error.
 func (o *ImageOps) initializeTransform(d Decoder, opt *ImageOptions, dst []byte) (*ImageHeader, Encoder, error) {
@@ -524,7 +988,7 @@ func (o *ImageOps) initializeTransform(d Decoder, opt *ImageOptions, dst []byte)
 			// rather than merged, which is what discards a malformed source
 			// iCCP blob.
 			//
-			// Restricted to the formats that embed a profile at all: JPEG and
+			// Restricted to the formats that embed a profile at all: PNG and
 			// GIF output carry none (cv::imencode drops it), so populating an
 			// override for them would be inert at best. An HDR source is
 			// excluded because its pixels have been tone-mapped to BT.709 and
@@ -537,6 +1001,25 @@ func (o *ImageOps) initializeTransform(d Decoder, opt *ImageOptions, dst []byte)
 		}
 	}
 
+	// An embedded profile is only converted from when no cICP chunk
+	// overrides it, and the output then carries no profile at all
+	if opt.ConvertToSRGB && o.tonemapCICP == nil && o.outputCICP == nil {
+		if icc := d.ICC(); iccConvertsToSRGB(icc) {
+			o.srgbICC = icc
+			encodeConfig = &EncodeConfig{DropICC: true}
+		}
+	}
+
+	if strings.ToLower(opt.FileType) == ".gif" {
+		if o.gifArena == nil {
+			o.gifArena = newGifEncoderArena()
+		}
+		if encodeConfig == nil {
+			encodeConfig = &EncodeConfig{}
+		}
+		encodeConfig.gifArena = o.gifArena
+	}
+
 	enc, err := NewEncoder(opt.FileType, d, dst, encodeConfig)
 	if err != nil {
 		return nil, nil, err
@@ -554,6 +1037,7 @@ func (o *ImageOps) applyDisposeMethod(d Decoder) error {
 	switch active.dispose {
 	case DisposeToBackgroundColor:
 		rect := image.Rect(active.xOffset, active.yOffset, active.xOffset+active.Width(), active.yOffset+active.Height())
+		o.dirty = o.dirty.Union(rect)
 		return o.animatedCompositeBuffer.ClearToTransparent(rect)
 	case NoDispose:
 		// Do nothing
@@ -561,6 +1045,19 @@ func (o *ImageOps) applyDisposeMethod(d Decoder) error {
 	return nil
 }
 
+// finishFoldedFrame completes a frame that foldFrame either folded
+// or failed on. A folded frame still has to be disposed so the composite is
+// right for the next one.
+func (o *ImageOps) finishFoldedFrame(d Decoder, err error) error {
+	if err != nil {
+		return err
+	}
+	if err := o.applyDisposeMethod(d); err != nil {
+		return err
+	}
+	return errFrameFolded
+}
+
 // applyBlendMethod composites the active frame onto the animation buffer using
 // the specified blending mode (alpha blending or direct copy).
 func (o *ImageOps) applyBlendMethod(d Decoder) error {
@@ -0,0 +1,144 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+// stripes smaller than this are not worth waking another thread for
+#define PARALLEL_MIN_STRIPE_BYTES (256 * 1024)
+
+namespace {
+
+struct parallel_job {
+    const std::function<void(int)>* fn = nullptr;
+    int stripes = 0;
+    std::atomic<int> next{0};
+    std::mutex mu;
+    std::condition_variable cv;
+    int finished = 0;
+};
+
+// Workers are started on demand, up to max_workers, and then wait for jobs.
+// A job is queued once per worker it could use; whoever dequeues it claims
+// stripes until there are none left, so an entry dequeued late costs nothing.
+struct parallel_pool {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<parallel_job>> queue;
+    std::atomic<int> max_workers{int(std::thread::hardware_concurrency())};
+    int workers = 0;
+    int idle = 0;
+};
+
+// never destroyed, so detached workers cannot outlive it at exit
+parallel_pool& parallel_get_pool()
+{
+    static parallel_pool* pool = new parallel_pool();
+    return *pool;
+}
+
+void parallel_run(parallel_job& job)
+{
+    int done = 0;
+    for (int i = job.next.fetch_add(1); i < job.stripes; i = job.next.fetch_add(1)) {
+        (*job.fn)(i);
+        done++;
+    }
+    if (done > 0) {
+        std::lock_guard<std::mutex> lock(job.mu);
+        job.finished += done;
+        if (job.finished == job.stripes) {
+            job.cv.notify_all();
+        }
+    }
+}
+
+void parallel_worker()
+{
+    parallel_pool& pool = parallel_get_pool();
+    std::unique_lock<std::mutex> lock(pool.mu);
+    while (pool.workers <= pool.max_workers.load()) {
+        if (pool.queue.empty()) {
+            pool.idle++;
+            pool.cv.wait(lock);
+            pool.idle--;
+            continue;
+        }
+        std::shared_ptr<parallel_job> job = std::move(pool.queue.front());
+        pool.queue.pop_front();
+        lock.unlock();
+        parallel_run(*job);
+        job.reset();
+        lock.lock();
+    }
+    pool.workers--;
+}
+
+} // namespace
+
+void parallel_set_max_workers(int n)
+{
+    parallel_pool& pool = parallel_get_pool();
+    std::lock_guard<std::mutex> lock(pool.mu);
+    pool.max_workers = std::max(n, 0);
+    pool.cv.notify_all();
+}
+
+int parallel_stripes(int threads, int rows, size_t bytes)
+{
+    size_t stripes = bytes / PARALLEL_MIN_STRIPE_BYTES;
+    stripes = std::min(stripes, size_t(std::max(rows, 1)));
+    stripes = std::min(stripes, size_t(std::max(threads, 1)));
+    stripes = std::min(stripes, size_t(parallel_get_pool().max_workers.load()) + 1);
+    return std::max(int(stripes), 1);
+}
+
+void parallel_for(int stripes, const std::function<void(int)>& fn)
+{
+    if (stripes <= 1) {
+        if (stripes == 1) {
+            fn(0);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<parallel_job>();
+    job->fn = &fn;
+    job->stripes = stripes;
+
+    parallel_pool& pool = parallel_get_pool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mu);
+        const int max_workers = pool.max_workers.load();
+        const int helpers = std::min(stripes - 1, max_workers);
+        for (int i = 0; i < helpers; i++) {
+            pool.queue.push_back(job);
+        }
+        int spawn = std::min(int(pool.queue.size()) - pool.idle, max_workers - pool.workers);
+        for (; spawn > 0; spawn--) {
+            try {
+                std::thread(parallel_worker).detach();
+            }
+            catch (const std::system_error&) {
+                // the caller runs whatever no worker picks up
+                break;
+            }
+            pool.workers++;
+        }
+        pool.cv.notify_all();
+    }
+
+    parallel_run(*job);
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mu);
+        pool.queue.erase(std::remove(pool.queue.begin(), pool.queue.end(), job), pool.queue.end());
+    }
+    std::unique_lock<std::mutex> lock(job->mu);
+    job->cv.wait(lock, [&] { return job->finished == stripes; });
+}
@@ -0,0 +1,19 @@
+package lilliput
+
+// #include "parallel.hpp"
+import "C"
+
+import "runtime"
+
+// SetMaxParallelism caps the number of worker threads, shared by every
+// ImageOps in the process, that help with images being processed at a
+// parallelism above 1 (see ImageOps.SetParallelism). An ImageOps always works
+// on its own stripes too, so n = 0 makes all processing single-threaded.
+// The default is the number of CPUs.
+func SetMaxParallelism(n int) {
+	C.parallel_set_max_workers(C.int(n))
+}
+
+func init() {
+	SetMaxParallelism(runtime.NumCPU())
+}
@@ -0,0 +1,33 @@
+#ifndef LILLIPUT_PARALLEL_HPP
+#define LILLIPUT_PARALLEL_HPP
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+#include <functional>
+
+extern "C" {
+#endif
+
+// Caps the number of worker threads, shared by the whole process, that help
+// callers with striped work. The calling thread always works on its own
+// stripes as well, so a cap of 0 makes every operation single-threaded.
+// Workers beyond a lowered cap exit once they are idle.
+void parallel_set_max_workers(int n);
+
+#ifdef __cplusplus
+}
+
+// Number of stripes to split `rows` rows totalling `bytes` bytes into for
+// `threads` threads: no more than `threads`, and none so small that handing
+// it to another thread costs more than it saves.
+int parallel_stripes(int threads, int rows, size_t bytes);
+
+// Runs fn(i) for each i in [0, stripes), on the calling thread plus up to
+// stripes - 1 pool workers, and returns once every call has finished. A
+// stripe runs on whichever thread claims it first, so fn must not throw and
+// must not assume which thread it is on.
+void parallel_for(int stripes, const std::function<void(int)>& fn);
+#endif
+
+#endif
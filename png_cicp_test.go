@@ -153,3 +153,75 @@ func TestPNGWithoutCICPUnchanged(t *testing.T) {
 		t.Fatalf("plain PNG must not gain a cICP chunk, got %v", types)
 	}
 }
+
+// A PQ source shrunk by Fit is tone-mapped after the resize, over the output
+// pixels only. The result must stay close to tone-mapping the whole frame and
+// then shrinking it, which is what Transform did before.
+func TestPNGHDRCICPTonemappedAfterDownscale(t *testing.T) {
+	src, err := os.ReadFile("testdata/ferry_sunset_no_icc.png")
+	if err != nil {
+		t.Skipf("fixture unavailable: %v", err)
+	}
+	in := injectPNGCICP(t, src, 9, 16) // BT.2020 primaries, PQ transfer
+	const width, height = 200, 74
+
+	d, err := NewDecoder(in)
+	if err != nil {
+		t.Fatalf("decoder: %v", err)
+	}
+	defer d.Close()
+	ops := NewImageOps(8192)
+	defer ops.Close()
+	opts := &ImageOptions{
+		FileType:      ".png",
+		Width:         width,
+		Height:        height,
+		ResizeMethod:  ImageOpsFit,
+		EncodeTimeout: time.Minute,
+	}
+	out, err := ops.Transform(d, opts, make([]byte, 16*1024*1024))
+	if err != nil {
+		t.Fatalf("transform: %v", err)
+	}
+	got := decodeFramebuffer(t, out)
+	defer got.Close()
+
+	full := decodeFramebuffer(t, src)
+	defer full.Close()
+	full.TonemapToSDR(CICP{Primaries: 9, Transfer: 16, FullRange: true})
+	want := NewFramebuffer(width, height)
+	defer want.Close()
+	if err := full.Fit(width, height, want); err != nil {
+		t.Fatalf("fit: %v", err)
+	}
+
+	if got.Width() != want.Width() || got.Height() != want.Height() {
+		t.Fatalf("got %dx%d, want %dx%d", got.Width(), got.Height(), want.Width(), want.Height())
+	}
+	var diff int
+	for i := range want.buf[:want.width*want.height*want.pixelType.Channels()] {
+		d := int(got.buf[i]) - int(want.buf[i])
+		if d < 0 {
+			d = -d
+		}
+		diff += d
+	}
+	if mean := float64(diff) / float64(want.width*want.height*want.pixelType.Channels()); mean > 4 {
+		t.Errorf("mean difference from tone-mapping before the resize is %.2f", mean)
+	}
+}
+
+func decodeFramebuffer(t *testing.T, buf []byte) *Framebuffer {
+	t.Helper()
+	d, err := NewDecoder(buf)
+	if err != nil {
+		t.Fatalf("decoder: %v", err)
+	}
+	defer d.Close()
+	f := NewFramebuffer(8192, 8192)
+	if err := d.DecodeTo(f); err != nil {
+		f.Close()
+		t.Fatalf("decode: %v", err)
+	}
+	return f
+}
@@ -0,0 +1,726 @@
+#include "probe.hpp"
+#include "avif.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Every parser here reads straight out of the caller's buffer and checks each
+// read against its end, so a truncated or malicious image stops the parse
+// rather than reading past it.
+
+static inline uint16_t probe_be16(const uint8_t* p)
+{
+    return uint16_t(p[0]) << 8 | p[1];
+}
+
+static inline uint32_t probe_be32(const uint8_t* p)
+{
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+static inline uint64_t probe_be64(const uint8_t* p)
+{
+    return uint64_t(probe_be32(p)) << 32 | probe_be32(p + 4);
+}
+
+static inline uint16_t probe_le16(const uint8_t* p)
+{
+    return uint16_t(p[1]) << 8 | p[0];
+}
+
+static inline uint32_t probe_le24(const uint8_t* p)
+{
+    return uint32_t(p[2]) << 16 | uint32_t(p[1]) << 8 | p[0];
+}
+
+static inline uint32_t probe_le32(const uint8_t* p)
+{
+    return uint32_t(p[3]) << 24 | probe_le24(p);
+}
+
+static constexpr uint32_t probe_fourcc(const char (&s)[5])
+{
+    return uint32_t(uint8_t(s[0])) << 24 | uint32_t(uint8_t(s[1])) << 16 | uint32_t(uint8_t(s[2])) << 8 |
+           uint32_t(uint8_t(s[3]));
+}
+
+//----------------------
+// Exif
+//----------------------
+
+// Returns the orientation tag of IFD0 in a TIFF structure, as found in a JPEG
+// APP1 segment after its "Exif\0\0" prefix and in a PNG eXIf chunk, or 0 if
+// there is none.
+static int probe_exif_orientation(const uint8_t* tiff, size_t len)
+{
+    if (len < 8) {
+        return 0;
+    }
+    bool little_endian;
+    if (tiff[0] == 'I' && tiff[1] == 'I') {
+        little_endian = true;
+    }
+    else if (tiff[0] == 'M' && tiff[1] == 'M') {
+        little_endian = false;
+    }
+    else {
+        return 0;
+    }
+    auto u16 = [&](const uint8_t* p) { return little_endian ? probe_le16(p) : probe_be16(p); };
+    auto u32 = [&](const uint8_t* p) { return little_endian ? probe_le32(p) : probe_be32(p); };
+
+    if (u16(tiff + 2) != 42) {
+        return 0;
+    }
+    const uint32_t ifd = u32(tiff + 4);
+    if (ifd > len - 2) {
+        return 0;
+    }
+    const uint16_t entries = u16(tiff + ifd);
+    for (uint32_t i = 0; i < entries; i++) {
+        const size_t entry = size_t(ifd) + 2 + size_t(i) * 12;
+        if (entry + 12 > len) {
+            return 0;
+        }
+        // a SHORT, whose value sits in the first two bytes of the value field
+        if (u16(tiff + entry) == 0x0112 && u16(tiff + entry + 2) == 3) {
+            const int orientation = u16(tiff + entry + 8);
+            return orientation >= CV_IMAGE_ORIENTATION_TL && orientation <= CV_IMAGE_ORIENTATION_LB ? orientation
+                                                                                                     : 0;
+        }
+    }
+    return 0;
+}
+
+//----------------------
+// JPEG
+//----------------------
+
+static bool probe_jpeg_is_sof(uint8_t marker)
+{
+    return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+// Walks the segments the same way detectContentLengthJPEG does, picking the
+// dimensions out of the first SOF and orientation and ICC out of APP1 and APP2.
+static bool probe_jpeg(const uint8_t* buf, size_t len, lilliput_probe_result* r)
+{
+    static const uint8_t exif_prefix[6] = {'E', 'x', 'i', 'f', 0, 0};
+    static const uint8_t icc_prefix[12] = {'I', 'C', 'C', '_', 'P', 'R', 'O', 'F', 'I', 'L', 'E', 0};
+
+    r->format = LILLIPUT_PROBE_JPEG;
+    r->num_frames = 1;
+    r->content_length = len;
+    bool have_sof = false;
+
+    size_t idx = 0;
+    while (idx + 1 < len) {
+        if (buf[idx] != 0xFF) {
+            break;
+        }
+        size_t next = idx + 2;
+        const uint8_t marker = buf[idx + 1];
+        if (marker == 0xD9) {
+            r->content_length = next;
+            break;
+        }
+        if (marker == 0xFF) {
+            idx++;
+            continue;
+        }
+        // RSTn and SOI carry no length
+        if (marker >= 0xD0 && marker <= 0xD8) {
+            idx = next;
+            continue;
+        }
+        if (idx + 3 >= len) {
+            break;
+        }
+        const size_t segment_len = probe_be16(buf + idx + 2);
+        next += segment_len;
+
+        const uint8_t* payload = buf + idx + 4;
+        const size_t payload_len = segment_len < 2 ? 0 : std::min(segment_len - 2, len - (idx + 4));
+        if (marker == 0xE1 && payload_len > sizeof(exif_prefix) &&
+            memcmp(payload, exif_prefix, sizeof(exif_prefix)) == 0 && r->orientation == 0) {
+            r->orientation = probe_exif_orientation(payload + sizeof(exif_prefix), payload_len - sizeof(exif_prefix));
+        }
+        else if (marker == 0xE2 && payload_len >= sizeof(icc_prefix) &&
+                 memcmp(payload, icc_prefix, sizeof(icc_prefix)) == 0) {
+            r->has_icc = true;
+        }
+        else if (probe_jpeg_is_sof(marker) && !have_sof && payload_len >= 6) {
+            r->height = probe_be16(payload + 1);
+            r->width = probe_be16(payload + 3);
+            have_sof = true;
+        }
+        else if (marker == 0xDA) {
+            // entropy-coded data runs to the next marker that is not a
+            // stuffed 0xFF or a restart
+            for (; next < len; next++) {
+                if (buf[next] != 0xFF) {
+                    continue;
+                }
+                if (next + 1 >= len) {
+                    next = len;
+                    break;
+                }
+                const uint8_t peek = buf[next + 1];
+                if (peek == 0xFF) {
+                    continue;
+                }
+                if (peek != 0 && (peek < 0xD0 || peek > 0xD7)) {
+                    break;
+                }
+            }
+        }
+        idx = next;
+    }
+
+    if (r->orientation == 0) {
+        r->orientation = CV_IMAGE_ORIENTATION_TL;
+    }
+    return have_sof && r->width > 0 && r->height > 0;
+}
+
+//----------------------
+// PNG
+//----------------------
+
+static bool probe_png(const uint8_t* buf, size_t len, lilliput_probe_result* r)
+{
+    r->format = LILLIPUT_PROBE_PNG;
+    r->orientation = CV_IMAGE_ORIENTATION_TL;
+    r->num_frames = 1;
+    r->content_length = len;
+    bool have_ihdr = false;
+
+    size_t idx = 8;
+    while (idx + 8 <= len) {
+        const size_t chunk_len = probe_be32(buf + idx);
+        const uint32_t type = probe_be32(buf + idx + 4);
+        const uint8_t* data = buf + idx + 8;
+        if (chunk_len > len - idx - 8) {
+            break;
+        }
+        const size_t next = idx + 12 + chunk_len;
+
+        if (type == probe_fourcc("IHDR") && chunk_len >= 13) {
+            r->width = probe_be32(data);
+            r->height = probe_be32(data + 4);
+            const uint8_t color_type = data[9];
+            r->has_alpha = r->has_alpha || (color_type & 4) != 0;
+            have_ihdr = true;
+        }
+        else if (type == probe_fourcc("acTL") && chunk_len >= 8) {
+            r->num_frames = probe_be32(data);
+        }
+        else if (type == probe_fourcc("fcTL") && chunk_len >= 26) {
+            const uint32_t delay_num = probe_be16(data + 20);
+            const uint32_t delay_den = probe_be16(data + 22);
+            r->duration_ms += delay_num * 1000 / (delay_den ? delay_den : 100);
+        }
+        else if (type == probe_fourcc("tRNS")) {
+            r->has_alpha = true;
+        }
+        else if (type == probe_fourcc("iCCP")) {
+            r->has_icc = true;
+        }
+        else if (type == probe_fourcc("eXIf")) {
+            if (int orientation = probe_exif_orientation(data, chunk_len)) {
+                r->orientation = orientation;
+            }
+        }
+        else if (type == probe_fourcc("IEND")) {
+            r->content_length = std::min(next, len);
+            break;
+        }
+        idx = next;
+    }
+
+    if (r->num_frames < 1) {
+        r->num_frames = 1;
+    }
+    return have_ihdr && r->width > 0 && r->height > 0;
+}
+
+//----------------------
+// GIF
+//----------------------
+
+// skips a run of data sub-blocks, returning the offset after its terminator or
+// len if it is cut short
+static size_t probe_gif_skip_sub_blocks(const uint8_t* buf, size_t len, size_t idx)
+{
+    while (idx < len) {
+        const uint8_t n = buf[idx++];
+        if (n == 0) {
+            return idx;
+        }
+        idx += n;
+    }
+    return len;
+}
+
+// Counts frames and adds up delays as giflib_decoder_get_animation_info does.
+static bool probe_gif(const uint8_t* buf, size_t len, lilliput_probe_result* r)
+{
+    r->format = LILLIPUT_PROBE_GIF;
+    r->orientation = CV_IMAGE_ORIENTATION_TL;
+    r->content_length = len;
+    if (len < 13) {
+        return false;
+    }
+    r->width = probe_le16(buf + 6);
+    r->height = probe_le16(buf + 8);
+
+    size_t idx = 13;
+    if (buf[10] & 0x80) {
+        idx += 3 << ((buf[10] & 7) + 1);
+    }
+
+    while (idx < len) {
+        const uint8_t block = buf[idx++];
+        if (block == 0x21) {
+            if (idx >= len) {
+                break;
+            }
+            const uint8_t label = buf[idx++];
+            if (label == 0xF9 && idx + 4 < len && buf[idx] >= 4) {
+                const uint8_t flags = buf[idx + 1];
+                const int delay_cs = probe_le16(buf + idx + 2);
+                r->duration_ms += (r->num_frames > 0 && delay_cs < 2) ? 20 : delay_cs * 10;
+                r->has_alpha = r->has_alpha || (flags & 1) != 0;
+            }
+            idx = probe_gif_skip_sub_blocks(buf, len, idx);
+        }
+        else if (block == 0x2C) {
+            if (idx + 9 > len) {
+                break;
+            }
+            const uint8_t flags = buf[idx + 8];
+            idx += 9;
+            if (flags & 0x80) {
+                idx += 3 << ((flags & 7) + 1);
+            }
+            r->num_frames++;
+            // LZW minimum code size, then the image data
+            idx = probe_gif_skip_sub_blocks(buf, len, idx + 1);
+        }
+        else if (block == 0x3B) {
+            r->content_length = idx;
+            break;
+        }
+        else {
+            break;
+        }
+    }
+
+    return r->width > 0 && r->height > 0;
+}
+
+//----------------------
+// WebP
+//----------------------
+
+static bool probe_webp(const uint8_t* buf, size_t len, lilliput_probe_result* r)
+{
+    r->format = LILLIPUT_PROBE_WEBP;
+    r->orientation = CV_IMAGE_ORIENTATION_TL;
+    const size_t riff_len = size_t(probe_le32(buf + 4)) + 8;
+    len = std::min(len, riff_len);
+    r->content_length = len;
+
+    bool animated = false;
+    int frames = 0;
+    size_t idx = 12;
+    while (idx + 8 <= len) {
+        const uint32_t type = probe_be32(buf + idx);
+        const size_t chunk_len = probe_le32(buf + idx + 4);
+        const uint8_t* data = buf + idx + 8;
+        const size_t data_len = std::min(chunk_len, len - idx - 8);
+
+        if (type == probe_fourcc("VP8X") && data_len >= 10) {
+            r->has_alpha = (data[0] & 0x10) != 0;
+            r->has_icc = (data[0] & 0x20) != 0;
+            animated = (data[0] & 0x02) != 0;
+            r->width = probe_le24(data + 4) + 1;
+            r->height = probe_le24(data + 7) + 1;
+        }
+        else if (type == probe_fourcc("VP8 ") && data_len >= 10 && r->width == 0) {
+            if (data[3] == 0x9D && data[4] == 0x01 && data[5] == 0x2A) {
+                r->width = probe_le16(data + 6) & 0x3FFF;
+                r->height = probe_le16(data + 8) & 0x3FFF;
+            }
+        }
+        else if (type == probe_fourcc("VP8L") && data_len >= 5 && r->width == 0) {
+            if (data[0] == 0x2F) {
+                const uint32_t bits = probe_le32(data + 1);
+                r->width = (bits & 0x3FFF) + 1;
+                r->height = ((bits >> 14) & 0x3FFF) + 1;
+                r->has_alpha = ((bits >> 28) & 1) != 0;
+            }
+        }
+        else if (type == probe_fourcc("ALPH")) {
+            r->has_alpha = true;
+        }
+        else if (type == probe_fourcc("ICCP")) {
+            r->has_icc = true;
+        }
+        else if (type == probe_fourcc("ANMF") && data_len >= 16) {
+            frames++;
+            r->duration_ms += probe_le24(data + 12);
+        }
+
+        // chunks are padded to an even length
+        if (chunk_len > len - idx - 8) {
+            break;
+        }
+        idx += 8 + chunk_len + (chunk_len & 1);
+    }
+
+    r->num_frames = animated ? frames : 1;
+    return r->width > 0 && r->height > 0;
+}
+
+//----------------------
+// AVIF
+//----------------------
+
+struct probe_box {
+    uint32_t type;
+    const uint8_t* data;
+    size_t size;
+};
+
+// Reads the box at the start of buf, returning its length including the
+// header, or 0 if that header does not fit. A box that runs past the end of
+// buf is cut short and *truncated set.
+static size_t probe_box_read(const uint8_t* buf, size_t len, probe_box* box, bool* truncated = nullptr)
+{
+    if (len < 8) {
+        return 0;
+    }
+    uint64_t size = probe_be32(buf);
+    size_t header = 8;
+    if (size == 1) {
+        if (len < 16) {
+            return 0;
+        }
+        size = probe_be64(buf + 8);
+        header = 16;
+    }
+    else if (size == 0) {
+        size = len;
+    }
+    if (size < header) {
+        return 0;
+    }
+    if (size > len) {
+        size = len;
+        if (truncated) {
+            *truncated = true;
+        }
+    }
+    box->type = probe_be32(buf + 4);
+    box->data = buf + header;
+    box->size = size_t(size) - header;
+    return size_t(size);
+}
+
+// calls fn on each box in buf
+template <typename Fn>
+static void probe_box_each(const uint8_t* buf, size_t len, Fn fn)
+{
+    probe_box box;
+    for (size_t idx = 0, n; idx < len && (n = probe_box_read(buf + idx, len - idx, &box)); idx += n) {
+        fn(box);
+    }
+}
+
+struct probe_avif_state {
+    bool have_primary = false;
+    uint32_t primary_item = 0;
+    probe_box ipco = {};
+    probe_box ipma = {};
+
+    bool have_track = false;
+    int track_width = 0;
+    int track_height = 0;
+    int track_frames = 0;
+    int track_duration_ms = 0;
+    bool track_icc = false;
+    bool alpha = false;
+};
+
+static bool probe_avif_colr_is_icc(const probe_box& colr)
+{
+    if (colr.size < 4) {
+        return false;
+    }
+    const uint32_t colour_type = probe_be32(colr.data);
+    return colour_type == probe_fourcc("prof") || colour_type == probe_fourcc("rICC");
+}
+
+static bool probe_avif_auxc_is_alpha(const probe_box& auxc)
+{
+    static const char alpha_urn[] = "urn:mpeg:mpegB:cicp:systems:auxiliary:alpha";
+    static const char hevc_alpha_urn[] = "urn:mpeg:hevc:2015:auxid:1";
+    // a full box, then a null-terminated URN
+    if (auxc.size < 4) {
+        return false;
+    }
+    const char* urn = reinterpret_cast<const char*>(auxc.data + 4);
+    const size_t urn_len = auxc.size - 4;
+    return (urn_len >= sizeof(alpha_urn) && memcmp(urn, alpha_urn, sizeof(alpha_urn)) == 0) ||
+           (urn_len >= sizeof(hevc_alpha_urn) && memcmp(urn, hevc_alpha_urn, sizeof(hevc_alpha_urn)) == 0);
+}
+
+static void probe_avif_trak(const probe_box& trak, probe_avif_state* s)
+{
+    uint32_t handler = 0;
+    bool aux = false;
+    int width = 0, height = 0, frames = 0, duration_ms = 0;
+    bool icc = false;
+
+    probe_box_each(trak.data, trak.size, [&](const probe_box& box) {
+        if (box.type == probe_fourcc("tref")) {
+            probe_box_each(box.data, box.size, [&](const probe_box& ref) {
+                aux = aux || ref.type == probe_fourcc("auxl");
+            });
+        }
+        if (box.type != probe_fourcc("mdia")) {
+            return;
+        }
+        probe_box_each(box.data, box.size, [&](const probe_box& mdia) {
+            if (mdia.type == probe_fourcc("mdhd") && mdia.size >= 4) {
+                uint64_t timescale = 0, duration = 0;
+                if (mdia.data[0] == 1 && mdia.size >= 32) {
+                    timescale = probe_be32(mdia.data + 20);
+                    duration = probe_be64(mdia.data + 24);
+                }
+                else if (mdia.data[0] == 0 && mdia.size >= 20) {
+                    timescale = probe_be32(mdia.data + 12);
+                    duration = probe_be32(mdia.data + 16);
+                }
+                if (timescale > 0 && duration != UINT64_MAX) {
+                    duration_ms = int(std::min<uint64_t>(duration * 1000 / timescale, INT32_MAX));
+                }
+            }
+            else if (mdia.type == probe_fourcc("hdlr") && mdia.size >= 12) {
+                handler = probe_be32(mdia.data + 8);
+            }
+            else if (mdia.type == probe_fourcc("minf")) {
+                probe_box_each(mdia.data, mdia.size, [&](const probe_box& minf) {
+                    if (minf.type != probe_fourcc("stbl")) {
+                        return;
+                    }
+                    probe_box_each(minf.data, minf.size, [&](const probe_box& stbl) {
+                        if (stbl.type == probe_fourcc("stsz") && stbl.size >= 12) {
+                            frames = int(std::min<uint32_t>(probe_be32(stbl.data + 8), INT32_MAX));
+                        }
+                        else if (stbl.type == probe_fourcc("stsd") && stbl.size >= 8) {
+                            probe_box entry;
+                            if (probe_box_read(stbl.data + 8, stbl.size - 8, &entry) && entry.size >= 78) {
+                                // a VisualSampleEntry, then boxes such as av1C and colr
+                                width = probe_be16(entry.data + 24);
+                                height = probe_be16(entry.data + 26);
+                                probe_box_each(entry.data + 78, entry.size - 78, [&](const probe_box& child) {
+                                    icc = icc || (child.type == probe_fourcc("colr") && probe_avif_colr_is_icc(child));
+                                });
+                            }
+                        }
+                    });
+                });
+            }
+        });
+    });
+
+    if (aux || handler == probe_fourcc("auxv")) {
+        s->alpha = true;
+        return;
+    }
+    if (!s->have_track && (handler == probe_fourcc("pict") || handler == probe_fourcc("vide"))) {
+        s->have_track = true;
+        s->track_width = width;
+        s->track_height = height;
+        s->track_frames = frames;
+        s->track_duration_ms = duration_ms;
+        s->track_icc = icc;
+    }
+}
+
+// finds property index (from 1) in ipco
+static bool probe_avif_property(const probe_box& ipco, uint32_t index, probe_box* property)
+{
+    uint32_t i = 0;
+    bool found = false;
+    probe_box_each(ipco.data, ipco.size, [&](const probe_box& box) {
+        if (++i == index) {
+            *property = box;
+            found = true;
+        }
+    });
+    return found;
+}
+
+// Reads the primary item's properties and, for an image sequence, its first
+// colour track, which is what libavif decodes frames from when there is one.
+static bool probe_avif(const uint8_t* buf, size_t len, lilliput_probe_result* r)
+{
+    r->format = LILLIPUT_PROBE_AVIF;
+    r->orientation = CV_IMAGE_ORIENTATION_TL;
+    r->num_frames = 1;
+
+    probe_avif_state s;
+    bool sequence = false;
+    bool truncated = false;
+    size_t idx = 0;
+    probe_box box;
+    for (size_t n; idx < len && (n = probe_box_read(buf + idx, len - idx, &box, &truncated)); idx += n) {
+        if (box.type == probe_fourcc("ftyp")) {
+            for (size_t brand = 0; brand + 4 <= box.size; brand += 4) {
+                // the minor version sits between the major and compatible brands
+                if (brand != 4 && probe_be32(box.data + brand) == probe_fourcc("avis")) {
+                    sequence = true;
+                }
+            }
+        }
+        else if (box.type == probe_fourcc("meta") && box.size >= 4) {
+            probe_box_each(box.data + 4, box.size - 4, [&](const probe_box& meta) {
+                if (meta.type == probe_fourcc("pitm") && meta.size >= 6) {
+                    s.have_primary = true;
+                    s.primary_item = meta.data[0] == 0 ? probe_be16(meta.data + 4)
+                                                       : (meta.size >= 8 ? probe_be32(meta.data + 4) : 0);
+                }
+                else if (meta.type == probe_fourcc("iprp")) {
+                    probe_box_each(meta.data, meta.size, [&](const probe_box& iprp) {
+                        if (iprp.type == probe_fourcc("ipco")) {
+                            s.ipco = iprp;
+                        }
+                        else if (iprp.type == probe_fourcc("ipma") && s.ipma.data == nullptr) {
+                            s.ipma = iprp;
+                        }
+                    });
+                }
+            });
+        }
+        else if (box.type == probe_fourcc("moov")) {
+            probe_box_each(box.data, box.size, [&](const probe_box& moov) {
+                if (moov.type == probe_fourcc("trak")) {
+                    probe_avif_trak(moov, &s);
+                }
+            });
+        }
+    }
+    r->content_length = truncated ? len : idx;
+
+    // the primary item's properties
+    int angle = 0, axis = 0;
+    bool mirrored = false;
+    if (s.ipco.data) {
+        probe_box_each(s.ipco.data, s.ipco.size, [&](const probe_box& property) {
+            s.alpha = s.alpha || (property.type == probe_fourcc("auxC") && probe_avif_auxc_is_alpha(property));
+        });
+    }
+    if (s.have_primary && s.ipco.data && s.ipma.data && s.ipma.size >= 8) {
+        const uint8_t version = s.ipma.data[0];
+        const bool wide_index = (s.ipma.data[3] & 1) != 0;
+        const uint8_t* p = s.ipma.data + 4;
+        const uint8_t* end = s.ipma.data + s.ipma.size;
+        uint32_t entries = probe_be32(p);
+        p += 4;
+        for (; entries > 0; entries--) {
+            uint32_t item;
+            if (version < 1) {
+                if (end - p < 3) {
+                    break;
+                }
+                item = probe_be16(p);
+                p += 2;
+            }
+            else {
+                if (end - p < 5) {
+                    break;
+                }
+                item = probe_be32(p);
+                p += 4;
+            }
+            const uint8_t associations = *p++;
+            const size_t association_len = wide_index ? 2 : 1;
+            if (size_t(end - p) < associations * association_len) {
+                break;
+            }
+            for (uint8_t i = 0; i < associations && item == s.primary_item; i++) {
+                const uint32_t index = wide_index ? probe_be16(p + i * 2) & 0x7FFF : p[i] & 0x7F;
+                probe_box property;
+                if (!probe_avif_property(s.ipco, index, &property)) {
+                    continue;
+                }
+                if (property.type == probe_fourcc("ispe") && property.size >= 12) {
+                    r->width = int(std::min<uint32_t>(probe_be32(property.data + 4), INT32_MAX));
+                    r->height = int(std::min<uint32_t>(probe_be32(property.data + 8), INT32_MAX));
+                }
+                else if (property.type == probe_fourcc("irot") && property.size >= 1) {
+                    angle = property.data[0] & 3;
+                }
+                else if (property.type == probe_fourcc("imir") && property.size >= 1) {
+                    mirrored = true;
+                    axis = property.data[0] & 1;
+                }
+                else if (property.type == probe_fourcc("colr") && probe_avif_colr_is_icc(property)) {
+                    r->has_icc = true;
+                }
+            }
+            p += associations * association_len;
+        }
+    }
+    r->orientation = avif_orientation_from_transform(angle, mirrored, axis);
+    r->has_alpha = s.alpha;
+
+    if (sequence && s.have_track) {
+        r->width = s.track_width;
+        r->height = s.track_height;
+        r->num_frames = std::max(s.track_frames, 1);
+        r->duration_ms = s.track_duration_ms;
+        r->has_icc = s.track_icc;
+    }
+    return r->width > 0 && r->height > 0;
+}
+
+static bool probe_image(const void* buf, size_t buf_len, lilliput_probe_result* r)
+{
+    static const uint8_t png_signature[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    memset(r, 0, sizeof(*r));
+    if (!p) {
+        return false;
+    }
+
+    if (buf_len >= 6 && (memcmp(p, "GIF87a", 6) == 0 || memcmp(p, "GIF89a", 6) == 0)) {
+        return probe_gif(p, buf_len, r);
+    }
+    if (buf_len >= 12 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0) {
+        return probe_webp(p, buf_len, r);
+    }
+    if (buf_len >= 12 && memcmp(p + 4, "ftyp", 4) == 0 &&
+        (memcmp(p + 8, "avif", 4) == 0 || memcmp(p + 8, "avis", 4) == 0)) {
+        return probe_avif(p, buf_len, r);
+    }
+    if (buf_len >= sizeof(png_signature) && memcmp(p, png_signature, sizeof(png_signature)) == 0) {
+        return probe_png(p, buf_len, r);
+    }
+    if (buf_len >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) {
+        return probe_jpeg(p, buf_len, r);
+    }
+    return false;
+}
+
+lilliput_probe_result lilliput_probe(const void* buf, size_t buf_len)
+{
+    lilliput_probe_result r;
+    bool ok = probe_image(buf, buf_len, &r);
+    r.ok = ok;
+    return r;
+}
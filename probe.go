@@ -0,0 +1,56 @@
+package lilliput
+
+// #include "probe.hpp"
+import "C"
+
+import (
+	"time"
+	"unsafe"
+)
+
+// ProbeResult describes an image as read by Probe from its container headers.
+type ProbeResult struct {
+	Format        string           // "JPEG", "PNG", "GIF", "WEBP" or "AVIF", as a Decoder's Description
+	Width         int              // Width of the image in pixels, before orientation
+	Height        int              // Height of the image in pixels, before orientation
+	Orientation   ImageOrientation // Orientation from Exif or the AVIF irot/imir properties
+	NumFrames     int              // Number of frames, 1 for a still image
+	Duration      time.Duration    // Total duration of an animation's frames
+	HasAlpha      bool             // Whether the image signals transparency
+	HasICC        bool             // Whether the image embeds an ICC profile
+	ContentLength int              // Length of the image's data in the buffer, ignoring trailing bytes
+}
+
+var probeFormats = map[C.int]string{
+	C.LILLIPUT_PROBE_JPEG: "JPEG",
+	C.LILLIPUT_PROBE_PNG:  "PNG",
+	C.LILLIPUT_PROBE_GIF:  "GIF",
+	C.LILLIPUT_PROBE_WEBP: "WEBP",
+	C.LILLIPUT_PROBE_AVIF: "AVIF",
+}
+
+// Probe reads an image's format, dimensions and other properties from its
+// headers alone. Unlike NewDecoder it decodes no pixels and allocates nothing,
+// which makes it the cheaper way to validate an image before deciding whether
+// to transform it. It returns ErrInvalidImage if buf is not a JPEG, PNG, GIF,
+// WebP or AVIF image, or ends before its headers give its dimensions.
+func Probe(buf []byte) (ProbeResult, error) {
+	if len(buf) == 0 {
+		return ProbeResult{}, ErrInvalidImage
+	}
+	r := C.lilliput_probe(unsafe.Pointer(&buf[0]), C.size_t(len(buf)))
+	if !r.ok {
+		return ProbeResult{}, ErrInvalidImage
+	}
+	return ProbeResult{
+		Format:        probeFormats[r.format],
+		Width:         int(r.width),
+		Height:        int(r.height),
+		Orientation:   ImageOrientation(r.orientation),
+		NumFrames:     int(r.num_frames),
+		Duration:      time.Duration(r.duration_ms) * time.Millisecond,
+		HasAlpha:      bool(r.has_alpha),
+		HasICC:        bool(r.has_icc),
+		ContentLength: int(r.content_length),
+	}, nil
+}
@@ -0,0 +1,43 @@
+#ifndef LILLIPUT_PROBE_HPP
+#define LILLIPUT_PROBE_HPP
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum LilliputProbeFormat {
+    LILLIPUT_PROBE_UNKNOWN = 0,
+    LILLIPUT_PROBE_JPEG = 1,
+    LILLIPUT_PROBE_PNG = 2,
+    LILLIPUT_PROBE_GIF = 3,
+    LILLIPUT_PROBE_WEBP = 4,
+    LILLIPUT_PROBE_AVIF = 5,
+};
+
+typedef struct lilliput_probe_result {
+    bool ok; // false if buf is not an image lilliput_probe can read
+    int format;
+    int width;
+    int height;
+    int orientation; // a CVImageOrientation
+    int num_frames;
+    int duration_ms;
+    bool has_alpha;
+    bool has_icc;
+    size_t content_length;
+} lilliput_probe_result;
+
+// Read the container headers of the image in buf, without decoding any pixels
+// or allocating memory. The result is returned by value so that Go can keep it
+// on the stack. Its ok is false if buf is not an image of a known format or its
+// headers end before they give its dimensions.
+lilliput_probe_result lilliput_probe(const void* buf, size_t buf_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
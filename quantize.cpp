@@ -0,0 +1,493 @@
+#include "quantize.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Palettes are built by median cut over a histogram of the image's colours,
+// each channel of premultiplied RGBA cut to QUANTIZE_BITS bits, refined by a
+// few passes of k-means over the same histogram. Pixels are then mapped
+// through a table of each histogram bin's nearest palette entry, and the
+// entries moved to the mean of the pixels mapped to them.
+#define QUANTIZE_BITS 5
+#define QUANTIZE_BINS (1 << (4 * QUANTIZE_BITS))
+#define QUANTIZE_COLORS 256
+#define QUANTIZE_REFINE_PASSES 2
+// the PSNRs that qualities 0 and 100 stand for
+#define QUANTIZE_PSNR_MIN 20.0
+#define QUANTIZE_PSNR_MAX 50.0
+
+struct quantize_bin {
+    uint32_t key;
+    uint32_t count;
+    int c[4]; // the centre of the bin
+};
+
+struct quantize_box {
+    int first;
+    int last;
+    uint64_t count;
+    int axis;  // the channel the box's bins spread furthest along
+    int range; // and how far
+};
+
+// where entries beyond the palette's size sit, so far from every colour that
+// none is ever nearest, yet near enough that distances fit in 23 bits
+#define QUANTIZE_FAR 1024
+
+#if defined(__SSE2__)
+static inline __m128i quantize_min_epi32(__m128i a, __m128i b)
+{
+    const __m128i lt = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+}
+#endif
+
+// the palette being built, channel by channel and always QUANTIZE_COLORS
+// entries long, so that the distances to every entry are found eight at a
+// time in a loop of fixed length
+struct quantize_palette {
+    int size;
+    alignas(16) int16_t c[4][QUANTIZE_COLORS];
+
+    void pad()
+    {
+        for (int ch = 0; ch < 4; ch++) {
+            std::fill(c[ch] + size, c[ch] + QUANTIZE_COLORS, (int16_t)QUANTIZE_FAR);
+        }
+    }
+
+    // the entry nearest px, found as the least of the entries' distances
+    // with their indices in the low 8 bits
+    int nearest(const int px[4]) const
+    {
+        int best = INT_MAX;
+#if defined(__SSE2__)
+        const __m128i p0 = _mm_set1_epi16((int16_t)px[0]);
+        const __m128i p1 = _mm_set1_epi16((int16_t)px[1]);
+        const __m128i p2 = _mm_set1_epi16((int16_t)px[2]);
+        const __m128i p3 = _mm_set1_epi16((int16_t)px[3]);
+        const __m128i step = _mm_set1_epi32(8);
+        __m128i index_lo = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i index_hi = _mm_setr_epi32(4, 5, 6, 7);
+        __m128i least = _mm_set1_epi32(INT_MAX);
+        for (int i = 0; i < QUANTIZE_COLORS; i += 8) {
+            const __m128i d0 = _mm_sub_epi16(_mm_load_si128((const __m128i*)(c[0] + i)), p0);
+            const __m128i d1 = _mm_sub_epi16(_mm_load_si128((const __m128i*)(c[1] + i)), p1);
+            const __m128i d2 = _mm_sub_epi16(_mm_load_si128((const __m128i*)(c[2] + i)), p2);
+            const __m128i d3 = _mm_sub_epi16(_mm_load_si128((const __m128i*)(c[3] + i)), p3);
+            // interleaved in pairs of channels, so madd squares and sums them
+            __m128i rg = _mm_unpacklo_epi16(d0, d1);
+            __m128i ba = _mm_unpacklo_epi16(d2, d3);
+            __m128i dist = _mm_add_epi32(_mm_madd_epi16(rg, rg), _mm_madd_epi16(ba, ba));
+            least = quantize_min_epi32(least, _mm_or_si128(_mm_slli_epi32(dist, 8), index_lo));
+            rg = _mm_unpackhi_epi16(d0, d1);
+            ba = _mm_unpackhi_epi16(d2, d3);
+            dist = _mm_add_epi32(_mm_madd_epi16(rg, rg), _mm_madd_epi16(ba, ba));
+            least = quantize_min_epi32(least, _mm_or_si128(_mm_slli_epi32(dist, 8), index_hi));
+            index_lo = _mm_add_epi32(index_lo, step);
+            index_hi = _mm_add_epi32(index_hi, step);
+        }
+        alignas(16) int lanes[4];
+        _mm_store_si128((__m128i*)lanes, least);
+        for (int lane : lanes) {
+            best = std::min(best, lane);
+        }
+#elif defined(__ARM_NEON)
+        const int16x8_t p0 = vdupq_n_s16((int16_t)px[0]);
+        const int16x8_t p1 = vdupq_n_s16((int16_t)px[1]);
+        const int16x8_t p2 = vdupq_n_s16((int16_t)px[2]);
+        const int16x8_t p3 = vdupq_n_s16((int16_t)px[3]);
+        const int32x4_t step = vdupq_n_s32(8);
+        static const int32_t first_lo[4] = {0, 1, 2, 3};
+        static const int32_t first_hi[4] = {4, 5, 6, 7};
+        int32x4_t index_lo = vld1q_s32(first_lo);
+        int32x4_t index_hi = vld1q_s32(first_hi);
+        int32x4_t least = vdupq_n_s32(INT_MAX);
+        for (int i = 0; i < QUANTIZE_COLORS; i += 8) {
+            const int16x8_t d0 = vsubq_s16(vld1q_s16(c[0] + i), p0);
+            const int16x8_t d1 = vsubq_s16(vld1q_s16(c[1] + i), p1);
+            const int16x8_t d2 = vsubq_s16(vld1q_s16(c[2] + i), p2);
+            const int16x8_t d3 = vsubq_s16(vld1q_s16(c[3] + i), p3);
+            int32x4_t dist = vmull_s16(vget_low_s16(d0), vget_low_s16(d0));
+            dist = vmlal_s16(dist, vget_low_s16(d1), vget_low_s16(d1));
+            dist = vmlal_s16(dist, vget_low_s16(d2), vget_low_s16(d2));
+            dist = vmlal_s16(dist, vget_low_s16(d3), vget_low_s16(d3));
+            least = vminq_s32(least, vorrq_s32(vshlq_n_s32(dist, 8), index_lo));
+            dist = vmull_s16(vget_high_s16(d0), vget_high_s16(d0));
+            dist = vmlal_s16(dist, vget_high_s16(d1), vget_high_s16(d1));
+            dist = vmlal_s16(dist, vget_high_s16(d2), vget_high_s16(d2));
+            dist = vmlal_s16(dist, vget_high_s16(d3), vget_high_s16(d3));
+            least = vminq_s32(least, vorrq_s32(vshlq_n_s32(dist, 8), index_hi));
+            index_lo = vaddq_s32(index_lo, step);
+            index_hi = vaddq_s32(index_hi, step);
+        }
+        int32_t lanes[4];
+        vst1q_s32(lanes, least);
+        for (int lane : lanes) {
+            best = std::min(best, lane);
+        }
+#else
+        for (int i = 0; i < QUANTIZE_COLORS; i++) {
+            const int d0 = c[0][i] - px[0];
+            const int d1 = c[1][i] - px[1];
+            const int d2 = c[2][i] - px[2];
+            const int d3 = c[3][i] - px[3];
+            best = std::min(best, ((d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3) << 8) | i);
+        }
+#endif
+        return best & 0xFF;
+    }
+};
+
+// pixel x of row, BGR or BGRA, as premultiplied RGBA
+static inline void quantize_premultiply(const uint8_t* row, int x, int channels, int out[4])
+{
+    const uint8_t* px = row + x * channels;
+    const int a = channels == 4 ? px[3] : 255;
+    out[0] = (px[2] * a + 127) / 255;
+    out[1] = (px[1] * a + 127) / 255;
+    out[2] = (px[0] * a + 127) / 255;
+    out[3] = a;
+}
+
+static inline uint32_t quantize_key(const int c[4])
+{
+    const int shift = 8 - QUANTIZE_BITS;
+    return ((uint32_t)(c[0] >> shift) << (3 * QUANTIZE_BITS)) | ((uint32_t)(c[1] >> shift) << (2 * QUANTIZE_BITS)) |
+           ((uint32_t)(c[2] >> shift) << QUANTIZE_BITS) | (uint32_t)(c[3] >> shift);
+}
+
+// Map the pixels exactly if there are no more than 256 colours, counting
+// every fully transparent pixel as the same one. Returns false as soon as it
+// finds more. The palette is written as RGBA.
+static bool quantize_exact(const uint8_t* data,
+                           size_t stride,
+                           int width,
+                           int height,
+                           int channels,
+                           uint8_t palette[256][4],
+                           int* palette_size,
+                           uint8_t* indices)
+{
+    // open addressing over twice as many slots as colours kept
+    const int slots = 2 * QUANTIZE_COLORS;
+    uint32_t keys[slots];
+    int slot_index[slots];
+    std::fill(slot_index, slot_index + slots, -1);
+    int n = 0;
+    bool have_last = false;
+    uint32_t last = 0;
+    uint8_t last_index = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = data + y * stride;
+        uint8_t* out = indices + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            const uint8_t* px = row + x * channels;
+            const uint8_t a = channels == 4 ? px[3] : 255;
+            const uint32_t color =
+              a == 0 ? 0 : ((uint32_t)px[2] << 24) | ((uint32_t)px[1] << 16) | ((uint32_t)px[0] << 8) | a;
+            if (have_last && color == last) {
+                out[x] = last_index;
+                continue;
+            }
+            uint32_t h = (color * 2654435761u) >> 23;
+            while (slot_index[h] >= 0 && keys[h] != color) {
+                h = (h + 1) & (slots - 1);
+            }
+            if (slot_index[h] < 0) {
+                if (n == QUANTIZE_COLORS) {
+                    return false;
+                }
+                keys[h] = color;
+                slot_index[h] = n;
+                palette[n][0] = (uint8_t)(color >> 24);
+                palette[n][1] = (uint8_t)(color >> 16);
+                palette[n][2] = (uint8_t)(color >> 8);
+                palette[n][3] = (uint8_t)color;
+                n++;
+            }
+            have_last = true;
+            last = color;
+            last_index = (uint8_t)slot_index[h];
+            out[x] = last_index;
+        }
+    }
+    *palette_size = n;
+    return true;
+}
+
+static void quantize_measure(const std::vector<quantize_bin>& bins, quantize_box& box)
+{
+    int lo[4] = {255, 255, 255, 255};
+    int hi[4] = {0, 0, 0, 0};
+    box.count = 0;
+    for (int i = box.first; i < box.last; i++) {
+        box.count += bins[i].count;
+        for (int ch = 0; ch < 4; ch++) {
+            lo[ch] = std::min(lo[ch], bins[i].c[ch]);
+            hi[ch] = std::max(hi[ch], bins[i].c[ch]);
+        }
+    }
+    box.axis = 0;
+    for (int ch = 1; ch < 4; ch++) {
+        if (hi[ch] - lo[ch] > hi[box.axis] - lo[box.axis]) {
+            box.axis = ch;
+        }
+    }
+    box.range = hi[box.axis] - lo[box.axis];
+}
+
+// split the histogram into up to QUANTIZE_COLORS boxes, each time halving,
+// by pixel count, the box whose pixels are spread widest
+static void quantize_median_cut(std::vector<quantize_bin>& bins, quantize_palette& palette)
+{
+    std::vector<quantize_box> boxes(1);
+    boxes[0].first = 0;
+    boxes[0].last = (int)bins.size();
+    quantize_measure(bins, boxes[0]);
+    while (boxes.size() < QUANTIZE_COLORS) {
+        int best = -1;
+        double best_score = 0;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            const double score = (double)boxes[i].count * boxes[i].range;
+            if (boxes[i].last - boxes[i].first > 1 && score > best_score) {
+                best = (int)i;
+                best_score = score;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        quantize_box box = boxes[best];
+        const int axis = box.axis;
+        std::sort(bins.begin() + box.first, bins.begin() + box.last, [axis](const quantize_bin& a, const quantize_bin& b) {
+            return a.c[axis] < b.c[axis];
+        });
+        int split = box.first + 1;
+        uint64_t below = bins[box.first].count;
+        while (split < box.last - 1 && below < box.count / 2) {
+            below += bins[split++].count;
+        }
+        quantize_box upper = box;
+        upper.first = split;
+        box.last = split;
+        quantize_measure(bins, box);
+        quantize_measure(bins, upper);
+        boxes[best] = box;
+        boxes.push_back(upper);
+    }
+
+    palette.size = (int)boxes.size();
+    for (int i = 0; i < palette.size; i++) {
+        double sum[4] = {0, 0, 0, 0};
+        for (int b = boxes[i].first; b < boxes[i].last; b++) {
+            for (int ch = 0; ch < 4; ch++) {
+                sum[ch] += (double)bins[b].c[ch] * bins[b].count;
+            }
+        }
+        for (int ch = 0; ch < 4; ch++) {
+            palette.c[ch][i] = (int16_t)std::lround(sum[ch] / boxes[i].count);
+        }
+    }
+}
+
+// move each palette entry to the mean of the histogram bins nearest it
+static void quantize_refine(const std::vector<quantize_bin>& bins, quantize_palette& palette)
+{
+    for (int pass = 0; pass < QUANTIZE_REFINE_PASSES; pass++) {
+        double sum[QUANTIZE_COLORS][4] = {};
+        uint64_t count[QUANTIZE_COLORS] = {};
+        for (const auto& bin : bins) {
+            const int i = palette.nearest(bin.c);
+            count[i] += bin.count;
+            for (int ch = 0; ch < 4; ch++) {
+                sum[i][ch] += (double)bin.c[ch] * bin.count;
+            }
+        }
+        for (int i = 0; i < palette.size; i++) {
+            if (count[i] > 0) {
+                for (int ch = 0; ch < 4; ch++) {
+                    palette.c[ch][i] = (int16_t)std::lround(sum[i][ch] / count[i]);
+                }
+            }
+        }
+    }
+}
+
+// what a stripe of the mapping pass gathers about the pixels it maps to
+// each entry, from which their mean and squared error follow
+struct quantize_stats {
+    uint64_t count[QUANTIZE_COLORS];
+    uint64_t sum[QUANTIZE_COLORS][4];
+    uint64_t squares[QUANTIZE_COLORS][4];
+};
+
+bool quantize_bgra(const uint8_t* data,
+                   size_t stride,
+                   int width,
+                   int height,
+                   int channels,
+                   int min_quality,
+                   int threads,
+                   uint8_t palette[256][4],
+                   int* palette_size,
+                   int* translucent,
+                   uint8_t* indices)
+{
+    if (!data || width <= 0 || height <= 0 || (channels != 3 && channels != 4)) {
+        return false;
+    }
+
+    bool used[QUANTIZE_COLORS];
+    std::fill(used, used + QUANTIZE_COLORS, true);
+    if (!quantize_exact(data, stride, width, height, channels, palette, palette_size, indices)) {
+        if (min_quality >= 100) {
+            return false;
+        }
+
+        std::unique_ptr<uint32_t, decltype(&free)> counts((uint32_t*)calloc(QUANTIZE_BINS, sizeof(uint32_t)), &free);
+        if (!counts) {
+            return false;
+        }
+        std::vector<uint32_t> occupied;
+        for (int y = 0; y < height; y++) {
+            const uint8_t* row = data + y * stride;
+            for (int x = 0; x < width; x++) {
+                int c[4];
+                quantize_premultiply(row, x, channels, c);
+                const uint32_t key = quantize_key(c);
+                if (counts.get()[key]++ == 0) {
+                    occupied.push_back(key);
+                }
+            }
+        }
+        std::vector<quantize_bin> bins(occupied.size());
+        const int shift = 8 - QUANTIZE_BITS;
+        const int mask = (1 << QUANTIZE_BITS) - 1;
+        for (size_t i = 0; i < occupied.size(); i++) {
+            const uint32_t key = occupied[i];
+            bins[i].key = key;
+            bins[i].count = counts.get()[key];
+            for (int ch = 0; ch < 4; ch++) {
+                bins[i].c[ch] = (((key >> ((3 - ch) * QUANTIZE_BITS)) & mask) << shift) + (1 << shift) / 2;
+            }
+        }
+        counts.reset();
+
+        quantize_palette pal;
+        quantize_median_cut(bins, pal);
+        pal.pad();
+        quantize_refine(bins, pal);
+        std::unique_ptr<uint8_t[]> nearest(new uint8_t[QUANTIZE_BINS]);
+        for (const auto& bin : bins) {
+            nearest[bin.key] = (uint8_t)pal.nearest(bin.c);
+        }
+
+        const int stripes = parallel_stripes(threads, height, (size_t)width * height * channels);
+        std::vector<quantize_stats> stats(stripes);
+        parallel_for(stripes, [&](int s) {
+            quantize_stats& st = stats[s];
+            memset(&st, 0, sizeof(st));
+            const int y0 = (int)((int64_t)height * s / stripes);
+            const int y1 = (int)((int64_t)height * (s + 1) / stripes);
+            for (int y = y0; y < y1; y++) {
+                const uint8_t* row = data + y * stride;
+                uint8_t* out = indices + (size_t)y * width;
+                for (int x = 0; x < width; x++) {
+                    int c[4];
+                    quantize_premultiply(row, x, channels, c);
+                    const uint8_t i = nearest[quantize_key(c)];
+                    out[x] = i;
+                    st.count[i]++;
+                    for (int ch = 0; ch < 4; ch++) {
+                        st.sum[i][ch] += c[ch];
+                        st.squares[i][ch] += c[ch] * c[ch];
+                    }
+                }
+            }
+        });
+
+        // each entry moves to the mean of its pixels, leaving as their
+        // squared error what their squares exceed its square by
+        double error = 0;
+        for (int i = 0; i < pal.size; i++) {
+            uint64_t count = 0;
+            uint64_t sum[4] = {0, 0, 0, 0};
+            uint64_t squares[4] = {0, 0, 0, 0};
+            for (const auto& st : stats) {
+                count += st.count[i];
+                for (int ch = 0; ch < 4; ch++) {
+                    sum[ch] += st.sum[i][ch];
+                    squares[ch] += st.squares[i][ch];
+                }
+            }
+            used[i] = count > 0;
+            for (int ch = 0; ch < 4 && used[i]; ch++) {
+                const double mean = (double)sum[ch] / count;
+                const int c = std::min(255, std::max(0, (int)std::lround(mean)));
+                error += (double)squares[ch] - 2.0 * c * sum[ch] + (double)c * c * count;
+                pal.c[ch][i] = (int16_t)c;
+            }
+        }
+        const double mse = error / ((double)width * height * (channels == 4 ? 4 : 3));
+        const double psnr = mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : QUANTIZE_PSNR_MAX;
+        const double quality = (psnr - QUANTIZE_PSNR_MIN) * 100.0 / (QUANTIZE_PSNR_MAX - QUANTIZE_PSNR_MIN);
+        if (quality < min_quality) {
+            return false;
+        }
+
+        for (int i = 0; i < pal.size; i++) {
+            const int a = pal.c[3][i];
+            for (int ch = 0; ch < 3; ch++) {
+                palette[i][ch] = a == 0 ? 0 : (uint8_t)std::min(255, (pal.c[ch][i] * 255 + a / 2) / a);
+            }
+            palette[i][3] = (uint8_t)a;
+        }
+        *palette_size = pal.size;
+    }
+
+    // put the entries that are not opaque first, so that tRNS need only
+    // cover those, and drop any that no pixel maps to
+    uint8_t order[QUANTIZE_COLORS];
+    uint8_t remap[QUANTIZE_COLORS] = {};
+    int n = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < *palette_size; i++) {
+            if (used[i] && (palette[i][3] == 255) == (pass == 1)) {
+                order[n++] = (uint8_t)i;
+            }
+        }
+        if (pass == 0) {
+            *translucent = n;
+        }
+    }
+    uint8_t sorted[QUANTIZE_COLORS][4];
+    bool identity = true;
+    for (int i = 0; i < n; i++) {
+        memcpy(sorted[i], palette[order[i]], 4);
+        remap[order[i]] = (uint8_t)i;
+        identity = identity && order[i] == i;
+    }
+    memcpy(palette, sorted, (size_t)n * 4);
+    identity = identity && n == *palette_size;
+    *palette_size = n;
+    if (!identity) {
+        const size_t pixels = (size_t)width * height;
+        for (size_t i = 0; i < pixels; i++) {
+            indices[i] = remap[indices[i]];
+        }
+    }
+    return true;
+}
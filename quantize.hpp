@@ -0,0 +1,30 @@
+#ifndef LILLIPUT_QUANTIZE_HPP
+#define LILLIPUT_QUANTIZE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reduce the width x height 8-bit BGR or BGRA pixels at data, rows stride
+// bytes apart, to a palette of at most 256 colours, writing one palette index
+// per pixel to the width * height bytes at indices. The palette is written to
+// palette as *palette_size RGBA entries, not premultiplied, with the entries
+// that are not opaque first and their number in *translucent.
+//
+// Images of 256 colours or fewer are mapped exactly. Others are quantized in
+// premultiplied RGBA, so that colour under low alpha counts for as little as
+// it shows, and the result is rated from 0 to 100 by its PSNR, 100 being
+// 50dB and 0 being 20dB. Returns false, with nothing useful written, if that
+// falls short of min_quality. The mapping runs in up to `threads` stripes.
+bool quantize_bgra(const uint8_t* data,
+                   size_t stride,
+                   int width,
+                   int height,
+                   int channels,
+                   int min_quality,
+                   int threads,
+                   uint8_t palette[256][4],
+                   int* palette_size,
+                   int* translucent,
+                   uint8_t* indices);
+
+#endif
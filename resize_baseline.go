@@ -0,0 +1,19 @@
+//go:build CV_RESIZE_BASELINE
+// +build CV_RESIZE_BASELINE
+
+package lilliput
+
+// #include "opencv.hpp"
+import "C"
+
+// resizeToInterArea resizes with cv::resize and INTER_AREA, which ResizeTo
+// used before the separable resampler. It is only built, with the
+// CV_RESIZE_BASELINE tag, for BenchmarkResizeInterArea to compare against.
+func (f *Framebuffer) resizeToInterArea(width, height int, dst *Framebuffer) error {
+	err := dst.resizeMat(width, height, f.pixelType)
+	if err != nil {
+		return err
+	}
+	C.opencv_mat_resize(f.mat, dst.mat, C.int(width), C.int(height), C.CV_INTER_AREA)
+	return nil
+}
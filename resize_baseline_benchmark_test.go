@@ -0,0 +1,29 @@
+//go:build CV_RESIZE_BASELINE
+// +build CV_RESIZE_BASELINE
+
+package lilliput
+
+import "testing"
+
+// BenchmarkResizeInterArea is the cv::resize INTER_AREA baseline for
+// BenchmarkResize, at the same sizes:
+//
+//	go test -tags CV_RESIZE_BASELINE -run '^$' -bench 'Resize(InterArea)?$'
+func BenchmarkResizeInterArea(b *testing.B) {
+	src := decodeResizeSource(b, 5)
+	defer src.Close()
+	dst := NewFramebuffer(8192, 8192)
+	defer dst.Close()
+
+	for _, target := range resizeTargets(src) {
+		target := target
+		b.Run(target.name+"/cv_inter_area", func(b *testing.B) {
+			b.SetBytes(int64(src.Width() * src.Height() * src.PixelType().Channels()))
+			for i := 0; i < b.N; i++ {
+				if err := src.resizeToInterArea(target.width, target.height, dst); err != nil {
+					b.Fatalf("resize: %v", err)
+				}
+			}
+		})
+	}
+}
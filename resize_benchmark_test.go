@@ -0,0 +1,89 @@
+package lilliput
+
+import (
+	"os"
+	"testing"
+)
+
+var resizeFilters = []struct {
+	name   string
+	filter ResizeFilter
+}{
+	{"area", ResizeFilterArea},
+	{"box", ResizeFilterBox},
+	{"mitchell", ResizeFilterMitchell},
+	{"lanczos3", ResizeFilterLanczos3},
+}
+
+// decodeResizeSource decodes ferry_sunset.jpg and enlarges it by scale, to
+// stand in for a camera-sized source.
+func decodeResizeSource(tb testing.TB, scale int) *Framebuffer {
+	data, err := os.ReadFile("testdata/ferry_sunset.jpg")
+	if err != nil {
+		tb.Fatalf("read fixture: %v", err)
+	}
+	dec, err := NewDecoder(data)
+	if err != nil {
+		tb.Fatalf("decoder: %v", err)
+	}
+	defer dec.Close()
+
+	decoded := NewFramebuffer(8192, 8192)
+	if err := dec.DecodeTo(decoded); err != nil {
+		tb.Fatalf("decode: %v", err)
+	}
+	if scale == 1 {
+		return decoded
+	}
+	defer decoded.Close()
+
+	src := NewFramebuffer(8192, 8192)
+	if err := decoded.ResizeTo(decoded.Width()*scale, decoded.Height()*scale, src); err != nil {
+		tb.Fatalf("enlarge: %v", err)
+	}
+	return src
+}
+
+type resizeTarget struct {
+	name          string
+	width, height int
+}
+
+// resizeTargets are the output sizes BenchmarkResize takes src to, which
+// BenchmarkResizeInterArea shares
+func resizeTargets(src *Framebuffer) []resizeTarget {
+	return []resizeTarget{
+		{"half", src.Width() / 2, src.Height() / 2},
+		{"thumb", 512, 512 * src.Height() / src.Width()},
+		{"icon", 64, 64 * src.Height() / src.Width()},
+		{"odd", src.Width() * 3 / 7, src.Height() * 3 / 7},
+	}
+}
+
+// BenchmarkResize measures the resampler's filters. The cv::resize
+// INTER_AREA baseline is BenchmarkResizeInterArea, built with
+// -tags CV_RESIZE_BASELINE.
+func BenchmarkResize(b *testing.B) {
+	src := decodeResizeSource(b, 5)
+	defer src.Close()
+	dst := NewFramebuffer(8192, 8192)
+	defer dst.Close()
+
+	for _, target := range resizeTargets(src) {
+		target := target
+		for _, f := range resizeFilters {
+			f := f
+			b.Run(target.name+"/"+f.name, func(b *testing.B) {
+				r := newResampler()
+				defer r.Close()
+				r.filter = f.filter
+				b.SetBytes(int64(src.Width() * src.Height() * src.PixelType().Channels()))
+				for i := 0; i < b.N; i++ {
+					if err := src.resizeTo(target.width, target.height, dst, r); err != nil {
+						b.Fatalf("resize: %v", err)
+					}
+				}
+			})
+		}
+	}
+}
@@ -0,0 +1,81 @@
+package lilliput
+
+import (
+	"os"
+	"strconv"
+	"testing"
+)
+
+// BenchmarkTonemap measures the HDR to SDR tone-map on its own for a still
+// image, and as part of decoding for the HDR AVIF fixtures.
+func BenchmarkTonemap(b *testing.B) {
+	data, err := os.ReadFile("data/hdr-ohmama.png")
+	if err != nil {
+		b.Fatalf("read fixture: %v", err)
+	}
+	dec, err := NewDecoder(data)
+	if err != nil {
+		b.Fatalf("decoder: %v", err)
+	}
+	src := NewFramebuffer(8192, 8192)
+	defer src.Close()
+	err = dec.DecodeTo(src)
+	dec.Close()
+	if err != nil {
+		b.Fatalf("decode: %v", err)
+	}
+	// enlarged to stand in for a photo-sized source
+	large := NewFramebuffer(8192, 8192)
+	defer large.Close()
+	if err := src.ResizeTo(src.Width()*16, src.Height()*16, large); err != nil {
+		b.Fatalf("enlarge: %v", err)
+	}
+	frame := NewFramebuffer(8192, 8192)
+	defer frame.Close()
+
+	pq := CICP{Primaries: 9, Transfer: 16, Matrix: 0, FullRange: true}
+	for _, threads := range []int{1, 4} {
+		threads := threads
+		for _, fixture := range []struct {
+			name string
+			fb   *Framebuffer
+		}{{"ohmama", src}, {"ohmama_x16", large}} {
+			fixture := fixture
+			b.Run(fixture.name+"/threads_"+strconv.Itoa(threads), func(b *testing.B) {
+				b.SetBytes(int64(fixture.fb.Width() * fixture.fb.Height() * fixture.fb.PixelType().Channels()))
+				for i := 0; i < b.N; i++ {
+					b.StopTimer()
+					if err := fixture.fb.resizeTo(fixture.fb.Width(), fixture.fb.Height(), frame, nil); err != nil {
+						b.Fatalf("copy: %v", err)
+					}
+					b.StartTimer()
+					if err := frame.tonemapToSDR(pq, threads); err != nil {
+						b.Fatalf("tonemap: %v", err)
+					}
+				}
+			})
+		}
+	}
+
+	for _, path := range []string{"testdata/hdr_color_preservation.avif"} {
+		avif, err := os.ReadFile(path)
+		if err != nil {
+			b.Fatalf("read fixture: %v", err)
+		}
+		b.Run(path, func(b *testing.B) {
+			fb := NewFramebuffer(4096, 4096)
+			defer fb.Close()
+			for i := 0; i < b.N; i++ {
+				dec, err := NewDecoder(avif)
+				if err != nil {
+					b.Fatalf("decoder: %v", err)
+				}
+				err = dec.DecodeTo(fb)
+				dec.Close()
+				if err != nil {
+					b.Fatalf("decode: %v", err)
+				}
+			}
+		})
+	}
+}
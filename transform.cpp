@@ -0,0 +1,348 @@
+#include "transform.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <vector>
+
+static size_t transform_frame_bytes(int width, int height, int type)
+{
+    return size_t(width) * size_t(height) * CV_ELEM_SIZE(type);
+}
+
+// A mat over the first bytes of buf for a width x height frame of the given
+// type, which must fit. Like a Framebuffer's, the mat does not own its data:
+// an orientation transform that swaps axes reinterprets the data in place,
+// which an owning mat would free from under it.
+static cv::Mat transform_frame_mat(uint8_t* buf, int width, int height, int type)
+{
+    cv::Mat mat(height, width, type, buf);
+    mat.datalimit = buf + transform_frame_bytes(width, height, type);
+    return mat;
+}
+
+static bool transform_swaps_axes(int orientation)
+{
+    switch (orientation) {
+    case CV_IMAGE_ORIENTATION_LT:
+    case CV_IMAGE_ORIENTATION_RT:
+    case CV_IMAGE_ORIENTATION_RB:
+    case CV_IMAGE_ORIENTATION_LB:
+        return true;
+    }
+    return false;
+}
+
+// calculateExpectedSize in ops.go
+static void transform_expected_size(int orig_width, int orig_height, int* width, int* height)
+{
+    const int req_width = *width;
+    const int req_height = *height;
+    if (req_width == req_height && req_width > std::min(orig_width, orig_height)) {
+        *width = *height = std::min(orig_width, orig_height);
+    }
+    else if (req_width > orig_width && req_height > orig_height && req_width != req_height) {
+        *width = orig_width;
+        *height = orig_height;
+    }
+}
+
+// fitCrop in opencv.go, with the same floating point arithmetic so that both
+// crop exactly the same pixels
+static cv::Rect transform_fit_crop(int width, int height, int output_width, int output_height)
+{
+    const double aspect_in = double(width) / double(height);
+    const double aspect_out = double(output_width) / double(output_height);
+
+    int width_post_crop, height_post_crop;
+    if (aspect_in > aspect_out) {
+        width_post_crop = int((aspect_out * double(height)) + 0.5);
+        height_post_crop = height;
+    }
+    else {
+        height_post_crop = int((double(width) / aspect_out) + 0.5);
+        width_post_crop = width;
+    }
+    width_post_crop = std::max(width_post_crop, 1);
+    height_post_crop = std::max(height_post_crop, 1);
+
+    const int left = std::max(int(double(width - width_post_crop) * 0.5), 0);
+    const int top = std::max(int(double(height - height_post_crop) * 0.5), 0);
+    return cv::Rect(left, top, width_post_crop, height_post_crop);
+}
+
+static bool transform_is_png(const void* src, size_t src_len)
+{
+    static const uint8_t png_signature[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+    return src_len >= sizeof(png_signature) && memcmp(src, png_signature, sizeof(png_signature)) == 0;
+}
+
+static bool transform_is_jpeg(const void* src, size_t src_len)
+{
+    static const uint8_t jpeg_soi[3] = {0xFF, 0xD8, 0xFF};
+    return src_len >= sizeof(jpeg_soi) && memcmp(src, jpeg_soi, sizeof(jpeg_soi)) == 0;
+}
+
+// where the pixels of r, a region of the width x height stored image, end up
+// once the image is oriented
+static cv::Rect transform_oriented_rect(int orientation, int width, int height, const cv::Rect& r)
+{
+    const int right = width - r.x - r.width;
+    const int bottom = height - r.y - r.height;
+    switch (orientation) {
+    case CV_IMAGE_ORIENTATION_TR:
+        return cv::Rect(right, r.y, r.width, r.height);
+    case CV_IMAGE_ORIENTATION_BR:
+        return cv::Rect(right, bottom, r.width, r.height);
+    case CV_IMAGE_ORIENTATION_BL:
+        return cv::Rect(r.x, bottom, r.width, r.height);
+    case CV_IMAGE_ORIENTATION_LT:
+        return cv::Rect(r.y, r.x, r.height, r.width);
+    case CV_IMAGE_ORIENTATION_RT:
+        return cv::Rect(bottom, r.x, r.height, r.width);
+    case CV_IMAGE_ORIENTATION_RB:
+        return cv::Rect(bottom, right, r.height, r.width);
+    case CV_IMAGE_ORIENTATION_LB:
+        return cv::Rect(r.y, right, r.height, r.width);
+    default:
+        return r;
+    }
+}
+
+// If all the steps below would do to the width x height stored image is
+// undo its orientation and keep a region of it at its own size, set *region
+// to that region of the oriented image and return true. crop is the part of
+// the stored image a Fit decodes. An image with no orientation to undo is
+// re-encoded instead, as the caller's JpegQuality and other options ask.
+static bool transform_unresampled_region(const lilliput_transform_spec* spec,
+                                         int width,
+                                         int height,
+                                         int orientation,
+                                         const cv::Rect& crop,
+                                         int output_width,
+                                         int output_height,
+                                         cv::Rect* region)
+{
+    if (orientation == CV_IMAGE_ORIENTATION_TL) {
+        return false;
+    }
+    cv::Rect kept(0, 0, width, height);
+    if (spec->resize_method != LILLIPUT_RESIZE_NONE) {
+        // an output larger than the image is oriented before it is resized,
+        // but is then resampled anyway
+        const bool swaps_axes = transform_swaps_axes(orientation);
+        const int resize_width = swaps_axes ? output_height : output_width;
+        const int resize_height = swaps_axes ? output_width : output_height;
+        cv::Rect resize_src(0, 0, crop.width, crop.height);
+        if (spec->resize_method == LILLIPUT_RESIZE_FIT) {
+            resize_src = transform_fit_crop(crop.width, crop.height, resize_width, resize_height);
+        }
+        if (resize_src.width != resize_width || resize_src.height != resize_height) {
+            return false;
+        }
+        kept = resize_src + crop.tl();
+    }
+    *region = transform_oriented_rect(orientation, width, height, kept);
+    return true;
+}
+
+// The steps below are those ImageOps.Transform takes for a still image, in the
+// same order and with the same kernels, so that both produce the same bytes.
+int lilliput_transform(lilliput_transform_spec* spec,
+                       opencv_decoder d,
+                       void* src,
+                       size_t src_len,
+                       void* decode_buf,
+                       size_t decode_cap,
+                       void* resize_buf,
+                       size_t resize_cap,
+                       const int* opt,
+                       size_t opt_len,
+                       const void* icc,
+                       size_t icc_len,
+                       void* dst,
+                       size_t dst_cap,
+                       size_t* dst_len)
+{
+    auto decoder = static_cast<cv::ImageDecoder*>(d);
+    if (!decoder) {
+        return LILLIPUT_TRANSFORM_INVALID_IMAGE;
+    }
+    if (!spec->header_read && !opencv_decoder_read_header(d)) {
+        return LILLIPUT_TRANSFORM_INVALID_IMAGE;
+    }
+    // only JPEG and PNG inputs are transformed here; other formats OpenCV
+    // decodes get the handling ImageOps gives them
+    if (!transform_is_jpeg(src, src_len) && !transform_is_png(src, src_len)) {
+        return LILLIPUT_TRANSFORM_UNSUPPORTED;
+    }
+
+    const int width = decoder->width();
+    const int height = decoder->height();
+    const int orientation = decoder->orientation();
+    const bool swaps_axes = transform_swaps_axes(orientation);
+    if (width <= 0 || height <= 0) {
+        return LILLIPUT_TRANSFORM_UNSUPPORTED;
+    }
+    if (spec->resize_method != LILLIPUT_RESIZE_NONE && (spec->width <= 0 || spec->height <= 0)) {
+        return LILLIPUT_TRANSFORM_UNSUPPORTED;
+    }
+    // ImageOps orients such a frame but sizes it as if it had not
+    if (swaps_axes && !spec->normalize_orientation) {
+        return LILLIPUT_TRANSFORM_UNSUPPORTED;
+    }
+    // colour signalled by a cICP chunk is for ImageOps to tone-map or carry over
+    if (transform_is_png(src, src_len)) {
+        uint8_t primaries, transfer, matrix, full_range;
+        if (opencv_decoder_get_png_cicp(src, src_len, &primaries, &transfer, &matrix, &full_range)) {
+            return LILLIPUT_TRANSFORM_UNSUPPORTED;
+        }
+    }
+
+    const int type = CV_MAKETYPE(CV_8U, CV_MAT_CN(decoder->type()));
+    const bool premultiply = CV_MAT_CN(type) == 4 && spec->resize_method != LILLIPUT_RESIZE_NONE;
+    const bool defer_orientation = orientation != CV_IMAGE_ORIENTATION_TL &&
+                                   spec->resize_method != LILLIPUT_RESIZE_NONE &&
+                                   int64_t(spec->width) * spec->height <= int64_t(width) * height;
+
+    // output size in display orientation, and for Fit the part of the
+    // stored image it keeps
+    int output_width = spec->width;
+    int output_height = spec->height;
+    cv::Rect crop(0, 0, width, height);
+    if (spec->resize_method == LILLIPUT_RESIZE_FIT) {
+        transform_expected_size(swaps_axes ? height : width, swaps_axes ? width : height, &output_width, &output_height);
+        if (output_width <= 0 || output_height <= 0) {
+            return LILLIPUT_TRANSFORM_UNSUPPORTED;
+        }
+        const int crop_width = swaps_axes ? output_height : output_width;
+        const int crop_height = swaps_axes ? output_width : output_height;
+        crop = transform_fit_crop(width, height, crop_width, crop_height);
+        // as in decodeCrop, only decode a region that the crop of the
+        // resize below will keep all of
+        if (transform_fit_crop(crop.width, crop.height, crop_width, crop_height).size() != crop.size()) {
+            crop = cv::Rect(0, 0, width, height);
+        }
+    }
+
+    // a JPEG that is only to have its orientation undone and be cropped has
+    // its DCT coefficients moved rather than its pixels decoded and encoded
+    // again, which is much faster and loses nothing. Its output is then only
+    // as large as the source, whatever the quality asked for.
+    cv::Rect region;
+    if (spec->output_format == LILLIPUT_OUTPUT_JPEG && transform_is_jpeg(src, src_len) &&
+        size_t(crop.width) * size_t(crop.height) * CV_ELEM_SIZE(type) <= spec->max_frame_bytes &&
+        transform_unresampled_region(spec, width, height, orientation, crop, output_width, output_height, &region)) {
+        switch (opencv_jpeg_transform(src,
+                                      src_len,
+                                      orientation,
+                                      region.x,
+                                      region.y,
+                                      region.width,
+                                      region.height,
+                                      opt,
+                                      opt_len,
+                                      icc,
+                                      icc_len,
+                                      dst,
+                                      dst_cap,
+                                      dst_len)) {
+        case OPENCV_JPEG_TRANSFORM_OK:
+            return LILLIPUT_TRANSFORM_OK;
+        case OPENCV_JPEG_TRANSFORM_BUF_TOO_SMALL:
+            return LILLIPUT_TRANSFORM_BUF_TOO_SMALL;
+        default:
+            break;
+        }
+    }
+
+    // the size of the resize, which is in stored orientation when the
+    // orientation waits for it
+    int resize_width = output_width;
+    int resize_height = output_height;
+    if (defer_orientation && swaps_axes) {
+        std::swap(resize_width, resize_height);
+    }
+    const size_t decode_bytes = transform_frame_bytes(crop.width, crop.height, type);
+    const size_t resize_bytes =
+      spec->resize_method != LILLIPUT_RESIZE_NONE ? transform_frame_bytes(resize_width, resize_height, type) : 0;
+    if (decode_bytes > spec->max_frame_bytes || resize_bytes > spec->max_frame_bytes) {
+        return LILLIPUT_TRANSFORM_BUF_TOO_SMALL;
+    }
+    if (decode_bytes > decode_cap || resize_bytes > resize_cap) {
+        spec->decode_bytes = decode_bytes;
+        spec->resize_bytes = resize_bytes;
+        return LILLIPUT_TRANSFORM_NEED_FRAMES;
+    }
+
+    cv::Mat frame = transform_frame_mat(static_cast<uint8_t*>(decode_buf), crop.width, crop.height, type);
+    try {
+        bool decoded;
+        if (crop.width == width && crop.height == height) {
+            decoded = opencv_decoder_read_data(d, &frame);
+        }
+        else {
+            decoded = opencv_decoder_read_region(d, src, src_len, &frame, crop.x, crop.y);
+        }
+        if (!decoded) {
+            return LILLIPUT_TRANSFORM_DECODING_FAILED;
+        }
+    }
+    catch (const cv::Exception& e) {
+        std::cerr << "OpenCV exception in lilliput_transform: " << e.what() << std::endl;
+        return LILLIPUT_TRANSFORM_DECODING_FAILED;
+    }
+    catch (const std::bad_alloc&) {
+        return LILLIPUT_TRANSFORM_DECODING_FAILED;
+    }
+
+    if (premultiply) {
+        opencv_mat_premultiply_alpha(&frame, spec->threads);
+    }
+    if (!defer_orientation && orientation != CV_IMAGE_ORIENTATION_TL) {
+        opencv_mat_orientation_transform(CVImageOrientation(orientation), &frame, spec->threads);
+    }
+
+    cv::Mat resized;
+    cv::Mat* output = &frame;
+    if (spec->resize_method != LILLIPUT_RESIZE_NONE) {
+        cv::Mat resize_src = frame;
+        if (spec->resize_method == LILLIPUT_RESIZE_FIT) {
+            resize_src = frame(transform_fit_crop(frame.cols, frame.rows, resize_width, resize_height));
+        }
+        resized = transform_frame_mat(static_cast<uint8_t*>(resize_buf), resize_width, resize_height, type);
+        if (opencv_mat_resample(spec->resampler, &resize_src, &resized, spec->filter, spec->threads) !=
+            OPENCV_SUCCESS) {
+            return LILLIPUT_TRANSFORM_RESIZE_FAILED;
+        }
+        if (defer_orientation) {
+            opencv_mat_orientation_transform(CVImageOrientation(orientation), &resized, spec->threads);
+        }
+        output = &resized;
+    }
+
+    if (premultiply) {
+        opencv_mat_unpremultiply_alpha(output, spec->threads);
+    }
+
+    if (spec->output_format == LILLIPUT_OUTPUT_JPEG) {
+        switch (opencv_jpeg_encode(output, opt, opt_len, icc, icc_len, dst, dst_cap, dst_len)) {
+        case OPENCV_JPEG_ENCODE_OK:
+            return LILLIPUT_TRANSFORM_OK;
+        case OPENCV_JPEG_ENCODE_BUF_TOO_SMALL:
+            return LILLIPUT_TRANSFORM_BUF_TOO_SMALL;
+        default:
+            return LILLIPUT_TRANSFORM_ENCODING_FAILED;
+        }
+    }
+
+    switch (opencv_png_encode(output, opt, opt_len, spec->threads, dst, dst_cap, dst_len)) {
+    case OPENCV_PNG_ENCODE_OK:
+        return LILLIPUT_TRANSFORM_OK;
+    case OPENCV_PNG_ENCODE_BUF_TOO_SMALL:
+        return LILLIPUT_TRANSFORM_BUF_TOO_SMALL;
+    default:
+        return LILLIPUT_TRANSFORM_ENCODING_FAILED;
+    }
+}
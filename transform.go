@@ -0,0 +1,151 @@
+package lilliput
+
+// #include "transform.hpp"
+import "C"
+
+import (
+	"strings"
+	"unsafe"
+)
+
+// transformStill transforms a still image from an openCVDecoder into JPEG or
+// PNG with one call to lilliput_transform, which decodes, orients, crops,
+// resizes and encodes it without coming back to Go in between. The output is
+// the same as Transform's, except that a JPEG that only has its orientation
+// undone and is cropped is transformed losslessly rather than re-encoded.
+// done is false, with d left as it was, for anything lilliput_transform does
+// not handle, which Transform then does itself.
+func (o *ImageOps) transformStill(d Decoder, opt *ImageOptions, dst []byte) (content []byte, done bool, err error) {
+	decoder, ok := d.(*openCVDecoder)
+	if !ok || decoder.hasDecoded || !decoder.crop.Empty() || len(decoder.buf) == 0 {
+		return nil, false, nil
+	}
+
+	var format C.int
+	switch strings.ToLower(opt.FileType) {
+	case ".jpeg", ".jpg":
+		format = C.LILLIPUT_OUTPUT_JPEG
+	case ".png":
+		format = C.LILLIPUT_OUTPUT_PNG
+	default:
+		return nil, false, nil
+	}
+
+	var method C.int
+	switch opt.ResizeMethod {
+	case ImageOpsNoResize:
+		method = C.LILLIPUT_RESIZE_NONE
+	case ImageOpsFit:
+		method = C.LILLIPUT_RESIZE_FIT
+	case ImageOpsResize:
+		method = C.LILLIPUT_RESIZE_STRETCH
+	default:
+		return nil, false, nil
+	}
+
+	if detectAPNG(decoder.buf) {
+		return nil, false, nil
+	}
+
+	// lilliput_transform decodes to 8 bits, so deeper images whose depth is
+	// to be kept take the long way, as do images to be converted to sRGB
+	if opt.PreserveHighBitDepth {
+		if h, err := decoder.Header(); err == nil && h.PixelType().Depth() > 8 {
+			return nil, false, nil
+		}
+	}
+	if opt.ConvertToSRGB && iccConvertsToSRGB(decoder.ICC()) {
+		return nil, false, nil
+	}
+
+	var optList []C.int
+	var firstOpt *C.int
+	for k, v := range opt.EncodeOptions {
+		optList = append(optList, C.int(k), C.int(v))
+	}
+	if len(optList) > 0 {
+		firstOpt = &optList[0]
+	}
+
+	spec := C.lilliput_transform_spec{
+		output_format:         format,
+		width:                 C.int(opt.Width),
+		height:                C.int(opt.Height),
+		resize_method:         method,
+		filter:                C.int(opt.ResizeFilter),
+		normalize_orientation: C.bool(opt.NormalizeOrientation),
+		header_read:           C.bool(decoder.hasReadHeader),
+		threads:               C.int(o.parallelism),
+		max_frame_bytes:       C.size_t(o.active().maxBytes),
+	}
+	if o.resampler != nil {
+		spec.resampler = o.resampler.resampler
+	}
+
+	// the profile the JPEG encoder would embed, picked as initializeTransform
+	// and newJpegEncoder would pick it
+	var icc []byte
+	if format == C.LILLIPUT_OUTPUT_JPEG {
+		icc = decoder.ICC()
+		if opt.ForceSdr && len(icc) > 0 && IsHDRICCProfile(icc) {
+			icc = SRGBICCProfile
+		}
+		if !ICCHeaderIsSane(icc) {
+			icc = nil
+		}
+	}
+	var iccPtr unsafe.Pointer
+	if len(icc) > 0 {
+		iccPtr = unsafe.Pointer(&icc[0])
+	}
+
+	// the frames are decoded and resized into the buffers of the ImageOps
+	// framebuffers, which are grown from the pool to the sizes
+	// lilliput_transform asks for when they are too small
+	decodeFrame, resizeFrame := o.active(), o.secondary()
+	dst = dst[:1]
+	var length C.size_t
+	var result C.int
+	for attempt := 0; attempt < 2; attempt++ {
+		decodeBuf, decodeCap := decodeFrame.rawBuf()
+		resizeBuf, resizeCap := resizeFrame.rawBuf()
+		result = C.lilliput_transform(&spec, decoder.decoder, unsafe.Pointer(&decoder.buf[0]), C.size_t(len(decoder.buf)), decodeBuf, decodeCap, resizeBuf, resizeCap, firstOpt, C.size_t(len(optList)), iccPtr, C.size_t(len(icc)), unsafe.Pointer(&dst[0]), C.size_t(cap(dst)), &length)
+		if result != C.LILLIPUT_TRANSFORM_NEED_FRAMES {
+			break
+		}
+		spec.header_read = true
+		decodeFrame.reserve(int(spec.decode_bytes))
+		if spec.resize_bytes > 0 {
+			resizeFrame.reserve(int(spec.resize_bytes))
+		}
+	}
+	if result == C.LILLIPUT_TRANSFORM_INVALID_IMAGE {
+		return nil, true, ErrInvalidImage
+	}
+	decoder.hasReadHeader = true
+
+	switch result {
+	case C.LILLIPUT_TRANSFORM_OK:
+		decoder.hasDecoded = true
+		return dst[:length], true, nil
+	case C.LILLIPUT_TRANSFORM_UNSUPPORTED:
+		return nil, false, nil
+	case C.LILLIPUT_TRANSFORM_BUF_TOO_SMALL:
+		return nil, true, ErrBufTooSmall
+	case C.LILLIPUT_TRANSFORM_RESIZE_FAILED:
+		return nil, true, handleOpenCVError(C.OPENCV_ERROR_RESIZE_FAILED)
+	case C.LILLIPUT_TRANSFORM_ENCODING_FAILED:
+		return nil, true, ErrInvalidImage
+	default:
+		return nil, true, ErrDecodingFailed
+	}
+}
+
+// rawBuf returns the framebuffer's pooled buffer, whatever its contents, for
+// native code to use as scratch
+func (f *Framebuffer) rawBuf() (unsafe.Pointer, C.size_t) {
+	if len(f.buf) == 0 {
+		return nil, 0
+	}
+	return unsafe.Pointer(&f.buf[0]), C.size_t(len(f.buf))
+}
@@ -0,0 +1,85 @@
+#ifndef LILLIPUT_TRANSFORM_HPP
+#define LILLIPUT_TRANSFORM_HPP
+
+#include "opencv.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// duplicated from ImageOpsSizeMethod
+enum LilliputResizeMethod {
+    LILLIPUT_RESIZE_NONE = 0,
+    LILLIPUT_RESIZE_FIT = 1,
+    LILLIPUT_RESIZE_STRETCH = 2,
+};
+
+enum LilliputOutputFormat {
+    LILLIPUT_OUTPUT_JPEG = 0,
+    LILLIPUT_OUTPUT_PNG = 1,
+};
+
+// Results of lilliput_transform. UNSUPPORTED means the image needs something
+// lilliput_transform does not do, and nothing has been decoded yet, so the
+// caller can still transform it the long way with the same decoder.
+// NEED_FRAMES means the frame buffers it was given are too small for the
+// sizes it has set in the spec, and nothing has been decoded yet either.
+enum LilliputTransformResult {
+    LILLIPUT_TRANSFORM_OK = 0,
+    LILLIPUT_TRANSFORM_UNSUPPORTED = 1,
+    LILLIPUT_TRANSFORM_INVALID_IMAGE = 2,
+    LILLIPUT_TRANSFORM_DECODING_FAILED = 3,
+    LILLIPUT_TRANSFORM_BUF_TOO_SMALL = 4,
+    LILLIPUT_TRANSFORM_RESIZE_FAILED = 5,
+    LILLIPUT_TRANSFORM_ENCODING_FAILED = 6,
+    LILLIPUT_TRANSFORM_NEED_FRAMES = 7,
+};
+
+typedef struct lilliput_transform_spec {
+    int output_format;
+    int width;
+    int height;
+    int resize_method;
+    int filter;                // an OpenCVResampleKernel
+    bool normalize_orientation;
+    bool header_read;          // whether d has already read its header
+    int threads;
+    size_t max_frame_bytes;    // largest decoded or resized frame allowed
+    opencv_resampler resampler; // may be NULL
+    // set on LILLIPUT_TRANSFORM_NEED_FRAMES to the bytes the decoded and the
+    // resized frame need, the latter 0 when there is no resize
+    size_t decode_bytes;
+    size_t resize_bytes;
+} lilliput_transform_spec;
+
+// Decode the still image d was created from, orient, crop and resize it as
+// ImageOps.Transform would, and encode it into dst with the encoder options
+// in opt, all in one call. A JPEG that would only have its orientation undone
+// and be cropped to a JPEG is transformed losslessly instead where
+// opencv_jpeg_transform can. src is the encoded image. A JPEG output embeds
+// icc when it is not null. On success *dst_len is the length of the output.
+//
+// The image is decoded into the decode_cap bytes at decode_buf and resized
+// into the resize_cap bytes at resize_buf, the buffers of the ImageOps
+// framebuffers, so that no frame is allocated here.
+int lilliput_transform(lilliput_transform_spec* spec,
+                       opencv_decoder d,
+                       void* src,
+                       size_t src_len,
+                       void* decode_buf,
+                       size_t decode_cap,
+                       void* resize_buf,
+                       size_t resize_cap,
+                       const int* opt,
+                       size_t opt_len,
+                       const void* icc,
+                       size_t icc_len,
+                       void* dst,
+                       size_t dst_cap,
+                       size_t* dst_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
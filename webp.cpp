@@ -6,6 +6,7 @@
 #include <webp/mux_types.h>
 #include <webp/demux.h>
 #include <stdbool.h>
+#include <algorithm>
 
 struct webp_decoder_struct {
     WebPMux* mux;
@@ -18,14 +19,16 @@ struct webp_decoder_struct {
     int height;
 
     int current_frame_index;
-    int prev_frame_delay_time;
-    int prev_frame_x_offset;
-    int prev_frame_y_offset;
-    WebPMuxAnimDispose prev_frame_dispose;
-    WebPMuxAnimBlend prev_frame_blend;
     uint8_t* decode_buffer;
     size_t decode_buffer_size;
     int total_duration;
+
+    // region of a still image to decode, set by webp_decoder_set_crop;
+    // crop_width is 0 to decode the whole image
+    int crop_x;
+    int crop_y;
+    int crop_width;
+    int crop_height;
 };
 
 struct webp_encoder_struct {
@@ -163,56 +166,6 @@ int webp_decoder_get_pixel_type(const webp_decoder d)
     return d->has_alpha ? CV_8UC4 : CV_8UC3;
 }
 
-/**
- * Gets the delay time of the previous frame.
- * @param d The webp_decoder_struct pointer.
- * @return The delay time of the previous frame.
- */
-int webp_decoder_get_prev_frame_delay(const webp_decoder d)
-{
-    return d->prev_frame_delay_time;
-}
-
-/**
- * Gets the x-offset of the previous frame.
- * @param d The webp_decoder_struct pointer.
- * @return The x-offset of the previous frame.
- */
-int webp_decoder_get_prev_frame_x_offset(const webp_decoder d)
-{
-    return d->prev_frame_x_offset;
-}
-
-/**
- * Gets the y-offset of the previous frame.
- * @param d The webp_decoder_struct pointer.
- * @return The y-offset of the previous frame.
- */
-int webp_decoder_get_prev_frame_y_offset(const webp_decoder d)
-{
-    return d->prev_frame_y_offset;
-}
-
-/**
- * Gets the dispose method of the previous frame.
- * @param d The webp_decoder_struct pointer.
- * @return The dispose method of the previous frame.
- */
-int webp_decoder_get_prev_frame_dispose(const webp_decoder d)
-{
-    return d->prev_frame_dispose;
-}
-
-/**
- * Gets the blend method of the previous frame.
- * @param d The webp_decoder_struct pointer.
- * @return The blend method of the previous frame.
- */
-int webp_decoder_get_prev_frame_blend(const webp_decoder d)
-{
-    return d->prev_frame_blend;
-}
-
 /**
  * Gets the background color of the WebP image.
  * @param d The webp_decoder_struct pointer.
@@ -254,23 +207,21 @@ int webp_decoder_get_total_duration(const webp_decoder d)
 }
 
 /**
- * Gets the ICC profile data from the WebP image.
+ * Gets the ICC profile data from the WebP image, without copying it.
  * @param d The webp_decoder_struct pointer.
- * @param dst The destination buffer to store the ICC profile data.
- * @param dst_len The size of the destination buffer.
- * @return The size of the ICC profile data copied to the destination buffer.
+ * @param len Set to the size of the ICC profile data, 0 if there is none.
+ * @return The ICC profile data, valid for as long as the decoder, or NULL.
  */
-size_t webp_decoder_get_icc(const webp_decoder d, void* dst, size_t dst_len)
+const void* webp_decoder_get_icc(const webp_decoder d, size_t* len)
 {
     WebPData icc = {nullptr, 0};
     auto res = WebPMuxGetChunk(d->mux, "ICCP", &icc);
     if (icc.size > 0 && res == WEBP_MUX_OK) {
-        if (icc.size <= dst_len) {
-            memcpy(dst, icc.bytes, icc.size);
-            return icc.size;
-        }
+        *len = icc.size;
+        return icc.bytes;
     }
-    return 0;
+    *len = 0;
+    return nullptr;
 }
 
 /**
@@ -284,22 +235,91 @@ int webp_decoder_has_more_frames(webp_decoder d)
 }
 
 /**
- * Advances to the next frame in the WebP image.
+ * Restricts decoding of a still image to a region, so that pixels outside it are never decoded.
  * @param d The webp_decoder_struct pointer.
+ * @param x The left edge of the region.
+ * @param y The top edge of the region.
+ * @param width The width of the region.
+ * @param height The height of the region.
+ * @return True if the region was set, false for an animation or a region outside the image.
  */
-void webp_decoder_advance_frame(webp_decoder d)
+bool webp_decoder_set_crop(webp_decoder d, int x, int y, int width, int height)
 {
-    d->current_frame_index++;
+    if (!d || d->has_animation || x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        x + width > d->width || y + height > d->height) {
+        return false;
+    }
+    d->crop_x = x;
+    d->crop_y = y;
+    d->crop_width = width;
+    d->crop_height = height;
+    return true;
+}
+
+/**
+ * Decodes the region set by webp_decoder_set_crop of a still image's bitstream into mat.
+ * libwebp crops lossy images from an even offset and upsamples chroma as if the edges of the crop
+ * were the edges of the image, so the region is widened by a pixel on each side and to an even
+ * offset, then trimmed while copying out.
+ * @param d The webp_decoder_struct pointer.
+ * @param bitstream The image's bitstream.
+ * @param mat The OpenCV matrix to store the region in.
+ * @return True if the region was successfully decoded, false otherwise.
+ */
+static bool webp_decoder_decode_region(const webp_decoder d, const WebPData& bitstream, opencv_mat mat)
+{
+    auto cvMat = static_cast<cv::Mat*>(mat);
+    const int type = webp_decoder_get_pixel_type(d);
+    cvMat->create(d->crop_height, d->crop_width, type);
+
+    const int left = std::max(d->crop_x - 1, 0) & ~1;
+    const int top = std::max(d->crop_y - 1, 0) & ~1;
+    const int width = std::min(d->crop_x + d->crop_width + 1, d->width) - left;
+    const int height = std::min(d->crop_y + d->crop_height + 1, d->height) - top;
+    const size_t elem_size = cvMat->elemSize();
+    const int stride = width * elem_size;
+
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        return false;
+    }
+    config.options.use_cropping = 1;
+    config.options.crop_left = left;
+    config.options.crop_top = top;
+    config.options.crop_width = width;
+    config.options.crop_height = height;
+    config.output.colorspace = type == CV_8UC4 ? MODE_BGRA : MODE_BGR;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = d->decode_buffer;
+    config.output.u.RGBA.stride = stride;
+    config.output.u.RGBA.size = (size_t)stride * height;
+    if (config.output.u.RGBA.size > d->decode_buffer_size) {
+        return false;
+    }
+
+    if (WebPDecode(bitstream.bytes, bitstream.size, &config) != VP8_STATUS_OK) {
+        WebPFreeDecBuffer(&config.output);
+        return false;
+    }
+
+    const uint8_t* src = d->decode_buffer + (size_t)(d->crop_y - top) * stride +
+                         (size_t)(d->crop_x - left) * elem_size;
+    for (int y = 0; y < d->crop_height; y++) {
+        memcpy(cvMat->ptr(y), src + (size_t)y * stride, d->crop_width * elem_size);
+    }
+    WebPFreeDecBuffer(&config.output);
+    return true;
 }
 
 /**
  * Decodes the current frame of the WebP image and stores the decoded image in the provided OpenCV
- * matrix.
+ * matrix, then advances to the next frame.
  * @param d The webp_decoder_struct pointer.
  * @param mat The OpenCV matrix to store the decoded image.
+ * @param info Filled in with the frame's duration, offsets, dispose and blend methods.
  * @return True if the frame was successfully decoded, false otherwise.
  */
-bool webp_decoder_decode(const webp_decoder d, opencv_mat mat)
+bool webp_decoder_decode(const webp_decoder d, opencv_mat mat, lilliput_frame_info* info)
 {
     if (!d) {
         return false;
@@ -318,6 +338,21 @@ bool webp_decoder_decode(const webp_decoder d, opencv_mat mat)
         return false;
     }
 
+    info->duration_ms = frame.duration;
+    info->x_offset = frame.x_offset;
+    info->y_offset = frame.y_offset;
+    info->dispose = frame.dispose_method;
+    info->blend = frame.blend_method;
+
+    if (d->crop_width > 0) {
+        bool ok = webp_decoder_decode_region(d, frame.bitstream, mat);
+        WebPDataClear(&frame.bitstream);
+        if (ok) {
+            d->current_frame_index++;
+        }
+        return ok;
+    }
+
     // Set the cv::Mat dimensions to the frame's width and height
     auto cvMat = static_cast<cv::Mat*>(mat);
     cvMat->create(features.height, features.width, webp_decoder_get_pixel_type(d));
@@ -325,13 +360,6 @@ bool webp_decoder_decode(const webp_decoder d, opencv_mat mat)
     // Recalculate row size based on the new dimensions
     int row_size = cvMat->cols * cvMat->elemSize();
 
-    // Store frame properties for future use
-    d->prev_frame_delay_time = frame.duration;
-    d->prev_frame_x_offset = frame.x_offset;
-    d->prev_frame_y_offset = frame.y_offset;
-    d->prev_frame_dispose = frame.dispose_method;
-    d->prev_frame_blend = frame.blend_method;
-
     // Decode the frame
     uint8_t* res = nullptr;
     switch (webp_decoder_get_pixel_type(d)) {
@@ -358,7 +386,11 @@ bool webp_decoder_decode(const webp_decoder d, opencv_mat mat)
     }
 
     WebPDataClear(&frame.bitstream);
-    return res != nullptr;
+    if (!res) {
+        return false;
+    }
+    d->current_frame_index++;
+    return true;
 }
 
 /**
@@ -772,6 +804,29 @@ void webp_encoder_release(webp_encoder e)
     }
 }
 
+/**
+ * Lengthens the most recently written frame instead of adding a repeat of it.
+ * @param e The webp_encoder_struct pointer.
+ * @param delay_ms How much longer the frame should display, in milliseconds.
+ * @return true if the frame was extended, false if no frame has been written yet.
+ */
+bool webp_encoder_extend_prev_frame_delay(webp_encoder e, int delay_ms)
+{
+    // frame_count starts at 1 and counts up as frames are written
+    if (!e || e->frame_count <= 1 || delay_ms < 0) {
+        return false;
+    }
+
+    if (e->is_animation) {
+        // a frame's duration is the gap to the next frame's timestamp
+        e->timestamp_ms += delay_ms;
+    }
+    else {
+        e->first_frame_delay += delay_ms;
+    }
+    return true;
+}
+
 /**
  * Flushes the remaining data in the webp_encoder_struct and finalizes the WebP image.
  * @param e The webp_encoder_struct pointer.
@@ -4,6 +4,7 @@ package lilliput
 import "C"
 
 import (
+	"image"
 	"io"
 	"time"
 	"unsafe"
@@ -14,6 +15,8 @@ type webpDecoder struct {
 	decoder C.webp_decoder
 	mat     C.opencv_mat
 	buf     []byte
+	crop    image.Rectangle // region set by setCrop; empty decodes whole frames
+	header  *ImageHeader    // read once, since DecodeTo needs it for every frame
 }
 
 // webpEncoder implements the Encoder interface for WebP images.
@@ -48,14 +51,18 @@ func newWebpDecoder(buf []byte) (*webpDecoder, error) {
 
 // Header returns the image metadata including dimensions, pixel type, and frame count.
 func (d *webpDecoder) Header() (*ImageHeader, error) {
-	return &ImageHeader{
-		width:         int(C.webp_decoder_get_width(d.decoder)),
-		height:        int(C.webp_decoder_get_height(d.decoder)),
-		pixelType:     PixelType(C.webp_decoder_get_pixel_type(d.decoder)),
-		orientation:   OrientationTopLeft,
-		numFrames:     int(C.webp_decoder_get_num_frames(d.decoder)),
-		contentLength: len(d.buf),
-	}, nil
+	if d.header == nil {
+		d.header = &ImageHeader{
+			width:         int(C.webp_decoder_get_width(d.decoder)),
+			height:        int(C.webp_decoder_get_height(d.decoder)),
+			pixelType:     PixelType(C.webp_decoder_get_pixel_type(d.decoder)),
+			orientation:   OrientationTopLeft,
+			numFrames:     int(C.webp_decoder_get_num_frames(d.decoder)),
+			contentLength: len(d.buf),
+		}
+	}
+	header := *d.header
+	return &header, nil
 }
 
 // Close releases all resources associated with the decoder.
@@ -91,16 +98,11 @@ func (d *webpDecoder) hasReachedEndOfFrames() bool {
 	return C.webp_decoder_has_more_frames(d.decoder) == 0
 }
 
-// advanceFrameIndex advances the internal frame index for the next decoding call.
-func (d *webpDecoder) advanceFrameIndex() {
-	C.webp_decoder_advance_frame(d.decoder)
-}
-
 // ICC returns the ICC color profile data embedded in the WebP image.
 func (d *webpDecoder) ICC() []byte {
-	iccDst := make([]byte, ICCProfileBufferSize)
-	iccLength := C.webp_decoder_get_icc(d.decoder, unsafe.Pointer(&iccDst[0]), C.size_t(cap(iccDst)))
-	return iccDst[:iccLength]
+	var n C.size_t
+	p := C.webp_decoder_get_icc(d.decoder, &n)
+	return internCICC(p, n)
 }
 
 // BackgroundColor returns the background color of the WebP image.
@@ -138,13 +140,19 @@ func (d *webpDecoder) DecodeTo(f *Framebuffer) error {
 	}
 
 	// Resize the framebuffer matrix to fit the image dimensions and pixel type
-	err = f.resizeMat(h.Width(), h.Height(), h.PixelType())
+	if d.crop.Empty() {
+		err = f.resizeMat(h.Width(), h.Height(), h.PixelType())
+	} else {
+		err = f.resizeMat(d.crop.Dx(), d.crop.Dy(), h.PixelType())
+	}
 	if err != nil {
 		return err
 	}
 
-	// Decode the current frame into the framebuffer
-	ret := C.webp_decoder_decode(d.decoder, f.mat)
+	// Decode the current frame into the framebuffer, which also advances to
+	// the next frame
+	var info C.lilliput_frame_info
+	ret := C.webp_decoder_decode(d.decoder, f.mat, &info)
 	if !ret {
 		// Check if the decoder has reached the end of the frames
 		if d.hasReachedEndOfFrames() {
@@ -153,19 +161,18 @@ func (d *webpDecoder) DecodeTo(f *Framebuffer) error {
 		return ErrDecodingFailed
 	}
 
-	// Set the frame properties
-	f.duration = time.Duration(C.webp_decoder_get_prev_frame_delay(d.decoder)) * time.Millisecond
-	f.xOffset = int(C.webp_decoder_get_prev_frame_x_offset(d.decoder))
-	f.yOffset = int(C.webp_decoder_get_prev_frame_y_offset(d.decoder))
-	f.dispose = DisposeMethod(C.webp_decoder_get_prev_frame_dispose(d.decoder))
-	f.blend = BlendMethod(C.webp_decoder_get_prev_frame_blend(d.decoder))
-
-	// Advance to the next frame
-	d.advanceFrameIndex()
-
+	f.setFrameInfo(&info)
 	return nil
 }
 
+// setCrop makes DecodeTo decode only rect of a still image, which libwebp
+// does without decoding the pixels outside it. Animations are unaffected.
+func (d *webpDecoder) setCrop(rect image.Rectangle) {
+	if C.webp_decoder_set_crop(d.decoder, C.int(rect.Min.X), C.int(rect.Min.Y), C.int(rect.Dx()), C.int(rect.Dy())) {
+		d.crop = rect
+	}
+}
+
 // SkipFrame is not supported for WebP images and always returns ErrSkipNotSupported.
 func (d *webpDecoder) SkipFrame() error {
 	return ErrSkipNotSupported
@@ -178,7 +185,9 @@ func newWebpEncoder(decodedBy Decoder, dstBuf []byte, config *EncodeConfig) (*we
 
 	// Use ICC override from config if provided, otherwise use decoder's ICC
 	var icc []byte
-	if config != nil && len(config.ICCOverride) > 0 {
+	if config != nil && config.DropICC {
+		icc = nil
+	} else if config != nil && len(config.ICCOverride) > 0 {
 		icc = config.ICCOverride
 	} else {
 		icc = decodedBy.ICC()
@@ -255,6 +264,14 @@ func (e *webpEncoder) Encode(f *Framebuffer, opt map[int]int) ([]byte, error) {
 	return nil, nil
 }
 
+// extendLastFrame lengthens the most recently encoded frame by d.
+func (e *webpEncoder) extendLastFrame(d time.Duration) bool {
+	if e.hasFlushed {
+		return false
+	}
+	return bool(C.webp_encoder_extend_prev_frame_delay(e.encoder, C.int(d.Milliseconds())))
+}
+
 // Close releases all resources associated with the encoder.
 func (e *webpEncoder) Close() {
 	C.webp_encoder_release(e.encoder)
@@ -38,17 +38,17 @@ int webp_decoder_get_height(const webp_decoder d);
 int webp_decoder_get_pixel_type(const webp_decoder d);
 int webp_decoder_get_num_frames(const webp_decoder d);
 int webp_decoder_get_total_duration(const webp_decoder d);
-int webp_decoder_get_prev_frame_delay(const webp_decoder d);
-int webp_decoder_get_prev_frame_dispose(const webp_decoder d);
-int webp_decoder_get_prev_frame_blend(const webp_decoder d);
-int webp_decoder_get_prev_frame_x_offset(const webp_decoder d);
-int webp_decoder_get_prev_frame_y_offset(const webp_decoder d);
-bool webp_decoder_get_prev_frame_has_alpha(const webp_decoder d);
 uint32_t webp_decoder_get_bg_color(const webp_decoder d);
 uint32_t webp_decoder_get_loop_count(const webp_decoder d);
-size_t webp_decoder_get_icc(const webp_decoder d, void* buf, size_t buf_len);
+// the image's ICC profile, owned by d, and its length in *len; null if it has none
+const void* webp_decoder_get_icc(const webp_decoder d, size_t* len);
 void webp_decoder_release(webp_decoder d);
-bool webp_decoder_decode(webp_decoder d, opencv_mat mat);
+// decode the current frame into mat and its properties into info, then advance
+// to the next frame
+bool webp_decoder_decode(webp_decoder d, opencv_mat mat, lilliput_frame_info* info);
+// decode only the width x height region at x, y of a still image. returns
+// false, decoding whole frames as before, for an animation
+bool webp_decoder_set_crop(webp_decoder d, int x, int y, int width, int height);
 
 //----------------------
 // Encoder Management
@@ -69,8 +69,8 @@ size_t webp_encoder_write(webp_encoder e,
                           int x_offset,
                           int y_offset);
 void webp_encoder_release(webp_encoder e);
+bool webp_encoder_extend_prev_frame_delay(webp_encoder e, int delay_ms);
 size_t webp_encoder_flush(webp_encoder e);
-void webp_decoder_advance_frame(webp_decoder d);
 int webp_decoder_has_more_frames(webp_decoder d);
 
 #ifdef __cplusplus
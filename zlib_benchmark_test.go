@@ -30,7 +30,7 @@ func benchmarkPngDecode(b *testing.B, path string) {
 	}
 }
 
-func benchmarkPngEncode(b *testing.B, path string, compression int) {
+func benchmarkPngEncode(b *testing.B, path string, compression int, newEncoder func(dec Decoder, dst []byte) (Encoder, error)) {
 	data, err := os.ReadFile(path)
 	if err != nil {
 		b.Fatalf("read %s: %v", path, err)
@@ -56,7 +56,7 @@ func benchmarkPngEncode(b *testing.B, path string, compression int) {
 	b.ResetTimer()
 	var lastSize int64
 	for i := 0; i < b.N; i++ {
-		enc, err := newOpenCVEncoder(".png", dec, dst, nil)
+		enc, err := newEncoder(dec, dst)
 		if err != nil {
 			b.Fatalf("encoder: %v", err)
 		}
@@ -75,11 +75,174 @@ func BenchmarkPNGDecode(b *testing.B) {
 }
 
 func BenchmarkPNGEncode(b *testing.B) {
-	for _, lvl := range []int{1, 6, 9} {
-		lvl := lvl
-		b.Run("ferry_sunset_lvl"+itoa(lvl), func(b *testing.B) {
-			benchmarkPngEncode(b, "testdata/ferry_sunset.png", lvl)
-		})
+	encoders := []struct {
+		name       string
+		newEncoder func(dec Decoder, dst []byte) (Encoder, error)
+	}{
+		{"opencv", func(dec Decoder, dst []byte) (Encoder, error) {
+			return newOpenCVEncoder(".png", dec, dst, nil)
+		}},
+		{"native", func(dec Decoder, dst []byte) (Encoder, error) {
+			return newPngEncoder(dec, dst, nil)
+		}},
+		{"native_threads4", func(dec Decoder, dst []byte) (Encoder, error) {
+			enc, err := newPngEncoder(dec, dst, nil)
+			if err != nil {
+				return nil, err
+			}
+			enc.setParallelism(4)
+			return enc, nil
+		}},
+	}
+	for _, e := range encoders {
+		e := e
+		for _, lvl := range []int{1, 6, 9} {
+			lvl := lvl
+			b.Run(e.name+"/ferry_sunset_lvl"+itoa(lvl), func(b *testing.B) {
+				benchmarkPngEncode(b, "testdata/ferry_sunset.png", lvl, e.newEncoder)
+			})
+		}
+	}
+}
+
+// syntheticScreenshot draws a frame like a screenshot of an app: flat panels
+// with rows of small high-contrast marks standing in for text.
+func syntheticScreenshot(width, height int) *Framebuffer {
+	fb := NewFramebuffer(width, height)
+	if err := fb.Create4Channel(width, height); err != nil {
+		panic(err)
+	}
+	for y := 0; y < height; y++ {
+		row := fb.buf[y*width*4 : (y+1)*width*4]
+		for x := 0; x < width; x++ {
+			shade := byte(0xF2)
+			if x < width/5 {
+				shade = 0x2B
+			} else if y < 48 {
+				shade = 0x36
+			}
+			b, g, r := shade, shade, shade
+			if y%24 >= 8 && y%24 < 20 && x%200 > 30 && (x*7+y*3)%11 < 4 {
+				b, g, r = 0x10, 0x10, 0x10
+				if shade < 0x80 {
+					b, g, r = 0xDC, 0xDD, 0xDE
+				}
+			}
+			row[x*4], row[x*4+1], row[x*4+2], row[x*4+3] = b, g, r, 0xFF
+		}
+	}
+	return fb
+}
+
+// BenchmarkPNGEncodePareto sweeps compression level, strategy and row filter
+// over a photo and a screenshot, reporting the output size of each so that
+// size can be plotted against time.
+func BenchmarkPNGEncodePareto(b *testing.B) {
+	data, err := os.ReadFile("testdata/ferry_sunset.png")
+	if err != nil {
+		b.Fatalf("read fixture: %v", err)
+	}
+	dec, err := newOpenCVDecoder(data)
+	if err != nil {
+		b.Fatalf("decoder: %v", err)
+	}
+	defer dec.Close()
+	photo := NewFramebuffer(4096, 4096)
+	defer photo.Close()
+	if err := dec.DecodeTo(photo); err != nil {
+		b.Fatalf("decode: %v", err)
+	}
+	screenshot := syntheticScreenshot(1280, 800)
+	defer screenshot.Close()
+
+	strategies := []struct {
+		name  string
+		value int
+	}{{"default", PngStrategyDefault}, {"filtered", PngStrategyFiltered}, {"rle", PngStrategyRLE}, {"auto", PngStrategyAuto}}
+	filters := []struct {
+		name  string
+		value int
+	}{{"sub", PngRowFilterSub}, {"adaptive", PngRowFilterAdaptive}}
+
+	dst := make([]byte, destinationBufferSize)
+	for _, image := range []struct {
+		name string
+		fb   *Framebuffer
+	}{{"photo", photo}, {"screenshot", screenshot}} {
+		for _, lvl := range []int{1, 3, 6, 9} {
+			for _, strategy := range strategies {
+				for _, filter := range filters {
+					image, lvl, strategy, filter := image, lvl, strategy, filter
+					name := image.name + "/lvl" + itoa(lvl) + "/" + strategy.name + "/" + filter.name
+					b.Run(name, func(b *testing.B) {
+						enc, err := newPngEncoder(dec, dst, nil)
+						if err != nil {
+							b.Fatalf("encoder: %v", err)
+						}
+						defer enc.Close()
+						opts := map[int]int{PngCompression: lvl, PngStrategy: strategy.value, PngRowFilter: filter.value}
+						b.SetBytes(int64(image.fb.Width() * image.fb.Height() * image.fb.pixelType.Channels()))
+						var size int
+						for i := 0; i < b.N; i++ {
+							out, err := enc.Encode(image.fb, opts)
+							if err != nil {
+								b.Fatalf("encode: %v", err)
+							}
+							size = len(out)
+						}
+						b.ReportMetric(float64(size), "out_bytes/op")
+					})
+				}
+			}
+		}
+	}
+}
+
+// BenchmarkPNGEncodePalette compares full colour PNG output with palette
+// output of a sticker-sized RGBA image and a screenshot.
+func BenchmarkPNGEncodePalette(b *testing.B) {
+	data, err := os.ReadFile("data/firefox.png")
+	if err != nil {
+		b.Fatalf("read fixture: %v", err)
+	}
+	dec, err := newOpenCVDecoder(data)
+	if err != nil {
+		b.Fatalf("decoder: %v", err)
+	}
+	defer dec.Close()
+	sticker := NewFramebuffer(1024, 1024)
+	defer sticker.Close()
+	if err := dec.DecodeTo(sticker); err != nil {
+		b.Fatalf("decode: %v", err)
+	}
+	screenshot := syntheticScreenshot(1280, 800)
+	defer screenshot.Close()
+
+	dst := make([]byte, destinationBufferSize)
+	for _, image := range []struct {
+		name string
+		fb   *Framebuffer
+	}{{"sticker", sticker}, {"screenshot", screenshot}} {
+		for _, quality := range []int{0, 60, 100} {
+			image, quality := image, quality
+			b.Run(image.name+"/quality"+itoa(quality), func(b *testing.B) {
+				enc, err := newPngEncoder(dec, dst, nil)
+				if err != nil {
+					b.Fatalf("encoder: %v", err)
+				}
+				defer enc.Close()
+				opts := map[int]int{PngCompression: 9, PngPaletteQuality: quality}
+				var size int
+				for i := 0; i < b.N; i++ {
+					out, err := enc.Encode(image.fb, opts)
+					if err != nil {
+						b.Fatalf("encode: %v", err)
+					}
+					size = len(out)
+				}
+				b.ReportMetric(float64(size), "out_bytes/op")
+			})
+		}
 	}
 }
 